@@ -0,0 +1,90 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _CLOCK_UTILS_H_
+#define _CLOCK_UTILS_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @return CLOCK_MONOTONIC time in nanoseconds
+ */
+inline int64_t MonotonicNowNs()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+/**
+ * @return CLOCK_REALTIME time in nanoseconds
+ */
+inline int64_t RealtimeNowNs()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+  return (int64_t)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+/**
+ * Sleep on CLOCK_MONOTONIC for a relative interval.
+ * @param duration_ns
+ *   time to sleep [ns]
+ */
+inline void SleepForNs(int64_t duration_ns)
+{
+  struct timespec t;
+  t.tv_sec = duration_ns/1000000000LL;
+  t.tv_nsec = duration_ns%1000000000LL;
+  clock_nanosleep(CLOCK_MONOTONIC, 0, &t, NULL);
+}
+
+/**
+ * Sleep on CLOCK_MONOTONIC until an absolute deadline, so time spent before
+ * the call does not shift the wakeup.
+ * @param deadline_ns
+ *   time to wake up at [ns]
+ * @return how late the wakeup was [ns]
+ */
+inline int64_t SleepUntilNs(int64_t deadline_ns)
+{
+  struct timespec t;
+  t.tv_sec = deadline_ns/1000000000LL;
+  t.tv_nsec = deadline_ns%1000000000LL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) {}
+  return MonotonicNowNs() - deadline_ns;
+}
+
+#endif
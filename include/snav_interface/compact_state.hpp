@@ -0,0 +1,236 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _COMPACT_STATE_H_
+#define _COMPACT_STATE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+
+#include <geometry_msgs/Pose.h>
+#include <geometry_msgs/Twist.h>
+#include <snav_ros/CompactState.h>
+
+/**
+ * Encoding of snav_ros/CompactState.
+ *
+ * Header-only so the ground station decoder builds without snav.
+ */
+
+/**
+ * Quantize a value to a saturating fixed-point integer.
+ * @param value
+ *   value in SI units
+ * @param scale
+ *   10^-exponent
+ */
+template <typename T>
+inline T QuantizeCompact(double value, double scale)
+{
+  double scaled = std::round(value*scale);
+  if (!(scaled > std::numeric_limits<T>::min()))
+    return std::numeric_limits<T>::min();
+  if (scaled > std::numeric_limits<T>::max())
+    return std::numeric_limits<T>::max();
+  return (T)scaled;
+}
+
+/**
+ * Pack a quaternion with the smallest-three method: the largest component
+ * is dropped and rebuilt from the unit norm, the other three lie in
+ * [-1/sqrt(2), 1/sqrt(2)] and are stored with bits bits each.
+ * @param bits
+ *   bits per component, 1 to 20
+ */
+inline uint64_t PackQuaternion(double x, double y, double z, double w, int bits)
+{
+  double q[4] = {x, y, z, w};
+  double norm = std::sqrt(x*x + y*y + z*z + w*w);
+  int largest = 0;
+  for (int i = 1; i < 4; ++i)
+  {
+    if (std::fabs(q[i]) > std::fabs(q[largest]))
+      largest = i;
+  }
+  // q and -q are the same rotation, keep the dropped component positive
+  double sign = q[largest] < 0 ? -1.0/norm : 1.0/norm;
+
+  const uint64_t max = (1ULL << bits) - 1;
+  uint64_t packed = largest;
+  int shift = 2;
+  for (int i = 0; i < 4; ++i)
+  {
+    if (i == largest)
+      continue;
+    double t = (sign*q[i] + M_SQRT1_2)/(2*M_SQRT1_2);
+    t = std::min(std::max(t, 0.0), 1.0);
+    packed |= (uint64_t)std::llround(t*max) << shift;
+    shift += bits;
+  }
+  return packed;
+}
+
+/**
+ * Inverse of PackQuaternion().
+ * @param q
+ *   set to x, y, z, w
+ */
+inline void UnpackQuaternion(uint64_t packed, int bits, double q[4])
+{
+  const uint64_t max = (1ULL << bits) - 1;
+  int largest = packed & 3;
+  int shift = 2;
+  double sum = 0;
+  for (int i = 0; i < 4; ++i)
+  {
+    if (i == largest)
+      continue;
+    double t = (double)((packed >> shift) & max)/max;
+    q[i] = t*2*M_SQRT1_2 - M_SQRT1_2;
+    sum += q[i]*q[i];
+    shift += bits;
+  }
+  q[largest] = std::sqrt(std::max(0.0, 1.0 - sum));
+}
+
+/**
+ * Fills snav_ros/CompactState messages with a fixed quantization.
+ */
+class CompactStateEncoder
+{
+public:
+  /**
+   * @param position_exponent
+   *   position resolution is 10^position_exponent m
+   * @param velocity_exponent
+   *   velocity resolution is 10^velocity_exponent m/s
+   * @param angular_velocity_exponent
+   *   angular rate resolution is 10^angular_velocity_exponent rad/s
+   * @param orientation_bits
+   *   bits per smallest-three quaternion component, clamped to 1-20
+   */
+  CompactStateEncoder(int position_exponent, int velocity_exponent,
+      int angular_velocity_exponent, int orientation_bits)
+    : position_exponent_(position_exponent),
+      velocity_exponent_(velocity_exponent),
+      angular_velocity_exponent_(angular_velocity_exponent),
+      orientation_bits_(std::min(std::max(orientation_bits, 1), 20)),
+      position_scale_(std::pow(10.0, -position_exponent)),
+      velocity_scale_(std::pow(10.0, -velocity_exponent)),
+      angular_velocity_scale_(std::pow(10.0, -angular_velocity_exponent)),
+      sequence_(0)
+  {
+  }
+
+  /**
+   * @param stamp
+   *   time of the pose
+   * @param pose
+   *   pose in the estimation frame
+   * @param velocity
+   *   linear velocity in the estimation frame and body angular rate
+   * @param msg
+   *   output, the sequence number advances on every call
+   */
+  void Encode(const ros::Time& stamp, const geometry_msgs::Pose& pose,
+      const geometry_msgs::Twist& velocity, snav_ros::CompactState& msg)
+  {
+    msg.sequence = sequence_++;
+    msg.stamp = stamp;
+    msg.position_exponent = position_exponent_;
+    msg.velocity_exponent = velocity_exponent_;
+    msg.angular_velocity_exponent = angular_velocity_exponent_;
+    msg.orientation_bits = orientation_bits_;
+
+    msg.position[0] = QuantizeCompact<int32_t>(pose.position.x, position_scale_);
+    msg.position[1] = QuantizeCompact<int32_t>(pose.position.y, position_scale_);
+    msg.position[2] = QuantizeCompact<int32_t>(pose.position.z, position_scale_);
+    msg.velocity[0] = QuantizeCompact<int16_t>(velocity.linear.x, velocity_scale_);
+    msg.velocity[1] = QuantizeCompact<int16_t>(velocity.linear.y, velocity_scale_);
+    msg.velocity[2] = QuantizeCompact<int16_t>(velocity.linear.z, velocity_scale_);
+    msg.angular_velocity[0] = QuantizeCompact<int16_t>(velocity.angular.x, angular_velocity_scale_);
+    msg.angular_velocity[1] = QuantizeCompact<int16_t>(velocity.angular.y, angular_velocity_scale_);
+    msg.angular_velocity[2] = QuantizeCompact<int16_t>(velocity.angular.z, angular_velocity_scale_);
+    msg.orientation = PackQuaternion(pose.orientation.x, pose.orientation.y,
+        pose.orientation.z, pose.orientation.w, orientation_bits_);
+  }
+
+private:
+  int position_exponent_;
+  int velocity_exponent_;
+  int angular_velocity_exponent_;
+  int orientation_bits_;
+  double position_scale_;
+  double velocity_scale_;
+  double angular_velocity_scale_;
+  uint32_t sequence_;
+};
+
+/**
+ * Expand a snav_ros/CompactState message.
+ * @param msg
+ *   quantized state
+ * @param pose
+ *   set to the pose in the estimation frame
+ * @param velocity
+ *   set to the linear velocity and angular rate
+ */
+inline void DecodeCompactState(const snav_ros::CompactState& msg, geometry_msgs::Pose& pose,
+    geometry_msgs::Twist& velocity)
+{
+  double position_resolution = std::pow(10.0, msg.position_exponent);
+  double velocity_resolution = std::pow(10.0, msg.velocity_exponent);
+  double angular_velocity_resolution = std::pow(10.0, msg.angular_velocity_exponent);
+
+  pose.position.x = msg.position[0]*position_resolution;
+  pose.position.y = msg.position[1]*position_resolution;
+  pose.position.z = msg.position[2]*position_resolution;
+
+  double q[4];
+  UnpackQuaternion(msg.orientation, std::min(std::max((int)msg.orientation_bits, 1), 20), q);
+  pose.orientation.x = q[0];
+  pose.orientation.y = q[1];
+  pose.orientation.z = q[2];
+  pose.orientation.w = q[3];
+
+  velocity.linear.x = msg.velocity[0]*velocity_resolution;
+  velocity.linear.y = msg.velocity[1]*velocity_resolution;
+  velocity.linear.z = msg.velocity[2]*velocity_resolution;
+  velocity.angular.x = msg.angular_velocity[0]*angular_velocity_resolution;
+  velocity.angular.y = msg.angular_velocity[1]*angular_velocity_resolution;
+  velocity.angular.z = msg.angular_velocity[2]*angular_velocity_resolution;
+}
+
+#endif
@@ -0,0 +1,204 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _DSP_CLOCK_SYNC_H_
+#define _DSP_CLOCK_SYNC_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <stdint.h>
+
+#include "snav_interface/seqlock.hpp"
+
+/**
+ * Tracks the mapping from snav (DSP) time to CLOCK_REALTIME.
+ *
+ * A background thread periodically reads the DSP qtimer through a kept-open
+ * sysfs fd, bracketed by CLOCK_REALTIME reads, and fits offset and drift
+ * over a sliding window with outlier rejection. Clock steps (e.g. NTP) are
+ * detected and restart the window. The fitted model is handed to readers
+ * through a seqlock, so ToRealtimeNs() never blocks, never allocates and
+ * uses integer arithmetic only.
+ */
+class DspClockSync
+{
+public:
+  enum Source
+  {
+    // Constant offset, no background estimation (simulation)
+    SOURCE_FIXED,
+    // DSP qtimer sysfs file
+    SOURCE_QTIMER,
+    // No qtimer available, snav time is CLOCK_MONOTONIC (e.g. the snav stub)
+    SOURCE_MONOTONIC
+  };
+
+  /**
+   * realtime_ns = dsp_ns + ref_offset_ns + (dsp_ns - ref_dsp_ns)*drift_ppb/1e9
+   */
+  struct Model
+  {
+    int64_t ref_dsp_ns;
+    int64_t ref_offset_ns;
+    int64_t drift_ppb;
+  };
+
+  struct Stats
+  {
+    Source source;
+    // Current offset realtime - dsp [s] and drift of the DSP clock [ppm]
+    double offset;
+    double drift_ppm;
+    // Fit residuals of the inlier samples in the window [s]
+    double residual_rms;
+    double residual_max;
+    // Width of the CLOCK_REALTIME bracket around the last qtimer read [s]
+    double read_width;
+    uint32_t window_fill;
+    uint64_t samples;
+    uint64_t outliers;
+    uint64_t read_failures;
+    uint64_t steps;
+  };
+
+  DspClockSync();
+
+  /**
+   * Destructor, stops the estimator thread.
+   */
+  ~DspClockSync();
+
+  /**
+   * Take an initial sample and start the estimator thread.
+   * @param qtimer_path
+   *   sysfs qtimer file, CLOCK_MONOTONIC is used if it cannot be opened
+   * @param period
+   *   time between samples [s]
+   * @param window
+   *   number of samples in the fit, at most kMaxWindow
+   * @return false if no initial sample could be taken
+   */
+  bool Start(const std::string& qtimer_path, double period, int window);
+
+  /**
+   * Use a constant offset instead of estimating one.
+   * @param offset_ns
+   *   realtime - dsp [ns]
+   */
+  void StartFixed(int64_t offset_ns);
+
+  /**
+   * Use a given model instead of estimating one, e.g. one stored in a
+   * flight record.
+   * @param model
+   *   model to convert with
+   */
+  void StartFixed(const Model& model);
+
+  /**
+   * Stop the estimator thread. The last model stays in use.
+   */
+  void Stop();
+
+  /**
+   * Convert a snav timestamp to CLOCK_REALTIME.
+   * @param dsp_time_us
+   *   snav timestamp [us]
+   * @return CLOCK_REALTIME [ns]
+   */
+  int64_t ToRealtimeNs(int64_t dsp_time_us) const;
+
+  /**
+   * Convert a snav timestamp to CLOCK_REALTIME with a given model.
+   * @param model
+   *   offset and drift model
+   * @param dsp_time_us
+   *   snav timestamp [us]
+   * @return CLOCK_REALTIME [ns]
+   */
+  static int64_t ToRealtimeNs(const Model& model, int64_t dsp_time_us)
+  {
+    int64_t dsp_ns = dsp_time_us*1000;
+    int64_t dx_us = (dsp_ns - model.ref_dsp_ns)/1000;
+    return dsp_ns + model.ref_offset_ns + dx_us*model.drift_ppb/1000000;
+  }
+
+  /**
+   * @return model currently used by ToRealtimeNs()
+   */
+  Model GetModel() const;
+
+  Stats GetStats() const;
+
+  static const int kMaxWindow = 64;
+
+private:
+  struct FitStats
+  {
+    double residual_rms;
+    double residual_max;
+    double read_width;
+    uint32_t window_fill;
+  };
+
+  void Run();
+  bool Sample(int64_t& dsp_ns, int64_t& realtime_ns, int64_t& width_ns);
+  bool ReadDspNs(int64_t& dsp_ns);
+  void AddSample(int64_t dsp_ns, int64_t offset_ns, int64_t width_ns);
+  void Fit();
+
+  Source source_;
+  int qtimer_fd_;
+  int stop_fd_;
+  int64_t period_ns_;
+  int window_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+
+  // Sliding window, only touched by the estimator thread
+  int64_t window_dsp_ns_[kMaxWindow];
+  int64_t window_offset_ns_[kMaxWindow];
+  int window_count_;
+  int window_next_;
+
+  Seqlock<Model> model_;
+  Seqlock<FitStats> fit_stats_;
+
+  std::atomic<uint64_t> samples_;
+  std::atomic<uint64_t> outliers_;
+  std::atomic<uint64_t> read_failures_;
+  std::atomic<uint64_t> steps_;
+};
+
+#endif
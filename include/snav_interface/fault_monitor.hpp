@@ -0,0 +1,118 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _FAULT_MONITOR_H_
+#define _FAULT_MONITOR_H_
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * Counts faults on the publish path per reason instead of logging each one.
+ *
+ * The first occurrence of a fault in a summary period is logged right
+ * away; repeats are only counted. Summarize(), called once per period, logs
+ * one line per fault that repeated and starts the next period. A fault that
+ * persists at the loop rate thus costs one log line per period instead of
+ * one per cycle. Raise() is a few relaxed atomic operations and may be
+ * called from any thread.
+ */
+class FaultMonitor
+{
+public:
+  enum Fault
+  {
+    // attitude estimate produced a NaN quaternion
+    FAULT_EST_ROTATION_NAN,
+    // sim ground truth produced a NaN quaternion
+    FAULT_SIM_ROTATION_NAN,
+    // no successful sn_update_data within rpc_timeout, cycle skipped
+    FAULT_STALE_DATA,
+    // no successful sn_update_data within 1 s, status outputs skipped
+    FAULT_STALE_STATUS,
+    // an est output was requested while its rotation was invalid
+    FAULT_INVALID_EST_OUTPUT,
+    // a sim output was requested while its rotation was invalid
+    FAULT_INVALID_SIM_OUTPUT,
+    NUM_FAULTS
+  };
+
+  FaultMonitor();
+
+  /**
+   * Count one occurrence, logging it if it is the first of the period.
+   * @param fault
+   *   reason
+   */
+  void Raise(Fault fault)
+  {
+    total_[fault].fetch_add(1, std::memory_order_relaxed);
+    if (period_[fault].fetch_add(1, std::memory_order_relaxed) == 0)
+      LogFirst(fault);
+  }
+
+  /**
+   * Log a line for every fault that repeated in the period that ends now
+   * and start the next one.
+   * @param period
+   *   length of the period that ends [s], for the log line
+   */
+  void Summarize(double period);
+
+  /**
+   * @return occurrences of a fault since startup
+   */
+  uint64_t GetTotal(Fault fault) const { return total_[fault].load(std::memory_order_relaxed); }
+
+  /**
+   * @return occurrences of a fault in the last completed period
+   */
+  uint64_t GetLastPeriod(Fault fault) const
+  {
+    return last_period_[fault].load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @return short name of a fault, used as diagnostics key
+   */
+  static const char* GetName(Fault fault);
+
+private:
+  void LogFirst(Fault fault);
+
+  std::atomic<uint64_t> total_[NUM_FAULTS];
+  std::atomic<uint64_t> period_[NUM_FAULTS];
+  std::atomic<uint64_t> last_period_[NUM_FAULTS];
+};
+
+#endif
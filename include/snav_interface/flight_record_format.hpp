@@ -0,0 +1,126 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _FLIGHT_RECORD_FORMAT_H_
+#define _FLIGHT_RECORD_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "snav_interface/snav_snapshot.hpp"
+
+/*
+ * On-disk layout of the flight recorder ring file.
+ *
+ *   [0, kFlightRecordHeaderSize)   FlightRecordFileHeader at 0 and two
+ *                                  FlightRecordCommit slots
+ *   [kFlightRecordHeaderSize, ...) capacity fixed-size record slots
+ *
+ * Record number n (1-based, never reused) lives in slot (n - 1) % capacity.
+ * Each slot is a FlightRecordHeader followed by a SnavSnapshot. The record
+ * CRC covers the sequence number and the payload, so a slot torn by a power
+ * loss or partially overwritten on wrap-around is detected by the reader.
+ *
+ * The commit slots are written alternately after the data they describe has
+ * been synced. Each carries its own CRC, so at least one of them is intact
+ * after a crash; the valid one with the highest generation is current.
+ */
+
+const char kFlightRecordMagic[8] = {'S', 'N', 'A', 'V', 'R', 'E', 'C', '1'};
+const uint32_t kFlightRecordVersion = 1;
+const size_t kFlightRecordHeaderSize = 4096;
+const size_t kFlightRecordCommitOffset[2] = {1024, 2048};
+
+struct FlightRecordFileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t record_size;
+  uint32_t payload_size;
+  uint64_t capacity;
+  int64_t created_realtime_ns;
+};
+
+struct FlightRecordCommit
+{
+  uint64_t generation;
+  // Records 1..records_written have been synced to disk
+  uint64_t records_written;
+  int64_t commit_realtime_ns;
+  // DspClockSync model at commit time, maps pos_vel.time etc. to realtime
+  int64_t clock_ref_dsp_ns;
+  int64_t clock_ref_offset_ns;
+  int64_t clock_drift_ppb;
+  uint32_t crc;
+  uint32_t reserved;
+};
+
+struct FlightRecordHeader
+{
+  // 0 for a slot that was never written
+  uint64_t sequence;
+  uint32_t crc;
+  uint32_t payload_size;
+};
+
+/**
+ * Size of one record slot, rounded up to a cache line
+ */
+const size_t kFlightRecordSize =
+  (sizeof(FlightRecordHeader) + sizeof(SnavSnapshot) + 63)/64*64;
+
+/**
+ * CRC-32 (IEEE 802.3)
+ * @param crc
+ *   running CRC, 0 to start
+ */
+uint32_t Crc32(uint32_t crc, const void* data, size_t length);
+
+/**
+ * @return CRC of a record's sequence number and payload
+ */
+inline uint32_t FlightRecordCrc(uint64_t sequence, const SnavSnapshot& payload)
+{
+  return Crc32(Crc32(0, &sequence, sizeof(sequence)), &payload, sizeof(payload));
+}
+
+/**
+ * @return CRC of a commit slot, excluding the crc field itself
+ */
+inline uint32_t FlightRecordCommitCrc(const FlightRecordCommit& commit)
+{
+  return Crc32(0, &commit, offsetof(FlightRecordCommit, crc));
+}
+
+#endif
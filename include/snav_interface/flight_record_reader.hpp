@@ -0,0 +1,115 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _FLIGHT_RECORD_READER_H_
+#define _FLIGHT_RECORD_READER_H_
+
+#include <string>
+#include <stdint.h>
+
+#include "snav_interface/dsp_clock_sync.hpp"
+#include "snav_interface/flight_record_format.hpp"
+
+/**
+ * Read-only view of a flight recorder ring file.
+ *
+ * The file is mapped, not read, so any number of threads can fetch records
+ * concurrently and hour-long logs open instantly.
+ */
+class FlightRecordReader
+{
+public:
+  FlightRecordReader();
+
+  /**
+   * Destructor, unmaps the file.
+   */
+  ~FlightRecordReader();
+
+  /**
+   * Map a ring file and find the range of records it still holds.
+   * @param path
+   *   ring file written by FlightRecorder
+   * @param error
+   *   set to a description of the problem on failure
+   * @return false if the file is not a valid ring file
+   */
+  bool Open(const std::string& path, std::string& error);
+
+  /**
+   * @return oldest record number still in the ring, 0 if empty
+   */
+  uint64_t GetFirst() const { return first_; }
+
+  /**
+   * @return newest intact record number, 0 if empty. Records after the last
+   * commit are included as long as they are intact.
+   */
+  uint64_t GetLast() const { return last_; }
+
+  /**
+   * @return record count of the last commit
+   */
+  uint64_t GetCommitted() const { return committed_; }
+
+  /**
+   * @return DSP clock model stored with the last commit
+   */
+  const DspClockSync::Model& GetClockModel() const { return clock_model_; }
+
+  /**
+   * Fetch one record. Thread-safe.
+   * @param sequence
+   *   record number in [GetFirst(), GetLast()]
+   * @param snapshot
+   *   set to the recorded sample
+   * @return false if the record was overwritten or torn
+   */
+  bool Get(uint64_t sequence, SnavSnapshot& snapshot) const;
+
+private:
+  bool IsIntact(uint64_t sequence) const;
+  const FlightRecordHeader* Slot(uint64_t sequence) const;
+
+  int fd_;
+  const uint8_t* map_;
+  size_t map_size_;
+  uint64_t capacity_;
+  uint32_t record_size_;
+  uint64_t first_;
+  uint64_t last_;
+  uint64_t committed_;
+  DspClockSync::Model clock_model_;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _FLIGHT_RECORDER_H_
+#define _FLIGHT_RECORDER_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <stdint.h>
+
+#include "snav_interface/dsp_clock_sync.hpp"
+#include "snav_interface/flight_record_format.hpp"
+#include "snav_interface/snav_snapshot.hpp"
+#include "snav_interface/spsc_ring.hpp"
+
+/**
+ * Records every snav sample to a preallocated, memory-mapped ring file.
+ *
+ * The acquisition thread only copies the snapshot into an in-memory SPSC
+ * queue. A recorder thread drains the queue into the mapped file every
+ * flush_period, and every sync_period syncs the written records to disk
+ * and then commits the header. See flight_record_format.hpp for the
+ * layout and the crash-safety guarantees.
+ */
+class FlightRecorder
+{
+public:
+  struct Stats
+  {
+    uint64_t capacity;
+    uint64_t records;
+    uint64_t committed;
+    uint64_t dropped;
+    uint64_t commits;
+    uint64_t sync_errors;
+    double sync_duration_last;
+    double sync_duration_max;
+  };
+
+  FlightRecorder();
+
+  /**
+   * Destructor, flushes and closes the file.
+   */
+  ~FlightRecorder();
+
+  /**
+   * Open or create the ring file and start the recorder thread. An existing
+   * file with the same layout is appended to after its last commit.
+   * @param path
+   *   ring file
+   * @param size
+   *   file size [bytes], preallocated so the ring never hits ENOSPC
+   * @param flush_period
+   *   how often queued samples are copied into the file [s]
+   * @param sync_period
+   *   how often the file is synced and the header committed [s]
+   * @param clock_sync
+   *   clock model stored with each commit, may be NULL
+   * @return false if the file could not be prepared
+   */
+  bool Open(const std::string& path, size_t size, double flush_period,
+      double sync_period, const DspClockSync* clock_sync);
+
+  /**
+   * Drain the queue, commit, and close the file.
+   */
+  void Close();
+
+  bool IsOpen() const { return running_; }
+
+  /**
+   * Queue a sample. Wait-free, called from the acquisition thread.
+   * @return false if the queue was full and the sample was dropped
+   */
+  bool Push(const SnavSnapshot& snapshot);
+
+  Stats GetStats() const;
+
+private:
+  void Run();
+  bool Drain();
+  void Commit();
+  void SyncRange(uint64_t first_record, uint64_t last_record);
+
+  int fd_;
+  int stop_fd_;
+  uint8_t* map_;
+  size_t map_size_;
+  uint64_t capacity_;
+  int64_t flush_period_ns_;
+  int64_t sync_period_ns_;
+  const DspClockSync* clock_sync_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+
+  SpscRing<SnavSnapshot> queue_;
+
+  // Recorder thread state
+  uint64_t next_sequence_;
+  uint64_t committed_;
+  uint64_t generation_;
+  int64_t last_commit_ns_;
+
+  std::atomic<uint64_t> records_;
+  std::atomic<uint64_t> committed_records_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> commits_;
+  std::atomic<uint64_t> sync_errors_;
+  std::atomic<uint64_t> sync_duration_last_ns_;
+  std::atomic<uint64_t> sync_duration_max_ns_;
+};
+
+#endif
@@ -0,0 +1,130 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _FRAME_KERNEL_H_
+#define _FRAME_KERNEL_H_
+
+#include "snav_interface/snav_snapshot.hpp"
+
+/**
+ * Quaternion in geometry_msgs order
+ */
+struct FrameQuaternion
+{
+  float x;
+  float y;
+  float z;
+  float w;
+};
+
+/**
+ * Rotations of every frame SnavInterface publishes, derived from one
+ * snapshot. Signs follow tf2::Matrix3x3::getRotation(), so the published
+ * quaternions are the ones the tf2 based conversion produced.
+ */
+struct SnavFrames
+{
+  // false if the attitude estimate / sim ground truth produced a NaN
+  bool est_valid;
+  bool sim_valid;
+
+  // estimation_frame -> base_link
+  FrameQuaternion est;
+  // base_link -> base_link_no_rot, the inverse of est
+  FrameQuaternion no_rot;
+  // base_link_no_rot -> base_link_stab, the yaw of est
+  FrameQuaternion stab;
+  // estimation_frame -> desired, from pos_vel.yaw_desired
+  FrameQuaternion des;
+  // estimation_frame -> gps_enu, from pos_vel.R_eg
+  FrameQuaternion gps_enu;
+
+  // sim ground truth orientation and its inverse transform, base_link -> sim_gt
+  FrameQuaternion sim;
+  FrameQuaternion sim_inv;
+  float sim_inv_translation[3];
+};
+
+/**
+ * Number of rotation matrices converted side by side in one pass. The
+ * attitude estimate, R_eg and the sim ground truth occupy three lanes; the
+ * fourth is padding so the loops map onto 4-wide float SIMD (NEON/SSE).
+ */
+const int kFrameKernelLanes = 4;
+
+/**
+ * Convert row-major rotation matrices to quaternions with Shepperd's method.
+ * The pivot is chosen with selects instead of branches so the per-lane loop
+ * vectorizes.
+ * @param R
+ *   kFrameKernelLanes row-major 3x3 matrices
+ * @param q
+ *   output quaternions, one per lane
+ * @param w_pivot
+ *   output, per lane true if w was the pivot (trace > 0)
+ */
+void RotationsToQuaternions(const float* const R[kFrameKernelLanes],
+    FrameQuaternion q[kFrameKernelLanes], bool w_pivot[kFrameKernelLanes]);
+
+/**
+ * Quaternion of a rotation about z by the angle with the given cosine and
+ * sine, computed from the half angle without trig calls.
+ * @param c
+ *   cosine of the angle
+ * @param s
+ *   sine of the angle
+ */
+FrameQuaternion YawQuaternion(float c, float s);
+
+/**
+ * Inverse of a quaternion from RotationsToQuaternions(), with the sign
+ * tf2::Matrix3x3::getRotation() picks for the transposed matrix. The
+ * transpose has the same diagonal and so the same pivot; if that is not w
+ * the conjugate is negated to keep the pivot component positive.
+ * @param q
+ *   quaternion to invert
+ * @param w_pivot
+ *   true if w was the pivot when q was computed
+ */
+FrameQuaternion Inverse(const FrameQuaternion& q, bool w_pivot);
+
+/**
+ * Compute every published rotation from a snapshot in a single pass.
+ * @param snapshot
+ *   source data
+ * @param frames
+ *   output
+ */
+void ComputeFrames(const SnavSnapshot& snapshot, SnavFrames& frames);
+
+#endif
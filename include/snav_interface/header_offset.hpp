@@ -0,0 +1,75 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _HEADER_OFFSET_H_
+#define _HEADER_OFFSET_H_
+
+#include <sstream>
+#include <string>
+
+/**
+ * Find where the first std_msgs/Header starts in a serialized message, from
+ * its type and full message definition as a subscriber sees them.
+ * @param datatype
+ *   e.g. geometry_msgs/PoseStamped
+ * @param definition
+ *   message definition text, e.g. ShapeShifter::getMessageDefinition()
+ * @return byte offset of the header's seq field, or -1 if the message does
+ * not start with a header
+ */
+inline int HeaderOffset(const std::string& datatype, const std::string& definition)
+{
+  // A TFMessage is the transform array length followed by the first
+  // transform's header
+  if (datatype == "tf2_msgs/TFMessage")
+    return 4;
+
+  std::istringstream lines(definition);
+  std::string line;
+  while (std::getline(lines, line))
+  {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::string type, name;
+    if (!(fields >> type >> name))
+      continue;
+    // Constants are not serialized
+    if (line.find('=') != std::string::npos)
+      continue;
+    // The first serialized field decides
+    return type == "Header" || type == "std_msgs/Header" ? 0 : -1;
+  }
+  return -1;
+}
+
+#endif
@@ -0,0 +1,181 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _LATENCY_HISTOGRAM_H_
+#define _LATENCY_HISTOGRAM_H_
+
+#include <atomic>
+#include <stdint.h>
+
+#include "snav_interface/clock_utils.hpp"
+
+/**
+ * Lock-free log-linear histogram of durations in nanoseconds.
+ *
+ * Values are bucketed by power of two and then linearly into
+ * kSubBuckets within each power of two, which bounds the relative error of
+ * reported percentiles to 1/kSubBuckets, as in HDR histograms. Recording is
+ * a handful of relaxed atomic adds and is safe from any number of threads.
+ */
+class LatencyHistogram
+{
+public:
+  struct Summary
+  {
+    uint64_t count;
+    double p50;
+    double p99;
+    double max;
+  };
+
+  LatencyHistogram() : max_ns_(0), count_(0)
+  {
+    for (int i = 0; i < kNumBuckets; ++i)
+      buckets_[i].store(0, std::memory_order_relaxed);
+  }
+
+  /**
+   * Record one duration.
+   * @param value_ns
+   *   duration [ns], negative values are recorded as 0
+   */
+  void Record(int64_t value_ns)
+  {
+    uint64_t value = value_ns < 0 ? 0 : (uint64_t)value_ns;
+    buckets_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    if (value > max_ns_.load(std::memory_order_relaxed))
+      max_ns_.store(value, std::memory_order_relaxed);
+  }
+
+  /**
+   * Summarize everything recorded since the last call and start a new
+   * window. Values recorded concurrently land in one window or the next,
+   * none are lost.
+   * @return count, percentiles and max [s] of the window
+   */
+  Summary Collect()
+  {
+    uint64_t counts[kNumBuckets];
+    Summary summary;
+    summary.count = 0;
+    for (int i = 0; i < kNumBuckets; ++i)
+    {
+      counts[i] = buckets_[i].exchange(0, std::memory_order_relaxed);
+      summary.count += counts[i];
+    }
+    count_.store(0, std::memory_order_relaxed);
+    summary.max = max_ns_.exchange(0, std::memory_order_relaxed)*1e-9;
+    summary.p50 = Percentile(counts, summary.count, 0.50)*1e-9;
+    summary.p99 = Percentile(counts, summary.count, 0.99)*1e-9;
+    return summary;
+  }
+
+  /**
+   * @return number of values recorded in the current window
+   */
+  uint64_t GetCount() const
+  {
+    return count_.load(std::memory_order_relaxed);
+  }
+
+private:
+  static const int kSubBucketBits = 4;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  // Enough powers of two to cover over a minute in nanoseconds
+  static const int kNumBuckets = (37 - kSubBucketBits + 1)*kSubBuckets;
+
+  static int BucketIndex(uint64_t value)
+  {
+    if (value < (uint64_t)kSubBuckets)
+      return (int)value;
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - kSubBucketBits;
+    int index = (shift + 1)*kSubBuckets + (int)((value >> shift) & (kSubBuckets - 1));
+    return index < kNumBuckets ? index : kNumBuckets - 1;
+  }
+
+  // Midpoint of the values that fall in a bucket
+  static double BucketValue(int index)
+  {
+    if (index < kSubBuckets)
+      return index;
+    int shift = index/kSubBuckets - 1;
+    uint64_t lower = ((uint64_t)(kSubBuckets + index % kSubBuckets)) << shift;
+    return lower + ((1ULL << shift) - 1)/2.0;
+  }
+
+  static double Percentile(const uint64_t* counts, uint64_t total, double fraction)
+  {
+    if (total == 0)
+      return 0.0;
+    uint64_t rank = (uint64_t)(fraction*(total - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < kNumBuckets; ++i)
+    {
+      seen += counts[i];
+      if (seen >= rank)
+        return BucketValue(i);
+    }
+    return BucketValue(kNumBuckets - 1);
+  }
+
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+  std::atomic<uint64_t> max_ns_;
+  std::atomic<uint64_t> count_;
+};
+
+/**
+ * Records the lifetime of the object into a histogram. Does nothing,
+ * including reading the clock, if the histogram is NULL.
+ */
+class ScopedLatency
+{
+public:
+  explicit ScopedLatency(LatencyHistogram* histogram)
+    : histogram_(histogram), start_ns_(histogram ? MonotonicNowNs() : 0)
+  {
+  }
+
+  ~ScopedLatency()
+  {
+    if (histogram_)
+      histogram_->Record(MonotonicNowNs() - start_ns_);
+  }
+
+private:
+  LatencyHistogram* histogram_;
+  int64_t start_ns_;
+};
+
+#endif
@@ -0,0 +1,102 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _MESSAGE_POOL_H_
+#define _MESSAGE_POOL_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * Recycles the messages handed to ros::Publisher::publish(shared_ptr), so
+ * zero-copy publishing does not allocate a message per publish.
+ *
+ * A pooled message is reused once every subscriber has released it. Its
+ * strings and arrays keep their storage, so copying a message of the same
+ * shape into it does not allocate either. Copy() must only be called from
+ * one thread; GetMisses() may be read from any.
+ */
+template <typename M>
+class MessagePool
+{
+public:
+  /**
+   * @param size
+   *   messages kept, enough to cover the subscriber queues that may still
+   *   hold one
+   */
+  explicit MessagePool(size_t size = 4) : next_(0), misses_(0)
+  {
+    for (size_t i = 0; i < size; ++i)
+      messages_.push_back(boost::make_shared<M>());
+  }
+
+  /**
+   * @param msg
+   *   message to publish
+   * @return copy of msg, in a pooled message if one is free
+   */
+  boost::shared_ptr<M> Copy(const M& msg)
+  {
+    for (size_t i = 0; i < messages_.size(); ++i)
+    {
+      const boost::shared_ptr<M>& pooled = messages_[next_];
+      next_ = (next_ + 1) % messages_.size();
+      // Only this pool may add references, so a unique message stays free
+      if (pooled.unique())
+      {
+        *pooled = msg;
+        return pooled;
+      }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return boost::make_shared<M>(msg);
+  }
+
+  /**
+   * @return messages allocated because every pooled one was in use
+   */
+  uint64_t GetMisses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+  std::vector<boost::shared_ptr<M> > messages_;
+  size_t next_;
+  std::atomic<uint64_t> misses_;
+};
+
+#endif
@@ -0,0 +1,113 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _OUTPUT_SCHEDULER_H_
+#define _OUTPUT_SCHEDULER_H_
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * Decides per cycle which outputs of an output mask are due, each output at
+ * its own rate.
+ *
+ * Outputs with the same rate form a rate group that shares one deadline, so
+ * they always come due in the same cycle and go out together, e.g. in one TF
+ * batch. Rate 0 means every cycle. A due output stays pending until the
+ * caller can serve it, so an output waiting for a new sample is produced with
+ * the first one after its deadline instead of being skipped.
+ *
+ * SetRate() may be called from any thread; the groups are rebuilt by the next
+ * Take() on the publishing thread, keeping the phase of rates that did not
+ * change.
+ */
+class OutputScheduler
+{
+public:
+  static const int kMaxOutputs = 32;
+
+  OutputScheduler();
+
+  /**
+   * @param output
+   *   bit index of the output
+   * @param rate
+   *   [Hz], 0 every cycle
+   * @return false if output or rate is out of range
+   */
+  bool SetRate(int output, double rate);
+
+  /**
+   * @return rate of an output [Hz], 0 every cycle
+   */
+  double GetRate(int output) const;
+
+  /**
+   * @return number of distinct rates, including every cycle
+   */
+  int GetNumGroups() const { return num_groups_.load(std::memory_order_relaxed); }
+
+  /**
+   * Mark the outputs of groups whose deadline has passed as pending and take
+   * those that can be served. Publishing thread only.
+   * @param now_ns
+   *   current time of the clock the rates refer to [ns]
+   * @param ready
+   *   mask of outputs that can be produced this cycle
+   * @return mask of outputs to produce this cycle
+   */
+  uint32_t Take(int64_t now_ns, uint32_t ready);
+
+private:
+  struct RateGroup
+  {
+    int64_t period_ns;
+    int64_t next_ns;
+    uint32_t outputs;
+  };
+
+  void Regroup(int64_t now_ns);
+
+  std::atomic<int64_t> period_ns_[kMaxOutputs];
+  std::atomic<uint32_t> version_;
+  std::atomic<int> num_groups_;
+
+  // Publishing thread only
+  uint32_t applied_version_;
+  RateGroup groups_[kMaxOutputs];
+  int group_count_;
+  uint32_t every_cycle_;
+  uint32_t pending_;
+};
+
+#endif
@@ -0,0 +1,130 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _REALTIME_H_
+#define _REALTIME_H_
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * Scheduling of one thread.
+ */
+struct ThreadPolicy
+{
+  ThreadPolicy() : priority(0) {}
+
+  // SCHED_FIFO priority, 0 leaves the thread on SCHED_OTHER
+  int priority;
+  // CPUs the thread may run on, empty for any
+  std::vector<int> cpus;
+};
+
+/**
+ * Parse a CPU list such as "3" or "0-1,3".
+ * @param text
+ *   list, empty for any CPU
+ * @param cpus
+ *   set to the listed CPUs
+ * @return false if the list is malformed
+ */
+bool ParseCpuList(const std::string& text, std::vector<int>& cpus);
+
+/**
+ * Applies real-time settings to the process and keeps a record of what
+ * worked for the startup report. Steps never abort on failure, the node
+ * runs with whatever could be applied.
+ */
+class RealtimeSetup
+{
+public:
+  struct Result
+  {
+    std::string step;
+    bool ok;
+    std::string detail;
+  };
+
+  /**
+   * Set the affinity and scheduling policy of a running thread.
+   * @param thread
+   *   thread to configure
+   * @param name
+   *   name used in the report
+   * @param policy
+   *   settings to apply, unset ones are skipped
+   */
+  void ApplyThreadPolicy(pthread_t thread, const std::string& name, const ThreadPolicy& policy);
+
+  /**
+   * Lock all current and future memory and pre-fault heap and stack, so the
+   * real-time threads never page fault. Freed heap memory is kept rather
+   * than returned to the kernel.
+   * @param prefault_heap_bytes
+   *   heap grown and touched up front
+   * @param prefault_stack_bytes
+   *   stack of the calling thread touched up front
+   */
+  void LockMemory(size_t prefault_heap_bytes, size_t prefault_stack_bytes);
+
+  /**
+   * Give up root for good. Settings already applied stay in effect.
+   * @param user
+   *   user to switch to, empty for the real user of a setuid binary
+   */
+  void DropPrivileges(const std::string& user);
+
+  /**
+   * Record a requested step as failed without attempting it.
+   * @param step
+   *   name used in the report
+   * @param reason
+   *   why it was not applied
+   */
+  void Refuse(const std::string& step, const std::string& reason) { Report(step, false, reason); }
+
+  /**
+   * @return one entry per step, in the order applied
+   */
+  const std::vector<Result>& GetResults() const { return results_; }
+
+private:
+  void Report(const std::string& step, bool ok, const std::string& detail);
+
+  std::vector<Result> results_;
+};
+
+#endif
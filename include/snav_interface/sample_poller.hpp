@@ -0,0 +1,134 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _SAMPLE_POLLER_H_
+#define _SAMPLE_POLLER_H_
+
+#include <stdint.h>
+
+/**
+ * Decides when to poll snav for the next estimator sample.
+ *
+ * The estimator produces samples at a roughly fixed cadence that is not
+ * synchronized with this process. The poller learns that cadence and its
+ * phase from the sample timestamps: the period from successive timestamps,
+ * and the offset from a sample's timestamp to when it becomes visible to a
+ * poll, bracketed by the last empty poll and the poll that returned it. Each
+ * poll is scheduled on an absolute deadline so that it returns just after
+ * the next sample is due, so wakeups follow the estimator instead of
+ * drifting with poll latency. A sample found on the first poll nudges the
+ * phase earlier, an empty poll pulls it back, and the poller then polls at a
+ * fine interval until the sample shows up. If samples stop arriving it backs off to a slow poll so
+ * the RPC is not hammered.
+ */
+class SamplePoller
+{
+public:
+  /**
+   * Constructor.
+   * @param min_poll_period
+   *   interval between polls [s] while a sample is expected
+   * @param max_poll_period
+   *   interval between polls [s] while samples are not arriving
+   */
+  SamplePoller(double min_poll_period = 0.0002, double max_poll_period = 0.01);
+
+  /**
+   * Record the outcome of a poll.
+   * @param new_sample
+   *   true if the poll returned a sample not seen before
+   * @param sample_time_us
+   *   timestamp of the latest sample in microseconds
+   * @param poll_start_ns
+   *   CLOCK_MONOTONIC time the poll started [ns]
+   * @param poll_end_ns
+   *   CLOCK_MONOTONIC time the poll returned [ns]
+   */
+  void Update(bool new_sample, int64_t sample_time_us, int64_t poll_start_ns, int64_t poll_end_ns);
+
+  /**
+   * Sleep until the next poll is due.
+   */
+  void Sleep();
+
+  /**
+   * @return estimated sample period in seconds, 0 if not yet known
+   */
+  double GetSamplePeriod() const { return sample_period_ns_*1e-9; }
+
+  /**
+   * @return CLOCK_MONOTONIC time [ns] the next sample is expected to be
+   * seen by a poll, 0 until the cadence is known
+   */
+  int64_t GetExpectedSampleNs() const { return expected_sample_ns_; }
+
+  /**
+   * @return number of polls that did not return a new sample
+   */
+  uint64_t GetEmptyPolls() const { return empty_polls_; }
+
+  /**
+   * @return number of wakeups later than their deadline by more than the
+   * fine poll interval or a tenth of the sample period
+   */
+  uint64_t GetDeadlineMisses() const { return deadline_misses_; }
+
+  /**
+   * @return number of samples seen more than a sample period after they
+   * could have been, i.e. when the next one was already due
+   */
+  uint64_t GetOverruns() const { return overruns_; }
+
+private:
+  int64_t min_poll_period_ns_;
+  int64_t max_poll_period_ns_;
+
+  int64_t sample_period_ns_;
+  int64_t last_sample_time_ns_;
+  int64_t last_sample_arrival_ns_;
+
+  // Offset from a sample's timestamp to when a poll can see it
+  int64_t visible_offset_ns_;
+  bool phase_known_;
+  int64_t poll_duration_ns_;
+  int64_t last_empty_poll_ns_;
+
+  int64_t expected_sample_ns_;
+  int64_t next_poll_ns_;
+
+  uint64_t empty_polls_;
+  uint64_t deadline_misses_;
+  uint64_t overruns_;
+};
+
+#endif
@@ -0,0 +1,126 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+/**
+ * Single-writer, multi-reader sequence lock.
+ *
+ * The writer never blocks and readers never block the writer; a reader that
+ * races with a write simply retries. T must be trivially copyable.
+ */
+template <typename T>
+class Seqlock
+{
+public:
+  Seqlock() : seq_(0)
+  {
+    std::memset(&data_, 0, sizeof(data_));
+  }
+
+  /**
+   * Publish a new value. Must only be called from one thread.
+   * @param value
+   *   value to publish
+   */
+  void Store(const T& value)
+  {
+    uint32_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&data_, &value, sizeof(T));
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  /**
+   * Try to read the current value once.
+   * @param value
+   *   set to the current value on success
+   * @param sequence
+   *   if not NULL, set to the sequence number of the value on success
+   * @return false if a write was in progress, value is then unspecified
+   */
+  bool TryLoad(T& value, uint32_t* sequence = NULL) const
+  {
+    uint32_t seq_before = seq_.load(std::memory_order_acquire);
+    if (seq_before & 1)
+      return false;
+    std::memcpy(&value, &data_, sizeof(T));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (seq_.load(std::memory_order_relaxed) != seq_before)
+      return false;
+    if (sequence != NULL)
+      *sequence = seq_before;
+    return true;
+  }
+
+  /**
+   * Read the current value, retrying until a consistent copy is obtained.
+   * @param value
+   *   set to the current value
+   * @return sequence number of the value that was read
+   */
+  uint32_t Load(T& value) const
+  {
+    uint32_t seq;
+    do
+    {
+      seq = seq_.load(std::memory_order_acquire);
+      if (seq & 1)
+        continue;
+      std::memcpy(&value, &data_, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while (seq & 1 || seq_.load(std::memory_order_relaxed) != seq);
+    return seq;
+  }
+
+  /**
+   * @return sequence number, which advances by two on every Store()
+   */
+  uint32_t GetSequence() const
+  {
+    return seq_.load(std::memory_order_acquire);
+  }
+
+private:
+  std::atomic<uint32_t> seq_;
+  T data_;
+};
+
+#endif
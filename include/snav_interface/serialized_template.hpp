@@ -0,0 +1,336 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _SERIALIZED_TEMPLATE_H_
+#define _SERIALIZED_TEMPLATE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <boost/shared_array.hpp>
+
+#include <ros/ros.h>
+#include <ros/topic_manager.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/TransformStamped.h>
+#include <geometry_msgs/Twist.h>
+#include <nav_msgs/Odometry.h>
+#include <tf2_msgs/TFMessage.h>
+
+/**
+ * Where the numeric fields of a message lie in its serialized form.
+ * Specialized for each message type that may be published through a
+ * SerializedTemplate. Patch() copies every numeric field of msg into data,
+ * which holds msg's serialization up to those fields.
+ */
+template <typename M>
+struct TemplateLayout;
+
+/**
+ * A message serialized once, with only its numeric fields rewritten on
+ * every publish. For messages whose strings and array lengths never change
+ * between publishes, e.g. frame ids that are set once.
+ *
+ * Publish() hands the serialized buffer itself to roscpp, which sends it
+ * without serializing or copying it again; subscribers receive an ordinary
+ * M. Since roscpp may still hold a published buffer for a slow subscriber,
+ * the template keeps a few buffers and Patch() writes into one that nobody
+ * holds. Publishing a SerializedTemplate<M> through ros::Publisher::publish()
+ * works too, but roscpp then copies it into a newly allocated buffer.
+ */
+template <typename M>
+class SerializedTemplate
+{
+public:
+  /**
+   * @param buffers
+   *   buffers kept, enough to cover the subscriber queues that may still
+   *   hold one
+   */
+  explicit SerializedTemplate(size_t buffers = 4) : num_buffers_(buffers), current_(0),
+    size_(0), misses_(0) {}
+
+  /**
+   * @return true once Build() has been called
+   */
+  bool IsBuilt() const { return !buffers_.empty(); }
+
+  /**
+   * Serialize msg in full. Its strings and array lengths become the
+   * layout of every later Patch().
+   */
+  void Build(const M& msg)
+  {
+    size_ = ros::serialization::serializationLength(msg);
+    buffers_.clear();
+    for (size_t i = 0; i < num_buffers_; ++i)
+    {
+      // Length prefixed, as ros::serialization::serializeMessage() lays it out
+      boost::shared_array<uint8_t> buffer(new uint8_t[size_ + 4]);
+      ros::serialization::OStream stream(buffer.get(), size_ + 4);
+      ros::serialization::serialize(stream, size_);
+      ros::serialization::serialize(stream, msg);
+      buffers_.push_back(buffer);
+    }
+    current_ = 0;
+  }
+
+  /**
+   * Copy the numeric fields of msg into a buffer no subscriber holds and
+   * make it the current one.
+   * @param msg
+   *   message with the same layout as the one the template was built from
+   */
+  void Patch(const M& msg)
+  {
+    size_t next = current_;
+    for (size_t i = 0; i < buffers_.size(); ++i)
+    {
+      next = (next + 1) % buffers_.size();
+      if (buffers_[next].unique())
+        break;
+    }
+    if (!buffers_[next].unique())
+    {
+      // All held, replace one; roscpp frees the old one when it is done
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      boost::shared_array<uint8_t> buffer(new uint8_t[size_ + 4]);
+      memcpy(buffer.get(), buffers_[current_].get(), size_ + 4);
+      buffers_[next] = buffer;
+    }
+    current_ = next;
+    TemplateLayout<M>::Patch(msg, buffers_[current_].get() + 4);
+  }
+
+  /**
+   * Publish the current buffer.
+   * @param publisher
+   *   publisher of M, always the same one for a template
+   */
+  void Publish(const ros::Publisher& publisher)
+  {
+    if (!publisher)
+      return;
+    // getTopic() returns a copy, so resolve it once
+    if (topic_.empty())
+      topic_ = publisher.getTopic();
+    ros::SerializedMessage m;
+    ros::TopicManager::instance()->publish(topic_, CurrentMessage(this), m);
+  }
+
+  const uint8_t* GetData() const { return buffers_[current_].get() + 4; }
+  uint32_t GetSize() const { return size_; }
+
+  /**
+   * @return buffers allocated because every kept one was still held by
+   * subscribers. May be read from any thread.
+   */
+  uint64_t GetMisses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+  // The current buffer as roscpp's serialization function returns it,
+  // small enough for boost::function to store without allocating
+  struct CurrentMessage
+  {
+    explicit CurrentMessage(const SerializedTemplate* tmpl) : tmpl(tmpl) {}
+
+    ros::SerializedMessage operator()() const
+    {
+      ros::SerializedMessage m(tmpl->buffers_[tmpl->current_], tmpl->size_ + 4);
+      m.message_start = m.buf.get() + 4;
+      return m;
+    }
+
+    const SerializedTemplate* tmpl;
+  };
+
+  size_t num_buffers_;
+  std::vector<boost::shared_array<uint8_t> > buffers_;
+  size_t current_;
+  uint32_t size_;
+  std::string topic_;
+  std::atomic<uint64_t> misses_;
+};
+
+namespace serialized_template
+{
+
+// ROS serializes primitives in host byte order, as memcpy does
+template <typename T>
+inline uint8_t* Write(uint8_t* data, const T& value)
+{
+  memcpy(data, &value, sizeof(value));
+  return data + sizeof(value);
+}
+
+inline uint8_t* WriteHeader(const std_msgs::Header& header, uint8_t* data)
+{
+  data = Write(data, header.seq);
+  data = Write(data, header.stamp.sec);
+  data = Write(data, header.stamp.nsec);
+  return data + sizeof(uint32_t) + header.frame_id.size();
+}
+
+inline uint8_t* WriteVector3(const geometry_msgs::Vector3& v, uint8_t* data)
+{
+  data = Write(data, v.x);
+  data = Write(data, v.y);
+  return Write(data, v.z);
+}
+
+inline uint8_t* WriteQuaternion(const geometry_msgs::Quaternion& q, uint8_t* data)
+{
+  data = Write(data, q.x);
+  data = Write(data, q.y);
+  data = Write(data, q.z);
+  return Write(data, q.w);
+}
+
+}
+
+template <>
+struct TemplateLayout<geometry_msgs::PoseStamped>
+{
+  static void Patch(const geometry_msgs::PoseStamped& msg, uint8_t* data)
+  {
+    using namespace serialized_template;
+    data = WriteHeader(msg.header, data);
+    data = Write(data, msg.pose.position.x);
+    data = Write(data, msg.pose.position.y);
+    data = Write(data, msg.pose.position.z);
+    WriteQuaternion(msg.pose.orientation, data);
+  }
+};
+
+template <>
+struct TemplateLayout<geometry_msgs::Twist>
+{
+  static void Patch(const geometry_msgs::Twist& msg, uint8_t* data)
+  {
+    using namespace serialized_template;
+    data = WriteVector3(msg.linear, data);
+    WriteVector3(msg.angular, data);
+  }
+};
+
+template <>
+struct TemplateLayout<nav_msgs::Odometry>
+{
+  static void Patch(const nav_msgs::Odometry& msg, uint8_t* data)
+  {
+    using namespace serialized_template;
+    data = WriteHeader(msg.header, data);
+    data += sizeof(uint32_t) + msg.child_frame_id.size();
+    data = Write(data, msg.pose.pose.position.x);
+    data = Write(data, msg.pose.pose.position.y);
+    data = Write(data, msg.pose.pose.position.z);
+    data = WriteQuaternion(msg.pose.pose.orientation, data);
+    data = Write(data, msg.pose.covariance);
+    data = WriteVector3(msg.twist.twist.linear, data);
+    data = WriteVector3(msg.twist.twist.angular, data);
+    Write(data, msg.twist.covariance);
+  }
+};
+
+template <>
+struct TemplateLayout<tf2_msgs::TFMessage>
+{
+  static void Patch(const tf2_msgs::TFMessage& msg, uint8_t* data)
+  {
+    using namespace serialized_template;
+    data += sizeof(uint32_t);
+    for (size_t i = 0; i < msg.transforms.size(); ++i)
+    {
+      const geometry_msgs::TransformStamped& transform = msg.transforms[i];
+      data = WriteHeader(transform.header, data);
+      data += sizeof(uint32_t) + transform.child_frame_id.size();
+      data = WriteVector3(transform.transform.translation, data);
+      data = WriteQuaternion(transform.transform.rotation, data);
+    }
+  }
+};
+
+namespace ros
+{
+namespace message_traits
+{
+
+template <typename M>
+struct MD5Sum<SerializedTemplate<M> >
+{
+  static const char* value() { return MD5Sum<M>::value(); }
+  static const char* value(const SerializedTemplate<M>&) { return value(); }
+};
+
+template <typename M>
+struct DataType<SerializedTemplate<M> >
+{
+  static const char* value() { return DataType<M>::value(); }
+  static const char* value(const SerializedTemplate<M>&) { return value(); }
+};
+
+template <typename M>
+struct Definition<SerializedTemplate<M> >
+{
+  static const char* value() { return Definition<M>::value(); }
+  static const char* value(const SerializedTemplate<M>&) { return value(); }
+};
+
+}
+
+namespace serialization
+{
+
+template <typename M>
+struct Serializer<SerializedTemplate<M> >
+{
+  template <typename Stream>
+  inline static void write(Stream& stream, const SerializedTemplate<M>& t)
+  {
+    memcpy(stream.advance(t.GetSize()), t.GetData(), t.GetSize());
+  }
+
+  inline static uint32_t serializedLength(const SerializedTemplate<M>& t)
+  {
+    return t.GetSize();
+  }
+};
+
+}
+}
+
+#endif
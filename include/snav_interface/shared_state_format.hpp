@@ -0,0 +1,112 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _SHARED_STATE_FORMAT_H_
+#define _SHARED_STATE_FORMAT_H_
+
+#include <stdint.h>
+
+#include "snav_interface/seqlock.hpp"
+
+/*
+ * Layout of the shared-memory state segment (/dev/shm/<shared_state_name>).
+ *
+ *   [0, 64)    SharedStateHeader, written once when the segment is set up
+ *   [64, 68)   sequence number, odd while a write is in progress and advanced
+ *              by two per state
+ *   [72, ...)  SharedState
+ *
+ * There is a single writer, snav_interface, and any number of readers. A
+ * reader copies the state and accepts it if the sequence number was even and
+ * unchanged around the copy, see Seqlock. The segment is reused across
+ * restarts of the writer so that mapped readers keep receiving states;
+ * writer_pid is 0 while no writer is attached. All fields are little-endian
+ * and naturally aligned; SharedState only ever changes together with
+ * kSharedStateVersion.
+ */
+
+const char kSharedStateMagic[8] = {'S', 'N', 'A', 'V', 'S', 'H', 'M', '1'};
+const uint32_t kSharedStateVersion = 1;
+
+struct SharedStateHeader
+{
+  char magic[8];
+  uint32_t version;
+  // offset of the sequence number
+  uint32_t header_size;
+  uint32_t state_size;
+  int32_t writer_pid;
+  int64_t created_realtime_ns;
+  uint32_t reserved[8];
+};
+
+struct SharedState
+{
+  // CLOCK_REALTIME stamps, as on the ROS topics [ns]
+  int64_t est_stamp_ns;
+  int64_t status_stamp_ns;
+  // CLOCK_MONOTONIC time the sn_update_data call that produced the state
+  // completed and time the state was written [ns]
+  int64_t acquired_ns;
+  int64_t written_ns;
+
+  // base_link in estimation_frame [m], orientation x, y, z, w
+  double position[3];
+  double orientation[4];
+  // linear velocity in estimation_frame [m/s], angular in base_link [rad/s]
+  double linear_velocity[3];
+  double angular_velocity[3];
+
+  // desired pose in estimation_frame [m], orientation x, y, z, w, yaw [rad]
+  double desired_position[3];
+  double desired_orientation[4];
+  double desired_yaw;
+
+  float battery_voltage;
+  int32_t on_ground;
+  // SnPropsState
+  int32_t props_state;
+  uint32_t reserved;
+};
+
+struct SharedStateSegment
+{
+  SharedStateHeader header;
+  Seqlock<SharedState> state;
+};
+
+static_assert(sizeof(SharedStateHeader) == 64, "SharedStateHeader layout changed");
+static_assert(sizeof(SharedState) == 216, "SharedState layout changed, bump kSharedStateVersion");
+static_assert(sizeof(SharedStateSegment) == 72 + sizeof(SharedState), "SharedStateSegment layout changed");
+
+#endif
@@ -0,0 +1,166 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _SHARED_STATE_READER_H_
+#define _SHARED_STATE_READER_H_
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snav_interface/shared_state_format.hpp"
+
+/**
+ * Reads the latest vehicle state that snav_interface exports with
+ * shared_state_name.
+ *
+ * Header-only and free of ROS and snav dependencies, so non-ROS programs on
+ * the vehicle can include it directly (link with -lrt on older glibc). Open()
+ * maps the segment once; afterwards Load() is a handful of loads and a copy,
+ * without syscalls or locks, and never delays the writer. Any number of
+ * readers may be attached. See shared_state_format.hpp for the layout.
+ */
+class SharedStateReader
+{
+public:
+  SharedStateReader() : segment_(NULL) {}
+
+  ~SharedStateReader() { Close(); }
+
+  /**
+   * Map the segment read-only and check its version.
+   * @param name
+   *   shared_state_name of the writer, e.g. "/snav_state"
+   * @param error
+   *   set to the reason if the segment cannot be used
+   * @return false if the segment does not exist (yet) or has another layout
+   */
+  bool Open(const std::string& name, std::string& error)
+  {
+    Close();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+      error = "shm_open: " + std::string(std::strerror(errno));
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SharedStateSegment))
+    {
+      ::close(fd);
+      error = "segment is too small, the writer may still be setting it up";
+      return false;
+    }
+    void* map = mmap(NULL, sizeof(SharedStateSegment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+      error = "mmap: " + std::string(std::strerror(errno));
+      return false;
+    }
+
+    const SharedStateSegment* segment = static_cast<const SharedStateSegment*>(map);
+    // The magic is written last when the writer sets the segment up
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (std::memcmp(segment->header.magic, kSharedStateMagic, sizeof(kSharedStateMagic)) != 0 ||
+        segment->header.version != kSharedStateVersion ||
+        segment->header.state_size != sizeof(SharedState))
+    {
+      munmap(map, sizeof(SharedStateSegment));
+      error = "segment is not set up or has a different version";
+      return false;
+    }
+    segment_ = segment;
+    return true;
+  }
+
+  void Close()
+  {
+    if (segment_ != NULL)
+      munmap(const_cast<SharedStateSegment*>(segment_), sizeof(SharedStateSegment));
+    segment_ = NULL;
+  }
+
+  bool IsOpen() const { return segment_ != NULL; }
+
+  /**
+   * Copy the latest state.
+   * @param state
+   *   set to the latest state on success
+   * @param sequence
+   *   if not NULL, set to the sequence number of the state on success; it
+   *   advances by two per state, so a reader can tell new states and count
+   *   the ones it missed
+   * @return false if nothing was written yet, or if no consistent copy was
+   *   obtained in max_attempts tries (the writer died in the middle of a
+   *   write)
+   */
+  bool Load(SharedState& state, uint32_t* sequence = NULL, int max_attempts = 1000) const
+  {
+    uint32_t seq = 0;
+    for (int attempt = 0; attempt < max_attempts; ++attempt)
+    {
+      if (segment_->state.TryLoad(state, &seq))
+      {
+        if (sequence != NULL)
+          *sequence = seq;
+        return seq != 0;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @return sequence number of the latest state, 0 before the first one.
+   *   Cheaper than Load() to poll for a new state.
+   */
+  uint32_t GetSequence() const { return segment_->state.GetSequence(); }
+
+  /**
+   * @return pid of the attached writer, 0 if there is none
+   */
+  int32_t GetWriterPid() const
+  {
+    return reinterpret_cast<const volatile SharedStateHeader*>(&segment_->header)->writer_pid;
+  }
+
+private:
+  const SharedStateSegment* segment_;
+};
+
+#endif
@@ -0,0 +1,98 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _SHARED_STATE_WRITER_H_
+#define _SHARED_STATE_WRITER_H_
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+#include "snav_interface/shared_state_format.hpp"
+
+/**
+ * Exports the latest vehicle state to a POSIX shared-memory segment for
+ * non-ROS readers on the vehicle, see SharedStateReader.
+ *
+ * Write() is a seqlock store into the mapped segment: no syscall, no lock,
+ * and readers never delay it. An existing segment with the same layout is
+ * reused so that readers which stay mapped across a restart of the node
+ * continue to receive states; the segment is not unlinked on Close().
+ */
+class SharedStateWriter
+{
+public:
+  SharedStateWriter();
+
+  /**
+   * Destructor, detaches from the segment.
+   */
+  ~SharedStateWriter();
+
+  /**
+   * Create or reuse the segment and map it.
+   * @param name
+   *   POSIX shared memory name, e.g. "/snav_state"
+   * @param error
+   *   set to the reason on failure
+   * @return false if the segment could not be prepared
+   */
+  bool Open(const std::string& name, std::string& error);
+
+  /**
+   * Mark the segment as having no writer and unmap it.
+   */
+  void Close();
+
+  bool IsOpen() const { return segment_ != NULL; }
+
+  /**
+   * Publish a state. Must only be called from one thread.
+   */
+  void Write(const SharedState& state)
+  {
+    segment_->state.Store(state);
+    writes_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @return states written since Open()
+   */
+  uint64_t GetWrites() const { return writes_.load(std::memory_order_relaxed); }
+
+private:
+  SharedStateSegment* segment_;
+  std::atomic<uint64_t> writes_;
+};
+
+#endif
@@ -0,0 +1,294 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _SNAV_ACQUISITION_H_
+#define _SNAV_ACQUISITION_H_
+
+#include <pthread.h>
+
+#include <atomic>
+#include <thread>
+
+#include <snav/snapdragon_navigator.h>
+
+#include "snav_interface/flight_record_reader.hpp"
+#include "snav_interface/flight_recorder.hpp"
+#include "snav_interface/latency_histogram.hpp"
+#include "snav_interface/sample_poller.hpp"
+#include "snav_interface/seqlock.hpp"
+#include "snav_interface/snav_snapshot.hpp"
+#include "snav_interface/telemetry_stream.hpp"
+
+/**
+ * Owns the snav cached data and runs sn_update_data() on its own thread.
+ *
+ * Every RPC that returns a new estimator or simulator sample is reduced to a
+ * SnavSnapshot and handed to the publishing side through a seqlock, so a slow
+ * RPC never stalls ROS callbacks and the publisher never waits on the RPC.
+ */
+class SnavAcquisition
+{
+public:
+  struct Stats
+  {
+    uint64_t rpc_count;
+    uint64_t rpc_failures;
+    // failures since the last success, the current retry delay [s] and
+    // how often the cached data pointer was re-acquired
+    uint64_t consecutive_failures;
+    double backoff;
+    uint64_t reconnects;
+    uint64_t reconnect_failures;
+    uint64_t rpc_timeouts;
+    double rpc_duration_mean;
+    double rpc_duration_max;
+    uint64_t est_samples;
+    uint64_t est_duplicates;
+    uint64_t sim_samples;
+    uint64_t sim_duplicates;
+    double sample_period;
+    uint64_t empty_polls;
+    // polls woken late, and samples seen a whole period late
+    uint64_t poll_deadline_misses;
+    uint64_t late_samples;
+  };
+
+  SnavAcquisition();
+  ~SnavAcquisition();
+
+  /**
+   * Attach to the snav cached data, run one synchronous update and start
+   * the acquisition thread.
+   * @param min_poll_period
+   *   interval between RPCs [s] while a sample is expected
+   * @param max_poll_period
+   *   interval between RPCs [s] while samples are not arriving
+   * @param rpc_timeout
+   *   RPCs taking longer than this [s] are counted as timeouts
+   * @return false if the snav cached data could not be obtained
+   */
+  bool Start(double min_poll_period, double max_poll_period, double rpc_timeout);
+
+  /**
+   * Feed a flight record through the snapshot path instead of calling
+   * sn_update_data(). Samples are released at their recorded pace scaled by
+   * speed; with speed 0 each sample is held until the publisher has taken
+   * the previous one, so nothing is skipped.
+   * @param reader
+   *   opened record, must outlive the acquisition
+   * @param speed
+   *   playback rate, 1 for real time, 0 for as fast as possible
+   * @return false if the record is empty
+   */
+  bool StartReplay(const FlightRecordReader* reader, double speed);
+
+  /**
+   * @return true once a replay has stored its last sample
+   */
+  bool IsReplayFinished() const { return replay_finished_; }
+
+  /**
+   * Retry a failing sn_update_data() with exponential backoff instead of at
+   * the poll rate. Must be called before Start().
+   * @param initial
+   *   delay after the first failure [s], doubled on every further one
+   * @param max
+   *   longest delay [s]
+   * @param reconnect_after
+   *   re-acquire the cached data pointer every this many consecutive
+   *   failures, 0 never
+   */
+  void SetRpcBackoff(double initial, double max, int reconnect_after);
+
+  /**
+   * Hold every new sample until the publisher has taken it, see
+   * MarkConsumed(), and poll again right away once it has. Each simulator
+   * step is then published exactly once. Must be called before Start().
+   * @param lockstep
+   *   true to step with the publisher
+   */
+  void SetLockstep(bool lockstep) { lockstep_ = lockstep; }
+
+  /**
+   * Tell a fast replay or a lockstep acquisition that a snapshot has been
+   * published.
+   * @param sequence
+   *   value returned by GetSnapshot()
+   */
+  void MarkConsumed(uint32_t sequence) { consumed_sequence_ = sequence; }
+
+  /**
+   * Hand every new sample to a flight recorder. Must be called before Start().
+   * @param recorder
+   *   recorder, or NULL to stop recording
+   */
+  void SetRecorder(FlightRecorder* recorder) { recorder_ = recorder; }
+
+  /**
+   * Queue every new compensated IMU sample. Enable before Start().
+   */
+  TelemetryStream<SnImuComp>& GetImuStream() { return imu_stream_; }
+
+  /**
+   * Queue every new ESC feedback sample. Enable before Start().
+   */
+  TelemetryStream<SnEscRawData>& GetEscStream() { return esc_stream_; }
+
+  /**
+   * Stop and join the acquisition thread.
+   */
+  void Stop();
+
+  /**
+   * Wait for a new snapshot, never longer than timeout.
+   * @param timeout
+   *   maximum time to wait [s]
+   * @return true if a new snapshot was published while waiting
+   */
+  bool WaitForSnapshot(double timeout);
+
+  /**
+   * Copy the most recent snapshot.
+   * @param snapshot
+   *   destination
+   * @return sequence number, which changes whenever a new snapshot is stored
+   */
+  uint32_t GetSnapshot(SnavSnapshot& snapshot) const;
+
+  /**
+   * @return time since the last successful RPC [s]
+   */
+  double GetDataAge() const;
+
+  /**
+   * @return CLOCK_MONOTONIC time [ns] the next estimator sample is expected
+   * to be acquired, 0 until the sample cadence is known
+   */
+  int64_t GetExpectedSampleNs() const { return expected_sample_ns_.load(std::memory_order_relaxed); }
+
+  /**
+   * @return true if the RPC in progress has been running longer than
+   * the configured timeout
+   */
+  bool IsRpcStalled() const;
+
+  /**
+   * @return counters for diagnostics
+   */
+  Stats GetStats() const;
+
+  /**
+   * @return histogram of sn_update_data() durations
+   */
+  LatencyHistogram& GetRpcHistogram() { return rpc_histogram_; }
+
+  /**
+   * @return handle of the acquisition or replay thread, only valid while
+   * it is running
+   */
+  pthread_t GetThreadHandle() { return thread_.native_handle(); }
+
+  /**
+   * @return true while the acquisition or replay thread is running
+   */
+  bool IsRunning() const { return thread_.joinable(); }
+
+private:
+  void Run(bool new_sample);
+  bool Acquire();
+  void Reconnect();
+  int64_t NextBackoffNs();
+  bool WaitForConsumed(uint32_t sequence);
+  void RunReplay();
+  bool WaitForReplayTime(int64_t target_ns);
+  void StoreSample(bool new_est_sample, bool new_sim_sample, int64_t acquired_ns);
+  void Signal();
+
+  SnavCachedData* cached_data_;
+  FlightRecorder* recorder_;
+  Seqlock<SnavSnapshot> snapshot_;
+  SamplePoller poller_;
+
+  std::thread thread_;
+  std::atomic<bool> running_;
+  int event_fd_;
+
+  int64_t rpc_timeout_ns_;
+
+  int64_t backoff_initial_ns_;
+  int64_t backoff_max_ns_;
+  int reconnect_after_;
+
+  bool lockstep_;
+  // While a lockstep sample is held no RPC runs, so the data is not stale
+  std::atomic<bool> holding_;
+  std::atomic<int64_t> released_ns_;
+
+  const FlightRecordReader* replay_reader_;
+  double replay_speed_;
+  std::atomic<bool> replay_finished_;
+  std::atomic<uint32_t> consumed_sequence_;
+
+  // Only touched by the acquisition thread
+  SnavSnapshot scratch_;
+  int64_t last_est_sample_time_;
+  int64_t last_sim_sample_time_;
+
+  std::atomic<int64_t> rpc_start_ns_;
+  std::atomic<int64_t> last_success_ns_;
+  std::atomic<uint64_t> rpc_count_;
+  std::atomic<uint64_t> rpc_failures_;
+  std::atomic<uint64_t> consecutive_failures_;
+  std::atomic<int64_t> backoff_ns_;
+  std::atomic<uint64_t> reconnects_;
+  std::atomic<uint64_t> reconnect_failures_;
+  std::atomic<uint64_t> rpc_timeouts_;
+  std::atomic<uint64_t> rpc_duration_total_ns_;
+  std::atomic<uint64_t> rpc_duration_max_ns_;
+  std::atomic<uint64_t> est_samples_;
+  std::atomic<uint64_t> est_duplicates_;
+  std::atomic<uint64_t> sim_samples_;
+  std::atomic<uint64_t> sim_duplicates_;
+  std::atomic<uint64_t> sample_period_ns_;
+  std::atomic<int64_t> expected_sample_ns_;
+  std::atomic<uint64_t> empty_polls_;
+  std::atomic<uint64_t> poll_deadline_misses_;
+  std::atomic<uint64_t> late_samples_;
+
+  LatencyHistogram rpc_histogram_;
+
+  TelemetryStream<SnImuComp> imu_stream_;
+  TelemetryStream<SnEscRawData> esc_stream_;
+};
+
+#endif
@@ -0,0 +1,287 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _SNAV_COMMAND_ENGINE_H_
+#define _SNAV_COMMAND_ENGINE_H_
+
+#include <pthread.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <snav/snapdragon_navigator.h>
+
+#include "snav_interface/latency_histogram.hpp"
+#include "snav_interface/seqlock.hpp"
+#include "snav_interface/snav_trajectory.hpp"
+
+/**
+ * Streams commands to snav at a fixed rate from its own thread.
+ *
+ * Callbacks drop the newest RC command into a single-slot mailbox and return;
+ * older commands are simply overwritten. The engine thread wakes on absolute
+ * deadlines, sends whatever is in the mailbox, and falls back to a zero-stick
+ * position hold command once the newest command is older than the timeout.
+ * Once it is older than the failsafe timeout the engine stops sending, so
+ * snav's own RC-loss failsafe takes over.
+ *
+ * Trajectory batches are buffered and executed on the same thread: each
+ * tick the buffer is interpolated at the current time and sent as a
+ * trajectory tracking command. Single trajectory setpoints go through a
+ * mailbox like RC commands. Whichever interface received input most
+ * recently owns the vehicle, and the engine thread is the only one that
+ * talks to it. A trajectory falls back to the same position hold and
+ * failsafe silence once its final setpoint is older than the timeout.
+ */
+class SnavCommandEngine
+{
+public:
+  struct RcCommand
+  {
+    float x;
+    float y;
+    float z;
+    float yaw;
+    SnRcCommandType type;
+    SnRcCommandOptions mapping;
+    // CLOCK_MONOTONIC time the command was received [ns], 0 if none yet
+    int64_t received_ns;
+  };
+
+  struct TrajCommand
+  {
+    // time_ns is unused, the setpoint applies from when it is received
+    SnavTrajectory::Sample setpoint;
+    // CLOCK_MONOTONIC time the command was received [ns], 0 if none yet
+    int64_t received_ns;
+  };
+
+  struct Stats
+  {
+    uint64_t commands_received;
+    uint64_t commands_sent;
+    uint64_t hover_sent;
+    uint64_t timeouts;
+    uint64_t failsafe_releases;
+    uint64_t deadline_misses;
+    double age_mean;
+    double age_max;
+    double age_last;
+    bool hovering;
+    // nothing is sent, waiting for snav's failsafe or a new command
+    bool failsafe;
+
+    uint64_t traj_batches;
+    uint64_t traj_splices;
+    uint64_t traj_setpoints_sent;
+    uint64_t traj_underruns;
+    uint64_t traj_underrun_cycles;
+    bool traj_starved;
+    double traj_receive_latency_mean;
+    double traj_receive_latency_max;
+    double traj_lead_last;
+    double traj_lead_min;
+  };
+
+  SnavCommandEngine();
+  ~SnavCommandEngine();
+
+  /**
+   * Start the streaming thread.
+   * @param rate
+   *   rate commands are sent to snav [Hz]
+   * @param timeout
+   *   age [s] after which the newest command is replaced by a position hold
+   *   command
+   * @param failsafe_timeout
+   *   age [s] after which nothing is sent any more, longer than timeout
+   */
+  void Start(double rate, double timeout, double failsafe_timeout);
+
+  /**
+   * Set the command timeouts, done by Start().
+   * @param timeout
+   *   age [s] after which the newest command is replaced by a position hold
+   *   command
+   * @param failsafe_timeout
+   *   age [s] after which nothing is sent any more, longer than timeout
+   */
+  void SetTimeouts(double timeout, double failsafe_timeout);
+
+  /**
+   * Stop and join the streaming thread.
+   */
+  void Stop();
+
+  /**
+   * Replace the pending command. Must only be called from one thread.
+   * @param command
+   *   new command, received_ns is filled in here
+   */
+  void SetRcCommand(const RcCommand& command);
+
+  /**
+   * As SetRcCommand(command), received at now_ns.
+   * @param now_ns
+   *   CLOCK_MONOTONIC time [ns]
+   */
+  void SetRcCommand(const RcCommand& command, int64_t now_ns);
+
+  /**
+   * Buffer a batch of trajectory setpoints. Must only be called from one
+   * thread.
+   * @param trajectory
+   *   setpoints sorted by time, stamp_ns set by the caller
+   * @param replace
+   *   if true the buffer is replaced, otherwise buffered setpoints from the
+   *   batch's first setpoint onwards are replaced and earlier ones are kept
+   */
+  void SetTrajectory(const std::shared_ptr<SnavTrajectory>& trajectory, bool replace);
+
+  /**
+   * As SetTrajectory(trajectory, replace), received at the given times.
+   * @param now_ns
+   *   CLOCK_MONOTONIC time [ns]
+   * @param ros_now_ns
+   *   ROS time [ns], buffered setpoints before it are dropped
+   */
+  void SetTrajectory(const std::shared_ptr<SnavTrajectory>& trajectory, bool replace,
+      int64_t now_ns, int64_t ros_now_ns);
+
+  /**
+   * Replace the pending single trajectory setpoint, sent until newer input
+   * arrives or it times out. Must only be called from one thread.
+   * @param command
+   *   new setpoint, received_ns is filled in here
+   */
+  void SetTrajCommand(const TrajCommand& command);
+
+  /**
+   * As SetTrajCommand(command), received at now_ns.
+   * @param now_ns
+   *   CLOCK_MONOTONIC time [ns]
+   */
+  void SetTrajCommand(const TrajCommand& command, int64_t now_ns);
+
+  /**
+   * Run one streaming cycle: send the command of whichever interface owns
+   * the vehicle, or hold position or go silent once it is too old. Called
+   * every period by the streaming thread; without Start() it can be called
+   * directly to step the engine through chosen times.
+   * @param now_ns
+   *   CLOCK_MONOTONIC time of the cycle [ns]
+   * @param ros_now_ns
+   *   ROS time of the cycle [ns], buffered trajectories are evaluated at it
+   */
+  void Tick(int64_t now_ns, int64_t ros_now_ns);
+
+  /**
+   * @return the buffered trajectory, empty before the first batch
+   */
+  std::shared_ptr<const SnavTrajectory> GetTrajectory() const
+  {
+    return std::atomic_load(&trajectory_);
+  }
+
+  /**
+   * @return counters for diagnostics
+   */
+  Stats GetStats() const;
+
+  /**
+   * @return histogram of RC command age at the time it is sent
+   */
+  LatencyHistogram& GetCommandAgeHistogram() { return age_histogram_; }
+
+  /**
+   * @return handle of the streaming thread, only valid while it is running
+   */
+  pthread_t GetThreadHandle() { return thread_.native_handle(); }
+
+  /**
+   * @return true while the streaming thread is running
+   */
+  bool IsRunning() const { return thread_.joinable(); }
+
+private:
+  void Run();
+  void SendRcCommand(const RcCommand& command);
+  bool HoldOnTimeout(int64_t age_ns);
+  void ExecuteTrajectory(const std::shared_ptr<const SnavTrajectory>& trajectory,
+      int64_t ros_now_ns);
+  void SendTrajectoryCommand(const SnavTrajectory::Sample& setpoint);
+
+  Seqlock<RcCommand> mailbox_;
+  Seqlock<TrajCommand> traj_mailbox_;
+
+  std::thread thread_;
+  std::atomic<bool> running_;
+
+  int64_t period_ns_;
+  int64_t timeout_ns_;
+  int64_t failsafe_timeout_ns_;
+
+  // Swapped atomically by SetTrajectory(), read by the engine thread
+  std::shared_ptr<const SnavTrajectory> trajectory_;
+  // Engine thread only
+  std::shared_ptr<const SnavTrajectory> executing_trajectory_;
+  size_t trajectory_cursor_;
+  std::atomic<bool> trajectory_underrun_;
+
+  std::atomic<bool> hovering_;
+  std::atomic<bool> failsafe_;
+
+  std::atomic<uint64_t> commands_received_;
+  std::atomic<uint64_t> commands_sent_;
+  std::atomic<uint64_t> hover_sent_;
+  std::atomic<uint64_t> timeouts_;
+  std::atomic<uint64_t> failsafe_releases_;
+  std::atomic<uint64_t> deadline_misses_;
+  std::atomic<uint64_t> age_total_ns_;
+  std::atomic<uint64_t> age_max_ns_;
+  std::atomic<uint64_t> age_last_ns_;
+  LatencyHistogram age_histogram_;
+
+  std::atomic<uint64_t> traj_batches_;
+  std::atomic<uint64_t> traj_splices_;
+  std::atomic<uint64_t> traj_setpoints_sent_;
+  std::atomic<uint64_t> traj_underruns_;
+  std::atomic<uint64_t> traj_underrun_cycles_;
+  std::atomic<int64_t> traj_receive_latency_total_ns_;
+  std::atomic<int64_t> traj_receive_latency_max_ns_;
+  std::atomic<int64_t> traj_lead_last_ns_;
+  std::atomic<int64_t> traj_lead_min_ns_;
+};
+
+#endif
@@ -34,15 +34,20 @@
 #ifndef _SNAV_INTERFACE_H_
 #define _SNAV_INTERFACE_H_
 
+#include <atomic>
+#include <memory>
+
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <geometry_msgs/Twist.h>
 #include <geometry_msgs/PoseStamped.h>
 #include <geometry_msgs/TransformStamped.h>
 #include <geometry_msgs/Quaternion.h>
+#include <nav_msgs/Odometry.h>
 #include <tf2/LinearMath/Quaternion.h>
 #include <tf2/LinearMath/Matrix3x3.h>
-#include <tf2_ros/transform_broadcaster.h>
 #include <tf2_geometry_msgs/tf2_geometry_msgs.h>
+#include <tf2_msgs/TFMessage.h>
 #include <std_msgs/Float32.h>
 #include <std_msgs/MultiArrayDimension.h>
 #include <std_msgs/MultiArrayLayout.h>
@@ -51,12 +56,93 @@
 #include <rosgraph_msgs/Clock.h>
 #include <std_msgs/Empty.h>
 #include <std_msgs/String.h>
+#include <std_msgs/Time.h>
+#include <trajectory_msgs/MultiDOFJointTrajectory.h>
+#include <boost/make_shared.hpp>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <sensor_msgs/Imu.h>
+#include <snav_ros/EscBatch.h>
+#include <snav_ros/ImuBatch.h>
+#include <snav_ros/SetOutputRate.h>
 
 #include <snav/snapdragon_navigator.h>
 
+#include "snav_interface/compact_state.hpp"
+#include "snav_interface/dsp_clock_sync.hpp"
+#include "snav_interface/fault_monitor.hpp"
+#include "snav_interface/frame_kernel.hpp"
+#include "snav_interface/latency_histogram.hpp"
+#include "snav_interface/message_pool.hpp"
+#include "snav_interface/output_scheduler.hpp"
+#include "snav_interface/realtime.hpp"
+#include "snav_interface/serialized_template.hpp"
+#include "snav_interface/shared_state_writer.hpp"
+#include "snav_interface/snav_acquisition.hpp"
+#include "snav_interface/snav_command_engine.hpp"
+#include "snav_interface/snav_snapshot.hpp"
+
 class SnavInterface
 {
 public:
+  enum TfFrame
+  {
+    TF_EST,
+    TF_BASE_LINK_NO_ROT,
+    TF_BASE_LINK_STAB,
+    TF_DESIRED,
+    TF_GPS_ENU,
+    TF_SIM_GT,
+    NUM_TF_FRAMES
+  };
+
+  // Outputs RunOnce() can produce, as bits of an output mask. TF frames
+  // follow the topics, see TfOutput()
+  enum Output
+  {
+    OUTPUT_POSE = 1 << 0,
+    OUTPUT_DES_POSE = 1 << 1,
+    OUTPUT_VEL = 1 << 2,
+    OUTPUT_SIM_GT_POSE = 1 << 3,
+    OUTPUT_IMU = 1 << 4,
+    OUTPUT_ESC = 1 << 5,
+    OUTPUT_COMPACT_STATE = 1 << 6,
+    OUTPUT_ODOM = 1 << 7,
+    OUTPUT_BATTERY_VOLTAGE = 1 << 8,
+    OUTPUT_ON_GROUND = 1 << 9,
+    OUTPUT_PROPS_STATE = 1 << 10,
+    OUTPUT_SHARED_STATE = 1 << 11,
+    OUTPUT_TF_SHIFT = 12,
+    NUM_OUTPUTS = OUTPUT_TF_SHIFT + NUM_TF_FRAMES,
+    ALL_OUTPUTS = (1 << NUM_OUTPUTS) - 1,
+    STATUS_OUTPUTS = OUTPUT_BATTERY_VOLTAGE | OUTPUT_ON_GROUND | OUTPUT_PROPS_STATE,
+    // Drained every cycle, their rate follows from the batch size
+    BATCH_OUTPUTS = OUTPUT_IMU | OUTPUT_ESC
+  };
+
+  /**
+   * @return output mask bit of a TF frame
+   */
+  static uint32_t TfOutput(TfFrame frame) { return 1u << (OUTPUT_TF_SHIFT + frame); }
+
+  // Stages of the publish cycle and callbacks that are timed when
+  // enable_profiling is set; sample_age is always recorded
+  enum ProfileStage
+  {
+    STAGE_SNAPSHOT,
+    STAGE_UPDATE_POSE,
+    STAGE_UPDATE_SIM,
+    STAGE_PUBLISH,
+    STAGE_TF,
+    STAGE_CYCLE,
+    STAGE_GEN_CMD_CALLBACK,
+    STAGE_TRAJ_BATCH_CALLBACK,
+    // acquisition thread finished the RPC -> est outputs published
+    STAGE_ACQUIRED_TO_PUBLISHED,
+    // estimator sample time -> est outputs published
+    STAGE_SAMPLE_AGE,
+    NUM_PROFILE_STAGES
+  };
+
   /**
    * Constructor.
    * @param nh
@@ -66,51 +152,135 @@ public:
    */
   SnavInterface(ros::NodeHandle nh, ros::NodeHandle pnh);
 
+  /**
+   * Destructor, stops the acquisition thread.
+   */
+  ~SnavInterface();
+
+  /**
+   * Run one acquisition/publish cycle with the outputs enabled by params
+   **/
+  void RunOnce();
+
+  /**
+   * Apply the configured thread scheduling and memory locking, then drop
+   * root. Must be called from the thread that runs RunOnce(), before the
+   * first cycle. Locking and dropping root affect the whole process.
+   * @param shared_process
+   *   true when other code shares the process, e.g. a nodelet manager;
+   *   lock_memory and drop_privileges are then refused and reported failed
+   **/
+  void ApplyRealtimeConfig(bool shared_process = false);
+
+  /**
+   * Block until the next cycle is due, either the next snav sample or the
+   * next loop_frequency tick. In lockstep mode, first wait for the
+   * acknowledgments of the step just published.
+   **/
+  void WaitForNextCycle();
+
   /**
    * pack vio, optic flow, and gps data into ros messages and tfs
+   * @param outputs
+   *   mask of Output bits, messages of other outputs are left untouched
    **/
-  void UpdatePoseMessages();
+  void UpdatePoseMessages(uint32_t outputs = ALL_OUTPUTS);
 
   /**
    * pack simulated data into ros messages and tfs
+   * @param outputs
+   *   mask of Output bits, messages of other outputs are left untouched
+   **/
+  void UpdateSimMessages(uint32_t outputs = ALL_OUTPUTS);
+
+  /**
+   * Recompute which outputs are enabled and, with lazy_outputs, have a
+   * subscriber. Runs whenever a subscriber connects or disconnects and
+   * with the low frequency data as a fallback.
    **/
-  void UpdateSimMessages();
+  void UpdateActiveOutputs();
 
   /**
-   * Update snav cached_data from snav RPC call
+   * @return mask of Output bits RunOnce() currently produces
+   **/
+  uint32_t GetActiveOutputs() const { return active_outputs_.load(std::memory_order_relaxed); }
+
+  /**
+   * @return messages and serialized buffers allocated because every pooled
+   * one of their type was still held by subscribers
+   **/
+  uint64_t GetPoolMisses() const;
+
+  /**
+   * Change the rate of an output, effective from the next cycle
+   * @param output
+   *   output name, as in its <name>_rate param
+   * @param rate
+   *   [Hz], 0 to produce it every cycle
+   * @param message
+   *   set to what was changed or why nothing was
+   * @return false if the output or rate is not accepted
+   **/
+  bool SetOutputRate(const std::string& output, double rate, std::string& message);
+
+  /**
+   * Take the latest snapshot produced by the acquisition thread
    **/
   void UpdateSnavData();
 
   /**
-   * Publish estimation_frame_ -> base_link_frame_ transform
+   * @return true if the last UpdateSnavData() produced a pos_vel sample
+   * that has not been seen before
+   **/
+  bool NewEstSample() const { return new_est_sample_; }
+
+  /**
+   * @return true if the last UpdateSnavData() produced a sim_ground_truth
+   * sample that has not been seen before
+   **/
+  bool NewSimSample() const { return new_sim_sample_; }
+
+  /**
+   * Wait until the acquisition thread has a new sample, at most one
+   * loop period
+   **/
+  void SleepUntilNextSample();
+
+  /**
+   * Queue estimation_frame_ -> base_link_frame_ transform for SendTfBatch()
    */
   void BroadcastEstTf();
 
   /**
-   * Publish base_link_frame_ -> base_link_no_rot_frame_ transform
+   * Queue base_link_frame_ -> base_link_no_rot_frame_ transform for SendTfBatch()
    */
   void BroadcastBaseLinkNoRotTf();
 
   /**
-   * Publish base_link_no_rot_frame_ -> base_link_stab_frame_ transform
+   * Queue base_link_no_rot_frame_ -> base_link_stab_frame_ transform for SendTfBatch()
    */
   void BroadcastBaseLinkStabTf();
 
   /**
-   * Publish estimation_frame_ -> desired_frame_ transform
+   * Queue estimation_frame_ -> desired_frame_ transform for SendTfBatch()
    */
   void BroadcastDesiredTf();
 
   /**
-   * Publish estimation_frame_ -> gps_enu_frame_ transform
+   * Queue estimation_frame_ -> gps_enu_frame_ transform for SendTfBatch()
    */
   void BroadcastGpsEnuTf();
 
   /**
-   * Publish base_link_frame_ -> sim_gt_frame_ transform
+   * Queue base_link_frame_ -> sim_gt_frame_ transform for SendTfBatch()
    */
   void BroadcastSimGtTf();
 
+  /**
+   * Publish all transforms queued this cycle as a single tf2_msgs/TFMessage
+   */
+  void SendTfBatch();
+
   /**
    * Publish base_link pose in estimation_frame_ as geometry_msgs/PoseStamped
    */
@@ -132,12 +302,45 @@ public:
   void PublishEstVel();
 
   /**
-   * Publish battery voltage and on_groung flag as Float32 and Bool msgs
+   * Publish base_link pose in estimation_frame_ and its twist in the
+   * odom_twist_frame as nav_msgs/Odometry, one stamp for both
+   */
+  void PublishEstOdom();
+
+  /**
+   * Publish the est pose and velocity quantized as snav_ros/CompactState
+   */
+  void PublishCompactState();
+
+  /**
+   * Write the est pose, velocity, desired pose and status to the
+   * shared_state_name shared memory segment
+   */
+  void PublishSharedState();
+
+  /**
+   * Refresh the active outputs in case a subscriber change was missed
+   * @param event
+   *   Required argument for a function passed to a ros timer, This function
+   *   is intended to be attached via nodehandle::createtimer
+   */
+  void RefreshActiveOutputs(const ros::TimerEvent& event);
+
+  /**
+   * Publish sample and sn_update_data counters as diagnostic_msgs/DiagnosticArray
+   * @param event
+   *   Required argument for a function passed to a ros timer, This function
+   *   is intended to be attached via nodehandle::createtimer
+   */
+  void PublishDiagnostics(const ros::TimerEvent& event);
+
+  /**
+   * Log how often each fault repeated since the last call
    * @param event
    *   Required argument for a function passed to a ros timer, This function
    *   is intended to be attached via nodehandle::createtimer
    */
-  void PublishLowFrequencyData(const ros::TimerEvent& event);
+  void PublishFaultSummary(const ros::TimerEvent& event);
 
   /**
    * Callback function to set SnRcCommandType
@@ -157,8 +360,8 @@ public:
    * Callback function for generic command input
    * @param msg
    *   geometry_msgs/Twist ros message.  linear x, y, z and angular z
-   *   are used. Note if this callback is active, it also maps and sends commdands to
-   *   snav via RPC call
+   *   are used. The command replaces any pending one and is streamed to
+   *   snav by the command engine at cmd_stream_rate
    */
   void GenCmdCallback(const geometry_msgs::Twist::ConstPtr& msg);
 
@@ -170,6 +373,37 @@ public:
    */
   void TrajCmdCallback(const std_msgs::Float32MultiArray::ConstPtr& msg);
 
+  /**
+   * Callback function for batches of trajectory setpoints
+   * @param msg
+   *   trajectory_msgs/MultiDOFJointTrajectory ros message. Setpoints are
+   *   at header.stamp + time_from_start (header.stamp 0 means now). The
+   *   first transform gives position and yaw, the first velocity gives
+   *   linear velocity and yaw rate (angular.z), the first acceleration
+   *   gives linear acceleration. Setpoints are buffered and executed
+   *   on-board by the command engine.
+   */
+  void TrajBatchCallback(const trajectory_msgs::MultiDOFJointTrajectory::ConstPtr& msg);
+
+  /**
+   * Callback function for lockstep acknowledgments, called from
+   * WaitForNextCycle()
+   * @param event
+   *   std_msgs/Time with the /clock time the publisher has finished
+   *   processing, and who published it
+   */
+  void LockstepAckCallback(const ros::MessageEvent<std_msgs::Time const>& event);
+
+  /**
+   * Service callback to change the rate of an output at runtime
+   * @param req
+   *   output name and rate [Hz], 0 for every cycle
+   * @param res
+   *   whether the rate was applied and a message
+   */
+  bool SetOutputRateCallback(snav_ros::SetOutputRate::Request& req,
+      snav_ros::SetOutputRate::Response& res);
+
   /**
    * Callback function to start propellers via ros message
    * @param msg
@@ -185,15 +419,68 @@ public:
   void StopPropsCallback(const std_msgs::Empty::ConstPtr& msg);
 
 private:
-  void GetRotationQuaternion(tf2::Quaternion &q);
-  void UpdatePosVelMessages(tf2::Quaternion q);
-
+  void UpdateFrames();
+  void UpdatePosVelMessages(uint32_t outputs);
+  void FinishLockstepStep();
+  void WaitForLockstepAck();
+  void SubscribersChanged(const ros::SingleSubscriberPublisher& publisher);
+
+  void QueueTransform(TfFrame frame);
+
+  // With zero_copy_ a shared_ptr from pool is published so subscribers in
+  // the same process receive it without serialization
+  template <typename M>
+  void PublishMessage(const ros::Publisher& publisher, const M& msg, MessagePool<M>& pool)
+  {
+    if (zero_copy_)
+      publisher.publish(pool.Copy(msg));
+    else
+      publisher.publish(msg);
+  }
+
+  // Otherwise, with preserialize_, msg is serialized into tmpl on the first
+  // publish and only its numeric fields are patched on later ones. roscpp
+  // sends tmpl's buffer as it is.
+  template <typename M>
+  void PublishTemplated(const ros::Publisher& publisher, const M& msg, MessagePool<M>& pool,
+      SerializedTemplate<M>& tmpl)
+  {
+    if (zero_copy_ || !preserialize_)
+    {
+      PublishMessage(publisher, msg, pool);
+      return;
+    }
+    if (tmpl.IsBuilt())
+      tmpl.Patch(msg);
+    else
+      tmpl.Build(msg);
+    tmpl.Publish(publisher);
+  }
+
+  // Battery voltage, on_ground and props_state of outputs, from snapshot_
+  void PublishStatusData(uint32_t outputs);
   void PublishBatteryVoltage();
   void PublishOnGroundFlag();
   void PublishPropsStateFlag();
 
-  void SendGenCommand();
-  void GetDSPTimeOffset();
+  // Drain the telemetry queues, publishing full batches if active
+  void PublishImuBatches(bool active);
+  void PublishEscBatches(bool active);
+
+  void AddLatencyValues(diagnostic_msgs::DiagnosticStatus& status,
+      const std::string& stage, const LatencyHistogram::Summary& summary);
+
+  LatencyHistogram* Profile(ProfileStage stage)
+  {
+    return profiling_ ? &profile_[stage] : NULL;
+  }
+
+  template <typename T>
+  void AddDiagnosticValue(diagnostic_msgs::DiagnosticStatus& status,
+      const std::string& key, T value);
+
+
+  void ReadThreadPolicy(const std::string& thread, ThreadPolicy& policy);
 
   void SetRcCommandType(std::string rc_cmd_type_string);
   void SetRcMappingType(std::string rc_cmd_mapping_string);
@@ -203,26 +490,82 @@ private:
   ros::Publisher pose_des_publisher_;
   ros::Publisher pose_sim_gt_publisher_;
   ros::Publisher vel_est_publisher_;
+  ros::Publisher odom_est_publisher_;
+  ros::Publisher imu_batch_publisher_;
+  ros::Publisher esc_batch_publisher_;
+  ros::Publisher compact_state_publisher_;
   ros::Publisher on_ground_publisher_;
   ros::Publisher props_state_publisher_;
   ros::Publisher clock_publisher_;
+  ros::Publisher diagnostics_publisher_;
+  ros::Publisher tf_publisher_;
+
+  ros::Timer active_outputs_timer_;
+  ros::Timer diagnostics_timer_;
+  ros::Timer fault_summary_timer_;
 
   ros::Subscriber cmd_type_subscriber_;
   ros::Subscriber mapping_type_subscriber_;
   ros::Subscriber gen_cmd_subscriber_;
   ros::Subscriber traj_cmd_subscriber_;
+  ros::Subscriber traj_batch_subscriber_;
   ros::Subscriber start_props_subscriber_;
   ros::Subscriber stop_props_subscriber_;
+  ros::Subscriber lockstep_ack_subscriber_;
+
+  ros::ServiceServer set_output_rate_service_;
 
   //public namespace nodehandle
   ros::NodeHandle nh_;
   //private namespace nodehandle
   ros::NodeHandle pnh_;
 
-  tf2_ros::TransformBroadcaster tf_pub_;
+  // Transforms are collected here and sent once per cycle. Queued frame
+  // messages are moved in for the publish and back out afterwards.
+  tf2_msgs::TFMessage tf_batch_;
+  geometry_msgs::TransformStamped* tf_messages_[NUM_TF_FRAMES];
+  uint32_t tf_queued_;
 
   geometry_msgs::Twist est_vel_msg_;
+
+  // Filled from snapshot_ at their output rates
+  std_msgs::Float32 battery_voltage_msg_;
+  std_msgs::Bool on_ground_msg_;
+  std_msgs::Bool props_state_msg_;
+
+  // zero_copy_ messages, one pool per message type and publishing thread.
+  // Pools shared by several outputs are sized per output.
+  MessagePool<geometry_msgs::PoseStamped> pose_pool_;
+  MessagePool<geometry_msgs::Twist> vel_pool_;
+  MessagePool<nav_msgs::Odometry> odom_pool_;
+  MessagePool<tf2_msgs::TFMessage> tf_pool_;
+  MessagePool<snav_ros::CompactState> compact_state_pool_;
+  MessagePool<snav_ros::ImuBatch> imu_batch_pool_;
+  MessagePool<snav_ros::EscBatch> esc_batch_pool_;
+  MessagePool<rosgraph_msgs::Clock> clock_pool_;
+  MessagePool<std_msgs::Float32> float32_pool_;
+  MessagePool<std_msgs::Bool> bool_pool_;
+
+  // Serialized messages, frame ids fixed, one TF batch per set of frames
+  SerializedTemplate<geometry_msgs::PoseStamped> est_pose_template_;
+  SerializedTemplate<geometry_msgs::PoseStamped> des_pose_template_;
+  SerializedTemplate<geometry_msgs::PoseStamped> sim_gt_pose_template_;
+  SerializedTemplate<geometry_msgs::Twist> vel_template_;
+  SerializedTemplate<nav_msgs::Odometry> odom_template_;
+  SerializedTemplate<tf2_msgs::TFMessage> tf_templates_[1 << NUM_TF_FRAMES];
+
+  // Batches are sized once and filled in place
+  snav_ros::ImuBatch imu_batch_msg_;
+  snav_ros::EscBatch esc_batch_msg_;
+  size_t imu_batch_fill_;
+  size_t esc_batch_fill_;
+
+  std::unique_ptr<CompactStateEncoder> compact_state_encoder_;
+  SharedStateWriter shared_state_writer_;
+  SharedState shared_state_;
+  snav_ros::CompactState compact_state_msg_;
   geometry_msgs::PoseStamped est_pose_msg_;
+  nav_msgs::Odometry est_odom_msg_;
   geometry_msgs::PoseStamped des_pose_msg_;
   geometry_msgs::PoseStamped sim_gt_pose_msg_;
   geometry_msgs::TransformStamped est_transform_msg_;
@@ -232,18 +575,53 @@ private:
   geometry_msgs::TransformStamped base_link_stab_transform_msg_;
   geometry_msgs::TransformStamped base_link_no_rot_transform_msg_;
 
-  geometry_msgs::Twist generic_command_;
+  SnavCommandEngine command_engine_;
+  bool traj_replace_;
+
+  FlightRecordReader replay_reader_;
+  SnavAcquisition acquisition_;
+  FlightRecorder flight_recorder_;
+  SnavSnapshot snapshot_;
 
-  SnavCachedData *cached_data_;
+  // Every rotation derived from snapshot_, computed once per snapshot by
+  // whichever of UpdatePoseMessages/UpdateSimMessages runs first
+  SnavFrames frames_;
+  bool frames_stale_;
 
   bool valid_rotation_est_;
   bool valid_rotation_sim_gt_;
 
-  ros::Time last_sn_update_;
-  ros::Time last_gen_command_time_;
-  ros::Time last_traj_command_time_;
 
-  int64_t dsp_offset_in_ns_;
+  DspClockSync clock_sync_;
+
+  // Faults of the publish path, logged once per fault_summary_period
+  FaultMonitor faults_;
+  double fault_summary_period_;
+
+  // Sample tracking, used to skip cycles where snav has nothing new
+  int64_t last_est_sample_time_;
+  int64_t last_sim_sample_time_;
+  bool new_est_sample_;
+  bool new_sim_sample_;
+  uint32_t snapshot_sequence_;
+  ros::Time sim_time_;
+
+  // Lockstep simulation: each simulator step is held by the acquisition
+  // thread until it has been published and, with lockstep_ack_count_ > 0,
+  // acknowledged by that many distinct lockstep_ack publishers
+  bool lockstep_;
+  int lockstep_ack_count_;
+  double lockstep_ack_timeout_;
+  ros::CallbackQueue lockstep_ack_queue_;
+  bool lockstep_awaiting_ack_;
+  uint32_t lockstep_sequence_;
+  ros::Time lockstep_step_time_;
+  std::vector<std::string> lockstep_ackers_;
+  std::atomic<uint64_t> lockstep_steps_;
+  std::atomic<uint64_t> lockstep_ack_timeouts_;
+
+  double max_sample_wait_;
+  double rpc_timeout_;
 
   // Params
   std::string gps_enu_frame_;
@@ -258,6 +636,57 @@ private:
   SnRcCommandOptions rc_cmd_mapping_;
 
   bool simulation_;
+  bool replaying_;
+  bool replay_exit_on_end_;
+  bool replay_end_reported_;
+
+  bool publish_on_new_sample_;
+  bool publish_est_data_;
+  bool publish_sim_data_;
+  bool broadcast_tf_;
+  bool broadcast_des_tf_;
+  bool broadcast_gps_tf_;
+  bool broadcast_sim_gt_tf_;
+  bool publish_pose_;
+  bool publish_des_pose_;
+  bool publish_sim_gt_pose_;
+  bool publish_compact_state_;
+  bool publish_vel_;
+  bool publish_odom_;
+  // Odometry twist in base_link_frame_ (REP 105) or in estimation_frame_
+  bool odom_twist_in_body_;
+  bool lazy_outputs_;
+  std::atomic<uint32_t> active_outputs_;
+  // Per-output rates, on the monotonic clock or, in lockstep and replay,
+  // on /clock
+  static const char* kOutputNames[NUM_OUTPUTS];
+  OutputScheduler output_scheduler_;
+  bool zero_copy_;
+  bool preserialize_;
+
+  ThreadPolicy acquisition_policy_;
+  ThreadPolicy publish_policy_;
+  ThreadPolicy command_policy_;
+  bool lock_memory_;
+  int prefault_heap_mb_;
+  int prefault_stack_kb_;
+  bool drop_privileges_;
+  std::string run_as_user_;
+  RealtimeSetup realtime_;
+  // set once realtime_ is complete and may be read by diagnostics
+  std::atomic<bool> realtime_applied_;
+
+  ros::WallDuration loop_period_;
+  // Without publish_on_new_sample_, CLOCK_MONOTONIC deadline of the next
+  // cycle and how long after an expected sample cycles are placed
+  int64_t next_cycle_ns_;
+  int64_t loop_phase_margin_ns_;
+
+  bool profiling_;
+  static const char* kProfileStageNames[NUM_PROFILE_STAGES];
+  LatencyHistogram profile_[NUM_PROFILE_STAGES];
+  std::atomic<uint64_t> loop_overruns_;
+  std::atomic<uint64_t> loop_deadline_misses_;
 };
 
 #endif
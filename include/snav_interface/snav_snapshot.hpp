@@ -0,0 +1,127 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _SNAV_SNAPSHOT_H_
+#define _SNAV_SNAPSHOT_H_
+
+#include <cstring>
+#include <stdint.h>
+
+#include <snav/snapdragon_navigator.h>
+
+/**
+ * Compact copy of the SnavCachedData fields used by SnavInterface.
+ *
+ * Member names mirror SnavCachedData so conversion code reads the same
+ * whether it works on the cached data or on a snapshot.
+ */
+struct SnavSnapshot
+{
+  // CLOCK_MONOTONIC time the RPC that produced this snapshot completed [ns]
+  int64_t acquired_time_ns;
+
+  struct
+  {
+    float rotation_matrix[9];
+  } attitude_estimate;
+
+  struct
+  {
+    int64_t time;
+    float position_estimated[3];
+    float velocity_estimated[3];
+    float position_desired[3];
+    float yaw_desired;
+    float R_eg[9];
+    float t_eg[3];
+  } pos_vel;
+
+  struct
+  {
+    float ang_vel[3];
+  } imu_0_compensated;
+
+  struct
+  {
+    int64_t time;
+    float position[3];
+    float R[9];
+  } sim_ground_truth;
+
+  struct
+  {
+    int64_t time;
+    float voltage;
+    int on_ground;
+    int props_state;
+  } general_status;
+};
+
+/**
+ * Copy the fields SnavInterface uses out of the snav cached data.
+ * @param data
+ *   cached data freshly updated by sn_update_data()
+ * @param snapshot
+ *   destination
+ */
+inline void FillSnapshot(const SnavCachedData& data, SnavSnapshot& snapshot)
+{
+  std::memcpy(snapshot.attitude_estimate.rotation_matrix,
+      data.attitude_estimate.rotation_matrix, sizeof(snapshot.attitude_estimate.rotation_matrix));
+
+  snapshot.pos_vel.time = data.pos_vel.time;
+  std::memcpy(snapshot.pos_vel.position_estimated,
+      data.pos_vel.position_estimated, sizeof(snapshot.pos_vel.position_estimated));
+  std::memcpy(snapshot.pos_vel.velocity_estimated,
+      data.pos_vel.velocity_estimated, sizeof(snapshot.pos_vel.velocity_estimated));
+  std::memcpy(snapshot.pos_vel.position_desired,
+      data.pos_vel.position_desired, sizeof(snapshot.pos_vel.position_desired));
+  snapshot.pos_vel.yaw_desired = data.pos_vel.yaw_desired;
+  std::memcpy(snapshot.pos_vel.R_eg, data.pos_vel.R_eg, sizeof(snapshot.pos_vel.R_eg));
+  std::memcpy(snapshot.pos_vel.t_eg, data.pos_vel.t_eg, sizeof(snapshot.pos_vel.t_eg));
+
+  std::memcpy(snapshot.imu_0_compensated.ang_vel,
+      data.imu_0_compensated.ang_vel, sizeof(snapshot.imu_0_compensated.ang_vel));
+
+  snapshot.sim_ground_truth.time = data.sim_ground_truth.time;
+  std::memcpy(snapshot.sim_ground_truth.position,
+      data.sim_ground_truth.position, sizeof(snapshot.sim_ground_truth.position));
+  std::memcpy(snapshot.sim_ground_truth.R, data.sim_ground_truth.R, sizeof(snapshot.sim_ground_truth.R));
+
+  snapshot.general_status.time = data.general_status.time;
+  snapshot.general_status.voltage = data.general_status.voltage;
+  snapshot.general_status.on_ground = data.general_status.on_ground;
+  snapshot.general_status.props_state = data.general_status.props_state;
+}
+
+#endif
@@ -0,0 +1,95 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _SNAV_TRAJECTORY_H_
+#define _SNAV_TRAJECTORY_H_
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Time-stamped batch of trajectory setpoints executed on-board by
+ * SnavCommandEngine.
+ */
+class SnavTrajectory
+{
+public:
+  struct Sample
+  {
+    // ROS time of the setpoint [ns]
+    int64_t time_ns;
+    float position[3];
+    float velocity[3];
+    float acceleration[3];
+    float yaw;
+    float yaw_rate;
+  };
+
+  SnavTrajectory() : received_ns(0), stamp_ns(0) {}
+
+  /**
+   * Evaluate the trajectory at a given time. Position and yaw use cubic
+   * Hermite interpolation with the sample velocities and yaw rates, whose
+   * derivatives give velocity and yaw rate; acceleration is interpolated
+   * linearly. Before the first
+   * sample the first one is held and after the last sample the last
+   * position is held with zero velocity and acceleration.
+   * @param time_ns
+   *   ROS time to evaluate at [ns]
+   * @param cursor
+   *   index of the segment used last time, speeds up monotonic evaluation;
+   *   start at 0
+   * @param out
+   *   interpolated setpoint
+   * @return false if time_ns is past the last sample (underrun)
+   */
+  bool Evaluate(int64_t time_ns, size_t& cursor, Sample& out) const;
+
+  /**
+   * @return ROS time of the last sample [ns], 0 if empty
+   */
+  int64_t GetEndTime() const
+  {
+    return samples.empty() ? 0 : samples.back().time_ns;
+  }
+
+  std::vector<Sample> samples;
+
+  // CLOCK_MONOTONIC time the batch was received [ns]
+  int64_t received_ns;
+  // ROS time the batch was stamped with by its sender [ns]
+  int64_t stamp_ns;
+};
+
+#endif
@@ -0,0 +1,171 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#ifndef _TELEMETRY_STREAM_H_
+#define _TELEMETRY_STREAM_H_
+
+#include <atomic>
+#include <stdint.h>
+
+#include "snav_interface/spsc_ring.hpp"
+
+/**
+ * Carries every new sample of one snav telemetry field (IMU, ESC) from the
+ * acquisition thread to the publisher.
+ *
+ * snav only exposes the latest sample of a field, so each RPC offers it
+ * here and the field's counter tells new samples from repeated reads and
+ * from samples that were never seen. Sample must have int64_t time and
+ * uint32_t cntr members.
+ */
+template <typename Sample>
+class TelemetryStream
+{
+public:
+  struct Entry
+  {
+    Sample sample;
+    // Samples lost right before this one, by snav or by a full queue
+    uint32_t dropped;
+    // Reads of an already queued sample since the previous entry
+    uint32_t duplicates;
+  };
+
+  struct Stats
+  {
+    uint64_t samples;
+    uint64_t dropped;
+    uint64_t duplicates;
+  };
+
+  /**
+   * @param capacity
+   *   samples queued for the publisher before new ones are dropped
+   */
+  explicit TelemetryStream(size_t capacity)
+    : ring_(capacity),
+      enabled_(false),
+      last_counter_(0),
+      has_last_(false),
+      pending_dropped_(0),
+      pending_duplicates_(0),
+      samples_(0),
+      dropped_(0),
+      duplicates_(0)
+  {
+  }
+
+  /**
+   * Enable the stream. Call before the acquisition thread starts.
+   */
+  void SetEnabled(bool enabled) { enabled_ = enabled; }
+  bool IsEnabled() const { return enabled_; }
+
+  /**
+   * Producer side, called after every successful RPC.
+   * @param sample
+   *   current value of the field
+   */
+  void Offer(const Sample& sample)
+  {
+    if (sample.time == 0)
+      return;
+
+    if (has_last_ && sample.cntr == last_counter_)
+    {
+      ++pending_duplicates_;
+      duplicates_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    // A counter that went backwards means snav restarted, not a gap
+    if (has_last_ && sample.cntr > last_counter_)
+    {
+      uint32_t gap = sample.cntr - last_counter_ - 1;
+      pending_dropped_ += gap;
+      dropped_.fetch_add(gap, std::memory_order_relaxed);
+    }
+    has_last_ = true;
+    last_counter_ = sample.cntr;
+
+    Entry entry;
+    entry.sample = sample;
+    entry.dropped = pending_dropped_;
+    entry.duplicates = pending_duplicates_;
+    if (ring_.TryPush(entry))
+    {
+      pending_dropped_ = 0;
+      pending_duplicates_ = 0;
+      samples_.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+      ++pending_dropped_;
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Consumer side.
+   * @return false if no sample is queued
+   */
+  bool Pop(Entry& entry) { return ring_.TryPop(entry); }
+
+  /**
+   * @return counters for diagnostics
+   */
+  Stats GetStats() const
+  {
+    Stats stats;
+    stats.samples = samples_.load(std::memory_order_relaxed);
+    stats.dropped = dropped_.load(std::memory_order_relaxed);
+    stats.duplicates = duplicates_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+private:
+  SpscRing<Entry> ring_;
+  bool enabled_;
+
+  // Only touched by the producer
+  uint32_t last_counter_;
+  bool has_last_;
+  uint32_t pending_dropped_;
+  uint32_t pending_duplicates_;
+
+  std::atomic<uint64_t> samples_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> duplicates_;
+};
+
+#endif
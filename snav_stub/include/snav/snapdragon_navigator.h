@@ -0,0 +1,216 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+/*
+ * Hardware-free stand-in for the Snapdragon Navigator API.
+ *
+ * Declares only the subset of snapdragon_navigator.h that snav_interface
+ * uses. It is source compatible with that subset, not ABI compatible with
+ * snav_arm, and is selected with -DSNAV_STUB=ON.
+ */
+#ifndef _SNAPDRAGON_NAVIGATOR_H_
+#define _SNAPDRAGON_NAVIGATOR_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+  SN_RC_RATES_CMD,
+  SN_RC_THRUST_ANGLE_CMD,
+  SN_RC_ALT_HOLD_CMD,
+  SN_RC_THRUST_ANGLE_GPS_HOVER_CMD,
+  SN_RC_GPS_POS_HOLD_CMD,
+  SN_RC_OPTIC_FLOW_POS_HOLD_CMD,
+  SN_RC_VIO_POS_HOLD_CMD,
+  SN_RC_ALT_HOLD_LOW_ANGLE_CMD,
+  SN_RC_POS_HOLD_CMD,
+  SN_RC_NUM_CMD_TYPES
+} SnRcCommandType;
+
+typedef enum
+{
+  RC_OPT_LINEAR_MAPPING = 0,
+  RC_OPT_ENABLE_DEADBAND = 1,
+  RC_OPT_COMPLIANT_TRACKING = 2,
+  RC_OPT_DEFAULT_RC = 3,
+  RC_OPT_TRIGGER_LANDING = 4
+} SnRcCommandOptions;
+
+typedef enum
+{
+  SN_PROPS_STATE_UNKNOWN = -1,
+  SN_PROPS_STATE_NOT_SPINNING = 0,
+  SN_PROPS_STATE_STARTING = 1,
+  SN_PROPS_STATE_SPINNING = 2
+} SnPropsState;
+
+typedef enum
+{
+  SN_POSITION_CONTROL_VIO
+} SnPositionControlType;
+
+typedef enum
+{
+  SN_TRAJ_DEFAULT
+} SnTrajectoryOptions;
+
+typedef struct
+{
+  int64_t time;
+  float rotation_matrix[9];
+} SnAttitudeEstimate;
+
+typedef struct
+{
+  int64_t time;
+  float position_estimated[3];
+  float velocity_estimated[3];
+  float yaw_estimated;
+  float position_desired[3];
+  float velocity_desired[3];
+  float yaw_desired;
+  float R_eg[9];
+  float t_eg[3];
+} SnPosVel;
+
+typedef struct
+{
+  int64_t time;
+  float temp;
+  float lin_acc[3];
+  float ang_vel[3];
+  uint32_t cntr;
+} SnImuComp;
+
+typedef struct
+{
+  int64_t time;
+  float position[3];
+  float velocity[3];
+  float R[9];
+  float ang_vel[3];
+} SnSimGroundTruth;
+
+typedef struct
+{
+  int64_t time;
+  float voltage;
+  float current;
+  int on_ground;
+  int props_state;
+} SnGeneralStatus;
+
+typedef struct
+{
+  int64_t time;
+  uint32_t cntr;
+  int16_t rpm[8];
+  int8_t power[8];
+  float voltage[8];
+  float current[8];
+  int8_t temperature[8];
+  uint32_t packet_cntr[8];
+} SnEscRawData;
+
+typedef struct
+{
+  SnAttitudeEstimate attitude_estimate;
+  SnPosVel pos_vel;
+  SnImuComp imu_0_compensated;
+  SnSimGroundTruth sim_ground_truth;
+  SnGeneralStatus general_status;
+  SnEscRawData esc_raw;
+} SnavCachedData;
+
+int sn_get_flight_data_ptr(int size, SnavCachedData **ptr);
+int sn_update_data(void);
+int sn_apply_cmd_mapping(SnRcCommandType type, SnRcCommandOptions options,
+    float rc_x, float rc_y, float rc_z, float rc_yaw,
+    float *cmd0, float *cmd1, float *cmd2, float *cmd3);
+int sn_send_rc_command(SnRcCommandType type, SnRcCommandOptions options,
+    float cmd0, float cmd1, float cmd2, float cmd3);
+int sn_send_trajectory_tracking_command(SnPositionControlType type,
+    SnTrajectoryOptions options, float x, float y, float z,
+    float vx, float vy, float vz, float ax, float ay, float az,
+    float yaw, float yaw_rate);
+int sn_spin_props(void);
+int sn_stop_props(void);
+
+/**
+ * Stub only: configure the simulated RPC. Every field also has an
+ * environment variable override read on first use (see snav_stub.cpp).
+ */
+typedef struct
+{
+  // Mean and uniform jitter of the sn_update_data() duration
+  double rpc_latency;
+  double rpc_jitter;
+  // Probability that sn_update_data() returns an error
+  double failure_rate;
+  // Rate at which new estimator samples appear
+  double sample_rate;
+  // Nonzero: every successful sn_update_data() advances the simulated time
+  // by one sample period instead of following the wall clock, like a
+  // simulator stepped by its client
+  int stepped;
+} SnStubConfig;
+
+void sn_stub_configure(const SnStubConfig *config);
+
+/**
+ * Stub only: what was last commanded, for tests
+ */
+typedef struct
+{
+  // sn_send_rc_command() calls and the arguments of the last one
+  unsigned long long rc_commands;
+  SnRcCommandType rc_type;
+  SnRcCommandOptions rc_options;
+  float rc_cmd[4];
+  // sn_send_trajectory_tracking_command() calls and the last setpoint
+  unsigned long long traj_commands;
+  float traj_position[3];
+  float traj_yaw;
+} SnStubCommands;
+
+void sn_stub_get_commands(SnStubCommands *commands);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
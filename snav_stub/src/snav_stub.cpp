@@ -0,0 +1,373 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+/*
+ * Hardware-free implementation of the snav API subset declared in
+ * snav_stub/include/snav/snapdragon_navigator.h.
+ *
+ * The vehicle flies a level circle with a small roll/pitch wobble so every
+ * transform snav_interface produces is non-trivial. Samples are quantized to
+ * the configured sample rate, so repeated sn_update_data() calls within one
+ * sample period return duplicates exactly like the DSP does.
+ *
+ * Environment overrides, read on first use:
+ *   SNAV_STUB_RPC_LATENCY   mean sn_update_data() duration [s]
+ *   SNAV_STUB_RPC_JITTER    uniform jitter on that duration [s]
+ *   SNAV_STUB_FAILURE_RATE  probability sn_update_data() fails [0-1]
+ *   SNAV_STUB_SAMPLE_RATE   estimator sample rate [Hz]
+ *   SNAV_STUB_STEPPED       nonzero: one sample per sn_update_data() call
+ */
+#include <snav/snapdragon_navigator.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mutex>
+#include <random>
+
+namespace
+{
+
+const float kCircleRadius = 1.0;
+const float kCircleRate = 0.5;
+const float kAltitude = 1.0;
+const float kWobbleAmplitude = 0.05;
+const float kWobbleRate = 3.0;
+
+struct StubState
+{
+  StubState()
+    : configured(false),
+      rng(12345),
+      props_state(SN_PROPS_STATE_NOT_SPINNING),
+      traj_valid(false),
+      rc_type(SN_RC_POS_HOLD_CMD),
+      rc_options(RC_OPT_LINEAR_MAPPING),
+      rc_commands(0),
+      traj_commands(0)
+  {
+    memset(&data, 0, sizeof(data));
+    memset(traj_position, 0, sizeof(traj_position));
+    memset(rc_cmd, 0, sizeof(rc_cmd));
+    traj_yaw = 0;
+    config.rpc_latency = 0.0005;
+    config.rpc_jitter = 0.0002;
+    config.failure_rate = 0.0;
+    config.sample_rate = 500.0;
+    config.stepped = 0;
+  }
+
+  std::mutex mutex;
+  bool configured;
+  SnStubConfig config;
+  std::mt19937 rng;
+  SnavCachedData data;
+
+  int props_state;
+  bool traj_valid;
+  float traj_position[3];
+  float traj_yaw;
+  SnRcCommandType rc_type;
+  SnRcCommandOptions rc_options;
+  float rc_cmd[4];
+  unsigned long long rc_commands;
+  unsigned long long traj_commands;
+};
+
+StubState& State()
+{
+  static StubState state;
+  return state;
+}
+
+void ReadEnv(const char* name, double& value)
+{
+  const char* str = getenv(name);
+  if (str != NULL)
+    value = atof(str);
+}
+
+void ReadEnv(const char* name, int& value)
+{
+  const char* str = getenv(name);
+  if (str != NULL)
+    value = atoi(str);
+}
+
+// Must be called with the state mutex held
+void ConfigureFromEnv(StubState& state)
+{
+  if (state.configured)
+    return;
+  ReadEnv("SNAV_STUB_RPC_LATENCY", state.config.rpc_latency);
+  ReadEnv("SNAV_STUB_RPC_JITTER", state.config.rpc_jitter);
+  ReadEnv("SNAV_STUB_FAILURE_RATE", state.config.failure_rate);
+  ReadEnv("SNAV_STUB_SAMPLE_RATE", state.config.sample_rate);
+  ReadEnv("SNAV_STUB_STEPPED", state.config.stepped);
+  state.configured = true;
+}
+
+int64_t NowUs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+void SleepSeconds(double seconds)
+{
+  if (seconds <= 0)
+    return;
+  struct timespec ts;
+  ts.tv_sec = (time_t)seconds;
+  ts.tv_nsec = (long)((seconds - ts.tv_sec)*1e9);
+  clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+}
+
+// Row-major R = Rz(yaw) * Ry(pitch) * Rx(roll)
+void RotationFromEuler(float roll, float pitch, float yaw, float R[9])
+{
+  float cr = cosf(roll), sr = sinf(roll);
+  float cp = cosf(pitch), sp = sinf(pitch);
+  float cy = cosf(yaw), sy = sinf(yaw);
+  R[0] = cy*cp; R[1] = cy*sp*sr - sy*cr; R[2] = cy*sp*cr + sy*sr;
+  R[3] = sy*cp; R[4] = sy*sp*sr + cy*cr; R[5] = sy*sp*cr - cy*sr;
+  R[6] = -sp;   R[7] = cp*sr;            R[8] = cp*cr;
+}
+
+// Must be called with the state mutex held
+void Synthesize(StubState& state, int64_t time_us)
+{
+  SnavCachedData& d = state.data;
+  float t = time_us*1e-6;
+  float phase = kCircleRate*t;
+  float yaw = remainderf(phase + M_PI/2, 2*M_PI);
+  float roll = kWobbleAmplitude*sinf(kWobbleRate*t);
+  float pitch = kWobbleAmplitude*cosf(kWobbleRate*t);
+
+  d.attitude_estimate.time = time_us;
+  RotationFromEuler(roll, pitch, yaw, d.attitude_estimate.rotation_matrix);
+
+  SnPosVel& pv = d.pos_vel;
+  pv.time = time_us;
+  pv.position_estimated[0] = kCircleRadius*cosf(phase);
+  pv.position_estimated[1] = kCircleRadius*sinf(phase);
+  pv.position_estimated[2] = kAltitude;
+  pv.velocity_estimated[0] = -kCircleRadius*kCircleRate*sinf(phase);
+  pv.velocity_estimated[1] = kCircleRadius*kCircleRate*cosf(phase);
+  pv.velocity_estimated[2] = 0;
+  pv.yaw_estimated = yaw;
+  if (state.traj_valid)
+  {
+    memcpy(pv.position_desired, state.traj_position, sizeof(pv.position_desired));
+    pv.yaw_desired = state.traj_yaw;
+  }
+  else
+  {
+    memcpy(pv.position_desired, pv.position_estimated, sizeof(pv.position_desired));
+    pv.yaw_desired = yaw;
+  }
+  memcpy(pv.velocity_desired, pv.velocity_estimated, sizeof(pv.velocity_desired));
+  // Small fixed rotation and offset between the estimation and GPS frames
+  RotationFromEuler(0, 0, 0.1, pv.R_eg);
+  pv.t_eg[0] = 10.0;
+  pv.t_eg[1] = -5.0;
+  pv.t_eg[2] = 0.0;
+
+  SnImuComp& imu = d.imu_0_compensated;
+  imu.time = time_us;
+  imu.temp = 40.0;
+  imu.lin_acc[0] = 0;
+  imu.lin_acc[1] = 0;
+  imu.lin_acc[2] = 9.81;
+  imu.ang_vel[0] = kWobbleAmplitude*kWobbleRate*cosf(kWobbleRate*t);
+  imu.ang_vel[1] = -kWobbleAmplitude*kWobbleRate*sinf(kWobbleRate*t);
+  imu.ang_vel[2] = kCircleRate;
+  imu.cntr++;
+
+  // Ground truth leads the estimate by a few centimeters of drift
+  SnSimGroundTruth& gt = d.sim_ground_truth;
+  gt.time = time_us;
+  for (int i = 0; i < 3; ++i)
+  {
+    gt.position[i] = pv.position_estimated[i] + 0.02*sinf(0.1*t + i);
+    gt.velocity[i] = pv.velocity_estimated[i];
+    gt.ang_vel[i] = imu.ang_vel[i];
+  }
+  memcpy(gt.R, d.attitude_estimate.rotation_matrix, sizeof(gt.R));
+
+  SnGeneralStatus& status = d.general_status;
+  status.time = time_us;
+  status.voltage = 12.6 - 0.0005*fmodf(t, 3600);
+  status.current = state.props_state == SN_PROPS_STATE_SPINNING ? 8.0 : 0.3;
+  status.on_ground = state.props_state == SN_PROPS_STATE_SPINNING ? 0 : 1;
+  status.props_state = state.props_state;
+
+  SnEscRawData& esc = d.esc_raw;
+  esc.time = time_us;
+  esc.cntr++;
+  for (int i = 0; i < 4; ++i)
+  {
+    esc.rpm[i] = state.props_state == SN_PROPS_STATE_SPINNING ? 8000 : 0;
+    esc.voltage[i] = status.voltage;
+    esc.packet_cntr[i] = esc.cntr;
+  }
+}
+
+}  // namespace
+
+extern "C" {
+
+int sn_get_flight_data_ptr(int size, SnavCachedData **ptr)
+{
+  if (ptr == NULL || size != (int)sizeof(SnavCachedData))
+    return -1;
+  *ptr = &State().data;
+  return 0;
+}
+
+int sn_update_data(void)
+{
+  StubState& state = State();
+  double latency;
+  bool fail;
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    ConfigureFromEnv(state);
+    std::uniform_real_distribution<double> jitter(-1.0, 1.0);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    latency = state.config.rpc_latency + state.config.rpc_jitter*jitter(state.rng);
+    fail = unit(state.rng) < state.config.failure_rate;
+  }
+
+  SleepSeconds(latency);
+  if (fail)
+    return -1;
+
+  std::lock_guard<std::mutex> lock(state.mutex);
+  int64_t period_us = state.config.sample_rate > 0 ?
+      (int64_t)(1e6/state.config.sample_rate) : 1;
+  // Stepped time starts at the first period so it is never mistaken for
+  // the zeroed cached data
+  int64_t sample_time = state.config.stepped ? state.data.pos_vel.time + period_us :
+      NowUs()/period_us*period_us;
+  if (sample_time != state.data.pos_vel.time)
+    Synthesize(state, sample_time);
+  return 0;
+}
+
+int sn_apply_cmd_mapping(SnRcCommandType type, SnRcCommandOptions options,
+    float rc_x, float rc_y, float rc_z, float rc_yaw,
+    float *cmd0, float *cmd1, float *cmd2, float *cmd3)
+{
+  if (cmd0 == NULL || cmd1 == NULL || cmd2 == NULL || cmd3 == NULL)
+    return -1;
+  *cmd0 = rc_x;
+  *cmd1 = rc_y;
+  *cmd2 = rc_z;
+  *cmd3 = rc_yaw;
+  return 0;
+}
+
+int sn_send_rc_command(SnRcCommandType type, SnRcCommandOptions options,
+    float cmd0, float cmd1, float cmd2, float cmd3)
+{
+  StubState& state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.rc_type = type;
+  state.rc_options = options;
+  ++state.rc_commands;
+  state.rc_cmd[0] = cmd0;
+  state.rc_cmd[1] = cmd1;
+  state.rc_cmd[2] = cmd2;
+  state.rc_cmd[3] = cmd3;
+  state.traj_valid = false;
+  return 0;
+}
+
+int sn_send_trajectory_tracking_command(SnPositionControlType type,
+    SnTrajectoryOptions options, float x, float y, float z,
+    float vx, float vy, float vz, float ax, float ay, float az,
+    float yaw, float yaw_rate)
+{
+  StubState& state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.traj_valid = true;
+  ++state.traj_commands;
+  state.traj_position[0] = x;
+  state.traj_position[1] = y;
+  state.traj_position[2] = z;
+  state.traj_yaw = yaw;
+  return 0;
+}
+
+int sn_spin_props(void)
+{
+  StubState& state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.props_state = SN_PROPS_STATE_SPINNING;
+  return 0;
+}
+
+int sn_stop_props(void)
+{
+  StubState& state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.props_state = SN_PROPS_STATE_NOT_SPINNING;
+  return 0;
+}
+
+void sn_stub_configure(const SnStubConfig *config)
+{
+  StubState& state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.config = *config;
+  state.configured = true;
+}
+
+void sn_stub_get_commands(SnStubCommands *commands)
+{
+  StubState& state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  commands->rc_commands = state.rc_commands;
+  commands->rc_type = state.rc_type;
+  commands->rc_options = state.rc_options;
+  memcpy(commands->rc_cmd, state.rc_cmd, sizeof(commands->rc_cmd));
+  commands->traj_commands = state.traj_commands;
+  memcpy(commands->traj_position, state.traj_position, sizeof(commands->traj_position));
+  commands->traj_yaw = state.traj_yaw;
+}
+
+}
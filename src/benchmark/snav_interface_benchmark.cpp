@@ -0,0 +1,412 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+/*
+ * Microbenchmark of the SnavInterface publish path.
+ *
+ * Times UpdatePoseMessages, UpdateSimMessages, every Broadcast and Publish
+ * call and a full RunOnce() iteration with no, some and all outputs
+ * subscribed, and prints count/mean/p50/p99/max per stage. Built against
+ * the snav stub (-DSNAV_STUB=ON) it runs on any Linux box with a roscore;
+ * the stub's RPC can be shaped through the SNAV_STUB_* environment
+ * variables.
+ *
+ * With --check it instead verifies that patched serialized templates match
+ * full serialization byte for byte, and exits non-zero on a mismatch. This
+ * needs no roscore. The frame kernel is checked against tf2 by the
+ * test_frame_kernel unit test.
+ *
+ * Usage: snav_interface_benchmark [--iterations N] [--check]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <functional>
+
+#include <tf2/LinearMath/Matrix3x3.h>
+#include <tf2/LinearMath/Quaternion.h>
+#include <tf2/LinearMath/Transform.h>
+
+#include "snav_interface/clock_utils.hpp"
+#include "snav_interface/frame_kernel.hpp"
+#include "snav_interface/latency_histogram.hpp"
+#include "snav_interface/serialized_template.hpp"
+#include "snav_interface/snav_interface.hpp"
+
+namespace
+{
+
+struct Options
+{
+  Options() : iterations(10000), check(false) {}
+  int iterations;
+  bool check;
+};
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+      options.iterations = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--check") == 0)
+      options.check = true;
+    else
+    {
+      fprintf(stderr, "Usage: %s [--iterations N] [--check]\n", argv[0]);
+      return false;
+    }
+  }
+  return options.iterations > 0;
+}
+
+void PrintHeader()
+{
+  printf("%-28s %10s %10s %10s %10s %10s\n",
+      "stage", "count", "mean_us", "p50_us", "p99_us", "max_us");
+}
+
+/**
+ * Run body() iterations times, timing each call, and run reset() untimed
+ * after each call so queued state does not grow between iterations.
+ */
+template <typename Body, typename Reset>
+void Measure(const char* name, int iterations, Body body, Reset reset)
+{
+  LatencyHistogram histogram;
+  int64_t total_ns = 0;
+  for (int i = 0; i < iterations; ++i)
+  {
+    int64_t start_ns = MonotonicNowNs();
+    body();
+    int64_t duration_ns = MonotonicNowNs() - start_ns;
+    histogram.Record(duration_ns);
+    total_ns += duration_ns;
+    reset();
+  }
+
+  LatencyHistogram::Summary summary = histogram.Collect();
+  printf("%-28s %10llu %10.2f %10.2f %10.2f %10.2f\n", name,
+      (unsigned long long)summary.count, total_ns/1e3/iterations,
+      summary.p50*1e6, summary.p99*1e6, summary.max*1e6);
+}
+
+template <typename Body>
+void Measure(const char* name, int iterations, Body body)
+{
+  Measure(name, iterations, body, [](){});
+}
+
+template <typename M>
+void Discard(const boost::shared_ptr<M const>& msg)
+{
+}
+
+// Rotations of every frame computed the way UpdatePosVelMessages and
+// UpdateSimMessages did before the frame kernel
+struct ReferenceFrames
+{
+  tf2::Quaternion est, no_rot, stab, des, gps_enu, sim, sim_inv;
+  tf2::Vector3 sim_inv_translation;
+};
+
+tf2::Matrix3x3 ToMatrix(const float* R)
+{
+  return tf2::Matrix3x3(R[0], R[1], R[2], R[3], R[4], R[5], R[6], R[7], R[8]);
+}
+
+void ComputeReferenceFrames(const SnavSnapshot& snapshot, ReferenceFrames& ref)
+{
+  ToMatrix(snapshot.attitude_estimate.rotation_matrix).getRotation(ref.est);
+
+  tf2::Quaternion q_des;
+  q_des.setEuler(0.0, 0.0, snapshot.pos_vel.yaw_desired);
+  ref.des = tf2::Transform(q_des).getRotation();
+
+  ref.gps_enu = tf2::Transform(ToMatrix(snapshot.pos_vel.R_eg)).getRotation();
+
+  tf2::Matrix3x3 RR_est(ref.est);
+  tf2Scalar roll, pitch, yaw;
+  RR_est.getRPY(roll, pitch, yaw);
+  ref.no_rot = tf2::Transform(RR_est.inverse()).getRotation();
+  tf2::Matrix3x3 RR_yaw;
+  RR_yaw.setRPY(0, 0, yaw);
+  ref.stab = tf2::Transform(RR_yaw).getRotation();
+
+  tf2::Quaternion q_sim;
+  ToMatrix(snapshot.sim_ground_truth.R).getRotation(q_sim);
+  tf2::Transform sim_gt_tf(q_sim, tf2::Vector3(snapshot.sim_ground_truth.position[0],
+        snapshot.sim_ground_truth.position[1], snapshot.sim_ground_truth.position[2]));
+  sim_gt_tf = sim_gt_tf.inverse();
+  ref.sim_inv = sim_gt_tf.getRotation();
+  ref.sim_inv_translation = sim_gt_tf.getOrigin();
+  ref.sim = sim_gt_tf.inverse().getRotation();
+}
+
+void FillRotation(const tf2::Quaternion& q, float* R)
+{
+  tf2::Matrix3x3 M(q);
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      R[3*i + j] = M[i][j];
+}
+
+// What the node serializes per cycle with default outputs: pose, vel and
+// a TF batch of the est, base_link_no_rot and base_link_stab frames. odom
+// replaces pose and vel for consumers that switch to it and is only
+// checked, not timed.
+struct CycleMessages
+{
+  geometry_msgs::PoseStamped pose;
+  geometry_msgs::Twist vel;
+  tf2_msgs::TFMessage tf;
+  nav_msgs::Odometry odom;
+};
+
+struct CycleTemplates
+{
+  SerializedTemplate<geometry_msgs::PoseStamped> pose;
+  SerializedTemplate<geometry_msgs::Twist> vel;
+  SerializedTemplate<tf2_msgs::TFMessage> tf;
+  SerializedTemplate<nav_msgs::Odometry> odom;
+};
+
+void InitCycleMessages(CycleMessages& msgs)
+{
+  msgs.pose.header.frame_id = "/odom";
+  msgs.odom.header.frame_id = "/odom";
+  msgs.odom.child_frame_id = "/base_link";
+  msgs.odom.pose.covariance[0] = 0.01;
+  msgs.odom.twist.covariance[35] = 0.02;
+  const char* frames[][2] = {{"/odom", "/base_link"}, {"/base_link", "/base_link_no_rot"},
+      {"/base_link_no_rot", "/base_link_stab"}};
+  msgs.tf.transforms.resize(3);
+  for (int i = 0; i < 3; ++i)
+  {
+    msgs.tf.transforms[i].header.frame_id = frames[i][0];
+    msgs.tf.transforms[i].child_frame_id = frames[i][1];
+  }
+}
+
+// New numbers and stamps, as every sample brings
+void UpdateCycleMessages(CycleMessages& msgs, int sample)
+{
+  ros::Time stamp;
+  stamp.fromNSec(1500000000000000000LL + sample*2000000LL);
+  double x = sample*1e-3;
+  msgs.pose.header.seq = sample;
+  msgs.pose.header.stamp = stamp;
+  msgs.pose.pose.position.x = x;
+  msgs.pose.pose.position.y = -x;
+  msgs.pose.pose.position.z = 2*x;
+  msgs.pose.pose.orientation.x = 0.1*sin(x);
+  msgs.pose.pose.orientation.w = cos(x);
+  msgs.vel.linear.x = x;
+  msgs.vel.angular.z = -x;
+  msgs.odom.header.seq = sample;
+  msgs.odom.header.stamp = stamp;
+  msgs.odom.pose.pose = msgs.pose.pose;
+  msgs.odom.twist.twist = msgs.vel;
+  for (size_t i = 0; i < msgs.tf.transforms.size(); ++i)
+  {
+    geometry_msgs::TransformStamped& transform = msgs.tf.transforms[i];
+    transform.header.seq = sample + i;
+    transform.header.stamp = stamp;
+    transform.transform.translation.x = x + i;
+    transform.transform.translation.z = x - i;
+    transform.transform.rotation.z = 0.2*sin(x + i);
+    transform.transform.rotation.w = cos(x + i);
+  }
+}
+
+void SerializeFull(const CycleMessages& msgs)
+{
+  ros::serialization::serializeMessage(msgs.pose);
+  ros::serialization::serializeMessage(msgs.vel);
+  ros::serialization::serializeMessage(msgs.tf);
+}
+
+// roscpp sends the patched buffers as they are, so patching is all the
+// serialization a templated publish does
+void SerializeTemplates(const CycleMessages& msgs, CycleTemplates& templates)
+{
+  templates.pose.Patch(msgs.pose);
+  templates.vel.Patch(msgs.vel);
+  templates.tf.Patch(msgs.tf);
+}
+
+template <typename M>
+bool SameBytes(const M& msg, const SerializedTemplate<M>& tmpl)
+{
+  ros::SerializedMessage full = ros::serialization::serializeMessage(msg);
+  ros::SerializedMessage patched = ros::serialization::serializeMessage(tmpl);
+  return full.num_bytes == patched.num_bytes &&
+    memcmp(full.buf.get(), patched.buf.get(), full.num_bytes) == 0;
+}
+
+int RunTemplateCheck(int iterations)
+{
+  CycleMessages msgs;
+  CycleTemplates templates;
+  InitCycleMessages(msgs);
+  UpdateCycleMessages(msgs, 0);
+  templates.pose.Build(msgs.pose);
+  templates.vel.Build(msgs.vel);
+  templates.tf.Build(msgs.tf);
+  templates.odom.Build(msgs.odom);
+
+  int mismatches = 0;
+  for (int i = 1; i <= iterations; ++i)
+  {
+    UpdateCycleMessages(msgs, i);
+    templates.pose.Patch(msgs.pose);
+    templates.vel.Patch(msgs.vel);
+    templates.tf.Patch(msgs.tf);
+    templates.odom.Patch(msgs.odom);
+    if (!SameBytes(msgs.pose, templates.pose) || !SameBytes(msgs.vel, templates.vel) ||
+        !SameBytes(msgs.tf, templates.tf) || !SameBytes(msgs.odom, templates.odom))
+      mismatches++;
+  }
+  printf("%d patched pose, vel, tf and odom templates, %d differ from full serialization, %s\n",
+      iterations, mismatches, mismatches == 0 ? "PASS" : "FAIL");
+  return mismatches == 0 ? 0 : 1;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  ros::init(argc, argv, "snav_interface_benchmark", ros::init_options::AnonymousName);
+
+  Options options;
+  if (!ParseOptions(argc, argv, options))
+    return 1;
+  if (options.check)
+    return RunTemplateCheck(options.iterations);
+
+  ros::NodeHandle nh;
+  ros::NodeHandle pnh("~");
+
+  // Time the publish path itself, not the instrumentation around it
+  if (!pnh.hasParam("enable_profiling"))
+    pnh.setParam("enable_profiling", false);
+
+  SnavInterface sn_iface(nh, pnh);
+
+  // Wait for the acquisition thread to produce a valid sample
+  ros::WallTime give_up = ros::WallTime::now() + ros::WallDuration(5.0);
+  do
+  {
+    sn_iface.SleepUntilNextSample();
+    sn_iface.UpdateSnavData();
+  } while (!sn_iface.NewEstSample() && ros::WallTime::now() < give_up);
+  if (!sn_iface.NewEstSample())
+  {
+    ROS_ERROR("No snav samples within 5 s, aborting benchmark");
+    return 1;
+  }
+  sn_iface.UpdatePoseMessages();
+  sn_iface.UpdateSimMessages();
+
+  const int n = options.iterations;
+  SnavInterface* iface = &sn_iface;
+  std::function<void()> send_tf = [iface](){ iface->SendTfBatch(); };
+
+  PrintHeader();
+  Measure("UpdateSnavData", n, [iface](){ iface->UpdateSnavData(); });
+  // UpdateSnavData() marks the frames stale so each iteration runs the kernel
+  std::function<void()> new_snapshot = [iface](){ iface->UpdateSnavData(); };
+  Measure("UpdatePoseMessages", n, [iface](){ iface->UpdatePoseMessages(); }, new_snapshot);
+  Measure("UpdateSimMessages", n, [iface](){ iface->UpdateSimMessages(); }, new_snapshot);
+  Measure("BroadcastEstTf", n, [iface](){ iface->BroadcastEstTf(); }, send_tf);
+  Measure("BroadcastBaseLinkNoRotTf", n, [iface](){ iface->BroadcastBaseLinkNoRotTf(); }, send_tf);
+  Measure("BroadcastBaseLinkStabTf", n, [iface](){ iface->BroadcastBaseLinkStabTf(); }, send_tf);
+  Measure("BroadcastDesiredTf", n, [iface](){ iface->BroadcastDesiredTf(); }, send_tf);
+  Measure("BroadcastGpsEnuTf", n, [iface](){ iface->BroadcastGpsEnuTf(); }, send_tf);
+  Measure("BroadcastSimGtTf", n, [iface](){ iface->BroadcastSimGtTf(); }, send_tf);
+  Measure("SendTfBatch", n, [iface](){ iface->SendTfBatch(); }, [iface](){
+        iface->BroadcastEstTf();
+        iface->BroadcastBaseLinkNoRotTf();
+        iface->BroadcastBaseLinkStabTf();
+      });
+  Measure("PublishEstPose", n, [iface](){ iface->PublishEstPose(); });
+  Measure("PublishDesiredPose", n, [iface](){ iface->PublishDesiredPose(); });
+  Measure("PublishSimGtPose", n, [iface](){ iface->PublishSimGtPose(); });
+  Measure("PublishEstVel", n, [iface](){ iface->PublishEstVel(); });
+
+  // Lazy outputs: the est path for a consumer of pose and base_link TF only,
+  // against every est output
+  const uint32_t pose_and_tf = SnavInterface::OUTPUT_POSE | SnavInterface::TfOutput(SnavInterface::TF_EST);
+  Measure("UpdatePoseMessages pose+tf", n, [iface, pose_and_tf](){
+        iface->UpdatePoseMessages(pose_and_tf); }, new_snapshot);
+
+  // RunOnce() as subscribers come in; UpdateActiveOutputs() is called
+  // directly since nothing spins the subscriber callbacks here
+  iface->UpdateActiveOutputs();
+  Measure("RunOnce no subscribers", n, [iface](){ iface->RunOnce(); });
+  ros::Subscriber pose_sub = nh.subscribe("pose", 1, &Discard<geometry_msgs::PoseStamped>);
+  ros::Subscriber tf_sub = nh.subscribe("/tf", 1, &Discard<tf2_msgs::TFMessage>);
+  iface->UpdateActiveOutputs();
+  Measure("RunOnce pose+tf", n, [iface](){ iface->RunOnce(); });
+  ros::Subscriber pose_des_sub = nh.subscribe("pose_des", 1, &Discard<geometry_msgs::PoseStamped>);
+  ros::Subscriber vel_sub = nh.subscribe("vel", 1, &Discard<geometry_msgs::Twist>);
+  ros::Subscriber odom_sub = nh.subscribe("odom", 1, &Discard<nav_msgs::Odometry>);
+  iface->UpdateActiveOutputs();
+  Measure("RunOnce all subscribed", n, [iface](){ iface->RunOnce(); });
+
+  SnavSnapshot snapshot;
+  memset(&snapshot, 0, sizeof(snapshot));
+  FillRotation(tf2::Quaternion(0.1, 0.2, 0.3, 0.9).normalized(), snapshot.attitude_estimate.rotation_matrix);
+  FillRotation(tf2::Quaternion(0, 0, 0.1, 1).normalized(), snapshot.pos_vel.R_eg);
+  FillRotation(tf2::Quaternion(0.1, 0.2, 0.3, 0.9).normalized(), snapshot.sim_ground_truth.R);
+  SnavFrames frames;
+  ReferenceFrames ref;
+  Measure("ComputeFrames", n, [&](){ ComputeFrames(snapshot, frames); });
+  Measure("tf2 reference frames", n, [&](){ ComputeReferenceFrames(snapshot, ref); });
+
+  // Serialization of one cycle's messages, in full and from templates
+  CycleMessages msgs;
+  CycleTemplates templates;
+  InitCycleMessages(msgs);
+  UpdateCycleMessages(msgs, 0);
+  templates.pose.Build(msgs.pose);
+  templates.vel.Build(msgs.vel);
+  templates.tf.Build(msgs.tf);
+  int sample = 0;
+  std::function<void()> next_sample = [&](){ UpdateCycleMessages(msgs, ++sample); };
+  Measure("serialize pose+vel+tf", n, [&](){ SerializeFull(msgs); }, next_sample);
+  Measure("template pose+vel+tf", n, [&](){ SerializeTemplates(msgs, templates); }, next_sample);
+
+  return 0;
+}
@@ -0,0 +1,572 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+/*
+ * Subscriber scaling load test of snav_interface_node.
+ *
+ * Starts the node, then for 1..N subscribers runs N separate subscriber
+ * processes, each with its own TCPROS connection to every topic, the way
+ * ground station tools and on-board nodes connect in the field. For each
+ * subscriber count it reports, per topic:
+ *   - the sustained receive rate, lowest and mean over the subscribers
+ *   - delivery latency (receive time - header stamp), worst subscriber
+ *   - messages dropped, from gaps in the header stamps
+ *   - CPU used by the node process, in percent of one core
+ * Topics without a header (vel) only get a rate.
+ *
+ * A subscriber count passes when every subscriber receives every topic at
+ * no less than --pass-rate (default 500 Hz) minus --rate-tolerance (default
+ * 1%) and drops at most --drop-tolerance (default 0.1%) of the messages it
+ * should have received. The exit status is non-zero if any count fails.
+ * --csv appends the report, tagged with --label, for comparison across
+ * builds.
+ *
+ * Built against the snav stub (-DSNAV_STUB=ON) this needs no hardware,
+ * only a roscore. Arguments after -- are passed to the node, e.g.
+ * _preserialize:=false. The stub is shaped with the SNAV_STUB_*
+ * environment variables, which the node inherits.
+ *
+ * Usage: snav_load_test [--subscribers N] [--topics pose,vel,/tf]
+ *   [--duration S] [--warmup S] [--startup S] [--sample-rate HZ]
+ *   [--pass-rate HZ] [--rate-tolerance F] [--drop-tolerance F]
+ *   [--label NAME] [--csv FILE] [--node PATH] [-- node args]
+ */
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <ros/ros.h>
+#include <topic_tools/shape_shifter.h>
+
+#include "snav_interface/clock_utils.hpp"
+#include "snav_interface/header_offset.hpp"
+#include "snav_interface/latency_histogram.hpp"
+
+namespace
+{
+
+struct Options
+{
+  Options()
+    : subscribers(4),
+      topics("pose,vel,/tf"),
+      duration(10.0),
+      warmup(2.0),
+      startup(3.0),
+      sample_rate(500.0),
+      pass_rate(500.0),
+      rate_tolerance(0.01),
+      drop_tolerance(0.001),
+      label("default")
+  {
+  }
+  int subscribers;
+  std::string topics;
+  double duration;
+  double warmup;
+  double startup;
+  double sample_rate;
+  double pass_rate;
+  double rate_tolerance;
+  double drop_tolerance;
+  std::string label;
+  std::string csv;
+  std::string node;
+  std::vector<std::string> node_args;
+};
+
+void PrintUsage(const char* name)
+{
+  fprintf(stderr, "Usage: %s [--subscribers N] [--topics pose,vel,/tf] [--duration S]\n"
+      "  [--warmup S] [--startup S] [--sample-rate HZ] [--pass-rate HZ]\n"
+      "  [--rate-tolerance F] [--drop-tolerance F] [--label NAME] [--csv FILE]\n"
+      "  [--node PATH] [-- node args]\n", name);
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--") == 0)
+    {
+      options.node_args.assign(argv + i + 1, argv + argc);
+      break;
+    }
+    else if (strcmp(argv[i], "--subscribers") == 0 && has_value)
+      options.subscribers = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--topics") == 0 && has_value)
+      options.topics = argv[++i];
+    else if (strcmp(argv[i], "--duration") == 0 && has_value)
+      options.duration = atof(argv[++i]);
+    else if (strcmp(argv[i], "--warmup") == 0 && has_value)
+      options.warmup = atof(argv[++i]);
+    else if (strcmp(argv[i], "--startup") == 0 && has_value)
+      options.startup = atof(argv[++i]);
+    else if (strcmp(argv[i], "--sample-rate") == 0 && has_value)
+      options.sample_rate = atof(argv[++i]);
+    else if (strcmp(argv[i], "--pass-rate") == 0 && has_value)
+      options.pass_rate = atof(argv[++i]);
+    else if (strcmp(argv[i], "--rate-tolerance") == 0 && has_value)
+      options.rate_tolerance = atof(argv[++i]);
+    else if (strcmp(argv[i], "--drop-tolerance") == 0 && has_value)
+      options.drop_tolerance = atof(argv[++i]);
+    else if (strcmp(argv[i], "--label") == 0 && has_value)
+      options.label = argv[++i];
+    else if (strcmp(argv[i], "--csv") == 0 && has_value)
+      options.csv = argv[++i];
+    else if (strcmp(argv[i], "--node") == 0 && has_value)
+      options.node = argv[++i];
+    else
+    {
+      PrintUsage(argv[0]);
+      return false;
+    }
+  }
+  return options.subscribers > 0 && options.duration > 0 && options.sample_rate > 0;
+}
+
+std::vector<std::string> SplitList(const std::string& list)
+{
+  std::vector<std::string> items;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ','))
+  {
+    if (!item.empty())
+      items.push_back(item);
+  }
+  return items;
+}
+
+// What one subscriber measured on one topic, sent back to the parent
+struct TopicResult
+{
+  uint64_t received;
+  uint64_t dropped;
+  int32_t stamped;
+  double latency_p50;
+  double latency_p99;
+  double latency_max;
+};
+
+/**
+ * Measures one topic in a subscriber process. Messages are taken as raw
+ * bytes so the subscriber does not pay for deserialization; only the
+ * header stamp is read.
+ */
+class TopicProbe
+{
+public:
+  TopicProbe(int64_t start_ns, int64_t end_ns, int64_t period_ns)
+    : start_ns_(start_ns), end_ns_(end_ns), period_ns_(period_ns), stamp_offset_(kUnknown),
+      last_stamp_ns_(0), received_(0), dropped_(0)
+  {
+  }
+
+  void Callback(const topic_tools::ShapeShifter::ConstPtr& msg)
+  {
+    int64_t now_ns = MonotonicNowNs();
+    if (now_ns < start_ns_ || now_ns >= end_ns_)
+      return;
+    int64_t receive_ns = RealtimeNowNs();
+    received_++;
+
+    if (stamp_offset_ == kUnknown)
+      stamp_offset_ = StampOffset(*msg);
+    if (stamp_offset_ == kNoStamp)
+      return;
+
+    buffer_.resize(msg->size());
+    ros::serialization::OStream stream(&buffer_[0], buffer_.size());
+    msg->write(stream);
+    // seq, then stamp.sec and stamp.nsec
+    if (buffer_.size() < (size_t)stamp_offset_ + 12)
+      return;
+    uint32_t sec, nsec;
+    memcpy(&sec, &buffer_[stamp_offset_ + 4], sizeof(sec));
+    memcpy(&nsec, &buffer_[stamp_offset_ + 8], sizeof(nsec));
+    int64_t stamp_ns = (int64_t)sec*1000000000LL + nsec;
+
+    latency_.Record(receive_ns - stamp_ns);
+    if (last_stamp_ns_ != 0 && stamp_ns > last_stamp_ns_)
+    {
+      int64_t missing = (stamp_ns - last_stamp_ns_ + period_ns_/2)/period_ns_ - 1;
+      if (missing > 0)
+        dropped_ += missing;
+    }
+    if (stamp_ns > last_stamp_ns_)
+      last_stamp_ns_ = stamp_ns;
+  }
+
+  TopicResult GetResult()
+  {
+    TopicResult result;
+    LatencyHistogram::Summary summary = latency_.Collect();
+    result.received = received_;
+    result.dropped = dropped_;
+    result.stamped = stamp_offset_ >= 0 ? 1 : 0;
+    result.latency_p50 = summary.p50;
+    result.latency_p99 = summary.p99;
+    result.latency_max = summary.max;
+    return result;
+  }
+
+private:
+  static const int kUnknown = -2;
+  static const int kNoStamp = -1;
+
+  // Where the first std_msgs/Header starts in the serialized message
+  static int StampOffset(const topic_tools::ShapeShifter& msg)
+  {
+    int offset = HeaderOffset(msg.getDataType(), msg.getMessageDefinition());
+    return offset >= 0 ? offset : kNoStamp;
+  }
+
+  int64_t start_ns_;
+  int64_t end_ns_;
+  int64_t period_ns_;
+  int stamp_offset_;
+  int64_t last_stamp_ns_;
+  uint64_t received_;
+  uint64_t dropped_;
+  LatencyHistogram latency_;
+  std::vector<uint8_t> buffer_;
+};
+
+// Body of a forked subscriber process, never returns
+void RunSubscriber(int index, const std::vector<std::string>& topics, double sample_rate,
+    int64_t start_ns, int64_t end_ns, int fd)
+{
+  std::ostringstream name;
+  name << "snav_load_test_sub_" << index;
+  ros::M_string remappings;
+  ros::init(remappings, name.str(), ros::init_options::NoSigintHandler);
+  ros::NodeHandle nh;
+
+  std::vector<boost::shared_ptr<TopicProbe> > probes;
+  std::vector<ros::Subscriber> subscribers;
+  for (size_t i = 0; i < topics.size(); ++i)
+  {
+    probes.push_back(boost::make_shared<TopicProbe>(start_ns, end_ns, (int64_t)(1e9/sample_rate)));
+    subscribers.push_back(nh.subscribe(topics[i], 1000, &TopicProbe::Callback, probes.back().get(),
+        ros::TransportHints().tcpNoDelay()));
+  }
+
+  while (ros::ok() && MonotonicNowNs() < end_ns)
+    ros::getGlobalCallbackQueue()->callAvailable(ros::WallDuration(0.01));
+
+  for (size_t i = 0; i < probes.size(); ++i)
+  {
+    TopicResult result = probes[i]->GetResult();
+    if (write(fd, &result, sizeof(result)) != sizeof(result))
+      _exit(1);
+  }
+  close(fd);
+  ros::shutdown();
+  _exit(0);
+}
+
+pid_t StartNode(const Options& options)
+{
+  std::vector<std::string> args;
+  args.push_back(options.node);
+  args.push_back("__name:=snav_load_test_node");
+  args.insert(args.end(), options.node_args.begin(), options.node_args.end());
+
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+  std::vector<char*> argv;
+  for (size_t i = 0; i < args.size(); ++i)
+    argv.push_back(const_cast<char*>(args[i].c_str()));
+  argv.push_back(NULL);
+  execv(argv[0], &argv[0]);
+  perror(options.node.c_str());
+  _exit(127);
+}
+
+bool IsAlive(pid_t pid)
+{
+  int status;
+  return waitpid(pid, &status, WNOHANG) == 0;
+}
+
+// utime + stime of a process [s]
+double CpuTime(pid_t pid)
+{
+  std::ostringstream path;
+  path << "/proc/" << pid << "/stat";
+  std::ifstream file(path.str().c_str());
+  std::string stat((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  // The command name may contain spaces, fields are counted after it
+  size_t end = stat.rfind(')');
+  if (end == std::string::npos)
+    return 0.0;
+  std::istringstream fields(stat.substr(end + 2));
+  std::string field;
+  unsigned long long utime = 0, stime = 0;
+  // state is field 3, utime and stime are fields 14 and 15
+  for (int i = 3; i <= 15 && fields >> field; ++i)
+  {
+    if (i == 14)
+      utime = strtoull(field.c_str(), NULL, 10);
+    else if (i == 15)
+      stime = strtoull(field.c_str(), NULL, 10);
+  }
+  return (double)(utime + stime)/sysconf(_SC_CLK_TCK);
+}
+
+struct LevelResult
+{
+  int subscribers;
+  double node_cpu;
+  // [topic][subscriber]
+  std::vector<std::vector<TopicResult> > topics;
+  bool complete;
+};
+
+LevelResult RunLevel(const Options& options, const std::vector<std::string>& topics,
+    int subscribers, pid_t node)
+{
+  LevelResult level;
+  level.subscribers = subscribers;
+  level.node_cpu = 0.0;
+  level.topics.assign(topics.size(), std::vector<TopicResult>());
+  level.complete = true;
+
+  int64_t start_ns = MonotonicNowNs() + (int64_t)(options.warmup*1e9);
+  int64_t end_ns = start_ns + (int64_t)(options.duration*1e9);
+
+  std::vector<pid_t> pids;
+  std::vector<int> fds;
+  for (int s = 0; s < subscribers; ++s)
+  {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0)
+    {
+      perror("pipe");
+      level.complete = false;
+      break;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(pipe_fds[0]);
+      RunSubscriber(s, topics, options.sample_rate, start_ns, end_ns, pipe_fds[1]);
+    }
+    close(pipe_fds[1]);
+    if (pid < 0)
+    {
+      perror("fork");
+      close(pipe_fds[0]);
+      level.complete = false;
+      break;
+    }
+    pids.push_back(pid);
+    fds.push_back(pipe_fds[0]);
+  }
+
+  SleepUntilNs(start_ns);
+  double cpu_start = CpuTime(node);
+  SleepUntilNs(end_ns);
+  double cpu_end = CpuTime(node);
+  level.node_cpu = 100.0*(cpu_end - cpu_start)/options.duration;
+
+  for (size_t s = 0; s < pids.size(); ++s)
+  {
+    for (size_t t = 0; t < topics.size(); ++t)
+    {
+      TopicResult result;
+      if (read(fds[s], &result, sizeof(result)) != sizeof(result))
+      {
+        level.complete = false;
+        break;
+      }
+      level.topics[t].push_back(result);
+    }
+    close(fds[s]);
+    int status;
+    waitpid(pids[s], &status, 0);
+  }
+  return level;
+}
+
+struct TopicSummary
+{
+  double rate_min;
+  double rate_mean;
+  double latency_p50;
+  double latency_p99;
+  double latency_max;
+  uint64_t dropped;
+  bool stamped;
+  bool pass;
+};
+
+TopicSummary Summarize(const Options& options, const std::vector<TopicResult>& results,
+    int subscribers)
+{
+  TopicSummary summary;
+  memset(&summary, 0, sizeof(summary));
+  summary.rate_min = results.empty() ? 0.0 : 1e300;
+  double rate_sum = 0.0;
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    double rate = results[i].received/options.duration;
+    summary.rate_min = std::min(summary.rate_min, rate);
+    rate_sum += rate;
+    summary.latency_p50 = std::max(summary.latency_p50, results[i].latency_p50);
+    summary.latency_p99 = std::max(summary.latency_p99, results[i].latency_p99);
+    summary.latency_max = std::max(summary.latency_max, results[i].latency_max);
+    summary.dropped += results[i].dropped;
+    summary.stamped = summary.stamped || results[i].stamped;
+  }
+  summary.rate_mean = results.empty() ? 0.0 : rate_sum/results.size();
+
+  // A missing subscriber's report fails the level
+  double expected = options.sample_rate*options.duration*subscribers;
+  summary.pass = (int)results.size() == subscribers &&
+      summary.rate_min >= options.pass_rate*(1.0 - options.rate_tolerance) &&
+      summary.dropped <= options.drop_tolerance*expected;
+  return summary;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  Options options;
+  if (!ParseOptions(argc, argv, options))
+    return 1;
+  std::vector<std::string> topics = SplitList(options.topics);
+  if (topics.empty())
+  {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  if (options.node.empty())
+  {
+    // Installed next to snav_interface_node
+    char self[4096];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    std::string dir = length > 0 ? std::string(self, length) : std::string(argv[0]);
+    options.node = dir.substr(0, dir.rfind('/') + 1) + "snav_interface_node";
+  }
+
+  // Nothing in this process talks to ROS, so forking is safe
+  pid_t node = StartNode(options);
+  if (node < 0)
+  {
+    perror("fork");
+    return 1;
+  }
+  SleepForNs((int64_t)(options.startup*1e9));
+  if (!IsAlive(node))
+  {
+    fprintf(stderr, "%s exited during startup\n", options.node.c_str());
+    return 1;
+  }
+
+  FILE* csv = NULL;
+  if (!options.csv.empty())
+  {
+    csv = fopen(options.csv.c_str(), "a");
+    if (csv == NULL)
+      perror(options.csv.c_str());
+    else if (ftell(csv) == 0)
+      fprintf(csv, "label,subscribers,topic,rate_min_hz,rate_mean_hz,latency_p50_us,"
+          "latency_p99_us,latency_max_us,dropped,node_cpu_percent,pass\n");
+  }
+
+  printf("# snav_load_test label=%s duration=%.1fs sample_rate=%.0fHz pass_rate=%.0fHz"
+      " rate_tolerance=%.3f drop_tolerance=%.4f\n", options.label.c_str(), options.duration,
+      options.sample_rate, options.pass_rate, options.rate_tolerance, options.drop_tolerance);
+  printf("%4s %-16s %11s %12s %10s %10s %10s %9s %8s %6s\n", "subs", "topic", "rate_min_hz",
+      "rate_mean_hz", "p50_us", "p99_us", "max_us", "dropped", "node_cpu", "result");
+
+  bool all_pass = true;
+  for (int subscribers = 1; subscribers <= options.subscribers; ++subscribers)
+  {
+    if (!IsAlive(node))
+    {
+      fprintf(stderr, "%s exited during the test\n", options.node.c_str());
+      all_pass = false;
+      break;
+    }
+    LevelResult level = RunLevel(options, topics, subscribers, node);
+    all_pass = all_pass && level.complete;
+    for (size_t t = 0; t < topics.size(); ++t)
+    {
+      TopicSummary summary = Summarize(options, level.topics[t], subscribers);
+      all_pass = all_pass && summary.pass;
+      // Unstamped topics have no latency or drop count
+      if (summary.stamped)
+        printf("%4d %-16s %11.1f %12.1f %10.1f %10.1f %10.1f %9llu %7.1f%% %6s\n", subscribers,
+            topics[t].c_str(), summary.rate_min, summary.rate_mean, summary.latency_p50*1e6,
+            summary.latency_p99*1e6, summary.latency_max*1e6, (unsigned long long)summary.dropped,
+            level.node_cpu, summary.pass ? "PASS" : "FAIL");
+      else
+        printf("%4d %-16s %11.1f %12.1f %10s %10s %10s %9s %7.1f%% %6s\n", subscribers,
+            topics[t].c_str(), summary.rate_min, summary.rate_mean, "-", "-", "-", "-",
+            level.node_cpu, summary.pass ? "PASS" : "FAIL");
+      if (csv != NULL)
+        fprintf(csv, "%s,%d,%s,%.2f,%.2f,%.2f,%.2f,%.2f,%llu,%.2f,%d\n", options.label.c_str(),
+            subscribers, topics[t].c_str(), summary.rate_min, summary.rate_mean,
+            summary.latency_p50*1e6, summary.latency_p99*1e6, summary.latency_max*1e6,
+            (unsigned long long)summary.dropped, level.node_cpu, summary.pass ? 1 : 0);
+    }
+    fflush(stdout);
+  }
+
+  if (csv != NULL)
+    fclose(csv);
+  kill(node, SIGINT);
+  int status;
+  waitpid(node, &status, 0);
+
+  printf("%s\n", all_pass ? "PASS" : "FAIL");
+  return all_pass ? 0 : 1;
+}
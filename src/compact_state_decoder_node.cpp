@@ -0,0 +1,144 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/Twist.h>
+#include <ros/ros.h>
+#include <tf2_msgs/TFMessage.h>
+
+#include "snav_interface/compact_state.hpp"
+
+namespace snav_ros
+{
+
+/**
+ * Ground station side of the compact_state topic. Expands each
+ * snav_ros/CompactState back into the pose, vel and /tf messages
+ * snav_interface publishes, and reports lost messages from gaps in the
+ * sequence number.
+ */
+class CompactStateDecoder
+{
+public:
+  CompactStateDecoder(ros::NodeHandle nh, ros::NodeHandle pnh)
+    : nh_(nh), has_sequence_(false), last_sequence_(0), received_(0), lost_(0)
+  {
+    pnh.param("estimation_frame", estimation_frame_, std::string("/odom"));
+    pnh.param("base_link_frame", base_link_frame_, std::string("/base_link"));
+    pnh.param("broadcast_tf", broadcast_tf_, true);
+    bool udp;
+    pnh.param("udp", udp, true);
+
+    pose_publisher_ = nh_.advertise<geometry_msgs::PoseStamped>("pose", 10);
+    vel_publisher_ = nh_.advertise<geometry_msgs::Twist>("vel", 10);
+    if (broadcast_tf_)
+      tf_publisher_ = nh_.advertise<tf2_msgs::TFMessage>("/tf", 100);
+
+    // A late sample is worth less than a lost one, prefer UDPROS if the
+    // publisher supports it
+    ros::TransportHints hints = udp ? ros::TransportHints().unreliable().reliable().tcpNoDelay() :
+        ros::TransportHints().tcpNoDelay();
+    state_subscriber_ = nh_.subscribe("compact_state", 10,
+        &CompactStateDecoder::StateCallback, this, hints);
+
+    pose_msg_.header.frame_id = estimation_frame_;
+    tf_msg_.transforms.resize(1);
+    tf_msg_.transforms[0].header.frame_id = estimation_frame_;
+    tf_msg_.transforms[0].child_frame_id = base_link_frame_;
+  }
+
+private:
+  void StateCallback(const snav_ros::CompactState::ConstPtr& msg)
+  {
+    if (has_sequence_ && msg->sequence != last_sequence_ + 1)
+    {
+      // A sequence that went backwards means snav_interface restarted
+      if (msg->sequence > last_sequence_)
+        lost_ += msg->sequence - last_sequence_ - 1;
+      ROS_WARN_THROTTLE(5.0, "compact_state: %llu of %llu messages lost",
+          (unsigned long long)lost_, (unsigned long long)(received_ + lost_));
+    }
+    has_sequence_ = true;
+    last_sequence_ = msg->sequence;
+    ++received_;
+
+    DecodeCompactState(*msg, pose_msg_.pose, vel_msg_);
+    pose_msg_.header.stamp = msg->stamp;
+    pose_publisher_.publish(pose_msg_);
+    vel_publisher_.publish(vel_msg_);
+
+    if (broadcast_tf_)
+    {
+      geometry_msgs::TransformStamped& transform = tf_msg_.transforms[0];
+      transform.header.stamp = msg->stamp;
+      transform.transform.translation.x = pose_msg_.pose.position.x;
+      transform.transform.translation.y = pose_msg_.pose.position.y;
+      transform.transform.translation.z = pose_msg_.pose.position.z;
+      transform.transform.rotation = pose_msg_.pose.orientation;
+      tf_publisher_.publish(tf_msg_);
+    }
+  }
+
+  ros::NodeHandle nh_;
+  ros::Subscriber state_subscriber_;
+  ros::Publisher pose_publisher_;
+  ros::Publisher vel_publisher_;
+  ros::Publisher tf_publisher_;
+
+  std::string estimation_frame_;
+  std::string base_link_frame_;
+  bool broadcast_tf_;
+
+  geometry_msgs::PoseStamped pose_msg_;
+  geometry_msgs::Twist vel_msg_;
+  tf2_msgs::TFMessage tf_msg_;
+
+  bool has_sequence_;
+  uint32_t last_sequence_;
+  uint64_t received_;
+  uint64_t lost_;
+};
+
+}
+
+int main(int argc, char *argv[])
+{
+  ros::init(argc, argv, "compact_state_decoder");
+  ros::NodeHandle nh;
+  ros::NodeHandle private_nh("~");
+
+  snav_ros::CompactStateDecoder decoder(nh, private_nh);
+  ros::spin();
+
+  return 0;
+}
@@ -0,0 +1,416 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include "snav_interface/dsp_clock_sync.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ros/ros.h>
+
+#include "snav_interface/clock_utils.hpp"
+
+namespace
+{
+
+// Reads per sample, the one with the tightest CLOCK_REALTIME bracket is kept
+const int kReadsPerSample = 3;
+// Residuals beyond this many robust standard deviations are outliers
+const double kOutlierSigmas = 4.0;
+// Never reject samples closer to the fit than this [ns]
+const double kMinOutlierThreshold = 20e3;
+// Consecutive samples this far off the model mean the clock stepped [ns]
+const int64_t kStepThreshold = 1000000;
+const int kStepSamples = 3;
+// Physically plausible crystal drift [ppb]
+const int64_t kMaxDriftPpb = 1000000;
+
+// Least squares y = a + b*x over the selected samples
+void LineFit(const double* x, const double* y, const bool* use, int n, double& a, double& b)
+{
+  double sx = 0, sy = 0, count = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    if (!use[i])
+      continue;
+    sx += x[i];
+    sy += y[i];
+    count++;
+  }
+  if (count == 0)
+  {
+    a = 0;
+    b = 0;
+    return;
+  }
+  double mx = sx/count, my = sy/count;
+  double sxx = 0, sxy = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    if (!use[i])
+      continue;
+    sxx += (x[i] - mx)*(x[i] - mx);
+    sxy += (x[i] - mx)*(y[i] - my);
+  }
+  b = sxx > 0 ? sxy/sxx : 0;
+  a = my - b*mx;
+}
+
+}  // namespace
+
+DspClockSync::DspClockSync()
+  : source_(SOURCE_FIXED),
+    qtimer_fd_(-1),
+    stop_fd_(-1),
+    period_ns_(0),
+    window_(1),
+    running_(false),
+    window_count_(0),
+    window_next_(0),
+    samples_(0),
+    outliers_(0),
+    read_failures_(0),
+    steps_(0)
+{
+}
+
+DspClockSync::~DspClockSync()
+{
+  Stop();
+}
+
+bool DspClockSync::Start(const std::string& qtimer_path, double period, int window)
+{
+  qtimer_fd_ = open(qtimer_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (qtimer_fd_ >= 0)
+    source_ = SOURCE_QTIMER;
+  else
+  {
+    ROS_WARN_STREAM("Could not open " << qtimer_path << ", assuming CLOCK_MONOTONIC snav time");
+    source_ = SOURCE_MONOTONIC;
+  }
+
+  period_ns_ = (int64_t)(period*1e9);
+  window_ = std::max(1, std::min(window, (int)kMaxWindow));
+  window_count_ = 0;
+  window_next_ = 0;
+
+  // The first sample defines the model before anything is stamped
+  int64_t dsp_ns, realtime_ns, width_ns;
+  if (!Sample(dsp_ns, realtime_ns, width_ns))
+  {
+    ROS_ERROR("Failed to read the DSP clock");
+    return false;
+  }
+  AddSample(dsp_ns, realtime_ns - dsp_ns, width_ns);
+  Fit();
+  ROS_INFO_STREAM("DSP offset: " << realtime_ns - dsp_ns << " ns");
+
+  stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (stop_fd_ < 0)
+  {
+    ROS_ERROR("Failed to create clock sync eventfd");
+    return false;
+  }
+  running_ = true;
+  thread_ = std::thread(&DspClockSync::Run, this);
+  return true;
+}
+
+void DspClockSync::StartFixed(int64_t offset_ns)
+{
+  Model model;
+  model.ref_dsp_ns = 0;
+  model.ref_offset_ns = offset_ns;
+  model.drift_ppb = 0;
+  StartFixed(model);
+}
+
+void DspClockSync::StartFixed(const Model& model)
+{
+  source_ = SOURCE_FIXED;
+  model_.Store(model);
+}
+
+void DspClockSync::Stop()
+{
+  if (running_)
+  {
+    running_ = false;
+    uint64_t one = 1;
+    if (write(stop_fd_, &one, sizeof(one)) < 0)
+    {
+      // Already signalled
+    }
+  }
+  if (thread_.joinable())
+    thread_.join();
+  if (stop_fd_ >= 0)
+  {
+    close(stop_fd_);
+    stop_fd_ = -1;
+  }
+  if (qtimer_fd_ >= 0)
+  {
+    close(qtimer_fd_);
+    qtimer_fd_ = -1;
+  }
+}
+
+void DspClockSync::Run()
+{
+  struct pollfd pfd;
+  pfd.fd = stop_fd_;
+  pfd.events = POLLIN;
+
+  struct timespec ts;
+  ts.tv_sec = period_ns_/1000000000LL;
+  ts.tv_nsec = period_ns_%1000000000LL;
+
+  while (running_)
+  {
+    pfd.revents = 0;
+    if (ppoll(&pfd, 1, &ts, NULL) != 0)
+      break;
+
+    int64_t dsp_ns, realtime_ns, width_ns;
+    if (!Sample(dsp_ns, realtime_ns, width_ns))
+    {
+      read_failures_.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    AddSample(dsp_ns, realtime_ns - dsp_ns, width_ns);
+    Fit();
+  }
+}
+
+bool DspClockSync::ReadDspNs(int64_t& dsp_ns)
+{
+  if (source_ == SOURCE_MONOTONIC)
+  {
+    dsp_ns = MonotonicNowNs();
+    return true;
+  }
+
+  // sysfs regenerates the value on every read from offset 0
+  char buffer[32];
+  ssize_t length = pread(qtimer_fd_, buffer, sizeof(buffer) - 1, 0);
+  if (length <= 0)
+    return false;
+  buffer[length] = '\0';
+  uint64_t ticks = strtoull(buffer, NULL, 16);
+
+  // 19.2 MHz qtimer: 1e9/19.2e6 = 625/12 ns per tick
+  dsp_ns = (int64_t)(ticks*625/12);
+  return true;
+}
+
+bool DspClockSync::Sample(int64_t& dsp_ns, int64_t& realtime_ns, int64_t& width_ns)
+{
+  bool ok = false;
+  for (int i = 0; i < kReadsPerSample; ++i)
+  {
+    int64_t dsp;
+    int64_t before = RealtimeNowNs();
+    if (!ReadDspNs(dsp))
+      continue;
+    int64_t after = RealtimeNowNs();
+    if (!ok || after - before < width_ns)
+    {
+      width_ns = after - before;
+      realtime_ns = before + width_ns/2;
+      dsp_ns = dsp;
+      ok = true;
+    }
+  }
+  return ok;
+}
+
+void DspClockSync::AddSample(int64_t dsp_ns, int64_t offset_ns, int64_t width_ns)
+{
+  samples_.fetch_add(1, std::memory_order_relaxed);
+
+  window_dsp_ns_[window_next_] = dsp_ns;
+  window_offset_ns_[window_next_] = offset_ns;
+  window_next_ = (window_next_ + 1) % window_;
+  window_count_ = std::min(window_count_ + 1, window_);
+
+  FitStats fit_stats;
+  fit_stats_.Load(fit_stats);
+  fit_stats.read_width = width_ns*1e-9;
+  fit_stats_.Store(fit_stats);
+
+  // A clock step shows up as several consecutive samples far off the model
+  // in the same direction. Restart the window from those samples.
+  if (window_count_ <= kStepSamples)
+    return;
+  Model model;
+  model_.Load(model);
+  int direction = 0;
+  for (int k = 1; k <= kStepSamples; ++k)
+  {
+    int i = (window_next_ - k + window_) % window_;
+    int64_t dx_us = (window_dsp_ns_[i] - model.ref_dsp_ns)/1000;
+    int64_t predicted = model.ref_offset_ns + dx_us*model.drift_ppb/1000000;
+    int64_t error = window_offset_ns_[i] - predicted;
+    int sign = error > kStepThreshold ? 1 : (error < -kStepThreshold ? -1 : 0);
+    if (sign == 0 || (direction != 0 && sign != direction))
+      return;
+    direction = sign;
+  }
+
+  int64_t dsp[kStepSamples], offset[kStepSamples];
+  for (int k = 0; k < kStepSamples; ++k)
+  {
+    int i = (window_next_ - kStepSamples + k + window_) % window_;
+    dsp[k] = window_dsp_ns_[i];
+    offset[k] = window_offset_ns_[i];
+  }
+  for (int k = 0; k < kStepSamples; ++k)
+  {
+    window_dsp_ns_[k] = dsp[k];
+    window_offset_ns_[k] = offset[k];
+  }
+  window_count_ = kStepSamples;
+  window_next_ = kStepSamples % window_;
+  steps_.fetch_add(1, std::memory_order_relaxed);
+  ROS_WARN("DSP clock sync: clock step detected, restarting fit");
+}
+
+void DspClockSync::Fit()
+{
+  // Fit relative to the newest sample so doubles keep ns resolution
+  int newest = (window_next_ - 1 + window_) % window_;
+  int64_t x0 = window_dsp_ns_[newest];
+  int64_t y0 = window_offset_ns_[newest];
+
+  // Zeroed, the compiler cannot tell that only the first n are read
+  double x[kMaxWindow] = {}, y[kMaxWindow] = {};
+  double abs_residual[kMaxWindow], sorted[kMaxWindow];
+  bool use[kMaxWindow] = {};
+  int n = window_count_;
+  for (int i = 0; i < n; ++i)
+  {
+    int j = (window_next_ - n + i + window_) % window_;
+    x[i] = (double)(window_dsp_ns_[j] - x0);
+    y[i] = (double)(window_offset_ns_[j] - y0);
+    use[i] = true;
+  }
+
+  double a, b;
+  LineFit(x, y, use, n, a, b);
+
+  // Reject by median absolute deviation and refit on the inliers
+  for (int i = 0; i < n; ++i)
+  {
+    abs_residual[i] = std::fabs(y[i] - (a + b*x[i]));
+    sorted[i] = abs_residual[i];
+  }
+  std::nth_element(sorted, sorted + n/2, sorted + n);
+  double threshold = std::max(kOutlierSigmas*1.4826*sorted[n/2], kMinOutlierThreshold);
+  int inliers = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    use[i] = abs_residual[i] <= threshold;
+    inliers += use[i];
+  }
+  if (!use[n - 1])
+    outliers_.fetch_add(1, std::memory_order_relaxed);
+  if (inliers >= 2 && inliers < n)
+    LineFit(x, y, use, n, a, b);
+
+  double sum_sq = 0, max_residual = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    if (!use[i])
+      continue;
+    double r = std::fabs(y[i] - (a + b*x[i]));
+    sum_sq += r*r;
+    max_residual = std::max(max_residual, r);
+  }
+
+  Model model;
+  model.ref_dsp_ns = x0;
+  model.ref_offset_ns = y0 + llround(a);
+  model.drift_ppb = std::max(-kMaxDriftPpb, std::min(kMaxDriftPpb, (int64_t)llround(b*1e9)));
+  model_.Store(model);
+
+  FitStats fit_stats;
+  fit_stats_.Load(fit_stats);
+  fit_stats.residual_rms = inliers > 0 ? std::sqrt(sum_sq/inliers)*1e-9 : 0.0;
+  fit_stats.residual_max = max_residual*1e-9;
+  fit_stats.window_fill = n;
+  fit_stats_.Store(fit_stats);
+}
+
+int64_t DspClockSync::ToRealtimeNs(int64_t dsp_time_us) const
+{
+  Model model;
+  model_.Load(model);
+  return ToRealtimeNs(model, dsp_time_us);
+}
+
+DspClockSync::Model DspClockSync::GetModel() const
+{
+  Model model;
+  model_.Load(model);
+  return model;
+}
+
+DspClockSync::Stats DspClockSync::GetStats() const
+{
+  Model model;
+  model_.Load(model);
+  FitStats fit_stats;
+  fit_stats_.Load(fit_stats);
+
+  Stats stats;
+  stats.source = source_;
+  stats.offset = model.ref_offset_ns*1e-9;
+  stats.drift_ppm = model.drift_ppb*1e-3;
+  stats.residual_rms = fit_stats.residual_rms;
+  stats.residual_max = fit_stats.residual_max;
+  stats.read_width = fit_stats.read_width;
+  stats.window_fill = fit_stats.window_fill;
+  stats.samples = samples_.load(std::memory_order_relaxed);
+  stats.outliers = outliers_.load(std::memory_order_relaxed);
+  stats.read_failures = read_failures_.load(std::memory_order_relaxed);
+  stats.steps = steps_.load(std::memory_order_relaxed);
+  return stats;
+}
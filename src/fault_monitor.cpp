@@ -0,0 +1,95 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include "snav_interface/fault_monitor.hpp"
+
+#include <ros/ros.h>
+
+namespace
+{
+
+struct FaultInfo
+{
+  const char* name;
+  const char* message;
+  bool error;
+};
+
+const FaultInfo kFaults[FaultMonitor::NUM_FAULTS] =
+{
+  {"est_rotation_nan", "Rotation Quaternion is NAN", false},
+  {"sim_rotation_nan", "Sim ground truth Rotation Quaternion is NAN", false},
+  {"stale_data", "sn_update_data failed, not publishing", false},
+  {"stale_status", "Tried to publish status data, but sn_update_data() has not been called in at least 1 second", true},
+  {"invalid_est_output", "Tried to publish or broadcast est data with an invalid rotation", true},
+  {"invalid_sim_output", "Tried to publish or broadcast sim ground truth with an invalid rotation", true}
+};
+
+}
+
+FaultMonitor::FaultMonitor()
+{
+  for (int i = 0; i < NUM_FAULTS; ++i)
+  {
+    total_[i].store(0, std::memory_order_relaxed);
+    period_[i].store(0, std::memory_order_relaxed);
+    last_period_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void FaultMonitor::LogFirst(Fault fault)
+{
+  if (kFaults[fault].error)
+    ROS_ERROR("%s (repeats are counted in the fault summary)", kFaults[fault].message);
+  else
+    ROS_WARN("%s (repeats are counted in the fault summary)", kFaults[fault].message);
+}
+
+void FaultMonitor::Summarize(double period)
+{
+  for (int i = 0; i < NUM_FAULTS; ++i)
+  {
+    uint64_t count = period_[i].exchange(0, std::memory_order_relaxed);
+    last_period_[i].store(count, std::memory_order_relaxed);
+    // The first occurrence has been logged already
+    if (count > 1)
+      ROS_WARN("%s: %llu times in the last %.1f s (%llu total)", kFaults[i].name,
+          (unsigned long long)count, period,
+          (unsigned long long)total_[i].load(std::memory_order_relaxed));
+  }
+}
+
+const char* FaultMonitor::GetName(Fault fault)
+{
+  return kFaults[fault].name;
+}
@@ -0,0 +1,156 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include "snav_interface/flight_record_reader.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FlightRecordReader::FlightRecordReader()
+  : fd_(-1),
+    map_(NULL),
+    map_size_(0),
+    capacity_(0),
+    record_size_(0),
+    first_(0),
+    last_(0),
+    committed_(0)
+{
+  memset(&clock_model_, 0, sizeof(clock_model_));
+}
+
+FlightRecordReader::~FlightRecordReader()
+{
+  if (map_ != NULL)
+    munmap(const_cast<uint8_t*>(map_), map_size_);
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool FlightRecordReader::Open(const std::string& path, std::string& error)
+{
+  fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd_ < 0 || fstat(fd_, &st) != 0)
+  {
+    error = path + ": " + strerror(errno);
+    return false;
+  }
+  map_size_ = st.st_size;
+  if (map_size_ < kFlightRecordHeaderSize)
+  {
+    error = path + ": too small for a flight record file";
+    return false;
+  }
+  void* map = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd_, 0);
+  if (map == MAP_FAILED)
+  {
+    error = path + ": " + strerror(errno);
+    return false;
+  }
+  map_ = static_cast<const uint8_t*>(map);
+  madvise(map, map_size_, MADV_SEQUENTIAL);
+
+  FlightRecordFileHeader header;
+  memcpy(&header, map_, sizeof(header));
+  if (memcmp(header.magic, kFlightRecordMagic, sizeof(header.magic)) != 0 ||
+      header.version != kFlightRecordVersion)
+  {
+    error = path + ": not a flight record file or unsupported version";
+    return false;
+  }
+  if (header.payload_size != sizeof(SnavSnapshot) ||
+      header.record_size < sizeof(FlightRecordHeader) + sizeof(SnavSnapshot) ||
+      header.header_size + header.capacity*header.record_size > map_size_)
+  {
+    error = path + ": record layout does not match this build";
+    return false;
+  }
+  capacity_ = header.capacity;
+  record_size_ = header.record_size;
+
+  // Newest intact commit
+  uint64_t generation = 0;
+  for (int i = 0; i < 2; ++i)
+  {
+    FlightRecordCommit commit;
+    memcpy(&commit, map_ + kFlightRecordCommitOffset[i], sizeof(commit));
+    if (commit.crc == FlightRecordCommitCrc(commit) && commit.generation > generation)
+    {
+      generation = commit.generation;
+      committed_ = commit.records_written;
+      clock_model_.ref_dsp_ns = commit.clock_ref_dsp_ns;
+      clock_model_.ref_offset_ns = commit.clock_ref_offset_ns;
+      clock_model_.drift_ppb = commit.clock_drift_ppb;
+    }
+  }
+
+  // Records written after the last commit survive if they are intact
+  last_ = committed_;
+  while (last_ - committed_ < capacity_ && IsIntact(last_ + 1))
+    last_++;
+  first_ = last_ == 0 ? 0 : (last_ > capacity_ ? last_ - capacity_ + 1 : 1);
+  // The oldest slots may have been torn while the ring wrapped
+  while (first_ != 0 && first_ < last_ && !IsIntact(first_))
+    first_++;
+  return true;
+}
+
+const FlightRecordHeader* FlightRecordReader::Slot(uint64_t sequence) const
+{
+  return reinterpret_cast<const FlightRecordHeader*>(
+      map_ + kFlightRecordHeaderSize + ((sequence - 1) % capacity_)*record_size_);
+}
+
+bool FlightRecordReader::IsIntact(uint64_t sequence) const
+{
+  SnavSnapshot snapshot;
+  return Get(sequence, snapshot);
+}
+
+bool FlightRecordReader::Get(uint64_t sequence, SnavSnapshot& snapshot) const
+{
+  if (sequence == 0 || capacity_ == 0)
+    return false;
+  const FlightRecordHeader* slot = Slot(sequence);
+  FlightRecordHeader record;
+  memcpy(&record, slot, sizeof(record));
+  if (record.sequence != sequence || record.payload_size != sizeof(SnavSnapshot))
+    return false;
+  memcpy(&snapshot, slot + 1, sizeof(snapshot));
+  return record.crc == FlightRecordCrc(sequence, snapshot);
+}
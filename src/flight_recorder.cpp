@@ -0,0 +1,396 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include "snav_interface/flight_recorder.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ros/ros.h>
+
+#include "snav_interface/clock_utils.hpp"
+
+namespace
+{
+
+// Samples that can be queued between flushes; 8 s at 500 Hz
+const size_t kQueueCapacity = 4096;
+
+uint32_t crc_table[256];
+
+bool InitCrcTable()
+{
+  for (uint32_t i = 0; i < 256; ++i)
+  {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k)
+      c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    crc_table[i] = c;
+  }
+  return true;
+}
+
+const bool crc_table_ready = InitCrcTable();
+
+}  // namespace
+
+uint32_t Crc32(uint32_t crc, const void* data, size_t length)
+{
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < length; ++i)
+    crc = crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+FlightRecorder::FlightRecorder()
+  : fd_(-1),
+    stop_fd_(-1),
+    map_(NULL),
+    map_size_(0),
+    capacity_(0),
+    flush_period_ns_(0),
+    sync_period_ns_(0),
+    clock_sync_(NULL),
+    running_(false),
+    queue_(kQueueCapacity),
+    next_sequence_(1),
+    committed_(0),
+    generation_(0),
+    last_commit_ns_(0),
+    records_(0),
+    committed_records_(0),
+    dropped_(0),
+    commits_(0),
+    sync_errors_(0),
+    sync_duration_last_ns_(0),
+    sync_duration_max_ns_(0)
+{
+}
+
+FlightRecorder::~FlightRecorder()
+{
+  Close();
+}
+
+bool FlightRecorder::Open(const std::string& path, size_t size, double flush_period,
+    double sync_period, const DspClockSync* clock_sync)
+{
+  if (size < kFlightRecordHeaderSize + 16*kFlightRecordSize)
+  {
+    ROS_ERROR_STREAM("Flight recorder file size " << size << " is too small");
+    return false;
+  }
+  capacity_ = (size - kFlightRecordHeaderSize)/kFlightRecordSize;
+  map_size_ = kFlightRecordHeaderSize + capacity_*kFlightRecordSize;
+  flush_period_ns_ = (int64_t)(flush_period*1e9);
+  sync_period_ns_ = (int64_t)(sync_period*1e9);
+  clock_sync_ = clock_sync;
+
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+  {
+    ROS_ERROR_STREAM("Could not open flight recorder file " << path << ": " << strerror(errno));
+    return false;
+  }
+
+  // Append to an existing ring with the same layout, otherwise start over
+  struct stat st;
+  FlightRecordFileHeader header;
+  bool resume = fstat(fd_, &st) == 0 && (size_t)st.st_size == map_size_ &&
+    pread(fd_, &header, sizeof(header), 0) == sizeof(header) &&
+    memcmp(header.magic, kFlightRecordMagic, sizeof(header.magic)) == 0 &&
+    header.version == kFlightRecordVersion &&
+    header.header_size == kFlightRecordHeaderSize &&
+    header.record_size == kFlightRecordSize &&
+    header.payload_size == sizeof(SnavSnapshot) &&
+    header.capacity == capacity_;
+
+  next_sequence_ = 1;
+  generation_ = 0;
+  if (resume)
+  {
+    for (int i = 0; i < 2; ++i)
+    {
+      FlightRecordCommit commit;
+      if (pread(fd_, &commit, sizeof(commit), kFlightRecordCommitOffset[i]) == sizeof(commit) &&
+          commit.crc == FlightRecordCommitCrc(commit) && commit.generation > generation_)
+      {
+        generation_ = commit.generation;
+        next_sequence_ = commit.records_written + 1;
+      }
+    }
+  }
+  else
+  {
+    // Truncate first so no slot of an older layout survives
+    int err = 0;
+    if (ftruncate(fd_, 0) != 0 || ftruncate(fd_, map_size_) != 0)
+      err = errno;
+    else
+      err = posix_fallocate(fd_, 0, map_size_);
+    if (err != 0)
+    {
+      ROS_ERROR_STREAM("Could not preallocate flight recorder file " << path << ": " << strerror(err));
+      close(fd_);
+      fd_ = -1;
+      return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kFlightRecordMagic, sizeof(header.magic));
+    header.version = kFlightRecordVersion;
+    header.header_size = kFlightRecordHeaderSize;
+    header.record_size = kFlightRecordSize;
+    header.payload_size = sizeof(SnavSnapshot);
+    header.capacity = capacity_;
+    header.created_realtime_ns = RealtimeNowNs();
+    if (pwrite(fd_, &header, sizeof(header), 0) != sizeof(header) || fsync(fd_) != 0)
+    {
+      ROS_ERROR_STREAM("Could not write flight recorder header " << path << ": " << strerror(errno));
+      close(fd_);
+      fd_ = -1;
+      return false;
+    }
+  }
+  committed_ = next_sequence_ - 1;
+
+  void* map = mmap(NULL, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (map == MAP_FAILED)
+  {
+    ROS_ERROR_STREAM("Could not map flight recorder file " << path << ": " << strerror(errno));
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  map_ = static_cast<uint8_t*>(map);
+
+  stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (stop_fd_ < 0)
+  {
+    ROS_ERROR("Failed to create flight recorder eventfd");
+    Close();
+    return false;
+  }
+
+  ROS_INFO_STREAM("Flight recorder: " << path << ", " << capacity_ << " records, " <<
+      (resume ? "appending after record " : "new file, starting at record ") << next_sequence_);
+
+  last_commit_ns_ = MonotonicNowNs();
+  running_ = true;
+  thread_ = std::thread(&FlightRecorder::Run, this);
+  return true;
+}
+
+void FlightRecorder::Close()
+{
+  if (running_)
+  {
+    running_ = false;
+    uint64_t one = 1;
+    if (write(stop_fd_, &one, sizeof(one)) < 0)
+    {
+      // Already signalled
+    }
+  }
+  if (thread_.joinable())
+    thread_.join();
+  if (stop_fd_ >= 0)
+  {
+    close(stop_fd_);
+    stop_fd_ = -1;
+  }
+  if (map_ != NULL)
+  {
+    munmap(map_, map_size_);
+    map_ = NULL;
+  }
+  if (fd_ >= 0)
+  {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool FlightRecorder::Push(const SnavSnapshot& snapshot)
+{
+  if (!running_)
+    return false;
+  if (!queue_.TryPush(snapshot))
+  {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+void FlightRecorder::Run()
+{
+  struct pollfd pfd;
+  pfd.fd = stop_fd_;
+  pfd.events = POLLIN;
+
+  struct timespec ts;
+  ts.tv_sec = flush_period_ns_/1000000000LL;
+  ts.tv_nsec = flush_period_ns_%1000000000LL;
+
+  while (running_)
+  {
+    pfd.revents = 0;
+    if (ppoll(&pfd, 1, &ts, NULL) != 0)
+      break;
+    Drain();
+    if (MonotonicNowNs() - last_commit_ns_ >= sync_period_ns_)
+      Commit();
+  }
+
+  // Whatever the acquisition thread queued before stopping
+  Drain();
+  Commit();
+}
+
+bool FlightRecorder::Drain()
+{
+  bool drained = false;
+  SnavSnapshot snapshot;
+  while (queue_.TryPop(snapshot))
+  {
+    uint8_t* slot = map_ + kFlightRecordHeaderSize + ((next_sequence_ - 1) % capacity_)*kFlightRecordSize;
+    FlightRecordHeader record;
+    record.sequence = next_sequence_;
+    record.crc = FlightRecordCrc(next_sequence_, snapshot);
+    record.payload_size = sizeof(SnavSnapshot);
+    memcpy(slot + sizeof(FlightRecordHeader), &snapshot, sizeof(snapshot));
+    memcpy(slot, &record, sizeof(record));
+    next_sequence_++;
+    drained = true;
+  }
+  records_.store(next_sequence_ - 1, std::memory_order_relaxed);
+  return drained;
+}
+
+void FlightRecorder::SyncRange(uint64_t first_record, uint64_t last_record)
+{
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  uint64_t first_slot = (first_record - 1) % capacity_;
+  uint64_t last_slot = (last_record - 1) % capacity_;
+
+  // A range that wraps is synced as two pieces; a full lap syncs it all
+  uint64_t ranges[2][2];
+  int num_ranges = 1;
+  if (last_record - first_record + 1 >= capacity_)
+  {
+    ranges[0][0] = 0;
+    ranges[0][1] = capacity_ - 1;
+  }
+  else if (first_slot <= last_slot)
+  {
+    ranges[0][0] = first_slot;
+    ranges[0][1] = last_slot;
+  }
+  else
+  {
+    ranges[0][0] = first_slot;
+    ranges[0][1] = capacity_ - 1;
+    ranges[1][0] = 0;
+    ranges[1][1] = last_slot;
+    num_ranges = 2;
+  }
+
+  for (int i = 0; i < num_ranges; ++i)
+  {
+    size_t begin = kFlightRecordHeaderSize + ranges[i][0]*kFlightRecordSize;
+    size_t end = kFlightRecordHeaderSize + (ranges[i][1] + 1)*kFlightRecordSize;
+    begin -= begin % page_size;
+    if (msync(map_ + begin, end - begin, MS_SYNC) != 0)
+      sync_errors_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void FlightRecorder::Commit()
+{
+  last_commit_ns_ = MonotonicNowNs();
+  uint64_t last_record = next_sequence_ - 1;
+  if (last_record == committed_)
+    return;
+
+  // Data first, then the commit that declares it durable
+  int64_t start_ns = MonotonicNowNs();
+  SyncRange(committed_ + 1, last_record);
+
+  FlightRecordCommit commit;
+  memset(&commit, 0, sizeof(commit));
+  commit.generation = ++generation_;
+  commit.records_written = last_record;
+  commit.commit_realtime_ns = RealtimeNowNs();
+  if (clock_sync_ != NULL)
+  {
+    DspClockSync::Model model = clock_sync_->GetModel();
+    commit.clock_ref_dsp_ns = model.ref_dsp_ns;
+    commit.clock_ref_offset_ns = model.ref_offset_ns;
+    commit.clock_drift_ppb = model.drift_ppb;
+  }
+  commit.crc = FlightRecordCommitCrc(commit);
+  memcpy(map_ + kFlightRecordCommitOffset[commit.generation % 2], &commit, sizeof(commit));
+  if (msync(map_, kFlightRecordHeaderSize, MS_SYNC) != 0)
+    sync_errors_.fetch_add(1, std::memory_order_relaxed);
+
+  committed_ = last_record;
+  committed_records_.store(committed_, std::memory_order_relaxed);
+  commits_.fetch_add(1, std::memory_order_relaxed);
+
+  uint64_t duration_ns = MonotonicNowNs() - start_ns;
+  sync_duration_last_ns_.store(duration_ns, std::memory_order_relaxed);
+  if (duration_ns > sync_duration_max_ns_.load(std::memory_order_relaxed))
+    sync_duration_max_ns_.store(duration_ns, std::memory_order_relaxed);
+}
+
+FlightRecorder::Stats FlightRecorder::GetStats() const
+{
+  Stats stats;
+  stats.capacity = capacity_;
+  stats.records = records_.load(std::memory_order_relaxed);
+  stats.committed = committed_records_.load(std::memory_order_relaxed);
+  stats.dropped = dropped_.load(std::memory_order_relaxed);
+  stats.commits = commits_.load(std::memory_order_relaxed);
+  stats.sync_errors = sync_errors_.load(std::memory_order_relaxed);
+  stats.sync_duration_last = sync_duration_last_ns_.load(std::memory_order_relaxed)*1e-9;
+  stats.sync_duration_max = sync_duration_max_ns_.load(std::memory_order_relaxed)*1e-9;
+  return stats;
+}
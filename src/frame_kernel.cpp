@@ -0,0 +1,173 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include "snav_interface/frame_kernel.hpp"
+
+#include <math.h>
+
+void RotationsToQuaternions(const float* const R[kFrameKernelLanes],
+    FrameQuaternion q[kFrameKernelLanes], bool w_pivot[kFrameKernelLanes])
+{
+  // Transpose into structure-of-arrays so each loop below works on all
+  // lanes at once
+  float m[9][kFrameKernelLanes];
+  for (int l = 0; l < kFrameKernelLanes; ++l)
+    for (int e = 0; e < 9; ++e)
+      m[e][l] = R[l][e];
+
+  float qx[kFrameKernelLanes], qy[kFrameKernelLanes];
+  float qz[kFrameKernelLanes], qw[kFrameKernelLanes];
+  bool use_w[kFrameKernelLanes];
+
+  for (int l = 0; l < kFrameKernelLanes; ++l)
+  {
+    float m00 = m[0][l], m01 = m[1][l], m02 = m[2][l];
+    float m10 = m[3][l], m11 = m[4][l], m12 = m[5][l];
+    float m20 = m[6][l], m21 = m[7][l], m22 = m[8][l];
+
+    // Same pivot choice as tf2::Matrix3x3::getRotation(): w if the trace is
+    // positive, otherwise the largest diagonal element
+    float trace = m00 + m11 + m22;
+    bool pivot_w = trace > 0;
+    bool pivot_x = !pivot_w && m00 >= m11 && m00 >= m22;
+    bool pivot_y = !pivot_w && m00 < m11 && m11 >= m22;
+
+    float t_w = 1 + trace;
+    float t_x = 1 + m00 - m11 - m22;
+    float t_y = 1 - m00 + m11 - m22;
+    float t_z = 1 - m00 - m11 + m22;
+    float t = pivot_w ? t_w : pivot_x ? t_x : pivot_y ? t_y : t_z;
+
+    // The pivot component is t*r = sqrt(t)/2, the others are sums or
+    // differences of off-diagonal elements times r
+    float r = 0.5f/sqrtf(t);
+    float d_x = m21 - m12;
+    float d_y = m02 - m20;
+    float d_z = m10 - m01;
+    float s_xy = m01 + m10;
+    float s_xz = m02 + m20;
+    float s_yz = m12 + m21;
+
+    qx[l] = r*(pivot_w ? d_x : pivot_x ? t : pivot_y ? s_xy : s_xz);
+    qy[l] = r*(pivot_w ? d_y : pivot_x ? s_xy : pivot_y ? t : s_yz);
+    qz[l] = r*(pivot_w ? d_z : pivot_x ? s_xz : pivot_y ? s_yz : t);
+    qw[l] = r*(pivot_w ? t : pivot_x ? d_x : pivot_y ? d_y : d_z);
+    use_w[l] = pivot_w;
+  }
+
+  for (int l = 0; l < kFrameKernelLanes; ++l)
+  {
+    q[l].x = qx[l];
+    q[l].y = qy[l];
+    q[l].z = qz[l];
+    q[l].w = qw[l];
+    w_pivot[l] = use_w[l];
+  }
+}
+
+FrameQuaternion YawQuaternion(float c, float s)
+{
+  // Normalize, a zero vector is treated as zero yaw
+  float h = sqrtf(c*c + s*s);
+  float inv_h = h > 0 ? 1.0f/h : 0.0f;
+  c = h > 0 ? c*inv_h : 1.0f;
+  s = s*inv_h;
+
+  // Shepperd on the z rotation matrix: the w pivot has trace 1 + 2c, the
+  // z pivot 2 - 2c. Both give the half angle without trig calls.
+  bool pivot_w = c > -0.5f;
+  float t = pivot_w ? 2 + 2*c : 2 - 2*c;
+  float r = 0.5f/sqrtf(t);
+
+  FrameQuaternion q;
+  q.x = 0;
+  q.y = 0;
+  q.z = pivot_w ? 2*s*r : t*r;
+  q.w = pivot_w ? t*r : 2*s*r;
+  return q;
+}
+
+FrameQuaternion Inverse(const FrameQuaternion& q, bool w_pivot)
+{
+  float sign = w_pivot ? 1.0f : -1.0f;
+  FrameQuaternion inv;
+  inv.x = -sign*q.x;
+  inv.y = -sign*q.y;
+  inv.z = -sign*q.z;
+  inv.w = sign*q.w;
+  return inv;
+}
+
+static inline bool IsNan(const FrameQuaternion& q)
+{
+  return q.x != q.x || q.y != q.y || q.z != q.z || q.w != q.w;
+}
+
+void ComputeFrames(const SnavSnapshot& snapshot, SnavFrames& frames)
+{
+  static const float kIdentity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+  const float* R_est = snapshot.attitude_estimate.rotation_matrix;
+  const float* R_sim = snapshot.sim_ground_truth.R;
+  const float* const R[kFrameKernelLanes] =
+  {
+    R_est,
+    snapshot.pos_vel.R_eg,
+    R_sim,
+    kIdentity
+  };
+
+  FrameQuaternion q[kFrameKernelLanes];
+  bool w_pivot[kFrameKernelLanes];
+  RotationsToQuaternions(R, q, w_pivot);
+
+  frames.est = q[0];
+  frames.est_valid = !IsNan(q[0]);
+  frames.no_rot = Inverse(q[0], w_pivot[0]);
+  frames.gps_enu = q[1];
+  frames.sim = q[2];
+  frames.sim_valid = !IsNan(q[2]);
+  frames.sim_inv = Inverse(q[2], w_pivot[2]);
+
+  // Yaw as tf2::Matrix3x3::getRPY() extracts it: atan2(m10, m00), or zero
+  // at gimbal lock
+  bool gimbal_lock = fabsf(R_est[6]) >= 1;
+  frames.stab = YawQuaternion(gimbal_lock ? 1.0f : R_est[0], gimbal_lock ? 0.0f : R_est[3]);
+
+  float yaw_des = snapshot.pos_vel.yaw_desired;
+  frames.des = YawQuaternion(cosf(yaw_des), sinf(yaw_des));
+
+  // base_link -> sim_gt translation, -R^T p
+  const float* p = snapshot.sim_ground_truth.position;
+  for (int i = 0; i < 3; ++i)
+    frames.sim_inv_translation[i] = -(R_sim[i]*p[0] + R_sim[3 + i]*p[1] + R_sim[6 + i]*p[2]);
+}
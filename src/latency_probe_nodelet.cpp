@@ -0,0 +1,96 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include <algorithm>
+#include <vector>
+
+#include <geometry_msgs/PoseStamped.h>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+namespace snav_ros
+{
+
+/**
+ * Benchmark nodelet that measures how old pose messages are when they
+ * arrive. Load it into the same manager as SnavInterfaceNodelet to measure
+ * intra-process delivery, or into a separate manager to measure loopback
+ * TCPROS; the difference between the two runs is the transport cost.
+ */
+class LatencyProbeNodelet : public nodelet::Nodelet
+{
+private:
+  virtual void onInit()
+  {
+    ros::NodeHandle& pnh = getPrivateNodeHandle();
+    std::string topic;
+    int window;
+    pnh.param("topic", topic, std::string("pose"));
+    pnh.param("window", window, 5000);
+    window_ = window > 0 ? window : 5000;
+    latencies_.reserve(window_);
+
+    ros::TransportHints hints = ros::TransportHints().tcpNoDelay();
+    pose_subscriber_ = getNodeHandle().subscribe(topic, 100,
+        &LatencyProbeNodelet::PoseCallback, this, hints);
+    NODELET_INFO_STREAM("Measuring latency of " << topic << " over " << window_ << " messages");
+  }
+
+  void PoseCallback(const geometry_msgs::PoseStamped::ConstPtr& msg)
+  {
+    latencies_.push_back((ros::Time::now() - msg->header.stamp).toSec());
+    if (latencies_.size() < window_)
+      return;
+
+    std::sort(latencies_.begin(), latencies_.end());
+    double sum = 0.0;
+    for (size_t i = 0; i < latencies_.size(); ++i)
+      sum += latencies_[i];
+
+    NODELET_INFO("latency over %zu msgs [us]: mean %.1f p50 %.1f p99 %.1f max %.1f",
+        latencies_.size(),
+        1e6*sum/latencies_.size(),
+        1e6*latencies_[latencies_.size()/2],
+        1e6*latencies_[(latencies_.size()*99)/100],
+        1e6*latencies_.back());
+    latencies_.clear();
+  }
+
+  ros::Subscriber pose_subscriber_;
+  std::vector<double> latencies_;
+  size_t window_;
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(snav_ros::LatencyProbeNodelet, nodelet::Nodelet)
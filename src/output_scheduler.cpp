@@ -0,0 +1,139 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include "snav_interface/output_scheduler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+OutputScheduler::OutputScheduler() :
+    version_(0),
+    num_groups_(1),
+    applied_version_(0),
+    group_count_(0),
+    every_cycle_(0xffffffffu),
+    pending_(0)
+{
+  for (int i = 0; i < kMaxOutputs; ++i)
+    period_ns_[i] = 0;
+}
+
+bool OutputScheduler::SetRate(int output, double rate)
+{
+  // Below 1 mHz a deadline would be further out than any flight
+  if (output < 0 || output >= kMaxOutputs || !std::isfinite(rate) || rate < 0.0 ||
+      (rate > 0.0 && rate < 1e-3))
+    return false;
+  int64_t period_ns = rate > 0.0 ? std::max((int64_t)(1e9/rate), (int64_t)1) : 0;
+  period_ns_[output].store(period_ns, std::memory_order_relaxed);
+  version_.fetch_add(1, std::memory_order_release);
+  return true;
+}
+
+double OutputScheduler::GetRate(int output) const
+{
+  if (output < 0 || output >= kMaxOutputs)
+    return 0.0;
+  int64_t period_ns = period_ns_[output].load(std::memory_order_relaxed);
+  return period_ns > 0 ? 1e9/period_ns : 0.0;
+}
+
+void OutputScheduler::Regroup(int64_t now_ns)
+{
+  RateGroup groups[kMaxOutputs];
+  int group_count = 0;
+  uint32_t every_cycle = 0;
+  for (int i = 0; i < kMaxOutputs; ++i)
+  {
+    int64_t period_ns = period_ns_[i].load(std::memory_order_relaxed);
+    if (period_ns == 0)
+    {
+      every_cycle |= 1u << i;
+      continue;
+    }
+    int group = 0;
+    while (group < group_count && groups[group].period_ns != period_ns)
+      ++group;
+    if (group == group_count)
+    {
+      // A rate that already had a group keeps its deadline, a new one is
+      // due right away
+      groups[group].period_ns = period_ns;
+      groups[group].next_ns = now_ns;
+      groups[group].outputs = 0;
+      for (int old = 0; old < group_count_; ++old)
+      {
+        if (groups_[old].period_ns == period_ns)
+          groups[group].next_ns = groups_[old].next_ns;
+      }
+      ++group_count;
+    }
+    groups[group].outputs |= 1u << i;
+  }
+
+  for (int i = 0; i < group_count; ++i)
+    groups_[i] = groups[i];
+  group_count_ = group_count;
+  every_cycle_ = every_cycle;
+  num_groups_.store(group_count + (every_cycle != 0 ? 1 : 0), std::memory_order_relaxed);
+}
+
+uint32_t OutputScheduler::Take(int64_t now_ns, uint32_t ready)
+{
+  uint32_t version = version_.load(std::memory_order_acquire);
+  if (version != applied_version_)
+  {
+    applied_version_ = version;
+    Regroup(now_ns);
+  }
+
+  pending_ |= every_cycle_;
+  for (int i = 0; i < group_count_; ++i)
+  {
+    RateGroup& group = groups_[i];
+    // The clock went back, e.g. a replay restarted
+    if (now_ns < group.next_ns - group.period_ns)
+      group.next_ns = now_ns;
+    if (now_ns < group.next_ns)
+      continue;
+    pending_ |= group.outputs;
+    // Catch up without bursting if cycles were late
+    group.next_ns += group.period_ns;
+    if (group.next_ns <= now_ns)
+      group.next_ns = now_ns + group.period_ns;
+  }
+
+  uint32_t outputs = pending_ & ready;
+  pending_ &= ~outputs;
+  return outputs;
+}
@@ -0,0 +1,229 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include "snav_interface/realtime.hpp"
+
+#include <alloca.h>
+#include <errno.h>
+#include <grp.h>
+#include <malloc.h>
+#include <pwd.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+
+std::string FormatCpuList(const std::vector<int>& cpus)
+{
+  std::ostringstream out;
+  for (size_t i = 0; i < cpus.size(); ++i)
+    out << (i > 0 ? "," : "") << cpus[i];
+  return out.str();
+}
+
+// VmLck from /proc/self/status, empty if unavailable
+std::string LockedMemory()
+{
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line))
+  {
+    if (line.compare(0, 6, "VmLck:") == 0)
+      return line.substr(line.find_first_not_of(" \t", 6));
+  }
+  return "";
+}
+
+void PrefaultStack(size_t bytes)
+{
+  volatile char* stack = (volatile char*)alloca(bytes);
+  for (size_t i = 0; i < bytes; i += 1024)
+    stack[i] = 0;
+}
+
+}
+
+bool ParseCpuList(const std::string& text, std::vector<int>& cpus)
+{
+  cpus.clear();
+  std::istringstream in(text);
+  std::string range;
+  while (std::getline(in, range, ','))
+  {
+    int first, last;
+    char extra;
+    if (sscanf(range.c_str(), " %d - %d %c", &first, &last, &extra) == 2) {}
+    else if (sscanf(range.c_str(), " %d %c", &first, &extra) == 1)
+      last = first;
+    else
+      return false;
+    if (first < 0 || last < first || last >= CPU_SETSIZE)
+      return false;
+    for (int cpu = first; cpu <= last; ++cpu)
+      cpus.push_back(cpu);
+  }
+  return true;
+}
+
+void RealtimeSetup::ApplyThreadPolicy(pthread_t thread, const std::string& name,
+    const ThreadPolicy& policy)
+{
+  if (!policy.cpus.empty())
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < policy.cpus.size(); ++i)
+      CPU_SET(policy.cpus[i], &set);
+    int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    Report(name + " affinity", err == 0,
+        err == 0 ? "CPUs " + FormatCpuList(policy.cpus) : strerror(err));
+  }
+
+  if (policy.priority > 0)
+  {
+    struct sched_param param;
+    param.sched_priority = std::min(std::max(policy.priority, sched_get_priority_min(SCHED_FIFO)),
+        sched_get_priority_max(SCHED_FIFO));
+    int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    std::ostringstream detail;
+    if (err == 0)
+      detail << "SCHED_FIFO " << param.sched_priority;
+    else
+      detail << strerror(err);
+    Report(name + " scheduling", err == 0, detail.str());
+  }
+}
+
+void RealtimeSetup::LockMemory(size_t prefault_heap_bytes, size_t prefault_stack_bytes)
+{
+  // Locked memory must not count against a limit once root is dropped, or
+  // future allocations would fail
+  struct rlimit unlimited;
+  unlimited.rlim_cur = RLIM_INFINITY;
+  unlimited.rlim_max = RLIM_INFINITY;
+  setrlimit(RLIMIT_MEMLOCK, &unlimited);
+
+  // Serve every allocation from the heap and never trim it, so memory
+  // prefaulted here is reused instead of being unmapped and faulted again
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+  {
+    Report("mlockall", false, strerror(errno));
+    return;
+  }
+
+  if (prefault_heap_bytes > 0)
+  {
+    char* heap = (char*)malloc(prefault_heap_bytes);
+    if (heap == NULL)
+      Report("prefault heap", false, "allocation failed");
+    else
+    {
+      long page = sysconf(_SC_PAGESIZE);
+      for (size_t i = 0; i < prefault_heap_bytes; i += page)
+        heap[i] = 0;
+      free(heap);
+      Report("prefault heap", true, std::to_string(prefault_heap_bytes >> 10) + " kB");
+    }
+  }
+
+  if (prefault_stack_bytes > 0)
+  {
+    PrefaultStack(prefault_stack_bytes);
+    Report("prefault stack", true, std::to_string(prefault_stack_bytes >> 10) + " kB");
+  }
+
+  Report("mlockall", true, "locked " + LockedMemory());
+}
+
+void RealtimeSetup::DropPrivileges(const std::string& user)
+{
+  uid_t uid = getuid();
+  gid_t gid = getgid();
+  if (!user.empty())
+  {
+    struct passwd* pw = getpwnam(user.c_str());
+    if (pw == NULL)
+    {
+      Report("drop privileges", false, "unknown user " + user);
+      return;
+    }
+    uid = pw->pw_uid;
+    gid = pw->pw_gid;
+  }
+
+  if (geteuid() != 0)
+  {
+    Report("drop privileges", true, "not running as root");
+    return;
+  }
+  if (uid == 0)
+  {
+    Report("drop privileges", false, "started as root, set run_as_user to drop");
+    return;
+  }
+
+  // The group has to go first, changing it needs root
+  if ((!user.empty() && initgroups(user.c_str(), gid) != 0) ||
+      setresgid(gid, gid, gid) != 0 || setresuid(uid, uid, uid) != 0)
+  {
+    Report("drop privileges", false, strerror(errno));
+    return;
+  }
+  if (setuid(0) == 0)
+  {
+    Report("drop privileges", false, "root could be regained");
+    return;
+  }
+  Report("drop privileges", true, "running as uid " + std::to_string(uid));
+}
+
+void RealtimeSetup::Report(const std::string& step, bool ok, const std::string& detail)
+{
+  Result result;
+  result.step = step;
+  result.ok = ok;
+  result.detail = detail;
+  results_.push_back(result);
+}
@@ -0,0 +1,155 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include "snav_interface/sample_poller.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "snav_interface/clock_utils.hpp"
+
+namespace
+{
+// Weight of a new period measurement in the running estimate
+const double kPeriodFilterGain = 0.05;
+// Measured periods further than this factor from the estimate are ignored
+const int64_t kPeriodOutlierRatio = 4;
+// Weight of a new poll duration measurement
+const double kDurationFilterGain = 0.1;
+// Fraction of the period the phase moves earlier when a sample was already
+// there on the first poll, until a poll comes up empty again
+const double kPhaseProbe = 0.05;
+// Fraction of the estimated period a poll aims to return after the expected
+// sample, so that most samples are found on the first try
+const double kReturnMargin = 0.05;
+}
+
+SamplePoller::SamplePoller(double min_poll_period, double max_poll_period)
+  : min_poll_period_ns_((int64_t)(min_poll_period*1e9)),
+    max_poll_period_ns_((int64_t)(max_poll_period*1e9)),
+    sample_period_ns_(0),
+    last_sample_time_ns_(0),
+    visible_offset_ns_(0),
+    phase_known_(false),
+    poll_duration_ns_(0),
+    last_empty_poll_ns_(0),
+    expected_sample_ns_(0),
+    empty_polls_(0),
+    deadline_misses_(0),
+    overruns_(0)
+{
+  last_sample_arrival_ns_ = MonotonicNowNs();
+  next_poll_ns_ = last_sample_arrival_ns_;
+}
+
+void SamplePoller::Update(bool new_sample, int64_t sample_time_us, int64_t poll_start_ns,
+    int64_t poll_end_ns)
+{
+  poll_duration_ns_ += (int64_t)(kDurationFilterGain*(poll_end_ns - poll_start_ns - poll_duration_ns_));
+
+  if (!new_sample)
+  {
+    ++empty_polls_;
+    last_empty_poll_ns_ = poll_end_ns;
+
+    // Poll finely while a sample is due, slowly once it is clearly overdue
+    int64_t since_last = poll_end_ns - last_sample_arrival_ns_;
+    if (sample_period_ns_ > 0 && since_last < 2*sample_period_ns_)
+      next_poll_ns_ = poll_end_ns + min_poll_period_ns_;
+    else
+      next_poll_ns_ = poll_end_ns + max_poll_period_ns_;
+    return;
+  }
+
+  int64_t sample_time_ns = sample_time_us*1000;
+  if (last_sample_time_ns_ != 0)
+  {
+    int64_t dt = sample_time_ns - last_sample_time_ns_;
+    if (dt <= 0)
+      // The estimator clock restarted, so the learned phase is void
+      phase_known_ = false;
+    else if (sample_period_ns_ == 0)
+      sample_period_ns_ = dt;
+    else if (dt < kPeriodOutlierRatio*sample_period_ns_ &&
+             dt > sample_period_ns_/kPeriodOutlierRatio)
+      sample_period_ns_ += (int64_t)(kPeriodFilterGain*(dt - sample_period_ns_));
+  }
+  last_sample_time_ns_ = sample_time_ns;
+  bool bracketed = last_empty_poll_ns_ > last_sample_arrival_ns_;
+  last_sample_arrival_ns_ = poll_end_ns;
+
+  // The sample became visible after the last empty poll and before this one
+  // returned
+  int64_t upper = poll_end_ns - sample_time_ns;
+  if (!phase_known_)
+  {
+    visible_offset_ns_ = upper;
+    phase_known_ = true;
+  }
+  else if (bracketed)
+  {
+    // The phase was too early, move it into the bracket
+    int64_t lower = last_empty_poll_ns_ - sample_time_ns;
+    visible_offset_ns_ = std::max(visible_offset_ns_, (lower + upper)/2);
+  }
+  else
+  {
+    // Found on the first try, it may have been there long before
+    visible_offset_ns_ = std::min(visible_offset_ns_, upper) -
+        (int64_t)(kPhaseProbe*sample_period_ns_);
+  }
+
+  if (sample_period_ns_ == 0)
+  {
+    next_poll_ns_ = poll_end_ns + min_poll_period_ns_;
+    return;
+  }
+
+  if (upper - visible_offset_ns_ > sample_period_ns_)
+    ++overruns_;
+
+  // Deadline on the estimator's clock: start the poll so that it returns a
+  // margin after the next sample is expected
+  expected_sample_ns_ = sample_time_ns + sample_period_ns_ + visible_offset_ns_;
+  next_poll_ns_ = expected_sample_ns_ - poll_duration_ns_ +
+      (int64_t)(kReturnMargin*sample_period_ns_);
+  next_poll_ns_ = std::max(next_poll_ns_, poll_end_ns + min_poll_period_ns_);
+  next_poll_ns_ = std::min(next_poll_ns_, poll_end_ns + max_poll_period_ns_);
+}
+
+void SamplePoller::Sleep()
+{
+  int64_t late_ns = SleepUntilNs(next_poll_ns_);
+  if (late_ns > std::max(min_poll_period_ns_, sample_period_ns_/10))
+    ++deadline_misses_;
+}
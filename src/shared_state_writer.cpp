@@ -0,0 +1,112 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include "snav_interface/shared_state_writer.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snav_interface/clock_utils.hpp"
+
+SharedStateWriter::SharedStateWriter() : segment_(NULL), writes_(0)
+{
+}
+
+SharedStateWriter::~SharedStateWriter()
+{
+  Close();
+}
+
+bool SharedStateWriter::Open(const std::string& name, std::string& error)
+{
+  Close();
+
+  // Readers only need to read, whoever the node runs as later
+  int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0)
+  {
+    error = "shm_open: " + std::string(std::strerror(errno));
+    return false;
+  }
+  if (ftruncate(fd, sizeof(SharedStateSegment)) != 0)
+  {
+    error = "ftruncate: " + std::string(std::strerror(errno));
+    ::close(fd);
+    return false;
+  }
+  void* map = mmap(NULL, sizeof(SharedStateSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED)
+  {
+    error = "mmap: " + std::string(std::strerror(errno));
+    return false;
+  }
+
+  segment_ = static_cast<SharedStateSegment*>(map);
+  SharedStateHeader& header = segment_->header;
+  bool reusable = std::memcmp(header.magic, kSharedStateMagic, sizeof(kSharedStateMagic)) == 0 &&
+      header.version == kSharedStateVersion && header.state_size == sizeof(SharedState);
+  if (!reusable)
+  {
+    // A fresh segment or an old layout; readers of the old layout see the
+    // magic disappear and must reopen
+    std::memset(header.magic, 0, sizeof(header.magic));
+    std::atomic_thread_fence(std::memory_order_release);
+    new (&segment_->state) Seqlock<SharedState>();
+    header.version = kSharedStateVersion;
+    header.header_size = sizeof(SharedStateHeader);
+    header.state_size = sizeof(SharedState);
+    header.created_realtime_ns = RealtimeNowNs();
+    std::memset(header.reserved, 0, sizeof(header.reserved));
+  }
+  header.writer_pid = getpid();
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(header.magic, kSharedStateMagic, sizeof(kSharedStateMagic));
+  writes_ = 0;
+  return true;
+}
+
+void SharedStateWriter::Close()
+{
+  if (segment_ == NULL)
+    return;
+  segment_->header.writer_pid = 0;
+  munmap(segment_, sizeof(SharedStateSegment));
+  segment_ = NULL;
+}
@@ -0,0 +1,462 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include "snav_interface/snav_acquisition.hpp"
+
+#include <algorithm>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <ros/ros.h>
+
+#include "snav_interface/clock_utils.hpp"
+
+// Telemetry samples held for the publisher, about 2 s at 500 Hz
+static const size_t kTelemetryQueueSize = 1024;
+
+SnavAcquisition::SnavAcquisition()
+  : cached_data_(NULL),
+    recorder_(NULL),
+    running_(false),
+    event_fd_(-1),
+    rpc_timeout_ns_(0),
+    backoff_initial_ns_(1000000),
+    backoff_max_ns_(100000000),
+    reconnect_after_(100),
+    lockstep_(false),
+    holding_(false),
+    released_ns_(0),
+    replay_reader_(NULL),
+    replay_speed_(1.0),
+    replay_finished_(false),
+    consumed_sequence_(0),
+    last_est_sample_time_(0),
+    last_sim_sample_time_(0),
+    rpc_start_ns_(0),
+    last_success_ns_(0),
+    rpc_count_(0),
+    rpc_failures_(0),
+    consecutive_failures_(0),
+    backoff_ns_(0),
+    reconnects_(0),
+    reconnect_failures_(0),
+    rpc_timeouts_(0),
+    rpc_duration_total_ns_(0),
+    rpc_duration_max_ns_(0),
+    est_samples_(0),
+    est_duplicates_(0),
+    sim_samples_(0),
+    sim_duplicates_(0),
+    sample_period_ns_(0),
+    expected_sample_ns_(0),
+    empty_polls_(0),
+    poll_deadline_misses_(0),
+    late_samples_(0),
+    imu_stream_(kTelemetryQueueSize),
+    esc_stream_(kTelemetryQueueSize)
+{
+  std::memset(&scratch_, 0, sizeof(scratch_));
+}
+
+SnavAcquisition::~SnavAcquisition()
+{
+  Stop();
+}
+
+bool SnavAcquisition::Start(double min_poll_period, double max_poll_period, double rpc_timeout)
+{
+  if (sn_get_flight_data_ptr(sizeof(SnavCachedData), &cached_data_) != 0)
+  {
+    ROS_ERROR("Error getting cached data.");
+    return false;
+  }
+
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ < 0)
+  {
+    ROS_ERROR("Failed to create acquisition eventfd");
+    return false;
+  }
+
+  poller_ = SamplePoller(min_poll_period, max_poll_period);
+  rpc_timeout_ns_ = (int64_t)(rpc_timeout*1e9);
+
+  // Make sure a snapshot is available before anyone asks for one
+  bool new_sample = Acquire();
+
+  running_ = true;
+  thread_ = std::thread(&SnavAcquisition::Run, this, new_sample);
+  return true;
+}
+
+void SnavAcquisition::SetRpcBackoff(double initial, double max, int reconnect_after)
+{
+  backoff_initial_ns_ = std::max((int64_t)(initial*1e9), (int64_t)1000);
+  backoff_max_ns_ = std::max((int64_t)(max*1e9), backoff_initial_ns_);
+  reconnect_after_ = std::max(reconnect_after, 0);
+}
+
+bool SnavAcquisition::StartReplay(const FlightRecordReader* reader, double speed)
+{
+  if (reader->GetLast() == 0)
+  {
+    ROS_ERROR("Flight record is empty, nothing to replay");
+    return false;
+  }
+
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ < 0)
+  {
+    ROS_ERROR("Failed to create acquisition eventfd");
+    return false;
+  }
+
+  replay_reader_ = reader;
+  replay_speed_ = speed > 0.0 ? speed : 0.0;
+  replay_finished_ = false;
+
+  running_ = true;
+  thread_ = std::thread(&SnavAcquisition::RunReplay, this);
+  return true;
+}
+
+void SnavAcquisition::Stop()
+{
+  running_ = false;
+  if (thread_.joinable())
+    thread_.join();
+  if (event_fd_ >= 0)
+  {
+    close(event_fd_);
+    event_fd_ = -1;
+  }
+}
+
+void SnavAcquisition::Run(bool new_sample)
+{
+  while (running_)
+  {
+    if (new_sample && lockstep_)
+    {
+      // The next step is only taken once this one has been published
+      holding_.store(true, std::memory_order_relaxed);
+      WaitForConsumed(snapshot_.GetSequence());
+      released_ns_.store(MonotonicNowNs(), std::memory_order_relaxed);
+      holding_.store(false, std::memory_order_relaxed);
+    }
+    else if (consecutive_failures_.load(std::memory_order_relaxed) > 0)
+      SleepForNs(NextBackoffNs());
+    else
+    {
+      poller_.Sleep();
+      poll_deadline_misses_.store(poller_.GetDeadlineMisses(), std::memory_order_relaxed);
+    }
+    new_sample = Acquire();
+  }
+}
+
+bool SnavAcquisition::Acquire()
+{
+  int64_t start_ns = MonotonicNowNs();
+  rpc_start_ns_.store(start_ns, std::memory_order_relaxed);
+  int ret = sn_update_data();
+  int64_t end_ns = MonotonicNowNs();
+  rpc_start_ns_.store(0, std::memory_order_relaxed);
+
+  uint64_t duration_ns = end_ns - start_ns;
+  rpc_histogram_.Record(duration_ns);
+  rpc_count_.fetch_add(1, std::memory_order_relaxed);
+  rpc_duration_total_ns_.fetch_add(duration_ns, std::memory_order_relaxed);
+  if (duration_ns > rpc_duration_max_ns_.load(std::memory_order_relaxed))
+    rpc_duration_max_ns_.store(duration_ns, std::memory_order_relaxed);
+  if ((int64_t)duration_ns > rpc_timeout_ns_)
+    rpc_timeouts_.fetch_add(1, std::memory_order_relaxed);
+
+  if (ret != 0)
+  {
+    rpc_failures_.fetch_add(1, std::memory_order_relaxed);
+    uint64_t failures = consecutive_failures_.fetch_add(1, std::memory_order_relaxed) + 1;
+    // Logged on the transitions only, the count is on /diagnostics
+    if (failures == 1)
+      ROS_WARN("sn_update_data failed, retrying with backoff");
+    if (reconnect_after_ > 0 && failures % reconnect_after_ == 0)
+      Reconnect();
+    poller_.Update(false, 0, start_ns, end_ns);
+    empty_polls_.store(poller_.GetEmptyPolls(), std::memory_order_relaxed);
+    return false;
+  }
+  uint64_t failures = consecutive_failures_.exchange(0, std::memory_order_relaxed);
+  if (failures > 0)
+  {
+    backoff_ns_.store(0, std::memory_order_relaxed);
+    ROS_INFO("sn_update_data recovered after %llu failures", (unsigned long long)failures);
+  }
+
+  bool new_est_sample = cached_data_->pos_vel.time != last_est_sample_time_;
+  if (new_est_sample)
+  {
+    last_est_sample_time_ = cached_data_->pos_vel.time;
+    est_samples_.fetch_add(1, std::memory_order_relaxed);
+  }
+  else if (last_est_sample_time_ != 0)
+    est_duplicates_.fetch_add(1, std::memory_order_relaxed);
+
+  bool new_sim_sample = cached_data_->sim_ground_truth.time != last_sim_sample_time_;
+  if (new_sim_sample)
+  {
+    last_sim_sample_time_ = cached_data_->sim_ground_truth.time;
+    sim_samples_.fetch_add(1, std::memory_order_relaxed);
+  }
+  else if (last_sim_sample_time_ != 0)
+    sim_duplicates_.fetch_add(1, std::memory_order_relaxed);
+
+  // Always refresh the snapshot so slow-changing status stays current, but
+  // only wake the publisher when there is a sample worth publishing
+  if (imu_stream_.IsEnabled())
+    imu_stream_.Offer(cached_data_->imu_0_compensated);
+  if (esc_stream_.IsEnabled())
+    esc_stream_.Offer(cached_data_->esc_raw);
+
+  FillSnapshot(*cached_data_, scratch_);
+  StoreSample(new_est_sample, new_sim_sample, end_ns);
+
+  poller_.Update(new_est_sample, last_est_sample_time_, start_ns, end_ns);
+  sample_period_ns_.store((uint64_t)(poller_.GetSamplePeriod()*1e9), std::memory_order_relaxed);
+  expected_sample_ns_.store(poller_.GetExpectedSampleNs(), std::memory_order_relaxed);
+  empty_polls_.store(poller_.GetEmptyPolls(), std::memory_order_relaxed);
+  late_samples_.store(poller_.GetOverruns(), std::memory_order_relaxed);
+  return new_est_sample || new_sim_sample;
+}
+
+int64_t SnavAcquisition::NextBackoffNs()
+{
+  // Doubles from backoff_initial_ns_ per consecutive failure
+  uint64_t failures = consecutive_failures_.load(std::memory_order_relaxed);
+  int shift = (int)std::min<uint64_t>(failures - 1, 30);
+  int64_t backoff_ns = std::min(backoff_initial_ns_ << shift, backoff_max_ns_);
+  backoff_ns_.store(backoff_ns, std::memory_order_relaxed);
+  return backoff_ns;
+}
+
+void SnavAcquisition::Reconnect()
+{
+  // The cached data pointer is the only connection state the snav API
+  // exposes; obtaining it again re-attaches to the flight data
+  SnavCachedData* cached_data = NULL;
+  if (sn_get_flight_data_ptr(sizeof(SnavCachedData), &cached_data) == 0 && cached_data != NULL)
+  {
+    cached_data_ = cached_data;
+    reconnects_.fetch_add(1, std::memory_order_relaxed);
+  }
+  else
+    reconnect_failures_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool SnavAcquisition::WaitForConsumed(uint32_t sequence)
+{
+  while (running_ && consumed_sequence_.load(std::memory_order_relaxed) != sequence)
+    SleepForNs(20000);
+  return running_;
+}
+
+void SnavAcquisition::RunReplay()
+{
+  // A gap this long means the recorder was restarted, replay straight across
+  static const int64_t kMaxGapUs = 1000000;
+
+  int64_t start_ns = 0;
+  int64_t start_us = 0;
+  int64_t previous_us = 0;
+  uint32_t stored_sequence = snapshot_.GetSequence();
+
+  for (uint64_t sequence = replay_reader_->GetFirst();
+       running_ && sequence <= replay_reader_->GetLast(); ++sequence)
+  {
+    if (!replay_reader_->Get(sequence, scratch_))
+    {
+      // Torn or already overwritten while we were replaying
+      rpc_failures_.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    rpc_count_.fetch_add(1, std::memory_order_relaxed);
+
+    int64_t sample_us = std::max(scratch_.pos_vel.time, scratch_.sim_ground_truth.time);
+    if (replay_speed_ > 0.0)
+    {
+      if (start_ns == 0 || sample_us < previous_us || sample_us - previous_us > kMaxGapUs)
+      {
+        start_ns = MonotonicNowNs();
+        start_us = sample_us;
+      }
+      previous_us = sample_us;
+      if (!WaitForReplayTime(start_ns + (int64_t)((sample_us - start_us)*1e3/replay_speed_)))
+        break;
+    }
+    else
+    {
+      // Never overwrite a snapshot the publisher has not seen yet
+      if (!WaitForConsumed(stored_sequence))
+        break;
+    }
+
+    bool new_est_sample = scratch_.pos_vel.time != last_est_sample_time_;
+    if (new_est_sample)
+    {
+      last_est_sample_time_ = scratch_.pos_vel.time;
+      est_samples_.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+      est_duplicates_.fetch_add(1, std::memory_order_relaxed);
+
+    bool new_sim_sample = scratch_.sim_ground_truth.time != last_sim_sample_time_;
+    if (new_sim_sample)
+    {
+      last_sim_sample_time_ = scratch_.sim_ground_truth.time;
+      sim_samples_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    StoreSample(new_est_sample, new_sim_sample, MonotonicNowNs());
+    stored_sequence = snapshot_.GetSequence();
+  }
+
+  replay_finished_ = true;
+  // Wake the publisher so it notices the end without waiting out a timeout
+  Signal();
+}
+
+bool SnavAcquisition::WaitForReplayTime(int64_t target_ns)
+{
+  // Sleep in slices so Stop() is honoured even at very slow replay speeds
+  static const int64_t kSliceNs = 10000000;
+  while (running_)
+  {
+    int64_t remaining_ns = target_ns - MonotonicNowNs();
+    if (remaining_ns <= 0)
+      return true;
+    SleepForNs(std::min(remaining_ns, kSliceNs));
+  }
+  return false;
+}
+
+void SnavAcquisition::StoreSample(bool new_est_sample, bool new_sim_sample, int64_t acquired_ns)
+{
+  last_success_ns_.store(acquired_ns, std::memory_order_relaxed);
+  scratch_.acquired_time_ns = acquired_ns;
+  snapshot_.Store(scratch_);
+
+  if (new_est_sample || new_sim_sample)
+  {
+    if (recorder_ != NULL && replay_reader_ == NULL)
+      recorder_->Push(scratch_);
+    Signal();
+  }
+}
+
+void SnavAcquisition::Signal()
+{
+  uint64_t one = 1;
+  if (write(event_fd_, &one, sizeof(one)) < 0)
+  {
+    // Counter saturated, the publisher is already signalled
+  }
+}
+
+bool SnavAcquisition::WaitForSnapshot(double timeout)
+{
+  struct pollfd pfd;
+  pfd.fd = event_fd_;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  struct timespec ts;
+  ts.tv_sec = (time_t)timeout;
+  ts.tv_nsec = (long)((timeout - ts.tv_sec)*1e9);
+
+  if (ppoll(&pfd, 1, &ts, NULL) <= 0)
+    return false;
+
+  uint64_t count;
+  return read(event_fd_, &count, sizeof(count)) == sizeof(count);
+}
+
+uint32_t SnavAcquisition::GetSnapshot(SnavSnapshot& snapshot) const
+{
+  return snapshot_.Load(snapshot);
+}
+
+double SnavAcquisition::GetDataAge() const
+{
+  // Recorded data is never stale, however slowly it is replayed
+  if (replay_reader_ != NULL)
+    return 0.0;
+  if (holding_.load(std::memory_order_relaxed))
+    return 0.0;
+  int64_t last_ns = last_success_ns_.load(std::memory_order_relaxed);
+  if (last_ns == 0)
+    return 1e9;
+  // Time spent holding a lockstep sample does not count
+  last_ns = std::max(last_ns, released_ns_.load(std::memory_order_relaxed));
+  return (MonotonicNowNs() - last_ns)*1e-9;
+}
+
+bool SnavAcquisition::IsRpcStalled() const
+{
+  int64_t start_ns = rpc_start_ns_.load(std::memory_order_relaxed);
+  return start_ns != 0 && MonotonicNowNs() - start_ns > rpc_timeout_ns_;
+}
+
+SnavAcquisition::Stats SnavAcquisition::GetStats() const
+{
+  Stats stats;
+  stats.rpc_count = rpc_count_.load(std::memory_order_relaxed);
+  stats.rpc_failures = rpc_failures_.load(std::memory_order_relaxed);
+  stats.consecutive_failures = consecutive_failures_.load(std::memory_order_relaxed);
+  stats.backoff = backoff_ns_.load(std::memory_order_relaxed)*1e-9;
+  stats.reconnects = reconnects_.load(std::memory_order_relaxed);
+  stats.reconnect_failures = reconnect_failures_.load(std::memory_order_relaxed);
+  stats.rpc_timeouts = rpc_timeouts_.load(std::memory_order_relaxed);
+  stats.rpc_duration_mean = stats.rpc_count == 0 ? 0.0 :
+      rpc_duration_total_ns_.load(std::memory_order_relaxed)*1e-9/stats.rpc_count;
+  stats.rpc_duration_max = rpc_duration_max_ns_.load(std::memory_order_relaxed)*1e-9;
+  stats.est_samples = est_samples_.load(std::memory_order_relaxed);
+  stats.est_duplicates = est_duplicates_.load(std::memory_order_relaxed);
+  stats.sim_samples = sim_samples_.load(std::memory_order_relaxed);
+  stats.sim_duplicates = sim_duplicates_.load(std::memory_order_relaxed);
+  stats.sample_period = sample_period_ns_.load(std::memory_order_relaxed)*1e-9;
+  stats.empty_polls = empty_polls_.load(std::memory_order_relaxed);
+  stats.poll_deadline_misses = poll_deadline_misses_.load(std::memory_order_relaxed);
+  stats.late_samples = late_samples_.load(std::memory_order_relaxed);
+  return stats;
+}
@@ -0,0 +1,368 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include "snav_interface/snav_command_engine.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <time.h>
+
+#include <ros/ros.h>
+
+#include "snav_interface/clock_utils.hpp"
+
+namespace
+{
+
+// Zero sticks in position hold, whatever mode the timed out command used:
+// zero sticks in a rates or thrust/angle mode do not hold the vehicle
+const SnavCommandEngine::RcCommand kHoverCommand =
+{
+  0.0f, 0.0f, 0.0f, 0.0f, SN_RC_POS_HOLD_CMD, RC_OPT_LINEAR_MAPPING, 0
+};
+
+}
+
+SnavCommandEngine::SnavCommandEngine()
+  : running_(false),
+    period_ns_(10000000),
+    timeout_ns_(500000000),
+    failsafe_timeout_ns_(2000000000),
+    trajectory_cursor_(0),
+    trajectory_underrun_(false),
+    hovering_(false),
+    failsafe_(false),
+    commands_received_(0),
+    commands_sent_(0),
+    hover_sent_(0),
+    timeouts_(0),
+    failsafe_releases_(0),
+    deadline_misses_(0),
+    age_total_ns_(0),
+    age_max_ns_(0),
+    age_last_ns_(0),
+    traj_batches_(0),
+    traj_splices_(0),
+    traj_setpoints_sent_(0),
+    traj_underruns_(0),
+    traj_underrun_cycles_(0),
+    traj_receive_latency_total_ns_(0),
+    traj_receive_latency_max_ns_(0),
+    traj_lead_last_ns_(0),
+    traj_lead_min_ns_(std::numeric_limits<int64_t>::max())
+{
+}
+
+SnavCommandEngine::~SnavCommandEngine()
+{
+  Stop();
+}
+
+void SnavCommandEngine::Start(double rate, double timeout, double failsafe_timeout)
+{
+  period_ns_ = (int64_t)(1e9/rate);
+  SetTimeouts(timeout, failsafe_timeout);
+  running_ = true;
+  thread_ = std::thread(&SnavCommandEngine::Run, this);
+}
+
+void SnavCommandEngine::Stop()
+{
+  running_ = false;
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void SnavCommandEngine::SetTimeouts(double timeout, double failsafe_timeout)
+{
+  timeout_ns_ = (int64_t)(timeout*1e9);
+  failsafe_timeout_ns_ = std::max((int64_t)(failsafe_timeout*1e9), timeout_ns_);
+}
+
+void SnavCommandEngine::SetRcCommand(const RcCommand& command)
+{
+  SetRcCommand(command, MonotonicNowNs());
+}
+
+void SnavCommandEngine::SetRcCommand(const RcCommand& command, int64_t now_ns)
+{
+  RcCommand stamped = command;
+  stamped.received_ns = now_ns;
+  mailbox_.Store(stamped);
+  commands_received_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SnavCommandEngine::SetTrajectory(const std::shared_ptr<SnavTrajectory>& trajectory,
+    bool replace)
+{
+  SetTrajectory(trajectory, replace, MonotonicNowNs(), (int64_t)ros::Time::now().toNSec());
+}
+
+void SnavCommandEngine::SetTrajectory(const std::shared_ptr<SnavTrajectory>& trajectory,
+    bool replace, int64_t now_ns, int64_t ros_now_ns)
+{
+  if (trajectory->samples.empty())
+    return;
+
+  std::shared_ptr<const SnavTrajectory> current = std::atomic_load(&trajectory_);
+
+  // Splice: keep buffered setpoints that precede the new batch, dropping
+  // those already in the past so the buffer stays bounded
+  if (!replace && current && !current->samples.empty())
+  {
+    int64_t splice_ns = trajectory->samples.front().time_ns;
+    std::vector<SnavTrajectory::Sample> merged;
+    merged.reserve(current->samples.size() + trajectory->samples.size());
+    for (size_t i = 0; i < current->samples.size(); ++i)
+    {
+      const SnavTrajectory::Sample& sample = current->samples[i];
+      if (sample.time_ns >= splice_ns)
+        break;
+      bool next_in_past = i + 1 < current->samples.size() &&
+          current->samples[i + 1].time_ns <= ros_now_ns;
+      if (!next_in_past)
+        merged.push_back(sample);
+    }
+    if (!merged.empty())
+      traj_splices_.fetch_add(1, std::memory_order_relaxed);
+    merged.insert(merged.end(), trajectory->samples.begin(), trajectory->samples.end());
+    trajectory->samples.swap(merged);
+  }
+
+  trajectory->received_ns = now_ns;
+  std::atomic_store(&trajectory_, std::shared_ptr<const SnavTrajectory>(trajectory));
+
+  traj_batches_.fetch_add(1, std::memory_order_relaxed);
+  int64_t latency_ns = ros_now_ns - trajectory->stamp_ns;
+  traj_receive_latency_total_ns_.fetch_add(latency_ns, std::memory_order_relaxed);
+  if (latency_ns > traj_receive_latency_max_ns_.load(std::memory_order_relaxed))
+    traj_receive_latency_max_ns_.store(latency_ns, std::memory_order_relaxed);
+  int64_t lead_ns = trajectory->GetEndTime() - ros_now_ns;
+  traj_lead_last_ns_.store(lead_ns, std::memory_order_relaxed);
+  if (lead_ns < traj_lead_min_ns_.load(std::memory_order_relaxed))
+    traj_lead_min_ns_.store(lead_ns, std::memory_order_relaxed);
+}
+
+void SnavCommandEngine::SetTrajCommand(const TrajCommand& command)
+{
+  SetTrajCommand(command, MonotonicNowNs());
+}
+
+void SnavCommandEngine::SetTrajCommand(const TrajCommand& command, int64_t now_ns)
+{
+  TrajCommand stamped = command;
+  stamped.received_ns = now_ns;
+  traj_mailbox_.Store(stamped);
+}
+
+void SnavCommandEngine::Run()
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  while (running_)
+  {
+    deadline.tv_nsec += period_ns_;
+    while (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_nsec -= 1000000000L;
+      ++deadline.tv_sec;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+
+    int64_t now_ns = MonotonicNowNs();
+    int64_t deadline_ns = (int64_t)deadline.tv_sec*1000000000LL + deadline.tv_nsec;
+    if (now_ns - deadline_ns > period_ns_)
+    {
+      // Woke up more than a period late, skip ahead instead of bursting
+      deadline_misses_.fetch_add(1, std::memory_order_relaxed);
+      deadline.tv_sec = now_ns/1000000000LL;
+      deadline.tv_nsec = now_ns%1000000000LL;
+    }
+
+    Tick(now_ns, (int64_t)ros::Time::now().toNSec());
+  }
+}
+
+void SnavCommandEngine::Tick(int64_t now_ns, int64_t ros_now_ns)
+{
+  RcCommand command;
+  mailbox_.Load(command);
+  TrajCommand traj_command;
+  traj_mailbox_.Load(traj_command);
+  std::shared_ptr<const SnavTrajectory> trajectory = std::atomic_load(&trajectory_);
+
+  // Whichever interface was commanded last owns the vehicle
+  int64_t rc_ns = command.received_ns;
+  int64_t buffered_ns = trajectory ? trajectory->received_ns : 0;
+  int64_t direct_ns = traj_command.received_ns;
+
+  if (direct_ns > rc_ns && direct_ns > buffered_ns)
+  {
+    if (!HoldOnTimeout(now_ns - direct_ns))
+      SendTrajectoryCommand(traj_command.setpoint);
+    return;
+  }
+
+  if (buffered_ns > rc_ns)
+  {
+    // Stale once both the batch and its final setpoint are older than the
+    // timeout, the final setpoint is not held forever
+    int64_t past_end_ns = ros_now_ns - trajectory->GetEndTime();
+    if (!HoldOnTimeout(std::min(now_ns - buffered_ns, past_end_ns)))
+      ExecuteTrajectory(trajectory, ros_now_ns);
+    return;
+  }
+
+  // Nothing to stream until someone has commanded the vehicle
+  if (rc_ns == 0)
+    return;
+
+  uint64_t age_ns = now_ns - command.received_ns;
+  if (HoldOnTimeout(age_ns))
+    return;
+
+  SendRcCommand(command);
+  commands_sent_.fetch_add(1, std::memory_order_relaxed);
+  age_total_ns_.fetch_add(age_ns, std::memory_order_relaxed);
+  age_histogram_.Record(age_ns);
+  age_last_ns_.store(age_ns, std::memory_order_relaxed);
+  if (age_ns > age_max_ns_.load(std::memory_order_relaxed))
+    age_max_ns_.store(age_ns, std::memory_order_relaxed);
+}
+
+bool SnavCommandEngine::HoldOnTimeout(int64_t age_ns)
+{
+  if (age_ns <= timeout_ns_)
+  {
+    hovering_.store(false, std::memory_order_relaxed);
+    failsafe_.store(false, std::memory_order_relaxed);
+    return false;
+  }
+
+  if (!hovering_.exchange(true, std::memory_order_relaxed))
+    timeouts_.fetch_add(1, std::memory_order_relaxed);
+  if (age_ns > failsafe_timeout_ns_)
+  {
+    // Going silent is what makes snav's RC-loss failsafe trigger
+    if (!failsafe_.exchange(true, std::memory_order_relaxed))
+      failsafe_releases_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  SendRcCommand(kHoverCommand);
+  hover_sent_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void SnavCommandEngine::ExecuteTrajectory(const std::shared_ptr<const SnavTrajectory>& trajectory,
+    int64_t ros_now_ns)
+{
+  if (trajectory != executing_trajectory_)
+  {
+    executing_trajectory_ = trajectory;
+    trajectory_cursor_ = 0;
+    trajectory_underrun_ = false;
+  }
+
+  SnavTrajectory::Sample setpoint;
+  if (!trajectory->Evaluate(ros_now_ns, trajectory_cursor_, setpoint))
+  {
+    // Ran out of setpoints, hold the final position until a new batch arrives
+    if (!trajectory_underrun_.exchange(true, std::memory_order_relaxed))
+      traj_underruns_.fetch_add(1, std::memory_order_relaxed);
+    traj_underrun_cycles_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  SendTrajectoryCommand(setpoint);
+}
+
+void SnavCommandEngine::SendTrajectoryCommand(const SnavTrajectory::Sample& setpoint)
+{
+  sn_send_trajectory_tracking_command(SN_POSITION_CONTROL_VIO, SN_TRAJ_DEFAULT,
+      setpoint.position[0], setpoint.position[1], setpoint.position[2],
+      setpoint.velocity[0], setpoint.velocity[1], setpoint.velocity[2],
+      setpoint.acceleration[0], setpoint.acceleration[1], setpoint.acceleration[2],
+      setpoint.yaw, setpoint.yaw_rate);
+  traj_setpoints_sent_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SnavCommandEngine::SendRcCommand(const RcCommand& command)
+{
+  float snav_rc_cmd[4];
+
+  sn_apply_cmd_mapping(command.type, command.mapping,
+      command.x,
+      command.y,
+      command.z,
+      command.yaw,
+      &snav_rc_cmd[0],
+      &snav_rc_cmd[1],
+      &snav_rc_cmd[2],
+      &snav_rc_cmd[3]);
+
+  sn_send_rc_command(command.type, command.mapping,
+      snav_rc_cmd[0],
+      snav_rc_cmd[1],
+      snav_rc_cmd[2],
+      snav_rc_cmd[3]);
+}
+
+SnavCommandEngine::Stats SnavCommandEngine::GetStats() const
+{
+  Stats stats;
+  stats.commands_received = commands_received_.load(std::memory_order_relaxed);
+  stats.commands_sent = commands_sent_.load(std::memory_order_relaxed);
+  stats.hover_sent = hover_sent_.load(std::memory_order_relaxed);
+  stats.timeouts = timeouts_.load(std::memory_order_relaxed);
+  stats.failsafe_releases = failsafe_releases_.load(std::memory_order_relaxed);
+  stats.deadline_misses = deadline_misses_.load(std::memory_order_relaxed);
+  stats.age_mean = stats.commands_sent == 0 ? 0.0 :
+      age_total_ns_.load(std::memory_order_relaxed)*1e-9/stats.commands_sent;
+  stats.age_max = age_max_ns_.load(std::memory_order_relaxed)*1e-9;
+  stats.age_last = age_last_ns_.load(std::memory_order_relaxed)*1e-9;
+  stats.hovering = hovering_.load(std::memory_order_relaxed);
+  stats.failsafe = failsafe_.load(std::memory_order_relaxed);
+
+  stats.traj_batches = traj_batches_.load(std::memory_order_relaxed);
+  stats.traj_splices = traj_splices_.load(std::memory_order_relaxed);
+  stats.traj_setpoints_sent = traj_setpoints_sent_.load(std::memory_order_relaxed);
+  stats.traj_underruns = traj_underruns_.load(std::memory_order_relaxed);
+  stats.traj_underrun_cycles = traj_underrun_cycles_.load(std::memory_order_relaxed);
+  stats.traj_starved = trajectory_underrun_.load(std::memory_order_relaxed);
+  stats.traj_receive_latency_mean = stats.traj_batches == 0 ? 0.0 :
+      traj_receive_latency_total_ns_.load(std::memory_order_relaxed)*1e-9/stats.traj_batches;
+  stats.traj_receive_latency_max = traj_receive_latency_max_ns_.load(std::memory_order_relaxed)*1e-9;
+  stats.traj_lead_last = traj_lead_last_ns_.load(std::memory_order_relaxed)*1e-9;
+  stats.traj_lead_min = stats.traj_batches == 0 ? 0.0 :
+      traj_lead_min_ns_.load(std::memory_order_relaxed)*1e-9;
+  return stats;
+}
@@ -33,28 +33,87 @@
  ****************************************************************************/
 #include "snav_interface/snav_interface.hpp"
 
-SnavInterface::SnavInterface(ros::NodeHandle nh, ros::NodeHandle pnh) : nh_(nh), pnh_(pnh)
-{
-  if(sn_get_flight_data_ptr(sizeof(SnavCachedData),&cached_data_)!=0){
-    ROS_ERROR("Error getting cached data.\n");
-  };
-  sn_update_data();
-  last_sn_update_ = ros::Time::now();
-  last_gen_command_time_ = ros::Time(0);
-  last_traj_command_time_ = ros::Time(0);
+#include <algorithm>
+
+#include "snav_interface/clock_utils.hpp"
+#include "snav_interface/topic_names.hpp"
 
+const char* SnavInterface::kProfileStageNames[SnavInterface::NUM_PROFILE_STAGES] =
+{
+  "snapshot",
+  "update_pose",
+  "update_sim",
+  "publish",
+  "tf",
+  "cycle",
+  "gen_cmd_callback",
+  "traj_batch_callback",
+  "acquired_to_published",
+  "sample_age"
+};
+
+// Also the prefixes of the <name>_rate params
+const char* SnavInterface::kOutputNames[SnavInterface::NUM_OUTPUTS] =
+{
+  "pose",
+  "pose_des",
+  "vel",
+  "sim_gt_pose",
+  "imu_batch",
+  "esc_batch",
+  "compact_state",
+  "odom",
+  "battery_voltage",
+  "on_ground",
+  "props_state",
+  "shared_state",
+  "est_tf",
+  "base_link_no_rot_tf",
+  "base_link_stab_tf",
+  "des_tf",
+  "gps_tf",
+  "sim_gt_tf"
+};
+
+SnavInterface::SnavInterface(ros::NodeHandle nh, ros::NodeHandle pnh) : nh_(nh), pnh_(pnh),
+  pose_pool_(12), bool_pool_(8)
+{
   // Setup the publishers
-  pose_est_publisher_ = nh_.advertise<geometry_msgs::PoseStamped>("pose", 10);
-  pose_des_publisher_ = nh_.advertise<geometry_msgs::PoseStamped>("pose_des", 10);
-  vel_est_publisher_ = nh_.advertise<geometry_msgs::Twist>("vel", 10);
-  battery_voltage_publisher_ = nh_.advertise<std_msgs::Float32>("battery_voltage", 10);
-  on_ground_publisher_ = nh_.advertise<std_msgs::Bool>("on_ground", 10);
-  props_state_publisher_ = nh_.advertise<std_msgs::Bool>("props_state", 10);
+  // Outputs are only computed while someone listens, so track who does
+  ros::SubscriberStatusCallback subscribers_changed =
+      boost::bind(&SnavInterface::SubscribersChanged, this, _1);
+  active_outputs_ = 0;
+  pose_est_publisher_ = nh_.advertise<geometry_msgs::PoseStamped>(kPoseTopic, 10,
+      subscribers_changed, subscribers_changed);
+  pose_des_publisher_ = nh_.advertise<geometry_msgs::PoseStamped>(kPoseDesTopic, 10,
+      subscribers_changed, subscribers_changed);
+  pose_sim_gt_publisher_ = nh_.advertise<geometry_msgs::PoseStamped>(kPoseSimGtTopic, 10,
+      subscribers_changed, subscribers_changed);
+  vel_est_publisher_ = nh_.advertise<geometry_msgs::Twist>(kVelTopic, 10,
+      subscribers_changed, subscribers_changed);
+  odom_est_publisher_ = nh_.advertise<nav_msgs::Odometry>(kOdomTopic, 10,
+      subscribers_changed, subscribers_changed);
+  imu_batch_publisher_ = nh_.advertise<snav_ros::ImuBatch>(kImuBatchTopic, 10,
+      subscribers_changed, subscribers_changed);
+  esc_batch_publisher_ = nh_.advertise<snav_ros::EscBatch>(kEscBatchTopic, 10,
+      subscribers_changed, subscribers_changed);
+  compact_state_publisher_ = nh_.advertise<snav_ros::CompactState>(kCompactStateTopic, 10,
+      subscribers_changed, subscribers_changed);
+  battery_voltage_publisher_ = nh_.advertise<std_msgs::Float32>(kBatteryVoltageTopic, 10);
+  on_ground_publisher_ = nh_.advertise<std_msgs::Bool>(kOnGroundTopic, 10);
+  props_state_publisher_ = nh_.advertise<std_msgs::Bool>(kPropsStateTopic, 10);
+  diagnostics_publisher_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+  tf_publisher_ = nh_.advertise<tf2_msgs::TFMessage>(kTfTopic, 100,
+      subscribers_changed, subscribers_changed);
 
   cmd_type_subscriber_ = nh_.subscribe("cmd_type", 10, &SnavInterface::CmdTypeCallback, this);
   mapping_type_subscriber_ = nh_.subscribe("mapping_type", 10, &SnavInterface::MappingTypeCallback, this);
-  gen_cmd_subscriber_ = nh_.subscribe("gen_cmd", 10, &SnavInterface::GenCmdCallback, this);
+  // Only the newest command matters, stale ones are never replayed
+  gen_cmd_subscriber_ = nh_.subscribe("gen_cmd", 1, &SnavInterface::GenCmdCallback, this,
+      ros::TransportHints().tcpNoDelay());
   traj_cmd_subscriber_ = nh_.subscribe("traj_cmd", 10, &SnavInterface::TrajCmdCallback, this);
+  traj_batch_subscriber_ = nh_.subscribe("traj_batch", 10, &SnavInterface::TrajBatchCallback, this,
+      ros::TransportHints().tcpNoDelay());
   start_props_subscriber_ = nh_.subscribe("start_props", 10, &SnavInterface::StartPropsCallback, this);
   stop_props_subscriber_ = nh_.subscribe("stop_props", 10, &SnavInterface::StopPropsCallback, this);
 
@@ -68,6 +127,192 @@ SnavInterface::SnavInterface(ros::NodeHandle nh, ros::NodeHandle pnh) : nh_(nh),
 
   pnh_.param("simulation", simulation_, false);
 
+  tf_batch_.transforms.reserve(NUM_TF_FRAMES);
+  tf_messages_[TF_EST] = &est_transform_msg_;
+  tf_messages_[TF_BASE_LINK_NO_ROT] = &base_link_no_rot_transform_msg_;
+  tf_messages_[TF_BASE_LINK_STAB] = &base_link_stab_transform_msg_;
+  tf_messages_[TF_DESIRED] = &des_transform_msg_;
+  tf_messages_[TF_GPS_ENU] = &gps_enu_transform_msg_;
+  tf_messages_[TF_SIM_GT] = &sim_gt_transform_msg_;
+  tf_queued_ = 0;
+
+  // Frame ids never change, so headers are only stamped per sample
+  est_transform_msg_.header.frame_id = estimation_frame_;
+  est_transform_msg_.child_frame_id = base_link_frame_;
+  est_pose_msg_.header.frame_id = estimation_frame_;
+  des_transform_msg_.header.frame_id = estimation_frame_;
+  des_transform_msg_.child_frame_id = desired_frame_;
+  des_pose_msg_.header.frame_id = estimation_frame_;
+  gps_enu_transform_msg_.header.frame_id = estimation_frame_;
+  gps_enu_transform_msg_.child_frame_id = gps_enu_frame_;
+  base_link_no_rot_transform_msg_.header.frame_id = base_link_frame_;
+  base_link_no_rot_transform_msg_.child_frame_id = base_link_no_rot_frame_;
+  base_link_stab_transform_msg_.header.frame_id = base_link_no_rot_frame_;
+  base_link_stab_transform_msg_.child_frame_id = base_link_stab_frame_;
+  sim_gt_transform_msg_.header.frame_id = base_link_frame_;
+  sim_gt_transform_msg_.child_frame_id = sim_gt_frame_;
+  sim_gt_pose_msg_.header.frame_id = sim_gt_frame_;
+
+  double loop_freq, sample_poll_period, rpc_timeout;
+  pnh_.param("loop_frequency", loop_freq, 100.0);
+  pnh_.param("sample_poll_period", sample_poll_period, 0.0002);
+  pnh_.param("rpc_timeout", rpc_timeout, 0.05);
+  max_sample_wait_ = 1.0/loop_freq;
+  rpc_timeout_ = rpc_timeout;
+
+  std::memset(&snapshot_, 0, sizeof(snapshot_));
+
+  // A flight record stands in for snav, nothing is commanded or recorded
+  std::string replay_path;
+  pnh_.param("replay_path", replay_path, std::string(""));
+  pnh_.param("replay_exit_on_end", replay_exit_on_end_, true);
+  replaying_ = !replay_path.empty();
+  replay_end_reported_ = false;
+
+  std::string record_path;
+  pnh_.param("record_path", record_path, std::string(""));
+  if (!record_path.empty() && !replaying_)
+  {
+    int record_size_mb;
+    double record_flush_period, record_sync_period;
+    pnh_.param("record_size_mb", record_size_mb, 64);
+    pnh_.param("record_flush_period", record_flush_period, 0.1);
+    pnh_.param("record_sync_period", record_sync_period, 1.0);
+    if (flight_recorder_.Open(record_path, (size_t)record_size_mb << 20,
+          record_flush_period, record_sync_period, &clock_sync_))
+      acquisition_.SetRecorder(&flight_recorder_);
+  }
+
+  // Full-rate IMU and ESC feedback, batch_size consecutive samples per message
+  bool publish_imu, publish_esc;
+  int imu_batch_size, esc_batch_size;
+  std::string imu_frame;
+  pnh_.param("publish_imu", publish_imu, false);
+  pnh_.param("imu_batch_size", imu_batch_size, 10);
+  pnh_.param("imu_frame", imu_frame, base_link_frame_);
+  pnh_.param("publish_esc", publish_esc, false);
+  pnh_.param("esc_batch_size", esc_batch_size, 10);
+  acquisition_.GetImuStream().SetEnabled(publish_imu);
+  acquisition_.GetEscStream().SetEnabled(publish_esc);
+
+  imu_batch_msg_.header.frame_id = imu_frame;
+  imu_batch_msg_.samples.resize(std::max(imu_batch_size, 1));
+  imu_batch_msg_.temperature.resize(imu_batch_msg_.samples.size());
+  for (size_t i = 0; i < imu_batch_msg_.samples.size(); ++i)
+  {
+    // snav_ros does not report the orientation with the IMU
+    imu_batch_msg_.samples[i].header.frame_id = imu_frame;
+    imu_batch_msg_.samples[i].orientation_covariance[0] = -1;
+  }
+  esc_batch_msg_.header.frame_id = base_link_frame_;
+  esc_batch_msg_.samples.resize(std::max(esc_batch_size, 1));
+  imu_batch_fill_ = 0;
+  esc_batch_fill_ = 0;
+
+  // Quantization of the compact_state topic, see msg/CompactState.msg
+  int compact_position_exponent, compact_velocity_exponent;
+  int compact_angular_velocity_exponent, compact_orientation_bits;
+  pnh_.param("compact_position_exponent", compact_position_exponent, -3);
+  pnh_.param("compact_velocity_exponent", compact_velocity_exponent, -3);
+  pnh_.param("compact_angular_velocity_exponent", compact_angular_velocity_exponent, -3);
+  pnh_.param("compact_orientation_bits", compact_orientation_bits, 15);
+  compact_state_encoder_.reset(new CompactStateEncoder(compact_position_exponent,
+      compact_velocity_exponent, compact_angular_velocity_exponent, compact_orientation_bits));
+
+  // Odometry twist frame: body (base_link, as REP 105 expects) or world
+  // (estimation_frame, as on vel)
+  std::string odom_twist_frame;
+  pnh_.param("odom_twist_frame", odom_twist_frame, std::string("body"));
+  if (odom_twist_frame != "body" && odom_twist_frame != "world")
+  {
+    ROS_ERROR_STREAM("Unrecognized odom_twist_frame " << odom_twist_frame << ", using body");
+    odom_twist_frame = "body";
+  }
+  odom_twist_in_body_ = odom_twist_frame == "body";
+  est_odom_msg_.header.frame_id = estimation_frame_;
+  est_odom_msg_.child_frame_id = odom_twist_in_body_ ? base_link_frame_ : estimation_frame_;
+
+  // snav reports no covariance; these diagonals (x y z rx ry rz) are sent
+  // as they are, all zeros meaning unknown
+  std::vector<double> odom_pose_covariance, odom_twist_covariance;
+  pnh_.param("odom_pose_covariance", odom_pose_covariance, std::vector<double>());
+  pnh_.param("odom_twist_covariance", odom_twist_covariance, std::vector<double>());
+  for (size_t i = 0; i < 6; ++i)
+  {
+    if (i < odom_pose_covariance.size())
+      est_odom_msg_.pose.covariance[i*7] = odom_pose_covariance[i];
+    if (i < odom_twist_covariance.size())
+      est_odom_msg_.twist.covariance[i*7] = odom_twist_covariance[i];
+  }
+
+  // Latest state for non-ROS readers on the vehicle, see shared_state_reader.hpp
+  std::string shared_state_name;
+  pnh_.param("shared_state_name", shared_state_name, std::string(""));
+  std::memset(&shared_state_, 0, sizeof(shared_state_));
+  if (!shared_state_name.empty())
+  {
+    std::string error;
+    if (shared_state_writer_.Open(shared_state_name, error))
+      ROS_INFO_STREAM("Exporting state to shared memory " << shared_state_name);
+    else
+      ROS_ERROR_STREAM("Failed to open shared memory " << shared_state_name << ": " << error);
+  }
+
+  // Lockstep: one publish cycle per simulator step, none skipped or repeated
+  pnh_.param("lockstep", lockstep_, false);
+  pnh_.param("lockstep_ack_count", lockstep_ack_count_, 0);
+  pnh_.param("lockstep_ack_timeout", lockstep_ack_timeout_, 1.0);
+  if (lockstep_ && (!simulation_ || replaying_))
+  {
+    ROS_WARN("lockstep needs simulation and no replay_path, ignoring it");
+    lockstep_ = false;
+  }
+  lockstep_awaiting_ack_ = false;
+  lockstep_sequence_ = 0;
+  lockstep_steps_ = 0;
+  lockstep_ack_timeouts_ = 0;
+  snapshot_sequence_ = 0;
+  double rpc_backoff_initial, rpc_backoff_max;
+  int rpc_reconnect_failures;
+  pnh_.param("rpc_backoff_initial", rpc_backoff_initial, 0.001);
+  pnh_.param("rpc_backoff_max", rpc_backoff_max, 0.1);
+  pnh_.param("rpc_reconnect_failures", rpc_reconnect_failures, 100);
+  acquisition_.SetRpcBackoff(rpc_backoff_initial, rpc_backoff_max, rpc_reconnect_failures);
+
+  if (lockstep_)
+  {
+    acquisition_.SetLockstep(true);
+    if (lockstep_ack_count_ > 0)
+    {
+      // Acks are only waited for in WaitForNextCycle(), on their own queue
+      ros::SubscribeOptions ops;
+      ops.initByFullCallbackType<const ros::MessageEvent<std_msgs::Time const>&>("lockstep_ack", 100,
+          boost::bind(&SnavInterface::LockstepAckCallback, this, _1));
+      ops.callback_queue = &lockstep_ack_queue_;
+      ops.transport_hints = ros::TransportHints().tcpNoDelay();
+      lockstep_ack_subscriber_ = nh_.subscribe(ops);
+      lockstep_ackers_.reserve(lockstep_ack_count_);
+    }
+    ROS_INFO("Lockstep simulation, waiting for %d lockstep_ack publisher(s) per step",
+        std::max(lockstep_ack_count_, 0));
+  }
+
+  if (replaying_)
+  {
+    double replay_speed;
+    pnh_.param("replay_speed", replay_speed, 1.0);
+    std::string error;
+    if (!replay_reader_.Open(replay_path, error))
+      ROS_ERROR_STREAM("Failed to open flight record " << replay_path << ": " << error);
+    else if (acquisition_.StartReplay(&replay_reader_, replay_speed))
+      ROS_INFO_STREAM("Replaying records " << replay_reader_.GetFirst() << "-"
+                      << replay_reader_.GetLast() << " of " << replay_path << " at "
+                      << (replay_speed > 0.0 ? replay_speed : 0.0) << "x (0 = fast as possible)");
+  }
+  else if (!acquisition_.Start(sample_poll_period, max_sample_wait_, rpc_timeout_))
+    ROS_ERROR("Failed to start snav acquisition");
+  acquisition_.GetSnapshot(snapshot_);
+
   std::string rc_cmd_type_string;
   std::string rc_cmd_mapping_string;
 
@@ -77,16 +322,380 @@ SnavInterface::SnavInterface(ros::NodeHandle nh, ros::NodeHandle pnh) : nh_(nh),
   SetRcCommandType(rc_cmd_type_string);
   SetRcMappingType(rc_cmd_mapping_string);
 
-  if(!simulation_)
-    GetDSPTimeOffset();
+  double cmd_stream_rate, cmd_timeout, cmd_failsafe_timeout;
+  pnh_.param("cmd_stream_rate", cmd_stream_rate, 100.0);
+  pnh_.param("cmd_timeout", cmd_timeout, 0.5);
+  pnh_.param("cmd_failsafe_timeout", cmd_failsafe_timeout, 2.0);
+  if (!replaying_)
+    command_engine_.Start(cmd_stream_rate, cmd_timeout, cmd_failsafe_timeout);
+
+  std::string traj_replace_mode;
+  pnh_.param("traj_replace_mode", traj_replace_mode, std::string("splice"));
+  traj_replace_ = traj_replace_mode == "replace";
+  ROS_INFO_STREAM("traj_batch replace mode: " << (traj_replace_ ? "replace" : "splice"));
+
+  if (replaying_)
+  {
+    // Stamp with the clock model that was in use while recording
+    clock_sync_.StartFixed(replay_reader_.GetClockModel());
+    clock_publisher_ = nh_.advertise<rosgraph_msgs::Clock>("clock", 1);
+  }
+  else if(!simulation_)
+  {
+#ifdef QC_SOC_TARGET_APQ8096
+    static const char qdspTimerTickPath[] = "/sys/kernel/boot_slpi/qdsp_qtimer";
+#endif
+#ifdef QC_SOC_TARGET_APQ8074
+    static const char qdspTimerTickPath[] = "/sys/kernel/boot_adsp/qdsp_qtimer";
+#endif
+    double clock_sync_period;
+    int clock_sync_window;
+    pnh_.param("clock_sync_period", clock_sync_period, 1.0);
+    pnh_.param("clock_sync_window", clock_sync_window, 30);
+    if (!clock_sync_.Start(qdspTimerTickPath, clock_sync_period, clock_sync_window))
+      ROS_ERROR("Failed to start DSP clock sync");
+  }
   else
   {
-    dsp_offset_in_ns_  = 0;
+    clock_sync_.StartFixed(0);
     clock_publisher_ = nh_.advertise<rosgraph_msgs::Clock>("clock", 1);
   }
 
+  // Real-time, applied by ApplyRealtimeConfig() once all threads run
+  ReadThreadPolicy("acquisition", acquisition_policy_);
+  ReadThreadPolicy("publish", publish_policy_);
+  ReadThreadPolicy("command", command_policy_);
+  pnh_.param("lock_memory", lock_memory_, false);
+  pnh_.param("prefault_heap_mb", prefault_heap_mb_, 16);
+  pnh_.param("prefault_stack_kb", prefault_stack_kb_, 256);
+  pnh_.param("drop_privileges", drop_privileges_, false);
+  pnh_.param("run_as_user", run_as_user_, std::string(""));
+  realtime_applied_ = false;
+
   valid_rotation_est_ = false;
   valid_rotation_sim_gt_ = false;
+  frames_stale_ = true;
+
+  last_est_sample_time_ = 0;
+  last_sim_sample_time_ = 0;
+  new_est_sample_ = false;
+  new_sim_sample_ = false;
+
+  // Outputs
+  pnh_.param("publish_on_new_sample", publish_on_new_sample_, true);
+  publish_on_new_sample_ = publish_on_new_sample_ || lockstep_;
+  pnh_.param("publish_est_data", publish_est_data_, true);
+  pnh_.param("publish_sim_data", publish_sim_data_, true);
+  pnh_.param("broadcast_tf", broadcast_tf_, true);
+  pnh_.param("broadcast_des_tf", broadcast_des_tf_, true);
+  pnh_.param("broadcast_gps_tf", broadcast_gps_tf_, true);
+  pnh_.param("broadcast_sim_gt_tf", broadcast_sim_gt_tf_, true);
+  pnh_.param("publish_pose", publish_pose_, true);
+  pnh_.param("publish_des_pose", publish_des_pose_, true);
+  pnh_.param("publish_sim_gt_pose", publish_sim_gt_pose_, true);
+  pnh_.param("publish_vel", publish_vel_, true);
+  pnh_.param("publish_odom", publish_odom_, false);
+  pnh_.param("publish_compact_state", publish_compact_state_, false);
+  pnh_.param("lazy_outputs", lazy_outputs_, true);
+  UpdateActiveOutputs();
+  pnh_.param("zero_copy_publish", zero_copy_, false);
+  pnh_.param("preserialize", preserialize_, true);
+  pnh_.param("enable_profiling", profiling_, false);
+  loop_overruns_ = 0;
+  loop_deadline_misses_ = 0;
+
+  loop_period_ = ros::WallDuration(1.0/loop_freq);
+  next_cycle_ns_ = MonotonicNowNs();
+  double loop_phase_margin;
+  pnh_.param("loop_phase_margin", loop_phase_margin, 0.0002);
+  loop_phase_margin_ns_ = (int64_t)(loop_phase_margin*1e9);
+
+  // Output rates, low_freq_data_rate stays the default of the status outputs
+  double slow_loop_freq, diagnostics_freq;
+  pnh_.param("low_freq_data_rate", slow_loop_freq, 5.0);
+  for (int i = 0; i < NUM_OUTPUTS; ++i)
+  {
+    if ((1u << i) & BATCH_OUTPUTS)
+      continue;
+    double rate;
+    std::string name(kOutputNames[i]);
+    pnh_.param(name + "_rate", rate, (1u << i) & STATUS_OUTPUTS ? slow_loop_freq : 0.0);
+    // <frame>_tf_rate_divisor used to drop transforms on top of the rate;
+    // it is folded into the rate once so the two cannot compound
+    int divisor;
+    if (i >= OUTPUT_TF_SHIFT && pnh_.getParam(name + "_rate_divisor", divisor))
+    {
+      if (divisor > 1)
+        rate = (rate > 0.0 ? rate : loop_freq)/divisor;
+      ROS_WARN("%s_rate_divisor is deprecated, set %s_rate instead. Using %s_rate %f",
+          name.c_str(), name.c_str(), name.c_str(), rate);
+    }
+    if (!output_scheduler_.SetRate(i, rate))
+      ROS_ERROR("Ignoring %s_rate %f, publishing it every cycle", kOutputNames[i], rate);
+  }
+  set_output_rate_service_ = nh_.advertiseService("set_output_rate",
+      &SnavInterface::SetOutputRateCallback, this);
+
+  pnh_.param("diagnostics_rate", diagnostics_freq, 1.0);
+  active_outputs_timer_ = nh_.createTimer(ros::Duration(1.0/slow_loop_freq),
+                                          &SnavInterface::RefreshActiveOutputs, this);
+  diagnostics_timer_ = nh_.createTimer(ros::Duration(1.0/diagnostics_freq),
+                                       &SnavInterface::PublishDiagnostics, this);
+  pnh_.param("fault_summary_period", fault_summary_period_, 5.0);
+  fault_summary_timer_ = nh_.createTimer(ros::Duration(fault_summary_period_),
+                                         &SnavInterface::PublishFaultSummary, this);
+}
+
+SnavInterface::~SnavInterface()
+{
+  command_engine_.Stop();
+  acquisition_.Stop();
+  flight_recorder_.Close();
+  clock_sync_.Stop();
+}
+
+void SnavInterface::ReadThreadPolicy(const std::string& thread, ThreadPolicy& policy)
+{
+  std::string cpus;
+  pnh_.param(thread + "_priority", policy.priority, 0);
+  pnh_.param(thread + "_cpus", cpus, std::string(""));
+  if (!ParseCpuList(cpus, policy.cpus))
+  {
+    ROS_ERROR_STREAM("Ignoring malformed " << thread << "_cpus: " << cpus);
+    policy.cpus.clear();
+  }
+}
+
+void SnavInterface::ApplyRealtimeConfig(bool shared_process)
+{
+  if (acquisition_.IsRunning())
+    realtime_.ApplyThreadPolicy(acquisition_.GetThreadHandle(), "acquisition", acquisition_policy_);
+  if (command_engine_.IsRunning())
+    realtime_.ApplyThreadPolicy(command_engine_.GetThreadHandle(), "command", command_policy_);
+  realtime_.ApplyThreadPolicy(pthread_self(), "publish", publish_policy_);
+
+  // Locking memory changes rlimits and malloc tuning of every thread, and
+  // dropping root takes it from everything else in the process
+  if (lock_memory_ && shared_process)
+    realtime_.Refuse("mlockall", "not done in a shared process");
+  else if (lock_memory_)
+    realtime_.LockMemory((size_t)std::max(prefault_heap_mb_, 0) << 20,
+        (size_t)std::max(prefault_stack_kb_, 0) << 10);
+
+  // Last, setting priorities and locking memory need root
+  if (drop_privileges_ && shared_process)
+    realtime_.Refuse("drop privileges", "not done in a shared process");
+  else if (drop_privileges_)
+    realtime_.DropPrivileges(run_as_user_);
+
+  const std::vector<RealtimeSetup::Result>& results = realtime_.GetResults();
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    if (results[i].ok)
+      ROS_INFO_STREAM("Real-time " << results[i].step << ": " << results[i].detail);
+    else
+      ROS_WARN_STREAM("Real-time " << results[i].step << " failed: " << results[i].detail);
+  }
+  realtime_applied_.store(true, std::memory_order_release);
+}
+
+void SnavInterface::RunOnce()
+{
+  int64_t cycle_start_ns = MonotonicNowNs();
+
+  {
+    ScopedLatency timer(Profile(STAGE_SNAPSHOT));
+    UpdateSnavData();
+  }
+
+  const uint32_t est_outputs = OUTPUT_POSE | OUTPUT_DES_POSE | OUTPUT_VEL | OUTPUT_ODOM |
+      OUTPUT_COMPACT_STATE | OUTPUT_SHARED_STATE |
+      TfOutput(TF_EST) | TfOutput(TF_BASE_LINK_NO_ROT) | TfOutput(TF_BASE_LINK_STAB) |
+      TfOutput(TF_DESIRED) | TfOutput(TF_GPS_ENU);
+  const uint32_t sim_outputs = OUTPUT_SIM_GT_POSE | TfOutput(TF_SIM_GT);
+
+  // Outputs that could be produced this cycle; one that is due but waits
+  // for a sample stays pending in the scheduler
+  uint32_t ready = ALL_OUTPUTS;
+  if (!publish_est_data_ || (publish_on_new_sample_ && !NewEstSample()))
+    ready &= ~est_outputs;
+  if (!publish_sim_data_ || (publish_on_new_sample_ && !NewSimSample()))
+    ready &= ~sim_outputs;
+
+  // Active outputs are refreshed on subscriber changes, never queried from
+  // here. Rates follow /clock where it runs off the wall clock.
+  const int64_t schedule_ns = lockstep_ || replaying_ ? (int64_t)sim_time_.toNSec() : cycle_start_ns;
+  const uint32_t outputs = output_scheduler_.Take(schedule_ns, GetActiveOutputs() & ready);
+
+  bool published_est = false;
+  if (outputs & est_outputs)
+  {
+    {
+      ScopedLatency timer(Profile(STAGE_UPDATE_POSE));
+      // The compact state is packed from the pose and velocity messages
+      UpdatePoseMessages(outputs & OUTPUT_COMPACT_STATE ? outputs | OUTPUT_POSE | OUTPUT_VEL : outputs);
+    }
+
+    // A NaN rotation has been counted once, none of its outputs are sent
+    if (valid_rotation_est_)
+    {
+      ScopedLatency timer(Profile(STAGE_PUBLISH));
+      if (outputs & TfOutput(TF_DESIRED))
+        BroadcastDesiredTf();
+      if (outputs & OUTPUT_DES_POSE)
+        PublishDesiredPose();
+      if (outputs & TfOutput(TF_EST))
+        BroadcastEstTf();
+      if (outputs & TfOutput(TF_BASE_LINK_NO_ROT))
+        BroadcastBaseLinkNoRotTf();
+      if (outputs & TfOutput(TF_BASE_LINK_STAB))
+        BroadcastBaseLinkStabTf();
+      if (outputs & OUTPUT_POSE)
+        PublishEstPose();
+      if (outputs & OUTPUT_VEL)
+        PublishEstVel();
+      if (outputs & OUTPUT_ODOM)
+        PublishEstOdom();
+      if (outputs & OUTPUT_COMPACT_STATE)
+        PublishCompactState();
+      if (outputs & OUTPUT_SHARED_STATE)
+        PublishSharedState();
+      if (outputs & TfOutput(TF_GPS_ENU))
+        BroadcastGpsEnuTf();
+      published_est = true;
+    }
+  }
+
+  if (outputs & sim_outputs)
+  {
+    {
+      ScopedLatency timer(Profile(STAGE_UPDATE_SIM));
+      UpdateSimMessages(outputs);
+    }
+
+    if (valid_rotation_sim_gt_)
+    {
+      ScopedLatency timer(Profile(STAGE_PUBLISH));
+      if (outputs & TfOutput(TF_SIM_GT))
+        BroadcastSimGtTf();
+      if (outputs & OUTPUT_SIM_GT_POSE)
+        PublishSimGtPose();
+    }
+  }
+
+  {
+    ScopedLatency timer(Profile(STAGE_PUBLISH));
+    if (outputs & STATUS_OUTPUTS)
+      PublishStatusData(outputs);
+    PublishImuBatches((outputs & OUTPUT_IMU) != 0);
+    PublishEscBatches((outputs & OUTPUT_ESC) != 0);
+  }
+
+  {
+    ScopedLatency timer(Profile(STAGE_TF));
+    SendTfBatch();
+  }
+
+  if (lockstep_ && (NewEstSample() || NewSimSample()))
+    FinishLockstepStep();
+
+  // Overruns and sample age are health metrics and always recorded, the
+  // stage timings only when profiling
+  int64_t cycle_end_ns = MonotonicNowNs();
+  if (cycle_end_ns - cycle_start_ns > loop_period_.toNSec())
+    loop_overruns_.fetch_add(1, std::memory_order_relaxed);
+  if (published_est && valid_rotation_est_)
+    profile_[STAGE_SAMPLE_AGE].Record(
+        (int64_t)ros::Time::now().toNSec() - clock_sync_.ToRealtimeNs(snapshot_.pos_vel.time));
+  if (profiling_)
+  {
+    profile_[STAGE_CYCLE].Record(cycle_end_ns - cycle_start_ns);
+    if (published_est && valid_rotation_est_)
+      profile_[STAGE_ACQUIRED_TO_PUBLISHED].Record(cycle_end_ns - snapshot_.acquired_time_ns);
+  }
+}
+
+void SnavInterface::WaitForNextCycle()
+{
+  if (lockstep_awaiting_ack_)
+    WaitForLockstepAck();
+
+  if (publish_on_new_sample_)
+  {
+    SleepUntilNextSample();
+    return;
+  }
+
+  // Fixed rate on absolute deadlines, shifted so that a cycle falls right
+  // after each sample the acquisition thread expects
+  const int64_t period_ns = loop_period_.toNSec();
+  next_cycle_ns_ += period_ns;
+  int64_t expected_sample_ns = acquisition_.GetExpectedSampleNs();
+  if (expected_sample_ns > 0)
+  {
+    int64_t shift = (expected_sample_ns + loop_phase_margin_ns_ - next_cycle_ns_) % period_ns;
+    if (shift < 0)
+      shift += period_ns;
+    if (shift > period_ns/2)
+      shift -= period_ns;
+    next_cycle_ns_ += shift;
+  }
+
+  // Catch up without bursting if a cycle overran
+  int64_t now_ns = MonotonicNowNs();
+  if (next_cycle_ns_ <= now_ns)
+  {
+    loop_deadline_misses_.fetch_add(1, std::memory_order_relaxed);
+    next_cycle_ns_ = now_ns;
+    return;
+  }
+  SleepUntilNs(next_cycle_ns_);
+}
+
+void SnavInterface::FinishLockstepStep()
+{
+  lockstep_steps_.fetch_add(1, std::memory_order_relaxed);
+  if (lockstep_ack_count_ <= 0)
+  {
+    acquisition_.MarkConsumed(snapshot_sequence_);
+    return;
+  }
+  // Released once acknowledged, see WaitForLockstepAck()
+  lockstep_awaiting_ack_ = true;
+  lockstep_sequence_ = snapshot_sequence_;
+  lockstep_step_time_ = sim_time_;
+  lockstep_ackers_.clear();
+}
+
+void SnavInterface::WaitForLockstepAck()
+{
+  ros::WallTime give_up = ros::WallTime::now() + ros::WallDuration(lockstep_ack_timeout_);
+  while (lockstep_awaiting_ack_ && ros::ok())
+  {
+    ros::WallDuration remaining = give_up - ros::WallTime::now();
+    if (remaining <= ros::WallDuration(0))
+    {
+      lockstep_ack_timeouts_.fetch_add(1, std::memory_order_relaxed);
+      ROS_WARN_THROTTLE(1.0, "lockstep_ack: %zu of %d acknowledgments within %.3f s, stepping on",
+          lockstep_ackers_.size(), lockstep_ack_count_, lockstep_ack_timeout_);
+      break;
+    }
+    lockstep_ack_queue_.callAvailable(remaining);
+  }
+  lockstep_awaiting_ack_ = false;
+  acquisition_.MarkConsumed(lockstep_sequence_);
+}
+
+void SnavInterface::LockstepAckCallback(const ros::MessageEvent<std_msgs::Time const>& event)
+{
+  // Acks of earlier steps, e.g. after a timeout, do not count
+  if (!lockstep_awaiting_ack_ || event.getMessage()->data < lockstep_step_time_)
+    return;
+  const std::string& publisher = event.getPublisherName();
+  if (std::find(lockstep_ackers_.begin(), lockstep_ackers_.end(), publisher) == lockstep_ackers_.end())
+    lockstep_ackers_.push_back(publisher);
+  if ((int)lockstep_ackers_.size() >= lockstep_ack_count_)
+    lockstep_awaiting_ack_ = false;
 }
 
 void SnavInterface::SetRcMappingType(std::string rc_cmd_mapping_string)
@@ -179,53 +788,343 @@ void SnavInterface::SetRcCommandType(std::string rc_cmd_type_string)
   }
 }
 
-void SnavInterface::GetDSPTimeOffset()
+void SnavInterface::RefreshActiveOutputs(const ros::TimerEvent& event)
 {
-  // get the adsp offset.
-  int64_t dsptime;
-#ifdef QC_SOC_TARGET_APQ8096
-  static const char qdspTimerTickPath[] = "/sys/kernel/boot_slpi/qdsp_qtimer";
-#endif
-#ifdef QC_SOC_TARGET_APQ8074
-  static const char qdspTimerTickPath[] = "/sys/kernel/boot_adsp/qdsp_qtimer";
-#endif
-  char qdspTicksStr[20] = "";
+  // Subscriber callbacks already keep this current
+  UpdateActiveOutputs();
+}
 
-  static const double clockFreq = 1 / 19.2;
-  FILE * qdspClockfp = fopen( qdspTimerTickPath, "r" );
-  fread( qdspTicksStr, 16, 1, qdspClockfp );
-  uint64_t qdspTicks = strtoull( qdspTicksStr, 0, 16 );
-  fclose( qdspClockfp );
+bool SnavInterface::SetOutputRate(const std::string& output, double rate, std::string& message)
+{
+  int index = std::find(kOutputNames, kOutputNames + NUM_OUTPUTS, output) - kOutputNames;
+  if (index == NUM_OUTPUTS)
+  {
+    message = "Unknown output " + output;
+    return false;
+  }
+  if ((1u << index) & BATCH_OUTPUTS)
+  {
+    message = output + " is published every batch, set its batch size instead";
+    return false;
+  }
+  if (!output_scheduler_.SetRate(index, rate))
+  {
+    message = "Rate out of range for " + output;
+    return false;
+  }
+  // Keep the param current so a restart comes up with the same rates
+  pnh_.setParam(output + "_rate", rate);
+  std::ostringstream ss;
+  ss << output << " at ";
+  if (rate > 0.0)
+    ss << rate << " Hz";
+  else
+    ss << "every cycle";
+  message = ss.str();
+  ROS_INFO_STREAM("Output rate: " << message);
+  return true;
+}
 
-  dsptime = (int64_t)( qdspTicks*clockFreq*1e3 );
+bool SnavInterface::SetOutputRateCallback(snav_ros::SetOutputRate::Request& req,
+    snav_ros::SetOutputRate::Response& res)
+{
+  res.success = SetOutputRate(req.output, req.rate, res.message);
+  return true;
+}
 
-  //get the apps proc timestamp;
-  int64_t appstimeInNs;
-  struct timespec t;
-  clock_gettime( CLOCK_REALTIME, &t );
+uint64_t SnavInterface::GetPoolMisses() const
+{
+  uint64_t misses = pose_pool_.GetMisses() + vel_pool_.GetMisses() + odom_pool_.GetMisses() +
+    tf_pool_.GetMisses() + compact_state_pool_.GetMisses() + imu_batch_pool_.GetMisses() +
+    esc_batch_pool_.GetMisses() + clock_pool_.GetMisses() + float32_pool_.GetMisses() +
+    bool_pool_.GetMisses();
+  misses += est_pose_template_.GetMisses() + des_pose_template_.GetMisses() +
+    sim_gt_pose_template_.GetMisses() + vel_template_.GetMisses() + odom_template_.GetMisses();
+  for (int i = 0; i < (1 << NUM_TF_FRAMES); ++i)
+    misses += tf_templates_[i].GetMisses();
+  return misses;
+}
 
-  uint64_t timeNanoSecMonotonic = (uint64_t)(t.tv_sec) * 1000000000ULL + t.tv_nsec;
-  appstimeInNs = (int64_t)timeNanoSecMonotonic;
+void SnavInterface::PublishDiagnostics(const ros::TimerEvent& event)
+{
+  diagnostic_msgs::DiagnosticArray diag_msg;
+  diag_msg.header.stamp = ros::Time::now();
 
-  // now compute the offset.
-  dsp_offset_in_ns_  = appstimeInNs - dsptime;
+  SnavAcquisition::Stats stats = acquisition_.GetStats();
 
-  ROS_INFO_STREAM("DSP offset: " <<   dsp_offset_in_ns_ << " ns");
-}
+  diagnostic_msgs::DiagnosticStatus samples;
+  samples.name = "snav_interface: samples";
+  samples.hardware_id = "snav";
+  samples.level = diagnostic_msgs::DiagnosticStatus::OK;
+  samples.message = "OK";
+  if (stats.est_samples == 0 && stats.sim_samples == 0)
+  {
+    samples.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    samples.message = "No samples received from snav";
+  }
+  AddDiagnosticValue(samples, "est_samples", stats.est_samples);
+  AddDiagnosticValue(samples, "est_duplicates_suppressed", stats.est_duplicates);
+  AddDiagnosticValue(samples, "sim_samples", stats.sim_samples);
+  AddDiagnosticValue(samples, "sim_duplicates_suppressed", stats.sim_duplicates);
+  AddDiagnosticValue(samples, "sample_period_us", stats.sample_period*1e6);
+  AddDiagnosticValue(samples, "empty_polls", stats.empty_polls);
+  AddDiagnosticValue(samples, "poll_deadline_misses", stats.poll_deadline_misses);
+  AddDiagnosticValue(samples, "late_samples", stats.late_samples);
+  if (lockstep_)
+  {
+    AddDiagnosticValue(samples, "lockstep_steps", lockstep_steps_.load(std::memory_order_relaxed));
+    AddDiagnosticValue(samples, "lockstep_ack_timeouts",
+        lockstep_ack_timeouts_.load(std::memory_order_relaxed));
+  }
+  diag_msg.status.push_back(samples);
+
+  diagnostic_msgs::DiagnosticStatus rpc;
+  rpc.name = "snav_interface: sn_update_data";
+  rpc.hardware_id = "snav";
+  rpc.level = diagnostic_msgs::DiagnosticStatus::OK;
+  rpc.message = "OK";
+  if (acquisition_.IsRpcStalled() || acquisition_.GetDataAge() > rpc_timeout_)
+  {
+    rpc.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+    rpc.message = "sn_update_data stalled";
+  }
+  AddDiagnosticValue(rpc, "calls", stats.rpc_count);
+  AddDiagnosticValue(rpc, "failures", stats.rpc_failures);
+  AddDiagnosticValue(rpc, "consecutive_failures", stats.consecutive_failures);
+  AddDiagnosticValue(rpc, "backoff_ms", stats.backoff*1e3);
+  AddDiagnosticValue(rpc, "reconnects", stats.reconnects);
+  AddDiagnosticValue(rpc, "reconnect_failures", stats.reconnect_failures);
+  AddDiagnosticValue(rpc, "timeouts", stats.rpc_timeouts);
+  AddDiagnosticValue(rpc, "duration_mean_us", stats.rpc_duration_mean*1e6);
+  AddDiagnosticValue(rpc, "duration_max_us", stats.rpc_duration_max*1e6);
+  AddDiagnosticValue(rpc, "data_age_ms", acquisition_.GetDataAge()*1e3);
+  diag_msg.status.push_back(rpc);
+
+  // Totals since startup and counts of the last fault_summary_period
+  diagnostic_msgs::DiagnosticStatus faults;
+  faults.name = "snav_interface: faults";
+  faults.hardware_id = "snav";
+  faults.level = diagnostic_msgs::DiagnosticStatus::OK;
+  faults.message = "OK";
+  for (int i = 0; i < FaultMonitor::NUM_FAULTS; ++i)
+  {
+    FaultMonitor::Fault fault = (FaultMonitor::Fault)i;
+    if (faults_.GetLastPeriod(fault) > 0)
+    {
+      faults.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      faults.message = "Faults in the last summary period";
+    }
+    AddDiagnosticValue(faults, FaultMonitor::GetName(fault), faults_.GetTotal(fault));
+    AddDiagnosticValue(faults, std::string(FaultMonitor::GetName(fault)) + "_last_period",
+        faults_.GetLastPeriod(fault));
+  }
+  diag_msg.status.push_back(faults);
+
+  diagnostic_msgs::DiagnosticStatus output_rates;
+  output_rates.name = "snav_interface: output rates";
+  output_rates.hardware_id = "snav";
+  output_rates.level = diagnostic_msgs::DiagnosticStatus::OK;
+  output_rates.message = "OK";
+  AddDiagnosticValue(output_rates, "rate_groups", output_scheduler_.GetNumGroups());
+  AddDiagnosticValue(output_rates, "active_outputs", GetActiveOutputs());
+  if (shared_state_writer_.IsOpen())
+    AddDiagnosticValue(output_rates, "shared_state_writes", shared_state_writer_.GetWrites());
+  AddDiagnosticValue(output_rates, "pool_misses", GetPoolMisses());
+  for (int i = 0; i < NUM_OUTPUTS; ++i)
+  {
+    if (!((1u << i) & BATCH_OUTPUTS))
+      AddDiagnosticValue(output_rates, std::string(kOutputNames[i]) + "_rate_hz",
+          output_scheduler_.GetRate(i));
+  }
+  diag_msg.status.push_back(output_rates);
 
+  SnavCommandEngine::Stats cmd_stats = command_engine_.GetStats();
 
-void SnavInterface::PublishLowFrequencyData(const ros::TimerEvent& event)
-{
-  if( (ros::Time::now()-last_sn_update_) < ros::Duration(1.0) )
+  diagnostic_msgs::DiagnosticStatus commands;
+  commands.name = "snav_interface: commands";
+  commands.hardware_id = "snav";
+  commands.level = diagnostic_msgs::DiagnosticStatus::OK;
+  commands.message = "OK";
+  if (cmd_stats.failsafe)
   {
-    PublishBatteryVoltage();
-    PublishOnGroundFlag();
-    PublishPropsStateFlag();
+    commands.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+    commands.message = "Commands timed out, nothing sent so snav's failsafe takes over";
+  }
+  else if (cmd_stats.hovering)
+  {
+    commands.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    commands.message = "Commands timed out, position hold commanded";
+  }
+  AddDiagnosticValue(commands, "received", cmd_stats.commands_received);
+  AddDiagnosticValue(commands, "sent", cmd_stats.commands_sent);
+  AddDiagnosticValue(commands, "hover_sent", cmd_stats.hover_sent);
+  AddDiagnosticValue(commands, "timeouts", cmd_stats.timeouts);
+  AddDiagnosticValue(commands, "failsafe_releases", cmd_stats.failsafe_releases);
+  AddDiagnosticValue(commands, "deadline_misses", cmd_stats.deadline_misses);
+  AddDiagnosticValue(commands, "age_at_send_mean_ms", cmd_stats.age_mean*1e3);
+  AddDiagnosticValue(commands, "age_at_send_max_ms", cmd_stats.age_max*1e3);
+  AddDiagnosticValue(commands, "age_at_send_last_ms", cmd_stats.age_last*1e3);
+  diag_msg.status.push_back(commands);
+
+  diagnostic_msgs::DiagnosticStatus trajectory;
+  trajectory.name = "snav_interface: trajectory";
+  trajectory.hardware_id = "snav";
+  trajectory.level = diagnostic_msgs::DiagnosticStatus::OK;
+  trajectory.message = "OK";
+  if (cmd_stats.traj_starved)
+  {
+    trajectory.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    trajectory.message = "Trajectory buffer ran out, holding last setpoint";
+  }
+  AddDiagnosticValue(trajectory, "batches", cmd_stats.traj_batches);
+  AddDiagnosticValue(trajectory, "splices", cmd_stats.traj_splices);
+  AddDiagnosticValue(trajectory, "setpoints_sent", cmd_stats.traj_setpoints_sent);
+  AddDiagnosticValue(trajectory, "underruns", cmd_stats.traj_underruns);
+  AddDiagnosticValue(trajectory, "underrun_cycles", cmd_stats.traj_underrun_cycles);
+  AddDiagnosticValue(trajectory, "receive_latency_mean_ms", cmd_stats.traj_receive_latency_mean*1e3);
+  AddDiagnosticValue(trajectory, "receive_latency_max_ms", cmd_stats.traj_receive_latency_max*1e3);
+  AddDiagnosticValue(trajectory, "buffer_lead_last_ms", cmd_stats.traj_lead_last*1e3);
+  AddDiagnosticValue(trajectory, "buffer_lead_min_ms", cmd_stats.traj_lead_min*1e3);
+  diag_msg.status.push_back(trajectory);
+
+  DspClockSync::Stats clock_stats = clock_sync_.GetStats();
+  diagnostic_msgs::DiagnosticStatus clock_sync;
+  clock_sync.name = "snav_interface: clock sync";
+  clock_sync.hardware_id = "snav";
+  clock_sync.level = diagnostic_msgs::DiagnosticStatus::OK;
+  clock_sync.message = clock_stats.source == DspClockSync::SOURCE_QTIMER ? "qtimer" :
+    (clock_stats.source == DspClockSync::SOURCE_MONOTONIC ? "CLOCK_MONOTONIC" : "fixed");
+  if (clock_stats.source != DspClockSync::SOURCE_FIXED && clock_stats.read_failures > 0)
+  {
+    clock_sync.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    clock_sync.message = "DSP clock read failures";
+  }
+  AddDiagnosticValue(clock_sync, "offset_ns", clock_sync_.GetModel().ref_offset_ns);
+  AddDiagnosticValue(clock_sync, "drift_ppm", clock_stats.drift_ppm);
+  AddDiagnosticValue(clock_sync, "residual_rms_us", clock_stats.residual_rms*1e6);
+  AddDiagnosticValue(clock_sync, "residual_max_us", clock_stats.residual_max*1e6);
+  AddDiagnosticValue(clock_sync, "read_width_us", clock_stats.read_width*1e6);
+  AddDiagnosticValue(clock_sync, "window_fill", clock_stats.window_fill);
+  AddDiagnosticValue(clock_sync, "samples", clock_stats.samples);
+  AddDiagnosticValue(clock_sync, "outliers", clock_stats.outliers);
+  AddDiagnosticValue(clock_sync, "read_failures", clock_stats.read_failures);
+  AddDiagnosticValue(clock_sync, "steps", clock_stats.steps);
+  diag_msg.status.push_back(clock_sync);
+
+  TelemetryStream<SnImuComp>::Stats imu_stats = acquisition_.GetImuStream().GetStats();
+  TelemetryStream<SnEscRawData>::Stats esc_stats = acquisition_.GetEscStream().GetStats();
+  diagnostic_msgs::DiagnosticStatus telemetry;
+  telemetry.name = "snav_interface: telemetry";
+  telemetry.hardware_id = "snav";
+  telemetry.level = diagnostic_msgs::DiagnosticStatus::OK;
+  telemetry.message = "OK";
+  if (imu_stats.dropped > 0 || esc_stats.dropped > 0)
+  {
+    telemetry.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    telemetry.message = "IMU or ESC samples dropped";
+  }
+  AddDiagnosticValue(telemetry, "imu_samples", imu_stats.samples);
+  AddDiagnosticValue(telemetry, "imu_dropped", imu_stats.dropped);
+  AddDiagnosticValue(telemetry, "imu_duplicates_suppressed", imu_stats.duplicates);
+  AddDiagnosticValue(telemetry, "esc_samples", esc_stats.samples);
+  AddDiagnosticValue(telemetry, "esc_dropped", esc_stats.dropped);
+  AddDiagnosticValue(telemetry, "esc_duplicates_suppressed", esc_stats.duplicates);
+  diag_msg.status.push_back(telemetry);
+
+  if (flight_recorder_.IsOpen())
+  {
+    FlightRecorder::Stats rec_stats = flight_recorder_.GetStats();
+    diagnostic_msgs::DiagnosticStatus recorder;
+    recorder.name = "snav_interface: recorder";
+    recorder.hardware_id = "snav";
+    recorder.level = diagnostic_msgs::DiagnosticStatus::OK;
+    recorder.message = "OK";
+    if (rec_stats.dropped > 0 || rec_stats.sync_errors > 0)
+    {
+      recorder.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      recorder.message = "Samples dropped or sync errors";
+    }
+    AddDiagnosticValue(recorder, "capacity", rec_stats.capacity);
+    AddDiagnosticValue(recorder, "records", rec_stats.records);
+    AddDiagnosticValue(recorder, "committed", rec_stats.committed);
+    AddDiagnosticValue(recorder, "dropped", rec_stats.dropped);
+    AddDiagnosticValue(recorder, "commits", rec_stats.commits);
+    AddDiagnosticValue(recorder, "sync_errors", rec_stats.sync_errors);
+    AddDiagnosticValue(recorder, "sync_duration_last_ms", rec_stats.sync_duration_last*1e3);
+    AddDiagnosticValue(recorder, "sync_duration_max_ms", rec_stats.sync_duration_max*1e3);
+    diag_msg.status.push_back(recorder);
+  }
+
+  if (realtime_applied_.load(std::memory_order_acquire))
+  {
+    diagnostic_msgs::DiagnosticStatus realtime;
+    realtime.name = "snav_interface: realtime";
+    realtime.hardware_id = "snav";
+    realtime.level = diagnostic_msgs::DiagnosticStatus::OK;
+    realtime.message = "OK";
+    const std::vector<RealtimeSetup::Result>& results = realtime_.GetResults();
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      if (!results[i].ok)
+      {
+        realtime.level = diagnostic_msgs::DiagnosticStatus::WARN;
+        realtime.message = "Some real-time settings could not be applied";
+      }
+      AddDiagnosticValue(realtime, results[i].step,
+          (results[i].ok ? "" : "failed: ") + results[i].detail);
+    }
+    diag_msg.status.push_back(realtime);
+  }
+
+  diagnostic_msgs::DiagnosticStatus latency;
+  latency.name = "snav_interface: latency";
+  latency.hardware_id = "snav";
+  latency.level = diagnostic_msgs::DiagnosticStatus::OK;
+  latency.message = "OK";
+  if (profiling_)
+  {
+    AddLatencyValues(latency, "sn_update_data", acquisition_.GetRpcHistogram().Collect());
+    for (int i = 0; i < NUM_PROFILE_STAGES; ++i)
+      AddLatencyValues(latency, kProfileStageNames[i], profile_[i].Collect());
   }
   else
   {
-    ROS_ERROR("Tried to publish low frequency data, but sn_update_data() has not been called in at least 1 second");
+    AddLatencyValues(latency, kProfileStageNames[STAGE_SAMPLE_AGE],
+        profile_[STAGE_SAMPLE_AGE].Collect());
   }
+  AddLatencyValues(latency, "cmd_age_at_send", command_engine_.GetCommandAgeHistogram().Collect());
+  AddDiagnosticValue(latency, "loop_overruns", loop_overruns_.load(std::memory_order_relaxed));
+  AddDiagnosticValue(latency, "loop_deadline_misses",
+      loop_deadline_misses_.load(std::memory_order_relaxed));
+  diag_msg.status.push_back(latency);
+
+  diagnostics_publisher_.publish(diag_msg);
+}
+
+void SnavInterface::PublishFaultSummary(const ros::TimerEvent& event)
+{
+  faults_.Summarize(fault_summary_period_);
+}
+
+template <typename T>
+void SnavInterface::AddDiagnosticValue(diagnostic_msgs::DiagnosticStatus& status,
+    const std::string& key, T value)
+{
+  diagnostic_msgs::KeyValue kv;
+  kv.key = key;
+  std::ostringstream ss;
+  ss << value;
+  kv.value = ss.str();
+  status.values.push_back(kv);
+}
+
+void SnavInterface::AddLatencyValues(diagnostic_msgs::DiagnosticStatus& status,
+    const std::string& stage, const LatencyHistogram::Summary& summary)
+{
+  AddDiagnosticValue(status, stage + "_count", summary.count);
+  AddDiagnosticValue(status, stage + "_p50_us", summary.p50*1e6);
+  AddDiagnosticValue(status, stage + "_p99_us", summary.p99*1e6);
+  AddDiagnosticValue(status, stage + "_max_us", summary.max*1e6);
 }
 
 void SnavInterface::CmdTypeCallback(const std_msgs::String::ConstPtr& msg)
@@ -240,344 +1139,637 @@ void SnavInterface::MappingTypeCallback(const std_msgs::String::ConstPtr& msg)
 
 void SnavInterface::GenCmdCallback(const geometry_msgs::Twist::ConstPtr& msg)
 {
-  generic_command_ = *msg;
-  last_gen_command_time_ = ros::Time::now();
-  SendGenCommand();
+  ScopedLatency timer(Profile(STAGE_GEN_CMD_CALLBACK));
+  SnavCommandEngine::RcCommand command;
+  command.x = msg->linear.x;
+  command.y = msg->linear.y;
+  command.z = msg->linear.z;
+  command.yaw = msg->angular.z;
+  command.type = rc_cmd_type_;
+  command.mapping = rc_cmd_mapping_;
+  command_engine_.SetRcCommand(command);
 }
 
 void SnavInterface::TrajCmdCallback(const std_msgs::Float32MultiArray::ConstPtr& msg)
 {
-  last_traj_command_time_ = ros::Time::now();
-  sn_send_trajectory_tracking_command(SN_POSITION_CONTROL_VIO, SN_TRAJ_DEFAULT, msg->data[0], msg->data[1], msg->data[2], msg->data[3], msg->data[4], msg->data[5], msg->data[6], msg->data[7], msg->data[8], msg->data[9], msg->data[10]);
+  if (replaying_)
+    return;
+  // pos[3], vel[3], acc[3], yaw, yaw_rate
+  if (msg->data.size() < 11)
+  {
+    ROS_WARN_THROTTLE(1.0, "Ignoring traj_cmd with %zu values, expected 11", msg->data.size());
+    return;
+  }
+  // Sent by the command engine thread, the only one talking to snav
+  SnavCommandEngine::TrajCommand command;
+  command.setpoint.time_ns = 0;
+  for (int i = 0; i < 3; ++i)
+  {
+    command.setpoint.position[i] = msg->data[i];
+    command.setpoint.velocity[i] = msg->data[3 + i];
+    command.setpoint.acceleration[i] = msg->data[6 + i];
+  }
+  command.setpoint.yaw = msg->data[9];
+  command.setpoint.yaw_rate = msg->data[10];
+  command_engine_.SetTrajCommand(command);
+}
+
+void SnavInterface::TrajBatchCallback(const trajectory_msgs::MultiDOFJointTrajectory::ConstPtr& msg)
+{
+  ScopedLatency timer(Profile(STAGE_TRAJ_BATCH_CALLBACK));
+  std::shared_ptr<SnavTrajectory> trajectory(new SnavTrajectory);
+  ros::Time start = msg->header.stamp.isZero() ? ros::Time::now() : msg->header.stamp;
+  trajectory->stamp_ns = (int64_t)start.toNSec();
+  trajectory->samples.reserve(msg->points.size());
+
+  for (size_t i = 0; i < msg->points.size(); ++i)
+  {
+    const trajectory_msgs::MultiDOFJointTrajectoryPoint& point = msg->points[i];
+    if (point.transforms.empty())
+    {
+      ROS_ERROR("traj_batch point %zu has no transform, dropping batch", i);
+      return;
+    }
+
+    SnavTrajectory::Sample sample;
+    std::memset(&sample, 0, sizeof(sample));
+    sample.time_ns = trajectory->stamp_ns + point.time_from_start.toNSec();
+    if (!trajectory->samples.empty() && sample.time_ns <= trajectory->samples.back().time_ns)
+    {
+      ROS_ERROR("traj_batch points must be strictly increasing in time, dropping batch");
+      return;
+    }
+
+    const geometry_msgs::Transform& tf = point.transforms[0];
+    sample.position[0] = tf.translation.x;
+    sample.position[1] = tf.translation.y;
+    sample.position[2] = tf.translation.z;
+    const geometry_msgs::Quaternion& q = tf.rotation;
+    sample.yaw = atan2(2.0*(q.w*q.z + q.x*q.y), 1.0 - 2.0*(q.y*q.y + q.z*q.z));
+
+    if (!point.velocities.empty())
+    {
+      sample.velocity[0] = point.velocities[0].linear.x;
+      sample.velocity[1] = point.velocities[0].linear.y;
+      sample.velocity[2] = point.velocities[0].linear.z;
+      sample.yaw_rate = point.velocities[0].angular.z;
+    }
+    if (!point.accelerations.empty())
+    {
+      sample.acceleration[0] = point.accelerations[0].linear.x;
+      sample.acceleration[1] = point.accelerations[0].linear.y;
+      sample.acceleration[2] = point.accelerations[0].linear.z;
+    }
+    trajectory->samples.push_back(sample);
+  }
+
+  command_engine_.SetTrajectory(trajectory, traj_replace_);
 }
 
 void SnavInterface::StartPropsCallback(const std_msgs::Empty::ConstPtr& msg)
 {
+  if (replaying_)
+  {
+    ROS_WARN("Replaying a flight record, ignoring start_props");
+    return;
+  }
   sn_spin_props();
 }
 
 void SnavInterface::StopPropsCallback(const std_msgs::Empty::ConstPtr& msg)
 {
+  if (replaying_)
+  {
+    ROS_WARN("Replaying a flight record, ignoring stop_props");
+    return;
+  }
   sn_stop_props();
 }
 
-void SnavInterface::SendGenCommand()
+void SnavInterface::UpdateFrames()
 {
-  float snav_rc_cmd[4];
-
-  sn_apply_cmd_mapping(rc_cmd_type_, rc_cmd_mapping_,
-      generic_command_.linear.x,
-      generic_command_.linear.y,
-      generic_command_.linear.z,
-      generic_command_.angular.z,
-      &snav_rc_cmd[0],
-      &snav_rc_cmd[1],
-      &snav_rc_cmd[2],
-      &snav_rc_cmd[3]);
-
-  sn_send_rc_command(rc_cmd_type_, rc_cmd_mapping_,
-      snav_rc_cmd[0],
-      snav_rc_cmd[1],
-      snav_rc_cmd[2],
-      snav_rc_cmd[3]);
+  if (!frames_stale_)
+    return;
+  ComputeFrames(snapshot_, frames_);
+  frames_stale_ = false;
 }
 
+void SnavInterface::UpdatePoseMessages(uint32_t outputs)
+{
+  // One kernel pass yields every rotation, so it is not split per output
+  UpdateFrames();
+  valid_rotation_est_ = frames_.est_valid;
+  if (!valid_rotation_est_)
+    faults_.Raise(FaultMonitor::FAULT_EST_ROTATION_NAN);
+  UpdatePosVelMessages(outputs);
+}
 
+// Fill a geometry_msgs Transform/Pose straight from the kernel output
+static void SetTransform(const FrameQuaternion& q, const float* t,
+    geometry_msgs::Transform& transform)
+{
+  transform.translation.x = t[0];
+  transform.translation.y = t[1];
+  transform.translation.z = t[2];
+  transform.rotation.x = q.x;
+  transform.rotation.y = q.y;
+  transform.rotation.z = q.z;
+  transform.rotation.w = q.w;
+}
 
-void SnavInterface::UpdatePoseMessages()
+static void SetPose(const FrameQuaternion& q, const float* t, geometry_msgs::Pose& pose)
 {
-  tf2::Quaternion q;
-  GetRotationQuaternion(q);
-  UpdatePosVelMessages(q);
+  pose.position.x = t[0];
+  pose.position.y = t[1];
+  pose.position.z = t[2];
+  pose.orientation.x = q.x;
+  pose.orientation.y = q.y;
+  pose.orientation.z = q.z;
+  pose.orientation.w = q.w;
 }
 
-void SnavInterface::GetRotationQuaternion(tf2::Quaternion &q)
+void SnavInterface::UpdatePosVelMessages(uint32_t outputs)
 {
-  // Get Rotation Matrix from sn_cached_data_, convert to tf2 Matrix
-  tf2::Matrix3x3 RR( cached_data_->attitude_estimate.rotation_matrix[0],
-      cached_data_->attitude_estimate.rotation_matrix[1],
-      cached_data_->attitude_estimate.rotation_matrix[2],
-      cached_data_->attitude_estimate.rotation_matrix[3],
-      cached_data_->attitude_estimate.rotation_matrix[4],
-      cached_data_->attitude_estimate.rotation_matrix[5],
-      cached_data_->attitude_estimate.rotation_matrix[6],
-      cached_data_->attitude_estimate.rotation_matrix[7],
-      cached_data_->attitude_estimate.rotation_matrix[8]);
+  static const float kZero[3] = {0, 0, 0};
 
-  // Convert Rotation Matrix to quaternion
-  RR.getRotation(q);
+  ros::Time timestamp;
+  timestamp.fromNSec(clock_sync_.ToRealtimeNs(snapshot_.pos_vel.time));
 
-  // Check for NAN in quaternion
-  if(q.getX()!=q.getX() || q.getY()!=q.getY() ||
-      q.getZ()!=q.getZ() || q.getW()!=q.getW())
+  if (outputs & OUTPUT_VEL)
   {
-    ROS_WARN("Rotation Quaternion is NAN");
-    valid_rotation_est_ = false;
+    // TODO: Move this elsewhere
+    est_vel_msg_.linear.x = snapshot_.pos_vel.velocity_estimated[0];
+    est_vel_msg_.linear.y = snapshot_.pos_vel.velocity_estimated[1];
+    est_vel_msg_.linear.z = snapshot_.pos_vel.velocity_estimated[2];
+    est_vel_msg_.angular.x = snapshot_.imu_0_compensated.ang_vel[0];
+    est_vel_msg_.angular.y = snapshot_.imu_0_compensated.ang_vel[1];
+    est_vel_msg_.angular.z = snapshot_.imu_0_compensated.ang_vel[2];
   }
-  else
+
+  if (outputs & TfOutput(TF_EST))
   {
-    valid_rotation_est_ = true;
+    est_transform_msg_.header.stamp = timestamp;
+    SetTransform(frames_.est, snapshot_.pos_vel.position_estimated, est_transform_msg_.transform);
   }
-}
-
-void SnavInterface::UpdatePosVelMessages(tf2::Quaternion q)
-{
-  // TODO: Move this elsewhere
-  est_vel_msg_.linear.x = cached_data_->pos_vel.velocity_estimated[0];
-  est_vel_msg_.linear.y = cached_data_->pos_vel.velocity_estimated[1];
-  est_vel_msg_.linear.z = cached_data_->pos_vel.velocity_estimated[2];
-  est_vel_msg_.angular.x = cached_data_->imu_0_compensated.ang_vel[0];
-  est_vel_msg_.angular.y = cached_data_->imu_0_compensated.ang_vel[1];
-  est_vel_msg_.angular.z = cached_data_->imu_0_compensated.ang_vel[2];
-
-
-  tf2::Transform est_tf(tf2::Transform(q, tf2::Vector3(
-          cached_data_->pos_vel.position_estimated[0],
-          cached_data_->pos_vel.position_estimated[1],
-          cached_data_->pos_vel.position_estimated[2])));
 
-  est_transform_msg_.child_frame_id = base_link_frame_;
-  est_transform_msg_.header.frame_id = estimation_frame_;
-
-  ros::Time timestamp;
-  timestamp = ros::Time((double)(cached_data_->pos_vel.time + (dsp_offset_in_ns_/1e3))/1e6);
-  est_transform_msg_.header.stamp = timestamp;
+  if (outputs & OUTPUT_POSE)
+  {
+    SetPose(frames_.est, snapshot_.pos_vel.position_estimated, est_pose_msg_.pose);
+    est_pose_msg_.header.stamp = timestamp;
+  }
 
-  tf2::convert(est_tf, est_transform_msg_.transform);
+  if (outputs & OUTPUT_ODOM)
+  {
+    est_odom_msg_.header.stamp = timestamp;
+    SetPose(frames_.est, snapshot_.pos_vel.position_estimated, est_odom_msg_.pose.pose);
+    // velocity_estimated is in estimation_frame, ang_vel in base_link; R
+    // rotates base_link into estimation_frame
+    const float* R = snapshot_.attitude_estimate.rotation_matrix;
+    const float* v = snapshot_.pos_vel.velocity_estimated;
+    const float* w = snapshot_.imu_0_compensated.ang_vel;
+    float linear[3], angular[3];
+    for (int i = 0; i < 3; ++i)
+    {
+      if (odom_twist_in_body_)
+      {
+        linear[i] = R[i]*v[0] + R[3 + i]*v[1] + R[6 + i]*v[2];
+        angular[i] = w[i];
+      }
+      else
+      {
+        linear[i] = v[i];
+        angular[i] = R[3*i]*w[0] + R[3*i + 1]*w[1] + R[3*i + 2]*w[2];
+      }
+    }
+    geometry_msgs::Twist& twist = est_odom_msg_.twist.twist;
+    twist.linear.x = linear[0];
+    twist.linear.y = linear[1];
+    twist.linear.z = linear[2];
+    twist.angular.x = angular[0];
+    twist.angular.y = angular[1];
+    twist.angular.z = angular[2];
+  }
 
-  tf2::toMsg(est_tf, est_pose_msg_.pose);
-  est_pose_msg_.header.stamp = timestamp;
-  est_pose_msg_.header.frame_id = est_transform_msg_.header.frame_id;
+  if (outputs & TfOutput(TF_DESIRED))
+  {
+    SetTransform(frames_.des, snapshot_.pos_vel.position_desired, des_transform_msg_.transform);
+    des_transform_msg_.header.stamp = timestamp;
+  }
 
-  tf2::Quaternion q_des;
-  q_des.setEuler(0.0, 0.0, cached_data_->pos_vel.yaw_desired);
-  tf2::Transform des_tf(tf2::Transform(q_des, tf2::Vector3(
-          cached_data_->pos_vel.position_desired[0],
-          cached_data_->pos_vel.position_desired[1],
-          cached_data_->pos_vel.position_desired[2])));
+  if (outputs & OUTPUT_DES_POSE)
+  {
+    SetPose(frames_.des, snapshot_.pos_vel.position_desired, des_pose_msg_.pose);
+    des_pose_msg_.header.stamp = timestamp;
+  }
 
-  tf2::convert(des_tf, des_transform_msg_.transform);
-  des_transform_msg_.child_frame_id = desired_frame_;
-  des_transform_msg_.header.frame_id = estimation_frame_;
-  des_transform_msg_.header.stamp = timestamp;
-
-  tf2::toMsg(des_tf, des_pose_msg_.pose);
-  des_pose_msg_.header.stamp = timestamp;
-  des_pose_msg_.header.frame_id = des_transform_msg_.header.frame_id;
-
-  tf2::Matrix3x3 R_eg(tf2::Matrix3x3(
-        cached_data_->pos_vel.R_eg[0],
-        cached_data_->pos_vel.R_eg[1],
-        cached_data_->pos_vel.R_eg[2],
-        cached_data_->pos_vel.R_eg[3],
-        cached_data_->pos_vel.R_eg[4],
-        cached_data_->pos_vel.R_eg[5],
-        cached_data_->pos_vel.R_eg[6],
-        cached_data_->pos_vel.R_eg[7],
-        cached_data_->pos_vel.R_eg[8]));
-
-  tf2::Transform gps_enu_tf(tf2::Transform(R_eg, tf2::Vector3(
-        cached_data_->pos_vel.t_eg[0],
-        cached_data_->pos_vel.t_eg[1],
-        cached_data_->pos_vel.t_eg[2])));
-
-  tf2::convert(gps_enu_tf, gps_enu_transform_msg_.transform);
-  gps_enu_transform_msg_.child_frame_id = gps_enu_frame_;
-  gps_enu_transform_msg_.header.frame_id = estimation_frame_;
-  gps_enu_transform_msg_.header.stamp = timestamp;
+  if (outputs & TfOutput(TF_GPS_ENU))
+  {
+    SetTransform(frames_.gps_enu, snapshot_.pos_vel.t_eg, gps_enu_transform_msg_.transform);
+    gps_enu_transform_msg_.header.stamp = timestamp;
+  }
 
   // base_link_no_rot and base_link_stab
-  tf2::Matrix3x3 RR_est(q);
-  tf2Scalar roll, pitch, yaw;
-  RR_est.getRPY(roll, pitch, yaw);
-
-  //tf2::Transform base_link_no_rot_tf(tf2::Transform(
-  //      tf2::Quaternion(0.0, 0.0, 0.0, 1.0), tf2::Vector3(
-  //        cached_data_->pos_vel.position_estimated[0],
-  //        cached_data_->pos_vel.position_estimated[1],
-  //        cached_data_->pos_vel.position_estimated[2])));
-  tf2::Transform base_link_no_rot_tf(tf2::Transform(
-          RR_est.inverse(), tf2::Vector3(0.0, 0.0, 0.0)));
-
-  base_link_no_rot_transform_msg_.child_frame_id = base_link_no_rot_frame_;
-  base_link_no_rot_transform_msg_.header.frame_id = base_link_frame_;
-  base_link_no_rot_transform_msg_.header.stamp = timestamp;
-  tf2::convert(base_link_no_rot_tf, base_link_no_rot_transform_msg_.transform);
-
-  tf2::Matrix3x3 RR_yaw;
-  RR_yaw.setRPY(0, 0, yaw);
-  tf2::Transform base_link_stab_tf(tf2::Transform(RR_yaw,
-        tf2::Vector3(0.0, 0.0, 0.0)));
-
-  base_link_stab_transform_msg_.child_frame_id = base_link_stab_frame_;
-  base_link_stab_transform_msg_.header.frame_id = base_link_no_rot_frame_;
-  base_link_stab_transform_msg_.header.stamp = timestamp;
-  tf2::convert(base_link_stab_tf, base_link_stab_transform_msg_.transform);
+  if (outputs & TfOutput(TF_BASE_LINK_NO_ROT))
+  {
+    base_link_no_rot_transform_msg_.header.stamp = timestamp;
+    SetTransform(frames_.no_rot, kZero, base_link_no_rot_transform_msg_.transform);
+  }
 
+  if (outputs & TfOutput(TF_BASE_LINK_STAB))
+  {
+    base_link_stab_transform_msg_.header.stamp = timestamp;
+    SetTransform(frames_.stab, kZero, base_link_stab_transform_msg_.transform);
+  }
 }
 
-void SnavInterface::UpdateSimMessages(){
-
-  // Get Rotation Matrix from sn_cached_data_, convert to tf2 Matrix
-  tf2::Matrix3x3 RR(
-      cached_data_->sim_ground_truth.R[0],
-      cached_data_->sim_ground_truth.R[1],
-      cached_data_->sim_ground_truth.R[2],
-      cached_data_->sim_ground_truth.R[3],
-      cached_data_->sim_ground_truth.R[4],
-      cached_data_->sim_ground_truth.R[5],
-      cached_data_->sim_ground_truth.R[6],
-      cached_data_->sim_ground_truth.R[7],
-      cached_data_->sim_ground_truth.R[8]);
+void SnavInterface::UpdateSimMessages(uint32_t outputs){
 
-  // Convert Rotation Matrix to quaternion
-  tf2::Quaternion q;
-  RR.getRotation(q);
+  UpdateFrames();
 
   // Check for NAN in quaternion
-  if(q.getX()!=q.getX() || q.getY()!=q.getY() ||
-      q.getZ()!=q.getZ() || q.getW()!=q.getW())
+  if(!frames_.sim_valid)
   {
-    ROS_WARN("Rotation Quaternion is NAN");
+    faults_.Raise(FaultMonitor::FAULT_SIM_ROTATION_NAN);
     valid_rotation_sim_gt_ = false;
   }
   else
   {
     valid_rotation_sim_gt_ = true;
 
-    tf2::Transform sim_gt_tf(tf2::Transform(q, tf2::Vector3(
-            cached_data_->sim_ground_truth.position[0],
-            cached_data_->sim_ground_truth.position[1],
-            cached_data_->sim_ground_truth.position[2])));
-
-    sim_gt_tf = sim_gt_tf.inverse();
-    sim_gt_transform_msg_.child_frame_id = sim_gt_frame_;
-    sim_gt_transform_msg_.header.frame_id = base_link_frame_;
-
     ros::Time timestamp;
-    timestamp = ros::Time((double)(cached_data_->sim_ground_truth.time + (dsp_offset_in_ns_/1e3))/1e6);
-    sim_gt_transform_msg_.header.stamp = timestamp;
-
-    tf2::convert(sim_gt_tf, sim_gt_transform_msg_.transform);
+    timestamp.fromNSec(clock_sync_.ToRealtimeNs(snapshot_.sim_ground_truth.time));
+
+    if (outputs & TfOutput(TF_SIM_GT))
+    {
+      sim_gt_transform_msg_.header.stamp = timestamp;
+      SetTransform(frames_.sim_inv, frames_.sim_inv_translation, sim_gt_transform_msg_.transform);
+    }
+
+    if (outputs & OUTPUT_SIM_GT_POSE)
+    {
+      SetPose(frames_.sim, snapshot_.sim_ground_truth.position, sim_gt_pose_msg_.pose);
+      sim_gt_pose_msg_.header.stamp = timestamp;
+    }
+  }
+}
 
-    tf2::toMsg(sim_gt_tf.inverse(), sim_gt_pose_msg_.pose);
-    sim_gt_pose_msg_.header.stamp = timestamp;
-    sim_gt_pose_msg_.header.frame_id = sim_gt_frame_;
+void SnavInterface::UpdateActiveOutputs()
+{
+  // Without lazy_outputs every enabled output is produced, listened to or not
+  bool pose = !lazy_outputs_ || pose_est_publisher_.getNumSubscribers() > 0;
+  bool pose_des = !lazy_outputs_ || pose_des_publisher_.getNumSubscribers() > 0;
+  bool pose_sim_gt = !lazy_outputs_ || pose_sim_gt_publisher_.getNumSubscribers() > 0;
+  bool vel = !lazy_outputs_ || vel_est_publisher_.getNumSubscribers() > 0;
+  bool odom = !lazy_outputs_ || odom_est_publisher_.getNumSubscribers() > 0;
+  bool imu = !lazy_outputs_ || imu_batch_publisher_.getNumSubscribers() > 0;
+  bool esc = !lazy_outputs_ || esc_batch_publisher_.getNumSubscribers() > 0;
+  bool compact_state = !lazy_outputs_ || compact_state_publisher_.getNumSubscribers() > 0;
+  // A TF listener takes every frame, so frames are gated on /tf as a whole
+  bool tf = !lazy_outputs_ || tf_publisher_.getNumSubscribers() > 0;
+
+  uint32_t outputs = 0;
+  if (publish_pose_ && pose)
+    outputs |= OUTPUT_POSE;
+  if (publish_des_pose_ && pose_des)
+    outputs |= OUTPUT_DES_POSE;
+  if (publish_vel_ && vel)
+    outputs |= OUTPUT_VEL;
+  if (publish_odom_ && odom)
+    outputs |= OUTPUT_ODOM;
+  if (publish_sim_gt_pose_ && pose_sim_gt)
+    outputs |= OUTPUT_SIM_GT_POSE;
+  if (acquisition_.GetImuStream().IsEnabled() && imu)
+    outputs |= OUTPUT_IMU;
+  if (acquisition_.GetEscStream().IsEnabled() && esc)
+    outputs |= OUTPUT_ESC;
+  if (publish_compact_state_ && compact_state)
+    outputs |= OUTPUT_COMPACT_STATE;
+  if (broadcast_tf_ && tf)
+    outputs |= TfOutput(TF_EST) | TfOutput(TF_BASE_LINK_NO_ROT) | TfOutput(TF_BASE_LINK_STAB);
+  if (broadcast_des_tf_ && tf)
+    outputs |= TfOutput(TF_DESIRED);
+  if (broadcast_gps_tf_ && tf)
+    outputs |= TfOutput(TF_GPS_ENU);
+  if (broadcast_sim_gt_tf_ && tf)
+    outputs |= TfOutput(TF_SIM_GT);
+  // Status topics are small and go out whether or not anyone listens
+  outputs |= STATUS_OUTPUTS;
+  // Shared memory readers cannot be counted
+  if (shared_state_writer_.IsOpen())
+    outputs |= OUTPUT_SHARED_STATE;
+  active_outputs_.store(outputs, std::memory_order_relaxed);
+}
 
-  }
+void SnavInterface::SubscribersChanged(const ros::SingleSubscriberPublisher& publisher)
+{
+  UpdateActiveOutputs();
 }
 
 void SnavInterface::UpdateSnavData(){
-  if (sn_update_data() != 0)
+  // Never wait on the RPC here, just take whatever the acquisition thread
+  // has most recently produced
+  uint32_t sequence = acquisition_.GetSnapshot(snapshot_);
+  snapshot_sequence_ = sequence;
+  frames_stale_ = true;
+  if (replaying_)
+  {
+    acquisition_.MarkConsumed(sequence);
+    if (acquisition_.IsReplayFinished() && snapshot_.pos_vel.time == last_est_sample_time_ &&
+        snapshot_.sim_ground_truth.time == last_sim_sample_time_ && !replay_end_reported_)
+    {
+      replay_end_reported_ = true;
+      ROS_INFO("Flight record replay finished");
+      if (replay_exit_on_end_)
+        ros::shutdown();
+    }
+  }
+  if (acquisition_.GetDataAge() > rpc_timeout_)
   {
-    ROS_WARN("sn_update_data failed, not publishing");
+    faults_.Raise(FaultMonitor::FAULT_STALE_DATA);
+    new_est_sample_ = false;
+    new_sim_sample_ = false;
     return;
   }
-  last_sn_update_ = ros::Time::now();
 
-  if(simulation_)
+  // Only treat data as new if the estimator timestamps have advanced
+  new_est_sample_ = snapshot_.pos_vel.time != last_est_sample_time_;
+  last_est_sample_time_ = snapshot_.pos_vel.time;
+  new_sim_sample_ = snapshot_.sim_ground_truth.time != last_sim_sample_time_;
+  last_sim_sample_time_ = snapshot_.sim_ground_truth.time;
+
+  // In lockstep /clock only advances with a new step
+  if((simulation_ || replaying_) && (!lockstep_ || new_est_sample_ || new_sim_sample_))
   {
     rosgraph_msgs::Clock simtime;
-    simtime.clock = ros::Time((double)(cached_data_->general_status.time)/1e6);
-    clock_publisher_.publish(simtime);
+    simtime.clock.fromNSec(clock_sync_.ToRealtimeNs(snapshot_.general_status.time));
+    sim_time_ = simtime.clock;
+    PublishMessage(clock_publisher_, simtime, clock_pool_);
   }
 }
 
+void SnavInterface::SleepUntilNextSample(){
+  acquisition_.WaitForSnapshot(max_sample_wait_);
+}
+
+void SnavInterface::PublishStatusData(uint32_t outputs){
+  if (acquisition_.GetDataAge() >= 1.0)
+  {
+    faults_.Raise(FaultMonitor::FAULT_STALE_STATUS);
+    return;
+  }
+  if (outputs & OUTPUT_BATTERY_VOLTAGE)
+    PublishBatteryVoltage();
+  if (outputs & OUTPUT_ON_GROUND)
+    PublishOnGroundFlag();
+  if (outputs & OUTPUT_PROPS_STATE)
+    PublishPropsStateFlag();
+}
+
 void SnavInterface::PublishBatteryVoltage(){
-  std_msgs::Float32 voltage_msg;
-  voltage_msg.data = cached_data_->general_status.voltage;
-  battery_voltage_publisher_.publish( voltage_msg );
+  battery_voltage_msg_.data = snapshot_.general_status.voltage;
+  PublishMessage(battery_voltage_publisher_, battery_voltage_msg_, float32_pool_);
 }
 
 void SnavInterface::PublishOnGroundFlag(){
-  std_msgs::Bool on_ground_msg;
-  on_ground_msg.data = cached_data_->general_status.on_ground;
-  on_ground_publisher_.publish( on_ground_msg );
+  on_ground_msg_.data = snapshot_.general_status.on_ground;
+  PublishMessage(on_ground_publisher_, on_ground_msg_, bool_pool_);
 }
 
 void SnavInterface::PublishPropsStateFlag(){
-  std_msgs::Bool props_state_msg;
-  SnPropsState props_state = (SnPropsState) cached_data_->general_status.props_state;
+  SnPropsState props_state = (SnPropsState) snapshot_.general_status.props_state;
   if (props_state == SN_PROPS_STATE_SPINNING)
   {
-    props_state_msg.data = true;
+    props_state_msg_.data = true;
   }
   else
   {
-    props_state_msg.data = false;
+    props_state_msg_.data = false;
+  }
+  PublishMessage(props_state_publisher_, props_state_msg_, bool_pool_);
+}
+
+void SnavInterface::PublishCompactState(){
+  if (valid_rotation_est_)
+  {
+    compact_state_encoder_->Encode(est_pose_msg_.header.stamp, est_pose_msg_.pose, est_vel_msg_,
+        compact_state_msg_);
+    PublishMessage(compact_state_publisher_, compact_state_msg_, compact_state_pool_);
+  }
+  else
+    faults_.Raise(FaultMonitor::FAULT_INVALID_EST_OUTPUT);
+}
+
+void SnavInterface::PublishSharedState(){
+  if (!valid_rotation_est_)
+  {
+    faults_.Raise(FaultMonitor::FAULT_INVALID_EST_OUTPUT);
+    return;
+  }
+  // Straight from the snapshot and frames, so it needs no other output
+  SharedState& state = shared_state_;
+  state.est_stamp_ns = clock_sync_.ToRealtimeNs(snapshot_.pos_vel.time);
+  state.status_stamp_ns = clock_sync_.ToRealtimeNs(snapshot_.general_status.time);
+  state.acquired_ns = snapshot_.acquired_time_ns;
+  const FrameQuaternion* orientations[2] = {&frames_.est, &frames_.des};
+  double* targets[2] = {state.orientation, state.desired_orientation};
+  for (int i = 0; i < 2; ++i)
+  {
+    targets[i][0] = orientations[i]->x;
+    targets[i][1] = orientations[i]->y;
+    targets[i][2] = orientations[i]->z;
+    targets[i][3] = orientations[i]->w;
+  }
+  for (int i = 0; i < 3; ++i)
+  {
+    state.position[i] = snapshot_.pos_vel.position_estimated[i];
+    state.linear_velocity[i] = snapshot_.pos_vel.velocity_estimated[i];
+    state.angular_velocity[i] = snapshot_.imu_0_compensated.ang_vel[i];
+    state.desired_position[i] = snapshot_.pos_vel.position_desired[i];
+  }
+  state.desired_yaw = snapshot_.pos_vel.yaw_desired;
+  state.battery_voltage = snapshot_.general_status.voltage;
+  state.on_ground = snapshot_.general_status.on_ground;
+  state.props_state = snapshot_.general_status.props_state;
+  state.written_ns = MonotonicNowNs();
+  shared_state_writer_.Write(state);
+}
+
+void SnavInterface::PublishImuBatches(bool active){
+  TelemetryStream<SnImuComp>::Entry entry;
+  while (acquisition_.GetImuStream().Pop(entry))
+  {
+    if (!active)
+    {
+      // Nobody listens, drop the partial batch and its counts with it
+      imu_batch_fill_ = 0;
+      imu_batch_msg_.dropped = 0;
+      imu_batch_msg_.duplicates = 0;
+      continue;
+    }
+
+    const SnImuComp& sample = entry.sample;
+    sensor_msgs::Imu& imu = imu_batch_msg_.samples[imu_batch_fill_];
+    imu.header.stamp.fromNSec(clock_sync_.ToRealtimeNs(sample.time));
+    imu.angular_velocity.x = sample.ang_vel[0];
+    imu.angular_velocity.y = sample.ang_vel[1];
+    imu.angular_velocity.z = sample.ang_vel[2];
+    imu.linear_acceleration.x = sample.lin_acc[0];
+    imu.linear_acceleration.y = sample.lin_acc[1];
+    imu.linear_acceleration.z = sample.lin_acc[2];
+    imu_batch_msg_.temperature[imu_batch_fill_] = sample.temp;
+    imu_batch_msg_.dropped += entry.dropped;
+    imu_batch_msg_.duplicates += entry.duplicates;
+
+    if (++imu_batch_fill_ == imu_batch_msg_.samples.size())
+    {
+      imu_batch_msg_.header.stamp = imu.header.stamp;
+      PublishMessage(imu_batch_publisher_, imu_batch_msg_, imu_batch_pool_);
+      imu_batch_fill_ = 0;
+      imu_batch_msg_.dropped = 0;
+      imu_batch_msg_.duplicates = 0;
+    }
+  }
+}
+
+void SnavInterface::PublishEscBatches(bool active){
+  TelemetryStream<SnEscRawData>::Entry entry;
+  while (acquisition_.GetEscStream().Pop(entry))
+  {
+    if (!active)
+    {
+      esc_batch_fill_ = 0;
+      esc_batch_msg_.dropped = 0;
+      esc_batch_msg_.duplicates = 0;
+      continue;
+    }
+
+    const SnEscRawData& sample = entry.sample;
+    snav_ros::EscSample& esc = esc_batch_msg_.samples[esc_batch_fill_];
+    esc.stamp.fromNSec(clock_sync_.ToRealtimeNs(sample.time));
+    esc.counter = sample.cntr;
+    for (size_t i = 0; i < esc.rpm.size(); ++i)
+    {
+      esc.rpm[i] = sample.rpm[i];
+      esc.power[i] = sample.power[i];
+      esc.voltage[i] = sample.voltage[i];
+      esc.current[i] = sample.current[i];
+      esc.temperature[i] = sample.temperature[i];
+      esc.packet_counter[i] = sample.packet_cntr[i];
+    }
+    esc_batch_msg_.dropped += entry.dropped;
+    esc_batch_msg_.duplicates += entry.duplicates;
+
+    if (++esc_batch_fill_ == esc_batch_msg_.samples.size())
+    {
+      esc_batch_msg_.header.stamp = esc.stamp;
+      PublishMessage(esc_batch_publisher_, esc_batch_msg_, esc_batch_pool_);
+      esc_batch_fill_ = 0;
+      esc_batch_msg_.dropped = 0;
+      esc_batch_msg_.duplicates = 0;
+    }
   }
-  props_state_publisher_.publish( props_state_msg );
 }
 
 void SnavInterface::BroadcastEstTf(){
   if(valid_rotation_est_)
-    tf_pub_.sendTransform(est_transform_msg_);
+    QueueTransform(TF_EST);
   else
-    ROS_ERROR("Tried to broadcast invalid Est Tf");
+    faults_.Raise(FaultMonitor::FAULT_INVALID_EST_OUTPUT);
 }
 
 void SnavInterface::BroadcastDesiredTf(){
   if(valid_rotation_est_)
-    tf_pub_.sendTransform(des_transform_msg_);
+    QueueTransform(TF_DESIRED);
   else
-    ROS_ERROR("Tried to broadcast invalid Desired Tf");
+    faults_.Raise(FaultMonitor::FAULT_INVALID_EST_OUTPUT);
 }
 
 void SnavInterface::BroadcastGpsEnuTf(){
   if(valid_rotation_est_)
-    tf_pub_.sendTransform(gps_enu_transform_msg_);
+    QueueTransform(TF_GPS_ENU);
   else
-    ROS_ERROR("Tried to broadcast invalid GPS ENU Tf");
+    faults_.Raise(FaultMonitor::FAULT_INVALID_EST_OUTPUT);
 }
 
 void SnavInterface::BroadcastBaseLinkNoRotTf(){
   if (valid_rotation_est_){
-    tf_pub_.sendTransform(base_link_no_rot_transform_msg_);
+    QueueTransform(TF_BASE_LINK_NO_ROT);
   }
   else
-    ROS_ERROR("Tried to broadcast invalid base link no rotation Tf");
+    faults_.Raise(FaultMonitor::FAULT_INVALID_EST_OUTPUT);
 }
 
 void SnavInterface::BroadcastBaseLinkStabTf(){
   if (valid_rotation_est_){
-    tf_pub_.sendTransform(base_link_stab_transform_msg_);
+    QueueTransform(TF_BASE_LINK_STAB);
   }
   else
-    ROS_ERROR("Tried to broadcast invalid base link stabilized Tf");
+    faults_.Raise(FaultMonitor::FAULT_INVALID_EST_OUTPUT);
 }
 
 void SnavInterface::BroadcastSimGtTf(){
   if (valid_rotation_sim_gt_){
-    tf_pub_.sendTransform(sim_gt_transform_msg_);
+    QueueTransform(TF_SIM_GT);
   }
   else
-    ROS_ERROR("Tried to broadcast invalid sim ground truth Tf");
+    faults_.Raise(FaultMonitor::FAULT_INVALID_SIM_OUTPUT);
+}
+
+void SnavInterface::QueueTransform(TfFrame frame){
+  tf_queued_ |= 1u << frame;
+}
+
+void SnavInterface::SendTfBatch(){
+  if (tf_queued_ == 0)
+    return;
+  // Moving keeps the frame id strings out of the allocator
+  for (int frame = 0; frame < NUM_TF_FRAMES; ++frame)
+  {
+    if (tf_queued_ & (1u << frame))
+      tf_batch_.transforms.push_back(std::move(*tf_messages_[frame]));
+  }
+  PublishTemplated(tf_publisher_, tf_batch_, tf_pool_, tf_templates_[tf_queued_]);
+  size_t sent = 0;
+  for (int frame = 0; frame < NUM_TF_FRAMES; ++frame)
+  {
+    if (tf_queued_ & (1u << frame))
+      *tf_messages_[frame] = std::move(tf_batch_.transforms[sent++]);
+  }
+  tf_batch_.transforms.clear();
+  tf_queued_ = 0;
 }
 
 void SnavInterface::PublishEstPose(){
   if(valid_rotation_est_)
-    pose_est_publisher_.publish(est_pose_msg_);
+    PublishTemplated(pose_est_publisher_, est_pose_msg_, pose_pool_, est_pose_template_);
   else
-    ROS_ERROR("Tried to publish invalid Est Pose");
+    faults_.Raise(FaultMonitor::FAULT_INVALID_EST_OUTPUT);
 }
 
 void SnavInterface::PublishDesiredPose(){
   if(valid_rotation_est_)
-    pose_des_publisher_.publish(des_pose_msg_);
+    PublishTemplated(pose_des_publisher_, des_pose_msg_, pose_pool_, des_pose_template_);
   else
-    ROS_ERROR("Tried to publish invalid Desired Pose");
+    faults_.Raise(FaultMonitor::FAULT_INVALID_EST_OUTPUT);
 }
 
 void SnavInterface::PublishSimGtPose(){
   if (valid_rotation_sim_gt_)
-    pose_est_publisher_.publish(sim_gt_pose_msg_);
+    PublishTemplated(pose_sim_gt_publisher_, sim_gt_pose_msg_, pose_pool_, sim_gt_pose_template_);
   else
-    ROS_ERROR("Tried to publish invalid sim ground truth pose");
+    faults_.Raise(FaultMonitor::FAULT_INVALID_SIM_OUTPUT);
 }
 
 void SnavInterface::PublishEstVel(){
   if(valid_rotation_est_)
-    vel_est_publisher_.publish(est_vel_msg_);
+    PublishTemplated(vel_est_publisher_, est_vel_msg_, vel_pool_, vel_template_);
+  else
+    faults_.Raise(FaultMonitor::FAULT_INVALID_EST_OUTPUT);
+}
+
+void SnavInterface::PublishEstOdom(){
+  if(valid_rotation_est_)
+    PublishTemplated(odom_est_publisher_, est_odom_msg_, odom_pool_, odom_template_);
   else
-    ROS_ERROR("Tried to publish invalid Est Vel");
+    faults_.Raise(FaultMonitor::FAULT_INVALID_EST_OUTPUT);
 }
@@ -39,69 +39,14 @@ int main(int argc, char *argv[])
   ros::NodeHandle nh;
   ros::NodeHandle private_nh("~");
 
-  double loop_freq, slow_loop_freq;
-  private_nh.param("loop_frequency", loop_freq, 100.0);
-  private_nh.param("low_freq_data_rate", slow_loop_freq, 5.0);
-
-  bool publish_est_data;
-  private_nh.param("publish_est_data", publish_est_data, true);
-  bool publish_sim_data;
-  private_nh.param("publish_sim_data", publish_sim_data, true);
-
-  bool broadcast_tf, publish_pose;
-  bool broadcast_des_tf, publish_des_pose;
-  bool broadcast_gps_tf;
-  bool broadcast_sim_gt_tf, publish_sim_gt_pose;
-  private_nh.param("broadcast_tf", broadcast_tf, true);
-  private_nh.param("broadcast_des_tf", broadcast_des_tf, true);
-  private_nh.param("broadcast_gps_tf", broadcast_gps_tf, true);
-  private_nh.param("broadcast_sim_gt_tf", broadcast_sim_gt_tf, true);
-  private_nh.param("publish_pose", publish_pose, true);
-  private_nh.param("publish_des_pose", publish_des_pose, true);
-  private_nh.param("publish_sim_gt_pose", publish_sim_gt_pose, true);
-
   SnavInterface sn_iface(nh, private_nh);
-
-  ros::Timer timer = nh.createTimer(ros::Duration(1.0/slow_loop_freq),
-                                    &SnavInterface::PublishLowFrequencyData, &sn_iface);
-  ros::WallRate loop_ctrl(loop_freq);
+  sn_iface.ApplyRealtimeConfig();
 
   while(ros::ok())
   {
     ros::spinOnce();
-
-    sn_iface.UpdateSnavData();
-
-    if (publish_est_data)
-    {
-      sn_iface.UpdatePoseMessages();
-      if (broadcast_des_tf)
-        sn_iface.BroadcastDesiredTf();
-      if (publish_des_pose)
-        sn_iface.PublishDesiredPose();
-      if (broadcast_tf)
-      {
-        sn_iface.BroadcastEstTf();
-        sn_iface.BroadcastBaseLinkNoRotTf();
-        sn_iface.BroadcastBaseLinkStabTf();
-      }
-      if (publish_pose)
-        sn_iface.PublishEstPose();
-        sn_iface.PublishEstVel();
-      if (broadcast_gps_tf)
-        sn_iface.BroadcastGpsEnuTf();
-    }
-
-    if (publish_sim_data)
-    {
-      sn_iface.UpdateSimMessages();
-      if (broadcast_sim_gt_tf)
-        sn_iface.BroadcastSimGtTf();
-      if (publish_sim_gt_pose)
-        sn_iface.PublishSimGtPose();
-    }
-
-    loop_ctrl.sleep();
+    sn_iface.RunOnce();
+    sn_iface.WaitForNextCycle();
   }
 
   return 0;
@@ -0,0 +1,98 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include <atomic>
+#include <thread>
+
+#include <boost/shared_ptr.hpp>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include "snav_interface/snav_interface.hpp"
+
+namespace snav_ros
+{
+
+/**
+ * Runs SnavInterface inside a nodelet manager so co-loaded nodelets receive
+ * pose, vel and tf messages without serialization.
+ */
+class SnavInterfaceNodelet : public nodelet::Nodelet
+{
+public:
+  SnavInterfaceNodelet() : running_(false) {}
+
+  ~SnavInterfaceNodelet()
+  {
+    running_ = false;
+    if (loop_thread_.joinable())
+      loop_thread_.join();
+  }
+
+private:
+  virtual void onInit()
+  {
+    ros::NodeHandle& pnh = getPrivateNodeHandle();
+
+    // Publishing shared_ptrs is what makes intra-process delivery zero-copy
+    if (!pnh.hasParam("zero_copy_publish"))
+      pnh.setParam("zero_copy_publish", true);
+
+    sn_iface_.reset(new SnavInterface(getNodeHandle(), pnh));
+
+    // The loop blocks between samples, so it gets its own thread rather than
+    // tying up one of the manager's callback workers. Subscriber and timer
+    // callbacks still run on the manager's queue.
+    running_ = true;
+    loop_thread_ = std::thread(&SnavInterfaceNodelet::Run, this);
+  }
+
+  void Run()
+  {
+    // The manager process is shared with the other nodelets
+    sn_iface_->ApplyRealtimeConfig(true);
+    while (running_ && ros::ok())
+    {
+      sn_iface_->RunOnce();
+      sn_iface_->WaitForNextCycle();
+    }
+  }
+
+  boost::shared_ptr<SnavInterface> sn_iface_;
+  std::thread loop_thread_;
+  std::atomic<bool> running_;
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(snav_ros::SnavInterfaceNodelet, nodelet::Nodelet)
@@ -0,0 +1,115 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include "snav_interface/snav_trajectory.hpp"
+
+#include <cmath>
+
+namespace
+{
+float WrapAngle(float angle)
+{
+  while (angle > (float)M_PI)
+    angle -= 2.0f*(float)M_PI;
+  while (angle < -(float)M_PI)
+    angle += 2.0f*(float)M_PI;
+  return angle;
+}
+
+// Cubic Hermite interpolation between p0 and p1 with slopes m0 and m1
+// over an interval of length dt, evaluated at s in [0, 1]
+float Hermite(float p0, float m0, float p1, float m1, float dt, float s)
+{
+  float s2 = s*s;
+  float s3 = s2*s;
+  return (2.0f*s3 - 3.0f*s2 + 1.0f)*p0 + (s3 - 2.0f*s2 + s)*dt*m0 +
+      (-2.0f*s3 + 3.0f*s2)*p1 + (s3 - s2)*dt*m1;
+}
+
+float HermiteDerivative(float p0, float m0, float p1, float m1, float dt, float s)
+{
+  float s2 = s*s;
+  return ((6.0f*s2 - 6.0f*s)*p0 + (3.0f*s2 - 4.0f*s + 1.0f)*dt*m0 +
+      (-6.0f*s2 + 6.0f*s)*p1 + (3.0f*s2 - 2.0f*s)*dt*m1)/dt;
+}
+}
+
+bool SnavTrajectory::Evaluate(int64_t time_ns, size_t& cursor, Sample& out) const
+{
+  if (samples.empty())
+    return false;
+
+  if (time_ns <= samples.front().time_ns)
+  {
+    out = samples.front();
+    out.time_ns = time_ns;
+    return true;
+  }
+
+  if (time_ns >= samples.back().time_ns)
+  {
+    out = samples.back();
+    out.time_ns = time_ns;
+    for (int i = 0; i < 3; ++i)
+    {
+      out.velocity[i] = 0.0f;
+      out.acceleration[i] = 0.0f;
+    }
+    out.yaw_rate = 0.0f;
+    return time_ns == samples.back().time_ns;
+  }
+
+  if (cursor >= samples.size() - 1 || samples[cursor].time_ns > time_ns)
+    cursor = 0;
+  while (samples[cursor + 1].time_ns <= time_ns)
+    ++cursor;
+
+  const Sample& a = samples[cursor];
+  const Sample& b = samples[cursor + 1];
+  float dt = (b.time_ns - a.time_ns)*1e-9f;
+  float s = (time_ns - a.time_ns)*1e-9f/dt;
+
+  out.time_ns = time_ns;
+  for (int i = 0; i < 3; ++i)
+  {
+    out.position[i] = Hermite(a.position[i], a.velocity[i], b.position[i], b.velocity[i], dt, s);
+    out.velocity[i] = HermiteDerivative(a.position[i], a.velocity[i], b.position[i], b.velocity[i], dt, s);
+    out.acceleration[i] = a.acceleration[i] + s*(b.acceleration[i] - a.acceleration[i]);
+  }
+
+  // Interpolate yaw along the short way around
+  float yaw_b = a.yaw + WrapAngle(b.yaw - a.yaw);
+  out.yaw = WrapAngle(Hermite(a.yaw, a.yaw_rate, yaw_b, b.yaw_rate, dt, s));
+  out.yaw_rate = HermiteDerivative(a.yaw, a.yaw_rate, yaw_b, b.yaw_rate, dt, s);
+  return true;
+}
@@ -0,0 +1,487 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+/*
+ * Offline converter for flight recorder ring files.
+ *
+ * Turns a record written with record_path into a CSV table (one row per
+ * record) or a rosbag with the pose, pose_des, vel, status and /tf topics
+ * snav_interface publishes. The record is split into chunks that are
+ * converted on all cores and written out in order, so an hour-long record
+ * converts in seconds. To push a record through the node itself, with every
+ * frame and parameter, use replay_path instead.
+ *
+ * Usage: snav_record_convert <record> <output.csv|output.bag> [--jobs N]
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/Twist.h>
+#include <rosbag/bag.h>
+#include <std_msgs/Bool.h>
+#include <std_msgs/Float32.h>
+#include <tf2_msgs/TFMessage.h>
+
+#include "snav_interface/clock_utils.hpp"
+#include "snav_interface/dsp_clock_sync.hpp"
+#include "snav_interface/flight_record_reader.hpp"
+#include "snav_interface/frame_kernel.hpp"
+#include "snav_interface/topic_names.hpp"
+
+namespace
+{
+
+// Records per unit of work, large enough to amortize the hand-off
+const uint64_t kChunkRecords = 8192;
+
+// Status topics are written at this period, like low_freq_data_rate [us]
+const int64_t kStatusPeriodUs = 200000;
+
+struct Options
+{
+  Options() : jobs(0), bag(false) {}
+  std::string record;
+  std::string output;
+  int jobs;
+  bool bag;
+};
+
+bool EndsWith(const std::string& s, const char* suffix)
+{
+  size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+      options.jobs = atoi(argv[++i]);
+    else if (argv[i][0] != '-')
+      positional.push_back(argv[i]);
+    else
+      positional.clear();
+  }
+
+  if (positional.size() != 2 || !(EndsWith(positional[1], ".csv") || EndsWith(positional[1], ".bag")))
+  {
+    fprintf(stderr, "Usage: %s <record> <output.csv|output.bag> [--jobs N]\n", argv[0]);
+    return false;
+  }
+  options.record = positional[0];
+  options.output = positional[1];
+  options.bag = EndsWith(options.output, ".bag");
+  if (options.jobs <= 0)
+    options.jobs = std::max(1u, std::thread::hardware_concurrency());
+  return true;
+}
+
+// Everything written to the bag for one record
+struct BagRecord
+{
+  bool est;
+  bool sim;
+  bool status;
+  ros::Time stamp;
+  ros::Time sim_stamp;
+  ros::Time status_stamp;
+  geometry_msgs::PoseStamped pose;
+  geometry_msgs::PoseStamped pose_des;
+  geometry_msgs::PoseStamped sim_pose;
+  geometry_msgs::Twist vel;
+  tf2_msgs::TFMessage tf;
+  std_msgs::Float32 voltage;
+  std_msgs::Bool on_ground;
+  std_msgs::Bool props_state;
+};
+
+struct Chunk
+{
+  Chunk() : ready(false), skipped(0) {}
+  bool ready;
+  uint64_t skipped;
+  std::string csv;
+  std::vector<BagRecord> bag;
+};
+
+void SetPose(const FrameQuaternion& q, const float* t, geometry_msgs::Pose& pose)
+{
+  pose.position.x = t[0];
+  pose.position.y = t[1];
+  pose.position.z = t[2];
+  pose.orientation.x = q.x;
+  pose.orientation.y = q.y;
+  pose.orientation.z = q.z;
+  pose.orientation.w = q.w;
+}
+
+void AddTransform(const FrameQuaternion& q, const float* t, const ros::Time& stamp,
+    const char* parent, const char* child, tf2_msgs::TFMessage& tf)
+{
+  geometry_msgs::TransformStamped msg;
+  msg.header.stamp = stamp;
+  msg.header.frame_id = parent;
+  msg.child_frame_id = child;
+  msg.transform.translation.x = t[0];
+  msg.transform.translation.y = t[1];
+  msg.transform.translation.z = t[2];
+  msg.transform.rotation.x = q.x;
+  msg.transform.rotation.y = q.y;
+  msg.transform.rotation.z = q.z;
+  msg.transform.rotation.w = q.w;
+  tf.transforms.push_back(msg);
+}
+
+ros::Time ToStamp(const DspClockSync::Model& model, int64_t dsp_time_us)
+{
+  ros::Time stamp;
+  stamp.fromNSec(DspClockSync::ToRealtimeNs(model, dsp_time_us));
+  return stamp;
+}
+
+const char kCsvHeader[] =
+    "sequence,acquired_time_ns,stamp_ns,est_time_us,x,y,z,vx,vy,vz,qx,qy,qz,qw,"
+    "x_des,y_des,z_des,yaw_des,wx,wy,wz,sim_time_us,sim_x,sim_y,sim_z,"
+    "sim_qx,sim_qy,sim_qz,sim_qw,voltage,on_ground,props_state\n";
+
+void AppendCsvRow(uint64_t sequence, const SnavSnapshot& s, const SnavFrames& frames,
+    const DspClockSync::Model& model, std::string& out)
+{
+  char row[768];
+  int n = snprintf(row, sizeof(row),
+      "%llu,%lld,%lld,%lld,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.7f,%.7f,%.7f,%.7f,"
+      "%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%lld,%.6f,%.6f,%.6f,"
+      "%.7f,%.7f,%.7f,%.7f,%.3f,%d,%d\n",
+      (unsigned long long)sequence, (long long)s.acquired_time_ns,
+      (long long)DspClockSync::ToRealtimeNs(model, s.pos_vel.time), (long long)s.pos_vel.time,
+      s.pos_vel.position_estimated[0], s.pos_vel.position_estimated[1], s.pos_vel.position_estimated[2],
+      s.pos_vel.velocity_estimated[0], s.pos_vel.velocity_estimated[1], s.pos_vel.velocity_estimated[2],
+      frames.est.x, frames.est.y, frames.est.z, frames.est.w,
+      s.pos_vel.position_desired[0], s.pos_vel.position_desired[1], s.pos_vel.position_desired[2],
+      s.pos_vel.yaw_desired,
+      s.imu_0_compensated.ang_vel[0], s.imu_0_compensated.ang_vel[1], s.imu_0_compensated.ang_vel[2],
+      (long long)s.sim_ground_truth.time,
+      s.sim_ground_truth.position[0], s.sim_ground_truth.position[1], s.sim_ground_truth.position[2],
+      frames.sim.x, frames.sim.y, frames.sim.z, frames.sim.w,
+      s.general_status.voltage, s.general_status.on_ground, s.general_status.props_state);
+  out.append(row, std::min(n, (int)sizeof(row) - 1));
+}
+
+void FillBagRecord(const SnavSnapshot& s, const SnavSnapshot& previous, const SnavFrames& frames,
+    const DspClockSync::Model& model, BagRecord& record)
+{
+  static const float kZero[3] = {0, 0, 0};
+
+  record.est = frames.est_valid && s.pos_vel.time != 0 && s.pos_vel.time != previous.pos_vel.time;
+  record.sim = frames.sim_valid && s.sim_ground_truth.time != 0 &&
+      s.sim_ground_truth.time != previous.sim_ground_truth.time;
+  record.status = s.general_status.time != 0 &&
+      s.general_status.time/kStatusPeriodUs != previous.general_status.time/kStatusPeriodUs;
+
+  if (record.est)
+  {
+    record.stamp = ToStamp(model, s.pos_vel.time);
+
+    SetPose(frames.est, s.pos_vel.position_estimated, record.pose.pose);
+    record.pose.header.stamp = record.stamp;
+    record.pose.header.frame_id = "/odom";
+
+    SetPose(frames.des, s.pos_vel.position_desired, record.pose_des.pose);
+    record.pose_des.header = record.pose.header;
+
+    record.vel.linear.x = s.pos_vel.velocity_estimated[0];
+    record.vel.linear.y = s.pos_vel.velocity_estimated[1];
+    record.vel.linear.z = s.pos_vel.velocity_estimated[2];
+    record.vel.angular.x = s.imu_0_compensated.ang_vel[0];
+    record.vel.angular.y = s.imu_0_compensated.ang_vel[1];
+    record.vel.angular.z = s.imu_0_compensated.ang_vel[2];
+
+    AddTransform(frames.est, s.pos_vel.position_estimated, record.stamp, "/odom", "/base_link", record.tf);
+    AddTransform(frames.des, s.pos_vel.position_desired, record.stamp, "/odom", "/desired", record.tf);
+    AddTransform(frames.no_rot, kZero, record.stamp, "/base_link", "/base_link_no_rot", record.tf);
+    AddTransform(frames.stab, kZero, record.stamp, "/base_link_no_rot", "/base_link_stab", record.tf);
+  }
+
+  if (record.sim)
+  {
+    record.sim_stamp = ToStamp(model, s.sim_ground_truth.time);
+    SetPose(frames.sim, s.sim_ground_truth.position, record.sim_pose.pose);
+    record.sim_pose.header.stamp = record.sim_stamp;
+    record.sim_pose.header.frame_id = "/sim/ground_truth";
+    AddTransform(frames.sim_inv, frames.sim_inv_translation, record.sim_stamp,
+        "/base_link", "/sim/ground_truth", record.tf);
+  }
+
+  if (record.status)
+  {
+    record.status_stamp = ToStamp(model, s.general_status.time);
+    record.voltage.data = s.general_status.voltage;
+    record.on_ground.data = s.general_status.on_ground;
+    record.props_state.data = s.general_status.props_state;
+  }
+}
+
+/**
+ * Converts chunks on a pool of workers and hands them to the writer in
+ * record order. At most window chunks are in flight, which bounds memory
+ * no matter how long the record is.
+ */
+class Converter
+{
+public:
+  Converter(const FlightRecordReader& reader, const Options& options)
+    : reader_(reader),
+      options_(options),
+      num_chunks_((reader.GetLast() - reader.GetFirst() + kChunkRecords)/kChunkRecords),
+      window_(2*options.jobs),
+      next_chunk_(0),
+      written_chunks_(0),
+      slots_(window_)
+  {
+  }
+
+  /**
+   * Convert every record, calling write(chunk) in order on this thread.
+   * @return number of torn or overwritten records that were skipped
+   */
+  template <typename Write>
+  uint64_t Run(Write write)
+  {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < options_.jobs; ++i)
+      workers.push_back(std::thread(&Converter::Work, this));
+
+    uint64_t skipped = 0;
+    for (uint64_t i = 0; i < num_chunks_; ++i)
+    {
+      Chunk& chunk = slots_[i % window_];
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [&chunk]() { return chunk.ready; });
+      }
+
+      write(chunk);
+      skipped += chunk.skipped;
+      chunk.csv.clear();
+      chunk.bag.clear();
+      chunk.skipped = 0;
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      chunk.ready = false;
+      written_chunks_ = i + 1;
+      space_.notify_all();
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i)
+      workers[i].join();
+    return skipped;
+  }
+
+private:
+  void Work()
+  {
+    for (;;)
+    {
+      uint64_t index;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        space_.wait(lock, [this]() {
+          return next_chunk_ >= num_chunks_ || next_chunk_ < written_chunks_ + window_; });
+        if (next_chunk_ >= num_chunks_)
+          return;
+        index = next_chunk_++;
+      }
+
+      Chunk& chunk = slots_[index % window_];
+      Convert(index, chunk);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      chunk.ready = true;
+      ready_.notify_all();
+    }
+  }
+
+  void Convert(uint64_t index, Chunk& chunk)
+  {
+    const DspClockSync::Model& model = reader_.GetClockModel();
+    uint64_t first = reader_.GetFirst() + index*kChunkRecords;
+    uint64_t last = std::min(first + kChunkRecords - 1, reader_.GetLast());
+
+    if (options_.bag)
+      chunk.bag.reserve(last - first + 1);
+    else
+      chunk.csv.reserve((last - first + 1)*320);
+
+    // Duplicate detection needs the record before the chunk
+    SnavSnapshot previous;
+    std::memset(&previous, 0, sizeof(previous));
+    if (first > reader_.GetFirst())
+      reader_.Get(first - 1, previous);
+
+    SnavSnapshot snapshot;
+    SnavFrames frames;
+    for (uint64_t sequence = first; sequence <= last; ++sequence)
+    {
+      if (!reader_.Get(sequence, snapshot))
+      {
+        ++chunk.skipped;
+        continue;
+      }
+      ComputeFrames(snapshot, frames);
+
+      if (options_.bag)
+      {
+        chunk.bag.push_back(BagRecord());
+        FillBagRecord(snapshot, previous, frames, model, chunk.bag.back());
+      }
+      else
+        AppendCsvRow(sequence, snapshot, frames, model, chunk.csv);
+      previous = snapshot;
+    }
+  }
+
+  const FlightRecordReader& reader_;
+  const Options& options_;
+  const uint64_t num_chunks_;
+  const uint64_t window_;
+
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable space_;
+  uint64_t next_chunk_;
+  uint64_t written_chunks_;
+  std::vector<Chunk> slots_;
+};
+
+void WriteBagRecord(rosbag::Bag& bag, const BagRecord& record)
+{
+  if (record.est)
+  {
+    bag.write(kPoseTopic, record.stamp, record.pose);
+    bag.write(kPoseDesTopic, record.stamp, record.pose_des);
+    bag.write(kVelTopic, record.stamp, record.vel);
+  }
+  if (record.sim)
+    bag.write(kPoseSimGtTopic, record.sim_stamp, record.sim_pose);
+  if (record.est || record.sim)
+    bag.write(kTfTopic, record.sim ? record.sim_stamp : record.stamp, record.tf);
+  if (record.status)
+  {
+    bag.write(kBatteryVoltageTopic, record.status_stamp, record.voltage);
+    bag.write(kOnGroundTopic, record.status_stamp, record.on_ground);
+    bag.write(kPropsStateTopic, record.status_stamp, record.props_state);
+  }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  if (!ParseOptions(argc, argv, options))
+    return 1;
+
+  FlightRecordReader reader;
+  std::string error;
+  if (!reader.Open(options.record, error))
+  {
+    fprintf(stderr, "%s: %s\n", options.record.c_str(), error.c_str());
+    return 1;
+  }
+  if (reader.GetLast() == 0)
+  {
+    fprintf(stderr, "%s: no records\n", options.record.c_str());
+    return 1;
+  }
+
+  int64_t start_ns = MonotonicNowNs();
+  Converter converter(reader, options);
+  uint64_t skipped = 0;
+
+  if (options.bag)
+  {
+    rosbag::Bag bag;
+    try
+    {
+      bag.open(options.output, rosbag::bagmode::Write);
+      // Messages are built on the workers, only serialization happens here
+      skipped = converter.Run([&bag](const Chunk& chunk) {
+        for (size_t i = 0; i < chunk.bag.size(); ++i)
+          WriteBagRecord(bag, chunk.bag[i]);
+      });
+      bag.close();
+    }
+    catch (const rosbag::BagException& e)
+    {
+      fprintf(stderr, "%s: %s\n", options.output.c_str(), e.what());
+      return 1;
+    }
+  }
+  else
+  {
+    FILE* out = fopen(options.output.c_str(), "w");
+    if (out == NULL)
+    {
+      fprintf(stderr, "%s: %s\n", options.output.c_str(), strerror(errno));
+      return 1;
+    }
+    bool ok = fputs(kCsvHeader, out) >= 0;
+    skipped = converter.Run([out, &ok](const Chunk& chunk) {
+      ok = ok && fwrite(chunk.csv.data(), 1, chunk.csv.size(), out) == chunk.csv.size();
+    });
+    if (fclose(out) != 0 || !ok)
+    {
+      fprintf(stderr, "%s: write failed\n", options.output.c_str());
+      return 1;
+    }
+  }
+
+  uint64_t total = reader.GetLast() - reader.GetFirst() + 1;
+  printf("Converted %llu records (%llu skipped) with %d jobs in %.2f s\n",
+      (unsigned long long)(total - skipped), (unsigned long long)skipped, options.jobs,
+      (MonotonicNowNs() - start_ns)*1e-9);
+  return 0;
+}
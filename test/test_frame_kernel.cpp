@@ -0,0 +1,397 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <tf2/LinearMath/Matrix3x3.h>
+#include <tf2/LinearMath/Quaternion.h>
+#include <tf2/LinearMath/Transform.h>
+
+#include "snav_interface/frame_kernel.hpp"
+
+namespace
+{
+
+// float kernel against double tf2
+const double kTolerance = 1e-5;
+
+tf2::Quaternion AxisAngle(double x, double y, double z, double angle)
+{
+  return tf2::Quaternion(tf2::Vector3(x, y, z).normalized(), angle);
+}
+
+tf2::Matrix3x3 ToMatrix(const float* R)
+{
+  return tf2::Matrix3x3(R[0], R[1], R[2], R[3], R[4], R[5], R[6], R[7], R[8]);
+}
+
+void FillRotation(const tf2::Quaternion& q, float* R)
+{
+  tf2::Matrix3x3 M(q);
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      R[3*i + j] = M[i][j];
+}
+
+tf2::Quaternion GetRotation(const tf2::Matrix3x3& M)
+{
+  tf2::Quaternion q;
+  M.getRotation(q);
+  return q;
+}
+
+// Same quaternion, sign included
+void ExpectSameQuaternion(const FrameQuaternion& q, const tf2::Quaternion& ref)
+{
+  EXPECT_NEAR(ref.x(), q.x, kTolerance);
+  EXPECT_NEAR(ref.y(), q.y, kTolerance);
+  EXPECT_NEAR(ref.z(), q.z, kTolerance);
+  EXPECT_NEAR(ref.w(), q.w, kTolerance);
+}
+
+// Same rotation, either sign
+void ExpectSameRotation(const FrameQuaternion& q, const tf2::Quaternion& ref)
+{
+  double same = fabs(q.x - ref.x()) + fabs(q.y - ref.y()) + fabs(q.z - ref.z()) + fabs(q.w - ref.w());
+  double flipped = fabs(q.x + ref.x()) + fabs(q.y + ref.y()) + fabs(q.z + ref.z()) + fabs(q.w + ref.w());
+  EXPECT_LT(std::min(same, flipped), kTolerance);
+}
+
+// Where float and double may choose a different Shepperd pivot: a trace
+// near zero, or a tie for the largest diagonal element
+bool NearPivotTie(const tf2::Matrix3x3& M)
+{
+  double d[3] = {M[0][0], M[1][1], M[2][2]};
+  std::sort(d, d + 3);
+  return fabs(d[0] + d[1] + d[2]) < 1e-4 || d[2] - d[1] < 1e-4;
+}
+
+// Rotations of every frame computed the way UpdatePosVelMessages and
+// UpdateSimMessages did before the frame kernel
+struct ReferenceFrames
+{
+  tf2::Quaternion est, no_rot, stab, des, gps_enu, sim, sim_inv;
+  tf2::Vector3 sim_inv_translation;
+};
+
+void ComputeReferenceFrames(const SnavSnapshot& snapshot, ReferenceFrames& ref)
+{
+  ToMatrix(snapshot.attitude_estimate.rotation_matrix).getRotation(ref.est);
+
+  tf2::Quaternion q_des;
+  q_des.setEuler(0.0, 0.0, snapshot.pos_vel.yaw_desired);
+  ref.des = tf2::Transform(q_des).getRotation();
+
+  ref.gps_enu = tf2::Transform(ToMatrix(snapshot.pos_vel.R_eg)).getRotation();
+
+  tf2::Matrix3x3 RR_est(ref.est);
+  tf2Scalar roll, pitch, yaw;
+  RR_est.getRPY(roll, pitch, yaw);
+  ref.no_rot = tf2::Transform(RR_est.inverse()).getRotation();
+  tf2::Matrix3x3 RR_yaw;
+  RR_yaw.setRPY(0, 0, yaw);
+  ref.stab = tf2::Transform(RR_yaw).getRotation();
+
+  tf2::Quaternion q_sim;
+  ToMatrix(snapshot.sim_ground_truth.R).getRotation(q_sim);
+  tf2::Transform sim_gt_tf(q_sim, tf2::Vector3(snapshot.sim_ground_truth.position[0],
+        snapshot.sim_ground_truth.position[1], snapshot.sim_ground_truth.position[2]));
+  sim_gt_tf = sim_gt_tf.inverse();
+  ref.sim_inv = sim_gt_tf.getRotation();
+  ref.sim_inv_translation = sim_gt_tf.getOrigin();
+  ref.sim = sim_gt_tf.inverse().getRotation();
+}
+
+// One rotation per Shepperd pivot, lane l pivots on w, x, y, z in turn
+class FrameKernelPivots : public testing::Test
+{
+protected:
+  virtual void SetUp()
+  {
+    attitudes[0] = AxisAngle(1, 2, 3, 0.5);
+    attitudes[1] = AxisAngle(1, 0.2, 0.1, 3.0);
+    attitudes[2] = AxisAngle(0.2, 1, 0.1, 3.0);
+    attitudes[3] = AxisAngle(0.1, 0.2, 1, 3.0);
+    const float* R_lanes[kFrameKernelLanes];
+    for (int l = 0; l < kFrameKernelLanes; ++l)
+    {
+      FillRotation(attitudes[l], R[l]);
+      R_lanes[l] = R[l];
+    }
+    RotationsToQuaternions(R_lanes, q, w_pivot);
+  }
+
+  tf2::Quaternion attitudes[kFrameKernelLanes];
+  float R[kFrameKernelLanes][9];
+  FrameQuaternion q[kFrameKernelLanes];
+  bool w_pivot[kFrameKernelLanes];
+};
+
+TEST_F(FrameKernelPivots, ConvertsEachPivotLikeTf2)
+{
+  EXPECT_TRUE(w_pivot[0]);
+  EXPECT_FALSE(w_pivot[1]);
+  EXPECT_FALSE(w_pivot[2]);
+  EXPECT_FALSE(w_pivot[3]);
+
+  // tf2 keeps the pivot component positive
+  EXPECT_GT(q[0].w, 0);
+  EXPECT_GT(q[1].x, 0);
+  EXPECT_GT(q[2].y, 0);
+  EXPECT_GT(q[3].z, 0);
+
+  for (int l = 0; l < kFrameKernelLanes; ++l)
+  {
+    SCOPED_TRACE(l);
+    ExpectSameQuaternion(q[l], GetRotation(ToMatrix(R[l])));
+  }
+}
+
+TEST_F(FrameKernelPivots, InverseMatchesTf2OnTransposedMatrix)
+{
+  for (int l = 0; l < kFrameKernelLanes; ++l)
+  {
+    SCOPED_TRACE(l);
+    ExpectSameQuaternion(Inverse(q[l], w_pivot[l]), GetRotation(ToMatrix(R[l]).transpose()));
+  }
+}
+
+TEST_F(FrameKernelPivots, InverseFlipsSignOffTheWPivot)
+{
+  // The plain conjugate on the w pivot
+  FrameQuaternion inv = Inverse(q[0], true);
+  EXPECT_FLOAT_EQ(-q[0].x, inv.x);
+  EXPECT_FLOAT_EQ(q[0].w, inv.w);
+
+  // The negated conjugate otherwise, so the pivot stays positive
+  for (int l = 1; l < kFrameKernelLanes; ++l)
+  {
+    SCOPED_TRACE(l);
+    inv = Inverse(q[l], false);
+    EXPECT_FLOAT_EQ(q[l].x, inv.x);
+    EXPECT_FLOAT_EQ(q[l].y, inv.y);
+    EXPECT_FLOAT_EQ(q[l].z, inv.z);
+    EXPECT_FLOAT_EQ(-q[l].w, inv.w);
+  }
+}
+
+TEST(FrameKernel, HalfTurnInverseKeepsPivotPositive)
+{
+  const float R_x[9] = {1, 0, 0, 0, -1, 0, 0, 0, -1};
+  const float R_y[9] = {-1, 0, 0, 0, 1, 0, 0, 0, -1};
+  const float R_z[9] = {-1, 0, 0, 0, -1, 0, 0, 0, 1};
+  const float R_id[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+  const float* const R[kFrameKernelLanes] = {R_x, R_y, R_z, R_id};
+  FrameQuaternion q[kFrameKernelLanes];
+  bool w_pivot[kFrameKernelLanes];
+  RotationsToQuaternions(R, q, w_pivot);
+
+  // A half turn is its own inverse; the conjugate would be its negation
+  for (int l = 0; l < kFrameKernelLanes; ++l)
+  {
+    SCOPED_TRACE(l);
+    tf2::Matrix3x3 M = ToMatrix(R[l]);
+    ExpectSameQuaternion(q[l], GetRotation(M));
+    ExpectSameQuaternion(Inverse(q[l], w_pivot[l]), GetRotation(M.transpose()));
+  }
+  EXPECT_FLOAT_EQ(1, Inverse(q[0], w_pivot[0]).x);
+  EXPECT_FLOAT_EQ(1, Inverse(q[1], w_pivot[1]).y);
+  EXPECT_FLOAT_EQ(1, Inverse(q[2], w_pivot[2]).z);
+  EXPECT_FLOAT_EQ(1, Inverse(q[3], w_pivot[3]).w);
+}
+
+TEST(FrameKernel, MatchesTf2OnRandomRotations)
+{
+  std::mt19937 rng(42);
+  std::normal_distribution<double> normal(0.0, 1.0);
+  int sign_checked = 0;
+  for (int i = 0; i < 2500; ++i)
+  {
+    float R[kFrameKernelLanes][9];
+    const float* R_lanes[kFrameKernelLanes];
+    for (int l = 0; l < kFrameKernelLanes; ++l)
+    {
+      tf2::Quaternion attitude(normal(rng), normal(rng), normal(rng), normal(rng));
+      FillRotation(attitude.normalized(), R[l]);
+      R_lanes[l] = R[l];
+    }
+    FrameQuaternion q[kFrameKernelLanes];
+    bool w_pivot[kFrameKernelLanes];
+    RotationsToQuaternions(R_lanes, q, w_pivot);
+
+    for (int l = 0; l < kFrameKernelLanes; ++l)
+    {
+      SCOPED_TRACE(4*i + l);
+      tf2::Matrix3x3 M = ToMatrix(R[l]);
+      if (NearPivotTie(M))
+      {
+        ExpectSameRotation(q[l], GetRotation(M));
+        ExpectSameRotation(Inverse(q[l], w_pivot[l]), GetRotation(M.transpose()));
+      }
+      else
+      {
+        ExpectSameQuaternion(q[l], GetRotation(M));
+        ExpectSameQuaternion(Inverse(q[l], w_pivot[l]), GetRotation(M.transpose()));
+        sign_checked++;
+      }
+    }
+  }
+  EXPECT_GT(sign_checked, 9900);
+}
+
+TEST(FrameKernel, YawQuaternionMatchesTf2)
+{
+  // Both pivots: w for cos(yaw) > -0.5, z beyond +-120 deg
+  for (int i = -16; i <= 16; ++i)
+  {
+    double yaw = i*M_PI/16;
+    SCOPED_TRACE(yaw);
+    tf2::Matrix3x3 M;
+    M.setRPY(0, 0, yaw);
+    ExpectSameQuaternion(YawQuaternion(cos(yaw), sin(yaw)), GetRotation(M));
+  }
+
+  // Scale does not matter, a zero vector is no yaw
+  tf2::Matrix3x3 M;
+  M.setRPY(0, 0, 0.3);
+  ExpectSameQuaternion(YawQuaternion(5*cos(0.3), 5*sin(0.3)), GetRotation(M));
+  ExpectSameQuaternion(YawQuaternion(0, 0), tf2::Quaternion(0, 0, 0, 1));
+}
+
+TEST(FrameKernel, StabIsTf2YawAtGimbalLock)
+{
+  // Pitch +-90 deg after some yaw, exactly: tf2::Matrix3x3::getRPY() puts
+  // the whole heading into roll and reports zero yaw
+  for (int i = -4; i <= 4; ++i)
+  {
+    float c = cosf(i*M_PI/4);
+    float s = sinf(i*M_PI/4);
+    const float R_up[9] = {0, -s, c, 0, c, s, -1, 0, 0};
+    const float R_down[9] = {0, -s, -c, 0, c, -s, 1, 0, 0};
+    const float* const R[] = {R_up, R_down};
+    for (int k = 0; k < 2; ++k)
+    {
+      SCOPED_TRACE(i);
+      SnavSnapshot snapshot;
+      memset(&snapshot, 0, sizeof(snapshot));
+      memcpy(snapshot.attitude_estimate.rotation_matrix, R[k], sizeof(R_up));
+      SnavFrames frames;
+      ComputeFrames(snapshot, frames);
+
+      tf2Scalar roll, pitch, yaw;
+      ToMatrix(R[k]).getRPY(roll, pitch, yaw);
+      EXPECT_EQ(0, yaw);
+      ExpectSameQuaternion(frames.stab, tf2::Quaternion(0, 0, 0, 1));
+    }
+  }
+}
+
+TEST(FrameKernel, ComputeFramesMatchesTf2)
+{
+  // Degenerate attitudes: identity, half turns about each axis, yaw near
+  // +-pi, and close to gimbal lock
+  std::vector<tf2::Quaternion> attitudes;
+  attitudes.push_back(tf2::Quaternion(0, 0, 0, 1));
+  attitudes.push_back(tf2::Quaternion(1, 0, 0, 0));
+  attitudes.push_back(tf2::Quaternion(0, 1, 0, 0));
+  attitudes.push_back(tf2::Quaternion(0, 0, 1, 0));
+  for (double yaw = -M_PI; yaw <= M_PI; yaw += M_PI/8)
+  {
+    tf2::Quaternion q;
+    q.setRPY(0, 0, yaw);
+    attitudes.push_back(q);
+    q.setRPY(0.1, M_PI/2 - 0.01, yaw);
+    attitudes.push_back(q);
+    q.setRPY(-0.1, -M_PI/2 + 0.01, yaw);
+    attitudes.push_back(q);
+  }
+
+  std::mt19937 rng(42);
+  std::normal_distribution<double> normal(0.0, 1.0);
+  std::uniform_real_distribution<double> angle(-4*M_PI, 4*M_PI);
+  std::uniform_real_distribution<double> position(-100.0, 100.0);
+  while (attitudes.size() < 10000)
+  {
+    tf2::Quaternion q(normal(rng), normal(rng), normal(rng), normal(rng));
+    attitudes.push_back(q.normalized());
+  }
+
+  for (size_t i = 0; i < attitudes.size(); ++i)
+  {
+    SCOPED_TRACE(i);
+    SnavSnapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    FillRotation(attitudes[i], snapshot.attitude_estimate.rotation_matrix);
+    FillRotation(attitudes[attitudes.size() - 1 - i], snapshot.pos_vel.R_eg);
+    FillRotation(attitudes[(i*7) % attitudes.size()], snapshot.sim_ground_truth.R);
+    snapshot.pos_vel.yaw_desired = i < 16 ? -M_PI + i*M_PI/8 : angle(rng);
+    for (int k = 0; k < 3; ++k)
+      snapshot.sim_ground_truth.position[k] = position(rng);
+
+    SnavFrames frames;
+    ComputeFrames(snapshot, frames);
+    ReferenceFrames ref;
+    ComputeReferenceFrames(snapshot, ref);
+
+    EXPECT_TRUE(frames.est_valid);
+    EXPECT_TRUE(frames.sim_valid);
+    ExpectSameRotation(frames.est, ref.est);
+    ExpectSameRotation(frames.no_rot, ref.no_rot);
+    // float and double may disagree on which side of gimbal lock a matrix
+    // this close to it is; the exact case is covered above
+    if (fabs(snapshot.attitude_estimate.rotation_matrix[6]) < 1 - 1e-5)
+      ExpectSameRotation(frames.stab, ref.stab);
+    ExpectSameRotation(frames.des, ref.des);
+    ExpectSameRotation(frames.gps_enu, ref.gps_enu);
+    ExpectSameRotation(frames.sim, ref.sim);
+    ExpectSameRotation(frames.sim_inv, ref.sim_inv);
+    const tf2::Vector3& t = ref.sim_inv_translation;
+    EXPECT_LT((fabs(frames.sim_inv_translation[0] - t.x()) + fabs(frames.sim_inv_translation[1] - t.y()) +
+          fabs(frames.sim_inv_translation[2] - t.z()))/(1.0 + t.length()), kTolerance);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
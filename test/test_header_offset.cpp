@@ -0,0 +1,88 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/Twist.h>
+#include <nav_msgs/Odometry.h>
+#include <tf2_msgs/TFMessage.h>
+
+#include "snav_interface/header_offset.hpp"
+
+namespace
+{
+
+// What a ShapeShifter subscriber of M sees
+template <typename M>
+int HeaderOffsetOf()
+{
+  return HeaderOffset(ros::message_traits::DataType<M>::value(),
+      ros::message_traits::Definition<M>::value());
+}
+
+// snav_load_test's default topics: pose and /tf are stamped, vel is not
+TEST(HeaderOffset, GeneratedDefinitions)
+{
+  EXPECT_EQ(0, HeaderOffsetOf<geometry_msgs::PoseStamped>());
+  EXPECT_EQ(0, HeaderOffsetOf<nav_msgs::Odometry>());
+  EXPECT_EQ(4, HeaderOffsetOf<tf2_msgs::TFMessage>());
+  EXPECT_EQ(-1, HeaderOffsetOf<geometry_msgs::Twist>());
+}
+
+TEST(HeaderOffset, FirstFieldDecides)
+{
+  EXPECT_EQ(0, HeaderOffset("a/A", "Header header"));
+  EXPECT_EQ(0, HeaderOffset("a/A", "std_msgs/Header header\nfloat64 x\n"));
+  EXPECT_EQ(0, HeaderOffset("a/A", "  Header   stamp_header  # comment\r\n"));
+  EXPECT_EQ(-1, HeaderOffset("a/A", "float64 x\nHeader header\n"));
+  EXPECT_EQ(-1, HeaderOffset("a/A", "Headers header\n"));
+  EXPECT_EQ(-1, HeaderOffset("a/A", ""));
+}
+
+TEST(HeaderOffset, SkipsCommentsAndConstants)
+{
+  EXPECT_EQ(0, HeaderOffset("a/A", "# A stamped thing\n\n# Header header\n"
+        "uint8 MODE_A=1\nHeader header\n"));
+  EXPECT_EQ(-1, HeaderOffset("a/A", "# Header header\nuint32 seq\n"));
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,240 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+/*
+ * Runs the node loop against the snav stub with every output enabled and
+ * checks that, once warmed up, RunOnce() and WaitForNextCycle() make no
+ * heap allocation of their own. Allocations are counted on the loop thread
+ * only; subscriber callbacks and the node's timers run on a spinner thread.
+ *
+ * With a subscriber on every output, roscpp allocates inside publish() to
+ * queue each message for delivery, so that phase checks the node's own
+ * allocations through the MessagePool misses instead: a pool that runs out
+ * of free messages falls back to allocating one.
+ */
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <ros/ros.h>
+
+#include "snav_interface/snav_interface.hpp"
+
+// Heap allocations of the calling thread, counted while enabled. Every
+// malloc of the process, including those behind operator new, resolves to
+// these wrappers.
+static __thread bool g_count_allocations = false;
+static __thread uint64_t g_allocations = 0;
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+  if (g_count_allocations)
+    g_allocations++;
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+  if (g_count_allocations)
+    g_allocations++;
+  return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+  if (g_count_allocations)
+    g_allocations++;
+  return __libc_realloc(ptr, size);
+}
+
+namespace
+{
+
+// Until every message has been filled and every pool used once
+const int kWarmupCycles = 500;
+const int kCheckCycles = 1000;
+
+class PublishAllocations : public testing::Test
+{
+protected:
+  static void SetUpTestCase()
+  {
+    ros::NodeHandle nh;
+    ros::NodeHandle pnh("~");
+    // Every output on whether anyone listens, so the whole loop runs.
+    // zero_copy_publish comes from the .test file.
+    pnh.setParam("lazy_outputs", false);
+    pnh.setParam("enable_profiling", true);
+    const char* outputs[] = {"publish_est_data", "publish_sim_data", "publish_pose",
+      "publish_des_pose", "publish_sim_gt_pose", "publish_vel", "publish_odom", "publish_imu",
+      "publish_esc", "publish_compact_state", "broadcast_tf", "broadcast_des_tf",
+      "broadcast_gps_tf", "broadcast_sim_gt_tf"};
+    for (size_t i = 0; i < sizeof(outputs)/sizeof(outputs[0]); ++i)
+      pnh.setParam(outputs[i], true);
+    iface_ = new SnavInterface(nh, pnh);
+
+    spinner_ = new ros::AsyncSpinner(1);
+    spinner_->start();
+  }
+
+  static void TearDownTestCase()
+  {
+    spinner_->stop();
+    delete spinner_;
+    delete iface_;
+  }
+
+  /**
+   * Run warm-up and then check cycles of the node loop
+   * @param new_samples
+   *   output, check cycles that had a new est sample
+   * @return allocations of this thread in the check cycles
+   */
+  uint64_t RunCycles(int* new_samples)
+  {
+    for (int i = 0; i < kWarmupCycles; ++i)
+    {
+      iface_->RunOnce();
+      iface_->WaitForNextCycle();
+    }
+
+    *new_samples = 0;
+    g_allocations = 0;
+    g_count_allocations = true;
+    for (int i = 0; i < kCheckCycles; ++i)
+    {
+      iface_->RunOnce();
+      *new_samples += iface_->NewEstSample() ? 1 : 0;
+      iface_->WaitForNextCycle();
+    }
+    g_count_allocations = false;
+    return g_allocations;
+  }
+
+  static SnavInterface* iface_;
+  static ros::AsyncSpinner* spinner_;
+};
+
+SnavInterface* PublishAllocations::iface_ = NULL;
+ros::AsyncSpinner* PublishAllocations::spinner_ = NULL;
+
+// Counts what one output delivered
+class Receiver
+{
+public:
+  Receiver() : received_(0) {}
+
+  template <typename M>
+  void Subscribe(ros::NodeHandle& nh, const std::string& topic)
+  {
+    // Queue size 1, like a consumer that only wants the latest value
+    subscriber_ = nh.subscribe(topic, 1, &Receiver::Callback<M>, this);
+  }
+
+  const ros::Subscriber& GetSubscriber() const { return subscriber_; }
+  int GetReceived() const { return received_.load(); }
+
+private:
+  template <typename M>
+  void Callback(const boost::shared_ptr<M const>& msg)
+  {
+    received_++;
+  }
+
+  ros::Subscriber subscriber_;
+  std::atomic<int> received_;
+};
+
+TEST_F(PublishAllocations, NoAllocationsWithoutSubscribers)
+{
+  uint64_t misses = iface_->GetPoolMisses();
+  int new_samples = 0;
+  EXPECT_EQ(0u, RunCycles(&new_samples));
+  EXPECT_GT(new_samples, 0);
+  EXPECT_EQ(misses, iface_->GetPoolMisses());
+}
+
+TEST_F(PublishAllocations, PoolsCoverEverySubscriber)
+{
+  ros::NodeHandle nh;
+  std::vector<Receiver> receivers(12);
+  receivers[0].Subscribe<geometry_msgs::PoseStamped>(nh, "pose");
+  receivers[1].Subscribe<geometry_msgs::PoseStamped>(nh, "pose_des");
+  receivers[2].Subscribe<geometry_msgs::Twist>(nh, "vel");
+  receivers[3].Subscribe<nav_msgs::Odometry>(nh, "odom");
+  receivers[4].Subscribe<snav_ros::ImuBatch>(nh, "imu_batch");
+  receivers[5].Subscribe<snav_ros::EscBatch>(nh, "esc_batch");
+  receivers[6].Subscribe<snav_ros::CompactState>(nh, "compact_state");
+  receivers[7].Subscribe<std_msgs::Float32>(nh, "battery_voltage");
+  receivers[8].Subscribe<std_msgs::Bool>(nh, "on_ground");
+  receivers[9].Subscribe<std_msgs::Bool>(nh, "props_state");
+  receivers[10].Subscribe<tf2_msgs::TFMessage>(nh, "/tf");
+  receivers[11].Subscribe<geometry_msgs::PoseStamped>(nh, "pose_sim_gt");
+
+  ros::WallTime give_up = ros::WallTime::now() + ros::WallDuration(5.0);
+  for (size_t i = 0; i < receivers.size(); ++i)
+  {
+    while (receivers[i].GetSubscriber().getNumPublishers() == 0 && ros::WallTime::now() < give_up)
+      ros::WallDuration(0.01).sleep();
+  }
+
+  uint64_t misses = iface_->GetPoolMisses();
+  int new_samples = 0;
+  uint64_t allocations = RunCycles(&new_samples);
+  EXPECT_GT(new_samples, 0);
+  EXPECT_EQ(misses, iface_->GetPoolMisses());
+  RecordProperty("roscpp_allocations_per_cycle", (int)(allocations/kCheckCycles));
+
+  for (size_t i = 0; i < receivers.size(); ++i)
+  {
+    SCOPED_TRACE(receivers[i].GetSubscriber().getTopic());
+    EXPECT_GT(receivers[i].GetReceived(), 0);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "test_publish_allocations");
+  return RUN_ALL_TESTS();
+}
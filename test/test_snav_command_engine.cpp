@@ -0,0 +1,404 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <ros/time.h>
+
+#include "snav_interface/clock_utils.hpp"
+#include "snav_interface/snav_command_engine.hpp"
+
+namespace
+{
+
+// Engine timing used by every test: 200 Hz, hold after 50 ms, silent after
+// 200 ms. Most tests step the engine with Tick() at fixed times instead of
+// running its thread, so they do not depend on scheduling.
+const double kRate = 200.0;
+const double kTimeout = 0.05;
+const double kFailsafeTimeout = 0.2;
+
+// Arbitrary CLOCK_MONOTONIC and ROS times the stepped tests start at [ns]
+const int64_t kStartNs = 1000000000LL;
+const int64_t kRosStartNs = 1500000000000000000LL;
+const int64_t kMsNs = 1000000LL;
+
+SnStubCommands GetCommands()
+{
+  SnStubCommands commands;
+  sn_stub_get_commands(&commands);
+  return commands;
+}
+
+// Poll until done() holds, for tests that run the streaming thread
+template <typename Done>
+bool WaitFor(Done done, double timeout)
+{
+  int64_t deadline_ns = MonotonicNowNs() + (int64_t)(timeout*1e9);
+  while (!done())
+  {
+    if (MonotonicNowNs() > deadline_ns)
+      return false;
+    SleepForNs(kMsNs);
+  }
+  return true;
+}
+
+SnavCommandEngine::RcCommand MakeCommand(SnRcCommandType type, float x)
+{
+  SnavCommandEngine::RcCommand command;
+  command.x = x;
+  command.y = 0.2f;
+  command.z = 0.4f;
+  command.yaw = 0.1f;
+  command.type = type;
+  command.mapping = RC_OPT_DEFAULT_RC;
+  command.received_ns = 0;
+  return command;
+}
+
+// Step both clocks together, ms after the start
+void TickAt(SnavCommandEngine& engine, int64_t ms)
+{
+  engine.Tick(kStartNs + ms*kMsNs, kRosStartNs + ms*kMsNs);
+}
+
+// Batch with one setpoint at each of the given ms after the start, x set to
+// the time in ms
+std::shared_ptr<SnavTrajectory> MakeBatch(const std::vector<int64_t>& times_ms)
+{
+  std::shared_ptr<SnavTrajectory> trajectory = std::make_shared<SnavTrajectory>();
+  for (size_t i = 0; i < times_ms.size(); ++i)
+  {
+    SnavTrajectory::Sample sample = SnavTrajectory::Sample();
+    sample.time_ns = kRosStartNs + times_ms[i]*kMsNs;
+    sample.position[0] = (float)times_ms[i];
+    trajectory->samples.push_back(sample);
+  }
+  trajectory->stamp_ns = kRosStartNs;
+  return trajectory;
+}
+
+// Send a batch as if received ms after the start
+void SendBatchAt(SnavCommandEngine& engine, int64_t ms, const std::vector<int64_t>& times_ms,
+    bool replace)
+{
+  engine.SetTrajectory(MakeBatch(times_ms), replace, kStartNs + ms*kMsNs, kRosStartNs + ms*kMsNs);
+}
+
+// Times of the buffered setpoints in ms after the start
+std::vector<int64_t> BufferedTimes(const SnavCommandEngine& engine)
+{
+  std::vector<int64_t> times_ms;
+  std::shared_ptr<const SnavTrajectory> trajectory = engine.GetTrajectory();
+  for (size_t i = 0; trajectory && i < trajectory->samples.size(); ++i)
+    times_ms.push_back((trajectory->samples[i].time_ns - kRosStartNs)/kMsNs);
+  return times_ms;
+}
+
+}
+
+TEST(SnavCommandEngine, StreamsFreshCommand)
+{
+  SnavCommandEngine engine;
+  engine.SetTimeouts(kTimeout, kFailsafeTimeout);
+  engine.SetRcCommand(MakeCommand(SN_RC_RATES_CMD, 0.3f), kStartNs);
+  unsigned long long sent = GetCommands().rc_commands;
+  TickAt(engine, 10);
+
+  SnStubCommands commands = GetCommands();
+  EXPECT_EQ(sent + 1, commands.rc_commands);
+  EXPECT_EQ(SN_RC_RATES_CMD, commands.rc_type);
+  EXPECT_FLOAT_EQ(0.3f, commands.rc_cmd[0]);
+  SnavCommandEngine::Stats stats = engine.GetStats();
+  EXPECT_FALSE(stats.hovering);
+  EXPECT_EQ(1u, stats.commands_sent);
+  EXPECT_DOUBLE_EQ(0.01, stats.age_last);
+}
+
+TEST(SnavCommandEngine, StaleRatesCommandHoldsPosition)
+{
+  SnavCommandEngine engine;
+  engine.SetTimeouts(kTimeout, kFailsafeTimeout);
+  engine.SetRcCommand(MakeCommand(SN_RC_RATES_CMD, 0.3f), kStartNs);
+  TickAt(engine, 50);
+  EXPECT_FALSE(engine.GetStats().hovering);
+  TickAt(engine, 51);
+
+  // Zero sticks in rates mode would not hold the vehicle, so the hold must
+  // switch to position hold
+  SnStubCommands commands = GetCommands();
+  EXPECT_EQ(SN_RC_POS_HOLD_CMD, commands.rc_type);
+  EXPECT_EQ(RC_OPT_LINEAR_MAPPING, commands.rc_options);
+  for (int i = 0; i < 4; ++i)
+    EXPECT_FLOAT_EQ(0.0f, commands.rc_cmd[i]);
+
+  TickAt(engine, 56);
+  SnavCommandEngine::Stats stats = engine.GetStats();
+  EXPECT_TRUE(stats.hovering);
+  EXPECT_FALSE(stats.failsafe);
+  EXPECT_EQ(1u, stats.timeouts);
+  EXPECT_EQ(2u, stats.hover_sent);
+}
+
+TEST(SnavCommandEngine, StopsSendingAfterFailsafeTimeout)
+{
+  SnavCommandEngine engine;
+  engine.SetTimeouts(kTimeout, kFailsafeTimeout);
+  engine.SetRcCommand(MakeCommand(SN_RC_THRUST_ANGLE_CMD, 0.3f), kStartNs);
+  TickAt(engine, 200);
+  EXPECT_FALSE(engine.GetStats().failsafe);
+
+  // Silent, so snav's own RC-loss failsafe can trigger
+  unsigned long long sent = GetCommands().rc_commands;
+  TickAt(engine, 201);
+  TickAt(engine, 300);
+  EXPECT_EQ(sent, GetCommands().rc_commands);
+  SnavCommandEngine::Stats stats = engine.GetStats();
+  EXPECT_TRUE(stats.failsafe);
+  EXPECT_EQ(1u, stats.failsafe_releases);
+
+  // A new command takes over again
+  engine.SetRcCommand(MakeCommand(SN_RC_RATES_CMD, -0.5f), kStartNs + 310*kMsNs);
+  TickAt(engine, 315);
+  SnStubCommands commands = GetCommands();
+  EXPECT_EQ(sent + 1, commands.rc_commands);
+  EXPECT_EQ(SN_RC_RATES_CMD, commands.rc_type);
+  EXPECT_FLOAT_EQ(-0.5f, commands.rc_cmd[0]);
+  stats = engine.GetStats();
+  EXPECT_FALSE(stats.failsafe);
+  EXPECT_FALSE(stats.hovering);
+}
+
+TEST(SnavCommandEngine, FinishedTrajectoryHoldsPositionThenFailsafe)
+{
+  SnavCommandEngine engine;
+  engine.SetTimeouts(kTimeout, kFailsafeTimeout);
+
+  // Two setpoints spanning the first 20 ms
+  std::shared_ptr<SnavTrajectory> trajectory = std::make_shared<SnavTrajectory>();
+  for (int i = 0; i < 2; ++i)
+  {
+    SnavTrajectory::Sample sample = SnavTrajectory::Sample();
+    sample.time_ns = kRosStartNs + i*20*kMsNs;
+    sample.position[0] = 1.0f + i;
+    trajectory->samples.push_back(sample);
+  }
+  trajectory->stamp_ns = kRosStartNs;
+  engine.SetTrajectory(trajectory, true, kStartNs, kRosStartNs);
+
+  unsigned long long traj_sent = GetCommands().traj_commands;
+  TickAt(engine, 10);
+  SnStubCommands commands = GetCommands();
+  EXPECT_EQ(traj_sent + 1, commands.traj_commands);
+  EXPECT_FLOAT_EQ(1.5f, commands.traj_position[0]);
+  EXPECT_FALSE(engine.GetStats().hovering);
+
+  // The final setpoint is not held forever
+  TickAt(engine, 20 + 50);
+  EXPECT_FALSE(engine.GetStats().hovering);
+  TickAt(engine, 20 + 51);
+  commands = GetCommands();
+  EXPECT_EQ(SN_RC_POS_HOLD_CMD, commands.rc_type);
+  EXPECT_TRUE(engine.GetStats().hovering);
+  traj_sent = commands.traj_commands;
+
+  unsigned long long rc_sent = commands.rc_commands;
+  TickAt(engine, 20 + 201);
+  TickAt(engine, 20 + 250);
+  EXPECT_TRUE(engine.GetStats().failsafe);
+  commands = GetCommands();
+  EXPECT_EQ(rc_sent, commands.rc_commands);
+  EXPECT_EQ(traj_sent, commands.traj_commands);
+}
+
+TEST(SnavCommandEngine, StreamsSingleSetpointUntilTimeout)
+{
+  SnavCommandEngine engine;
+  engine.SetTimeouts(kTimeout, kFailsafeTimeout);
+  SnavCommandEngine::TrajCommand command = SnavCommandEngine::TrajCommand();
+  command.setpoint.position[2] = 1.5f;
+  command.setpoint.yaw = 0.25f;
+  unsigned long long traj_sent = GetCommands().traj_commands;
+  engine.SetTrajCommand(command, kStartNs);
+  TickAt(engine, 5);
+  TickAt(engine, 10);
+
+  SnStubCommands commands = GetCommands();
+  EXPECT_EQ(traj_sent + 2, commands.traj_commands);
+  EXPECT_FLOAT_EQ(1.5f, commands.traj_position[2]);
+  EXPECT_FLOAT_EQ(0.25f, commands.traj_yaw);
+
+  TickAt(engine, 51);
+  EXPECT_EQ(SN_RC_POS_HOLD_CMD, GetCommands().rc_type);
+  EXPECT_TRUE(engine.GetStats().hovering);
+}
+
+TEST(SnavCommandEngine, NewestInterfaceOwnsVehicle)
+{
+  SnavCommandEngine engine;
+  engine.SetTimeouts(kTimeout, kFailsafeTimeout);
+  SnavCommandEngine::TrajCommand setpoint = SnavCommandEngine::TrajCommand();
+  setpoint.setpoint.position[0] = 2.0f;
+  engine.SetTrajCommand(setpoint, kStartNs);
+  engine.SetRcCommand(MakeCommand(SN_RC_RATES_CMD, 0.3f), kStartNs + kMsNs);
+
+  SnStubCommands before = GetCommands();
+  TickAt(engine, 5);
+  SnStubCommands after = GetCommands();
+  EXPECT_EQ(before.rc_commands + 1, after.rc_commands);
+  EXPECT_EQ(before.traj_commands, after.traj_commands);
+
+  engine.SetTrajCommand(setpoint, kStartNs + 6*kMsNs);
+  TickAt(engine, 10);
+  before = after;
+  after = GetCommands();
+  EXPECT_EQ(before.rc_commands, after.rc_commands);
+  EXPECT_EQ(before.traj_commands + 1, after.traj_commands);
+  EXPECT_FLOAT_EQ(2.0f, after.traj_position[0]);
+}
+
+TEST(SnavCommandEngine, SpliceKeepsSetpointBeforeNowAndCutsAtBatch)
+{
+  SnavCommandEngine engine;
+  engine.SetTimeouts(kTimeout, kFailsafeTimeout);
+  SendBatchAt(engine, 0, {0, 10, 20, 30, 40}, false);
+  EXPECT_EQ(0u, engine.GetStats().traj_splices);
+
+  // At 25 ms: 0 and 10 are past, 20 is still needed to interpolate up to 30,
+  // and 40 is replaced by the batch starting at 35
+  SendBatchAt(engine, 25, {35, 45}, false);
+  EXPECT_EQ(std::vector<int64_t>({20, 30, 35, 45}), BufferedTimes(engine));
+  SnavCommandEngine::Stats stats = engine.GetStats();
+  EXPECT_EQ(2u, stats.traj_batches);
+  EXPECT_EQ(1u, stats.traj_splices);
+  EXPECT_DOUBLE_EQ(0.02, stats.traj_lead_last);
+
+  // A batch starting before now replaces everything from its start
+  SendBatchAt(engine, 29, {28, 50}, false);
+  EXPECT_EQ(std::vector<int64_t>({20, 28, 50}), BufferedTimes(engine));
+}
+
+TEST(SnavCommandEngine, SpliceKeepsLastSetpointOnceAllArePast)
+{
+  SnavCommandEngine engine;
+  engine.SetTimeouts(kTimeout, kFailsafeTimeout);
+  SendBatchAt(engine, 0, {0, 10}, false);
+
+  // Interpolating from where the vehicle was told to be into the new batch
+  SendBatchAt(engine, 25, {35, 45}, false);
+  EXPECT_EQ(std::vector<int64_t>({10, 35, 45}), BufferedTimes(engine));
+  EXPECT_EQ(1u, engine.GetStats().traj_splices);
+
+  // A batch entirely before the buffer has nothing to keep
+  SendBatchAt(engine, 30, {5, 60}, false);
+  EXPECT_EQ(std::vector<int64_t>({5, 60}), BufferedTimes(engine));
+  EXPECT_EQ(1u, engine.GetStats().traj_splices);
+}
+
+TEST(SnavCommandEngine, ReplaceDropsBufferedSetpoints)
+{
+  SnavCommandEngine engine;
+  engine.SetTimeouts(kTimeout, kFailsafeTimeout);
+  SendBatchAt(engine, 0, {0, 10, 20, 30, 40}, false);
+  SendBatchAt(engine, 25, {35, 45}, true);
+  EXPECT_EQ(std::vector<int64_t>({35, 45}), BufferedTimes(engine));
+  EXPECT_EQ(0u, engine.GetStats().traj_splices);
+
+  // Empty batches are ignored
+  SendBatchAt(engine, 26, std::vector<int64_t>(), true);
+  EXPECT_EQ(std::vector<int64_t>({35, 45}), BufferedTimes(engine));
+  EXPECT_EQ(2u, engine.GetStats().traj_batches);
+}
+
+TEST(SnavCommandEngine, CountsTrajectoryUnderruns)
+{
+  SnavCommandEngine engine;
+  engine.SetTimeouts(kTimeout, kFailsafeTimeout);
+  SendBatchAt(engine, 0, {0, 10, 20}, false);
+
+  unsigned long long traj_sent = GetCommands().traj_commands;
+  TickAt(engine, 5);
+  TickAt(engine, 20);
+  SnavCommandEngine::Stats stats = engine.GetStats();
+  EXPECT_EQ(0u, stats.traj_underruns);
+  EXPECT_FALSE(stats.traj_starved);
+  EXPECT_FLOAT_EQ(20.0f, GetCommands().traj_position[0]);
+
+  // Ran dry: the final setpoint is still sent, every cycle is counted but the
+  // underrun only once
+  TickAt(engine, 25);
+  TickAt(engine, 30);
+  stats = engine.GetStats();
+  EXPECT_EQ(1u, stats.traj_underruns);
+  EXPECT_EQ(2u, stats.traj_underrun_cycles);
+  EXPECT_TRUE(stats.traj_starved);
+  EXPECT_EQ(4u, stats.traj_setpoints_sent);
+  EXPECT_EQ(traj_sent + 4, GetCommands().traj_commands);
+  EXPECT_FLOAT_EQ(20.0f, GetCommands().traj_position[0]);
+  EXPECT_FALSE(stats.hovering);
+
+  // A new batch ends the underrun, running dry again is a second one
+  SendBatchAt(engine, 31, {35, 40}, false);
+  TickAt(engine, 35);
+  EXPECT_FALSE(engine.GetStats().traj_starved);
+  TickAt(engine, 45);
+  stats = engine.GetStats();
+  EXPECT_EQ(2u, stats.traj_underruns);
+  EXPECT_EQ(3u, stats.traj_underrun_cycles);
+}
+
+TEST(SnavCommandEngine, StreamingThreadSendsThenHolds)
+{
+  SnavCommandEngine engine;
+  engine.Start(kRate, kTimeout, kFailsafeTimeout);
+  unsigned long long sent = GetCommands().rc_commands;
+  engine.SetRcCommand(MakeCommand(SN_RC_RATES_CMD, 0.3f));
+
+  // Deadlines are generous, only the outcome is checked
+  EXPECT_TRUE(WaitFor([&]() { return engine.GetStats().commands_sent > 0; }, 5.0));
+  EXPECT_GT(GetCommands().rc_commands, sent);
+  EXPECT_TRUE(WaitFor([&]() { return engine.GetStats().hovering; }, 5.0));
+  EXPECT_TRUE(WaitFor([&]() { return engine.GetStats().failsafe; }, 5.0));
+  engine.Stop();
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  ros::Time::init();
+  return RUN_ALL_TESTS();
+}
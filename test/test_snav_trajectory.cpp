@@ -0,0 +1,184 @@
+/****************************************************************************
+ *   Copyright (c) 2017 Michael Shomin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ATLFlight nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY THIS LICENSE.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * In addition Supplemental Terms apply.  See the SUPPLEMENTAL file.
+ ****************************************************************************/
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+#include "snav_interface/snav_trajectory.hpp"
+
+namespace
+{
+
+const int64_t kStartNs = 1500000000000000000LL;
+const int64_t kSecondNs = 1000000000LL;
+
+SnavTrajectory::Sample MakeSample(int64_t time_ns, float x, float vx, float yaw, float yaw_rate)
+{
+  SnavTrajectory::Sample sample = SnavTrajectory::Sample();
+  sample.time_ns = time_ns;
+  sample.position[0] = x;
+  sample.velocity[0] = vx;
+  sample.yaw = yaw;
+  sample.yaw_rate = yaw_rate;
+  return sample;
+}
+
+SnavTrajectory::Sample EvaluateAt(const SnavTrajectory& trajectory, int64_t time_ns, bool* ok = NULL)
+{
+  size_t cursor = 0;
+  SnavTrajectory::Sample out;
+  bool valid = trajectory.Evaluate(time_ns, cursor, out);
+  if (ok != NULL)
+    *ok = valid;
+  return out;
+}
+
+}
+
+TEST(SnavTrajectory, HermiteReproducesCubic)
+{
+  // x = t^3 over one second, dx/dt = 3 t^2
+  SnavTrajectory trajectory;
+  trajectory.samples.push_back(MakeSample(kStartNs, 0.0f, 0.0f, 0.0f, 0.0f));
+  trajectory.samples.push_back(MakeSample(kStartNs + kSecondNs, 1.0f, 3.0f, 0.0f, 0.0f));
+
+  const double kTimes[] = {0.25, 0.5, 0.75};
+  for (size_t i = 0; i < sizeof(kTimes)/sizeof(kTimes[0]); ++i)
+  {
+    double t = kTimes[i];
+    bool ok = false;
+    SnavTrajectory::Sample out = EvaluateAt(trajectory, kStartNs + (int64_t)(t*kSecondNs), &ok);
+    EXPECT_TRUE(ok);
+    EXPECT_NEAR(t*t*t, out.position[0], 1e-5);
+    EXPECT_NEAR(3.0*t*t, out.velocity[0], 1e-4);
+  }
+}
+
+TEST(SnavTrajectory, HermiteUsesSampleVelocities)
+{
+  // From 0 to 2 m in 1 s, leaving at 1 m/s and arriving at rest
+  SnavTrajectory trajectory;
+  trajectory.samples.push_back(MakeSample(kStartNs, 0.0f, 1.0f, 0.0f, 0.0f));
+  trajectory.samples.push_back(MakeSample(kStartNs + kSecondNs, 2.0f, 0.0f, 0.0f, 0.0f));
+  trajectory.samples[0].acceleration[1] = 1.0f;
+  trajectory.samples[1].acceleration[1] = 3.0f;
+
+  SnavTrajectory::Sample out = EvaluateAt(trajectory, kStartNs + kSecondNs/2);
+  EXPECT_FLOAT_EQ(1.125f, out.position[0]);
+  EXPECT_FLOAT_EQ(2.75f, out.velocity[0]);
+  EXPECT_FLOAT_EQ(2.0f, out.acceleration[1]);
+
+  // The sample itself at its own time
+  out = EvaluateAt(trajectory, kStartNs);
+  EXPECT_FLOAT_EQ(0.0f, out.position[0]);
+  EXPECT_FLOAT_EQ(1.0f, out.velocity[0]);
+}
+
+TEST(SnavTrajectory, YawTakesShortWayAround)
+{
+  // 3.0 to -3.1 rad is 0.18 rad counterclockwise across +-pi, not 6.1 rad
+  // clockwise
+  const float kDelta = -3.1f + 2.0f*(float)M_PI - 3.0f;
+  SnavTrajectory trajectory;
+  trajectory.samples.push_back(MakeSample(kStartNs, 0.0f, 0.0f, 3.0f, 0.0f));
+  trajectory.samples.push_back(MakeSample(kStartNs + kSecondNs, 0.0f, 0.0f, -3.1f, 0.0f));
+
+  SnavTrajectory::Sample out = EvaluateAt(trajectory, kStartNs + kSecondNs/2);
+  EXPECT_NEAR(3.0f + 0.5f*kDelta, out.yaw, 1e-5);
+  EXPECT_NEAR(1.5f*kDelta, out.yaw_rate, 1e-5);
+
+  // Past pi the yaw is wrapped back into [-pi, pi]
+  out = EvaluateAt(trajectory, kStartNs + 3*kSecondNs/4);
+  EXPECT_NEAR(3.0f + 0.84375f*kDelta - 2.0f*(float)M_PI, out.yaw, 1e-5);
+  EXPECT_GT(out.yaw_rate, 0.0f);
+}
+
+TEST(SnavTrajectory, HoldsEndsAndReportsUnderrun)
+{
+  SnavTrajectory trajectory;
+  trajectory.samples.push_back(MakeSample(kStartNs, 1.0f, 0.5f, 0.2f, 0.1f));
+  trajectory.samples.push_back(MakeSample(kStartNs + kSecondNs, 2.0f, 0.5f, 0.3f, 0.1f));
+
+  // Before the first sample it is held as is
+  bool ok = false;
+  SnavTrajectory::Sample out = EvaluateAt(trajectory, kStartNs - kSecondNs, &ok);
+  EXPECT_TRUE(ok);
+  EXPECT_EQ(kStartNs - kSecondNs, out.time_ns);
+  EXPECT_FLOAT_EQ(1.0f, out.position[0]);
+  EXPECT_FLOAT_EQ(0.5f, out.velocity[0]);
+
+  // At the last sample the vehicle comes to rest there
+  out = EvaluateAt(trajectory, kStartNs + kSecondNs, &ok);
+  EXPECT_TRUE(ok);
+  EXPECT_FLOAT_EQ(2.0f, out.position[0]);
+  EXPECT_FLOAT_EQ(0.0f, out.velocity[0]);
+  EXPECT_FLOAT_EQ(0.0f, out.yaw_rate);
+
+  // Past it, too, but that is an underrun
+  out = EvaluateAt(trajectory, kStartNs + 2*kSecondNs, &ok);
+  EXPECT_FALSE(ok);
+  EXPECT_FLOAT_EQ(2.0f, out.position[0]);
+  EXPECT_FLOAT_EQ(0.3f, out.yaw);
+  EXPECT_FLOAT_EQ(0.0f, out.velocity[0]);
+
+  SnavTrajectory empty;
+  size_t cursor = 0;
+  EXPECT_FALSE(empty.Evaluate(kStartNs, cursor, out));
+}
+
+TEST(SnavTrajectory, CursorFollowsTimeBothWays)
+{
+  SnavTrajectory trajectory;
+  for (int i = 0; i < 5; ++i)
+    trajectory.samples.push_back(MakeSample(kStartNs + i*kSecondNs, (float)(i*i), 2.0f*i, 0.0f, 0.0f));
+
+  // Evaluating forwards and then backwards with one cursor matches a fresh
+  // cursor every time
+  const int64_t kTimes[] = {500, 1500, 3500, 3900, 1200, 200, 2600};
+  size_t cursor = 0;
+  for (size_t i = 0; i < sizeof(kTimes)/sizeof(kTimes[0]); ++i)
+  {
+    int64_t time_ns = kStartNs + kTimes[i]*1000000LL;
+    SnavTrajectory::Sample out;
+    ASSERT_TRUE(trajectory.Evaluate(time_ns, cursor, out));
+    EXPECT_EQ((size_t)(kTimes[i]/1000), cursor);
+    EXPECT_FLOAT_EQ(EvaluateAt(trajectory, time_ns).position[0], out.position[0]);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}